@@ -20,6 +20,52 @@
 dispatch_source_t NNCreateTimer(dispatch_queue_t queue, NSTimeInterval timeout, dispatch_block_t block);
 void NNCancelTimer(dispatch_source_t);
 
+// ================================================================
+// NNTimingWheel
+// ================================================================
+// Handle of a deadline registered to NNTimingWheel.
+@interface NNTimeout : NSObject
+
+// Unregisters the deadline in O(1). The block is not called once this returns on the queue of the block.
+- (void)cancel;
+
+@end
+
+// Coarse timer service shared by many connections. Deadlines are kept in a hierarchical wheel driven by
+// one dispatch source, which fires at the resolution only while deadlines exist.
+@interface NNTimingWheel : NSObject
+
+@property(readonly, nonatomic) NSTimeInterval resolution;
+
+// Shared wheel of the resolution, which is clamped to 10-100 msec.
++ (instancetype)sharedWheelWithResolution:(NSTimeInterval)resolution;
+- (id)initWithResolution:(NSTimeInterval)resolution;
+// Calls the block on the queue once after the timeout, later by the resolution at most.
+- (NNTimeout *)scheduleTimeout:(NSTimeInterval)timeout queue:(dispatch_queue_t)queue block:(dispatch_block_t)block;
+
+@end
+
+// ================================================================
+// NNQueue
+// ================================================================
+// Marks the queue so that NNIsCurrentQueue can tell whether the caller is running on it.
+void NNMarkQueue(dispatch_queue_t queue);
+BOOL NNIsCurrentQueue(dispatch_queue_t queue);
+
+// ================================================================
+// NNDataSlice
+// ================================================================
+// Immutable view of a range of another data object's bytes. The owner is retained and is never copied.
+@interface NNDataSlice : NSData
+
+// Returns a slice of the owner, or a copy when the range is too short to be worth pinning the owner,
+// that is shorter than 4KB or than a quarter of the owner.
+// 'sliced' is set to YES when the returned data refers to the owner.
++ (NSData *)dataWithOwner:(NSData *)owner bytes:(const void *)bytes length:(NSUInteger)length sliced:(BOOL *)sliced;
+- (id)initWithOwner:(NSData *)owner bytes:(const void *)bytes length:(NSUInteger)length;
+
+@end
+
 // ================================================================
 // NSRunloopBroker
 // ================================================================
@@ -27,15 +73,39 @@ void NNCancelTimer(dispatch_source_t);
 
 @property(readonly, nonatomic) NSString *name;
 @property(readonly, nonatomic) NSRunLoop *runLoop;
+@property(readonly, nonatomic) NSThread *thread;
 
 - (id)initWithName:(NSString *)name;
 - (void)terminate;
 
 @end
 
+// ================================================================
+// NNRunLoopBrokerPool
+// ================================================================
+// Fixed number of runloop threads shared by connections. Threads are started on demand.
+@interface NNRunLoopBrokerPool : NSObject
+
+@property(readonly, nonatomic) NSUInteger size;
+// Number of threads currently running.
+@property(readonly, nonatomic) NSUInteger brokerCount;
+
+// Size 0 means the number of active processors.
++ (instancetype)sharedPoolWithSize:(NSUInteger)size;
+- (id)initWithName:(NSString *)name size:(NSUInteger)size;
+// Returns the broker which has the fewest users, taking turns among equally loaded ones.
+- (NNRunLoopBroker *)acquireBroker;
+// Thread of the broker is terminated when its last user releases it.
+- (void)releaseBroker:(NNRunLoopBroker *)broker;
+
+@end
+
 // ================================================================
 // NNBase64
 // ================================================================
+// Writes ((length + 2) / 3) * 4 padded characters of standard base64 to 'out'.
+void NNBase64Encode(const uint8_t *bytes, NSUInteger length, char *out);
+
 @interface NNBase64 : NSObject
 
 + (instancetype)base64;
@@ -59,12 +129,40 @@ void NNCancelTimer(dispatch_source_t);
 // ================================================================
 // NNUTF8Buffer
 // ================================================================
+BOOL NNIsValidUTF8(const void *bytes, NSUInteger length);
+// Same as NNIsValidUTF8 but 'bytes' may end in the middle of a character. 'completeLength' is set to the
+// length without it.
+BOOL NNIsValidUTF8Prefix(const void *bytes, NSUInteger length, NSUInteger *completeLength);
+
 @interface NNUTF8Buffer : NSObject
 
 @property(readonly, nonatomic) NSUInteger length;
 
 + (instancetype)buffer;
+- (void)reset;
 - (BOOL)appendData:(NSData *)utf8ByteSequence;
 - (NSData *)removeValidUTF8Portion;
 
 @end
+
+// ================================================================
+// NNMessageBuffer
+// ================================================================
+// Growable buffer which messages are assembled in one after another. The capacity is reserved from the sizes of
+// recent messages when a message starts, and is given back once large messages are no longer seen.
+@interface NNMessageBuffer : NSObject
+
+@property(readonly, nonatomic) const uint8_t *bytes;
+@property(readonly, nonatomic) NSUInteger length;
+@property(readonly, nonatomic) NSUInteger capacity;
+
++ (instancetype)buffer;
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length;
+// Removes the message from the buffer. Bytes are handed over without copying when they fill most of the buffer.
+- (NSData *)takeData;
+// Removes the leading bytes of a message which have been consumed, keeping the rest.
+- (void)removeLeadingBytes:(NSUInteger)length;
+// Discards a message which has not been completed.
+- (void)reset;
+
+@end
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #import "NNUtils.h"
+#import <pthread.h>
 
 // ================================================================
 // NNCreateTimer
@@ -44,6 +45,342 @@ void NNCancelTimer(dispatch_source_t timer)
     }
 }
 
+// ================================================================
+// NNTimingWheel
+// ================================================================
+#define NNTIMINGWHEEL_LEVELS 4
+#define NNTIMINGWHEEL_BITS 6
+#define NNTIMINGWHEEL_SLOTS (1 << NNTIMINGWHEEL_BITS)
+#define NNTIMINGWHEEL_MASK (NNTIMINGWHEEL_SLOTS - 1)
+#define NNTIMINGWHEEL_MAX_TICKS ((1ull << (NNTIMINGWHEEL_BITS * NNTIMINGWHEEL_LEVELS)) - 1)
+#define NNTIMINGWHEEL_MIN_RESOLUTION 0.01
+#define NNTIMINGWHEEL_MAX_RESOLUTION 0.1
+
+@interface NNTimingWheel ()
+- (void)cancelTimeout:(NNTimeout *)timeout;
+@end
+
+@interface NNTimeout ()
+{
+    @package
+    NNTimingWheel *_wheel;
+    NNTimeout *_next;
+    __unsafe_unretained NNTimeout *_prev;
+    uint64_t _expires;
+    NSUInteger _level;
+    NSUInteger _slot;
+    BOOL _linked;
+    BOOL _cancelled;
+    dispatch_queue_t _queue;
+    dispatch_block_t _block;
+}
+@end
+
+@implementation NNTimeout
+
+- (void)dealloc
+{
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(_queue);
+    #endif
+}
+
+- (void)cancel
+{
+    [_wheel cancelTimeout:self];
+}
+
+@end
+
+@implementation NNTimingWheel
+{
+    pthread_mutex_t _lock;
+    dispatch_queue_t _queue;
+    dispatch_source_t _source;
+    BOOL _running;
+    CFAbsoluteTime _startTime;
+    uint64_t _tick;
+    NSUInteger _count;
+    __strong NNTimeout *_slots[NNTIMINGWHEEL_LEVELS][NNTIMINGWHEEL_SLOTS];
+}
+
++ (instancetype)sharedWheelWithResolution:(NSTimeInterval)resolution
+{
+    static NSMutableDictionary *wheels;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        wheels = [NSMutableDictionary dictionary];
+    });
+    resolution = MAX(NNTIMINGWHEEL_MIN_RESOLUTION, MIN(NNTIMINGWHEEL_MAX_RESOLUTION, resolution));
+    NSNumber *key = @((NSUInteger)(resolution * 1000));
+    @synchronized (wheels) {
+        NNTimingWheel *wheel = [wheels objectForKey:key];
+        if (!wheel) {
+            wheel = [[self alloc] initWithResolution:resolution];
+            [wheels setObject:wheel forKey:key];
+        }
+        return wheel;
+    }
+}
+
+- (id)initWithResolution:(NSTimeInterval)resolution
+{
+    self = [super init];
+    if (self) {
+        _resolution = MAX(NNTIMINGWHEEL_MIN_RESOLUTION, MIN(NNTIMINGWHEEL_MAX_RESOLUTION, resolution));
+        pthread_mutex_init(&_lock, NULL);
+        _queue = dispatch_queue_create("NNTimingWheel", DISPATCH_QUEUE_SERIAL);
+        _source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+        __unsafe_unretained NNTimingWheel *wheel = self;
+        dispatch_source_set_event_handler(_source, ^{
+            [wheel advance];
+        });
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (!_running) {
+        // Suspended source must be resumed before it is released.
+        dispatch_resume(_source);
+    }
+    dispatch_source_cancel(_source);
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(_source);
+    dispatch_release(_queue);
+    #endif
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NNTimeout *)scheduleTimeout:(NSTimeInterval)timeout queue:(dispatch_queue_t)queue block:(dispatch_block_t)block
+{
+    NNTimeout *t = [[NNTimeout alloc] init];
+    t->_wheel = self;
+    t->_queue = queue;
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_retain(queue);
+    #endif
+    t->_block = [block copy];
+    uint64_t ticks = (uint64_t)ceil(MAX(timeout, 0) / _resolution);
+    pthread_mutex_lock(&_lock);
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (!_running) {
+        _startTime = now - _tick * _resolution;
+        uint64_t interval = (uint64_t)(_resolution * NSEC_PER_SEC);
+        dispatch_source_set_timer(_source, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+        dispatch_resume(_source);
+        _running = YES;
+    }
+    uint64_t current = MAX(_tick, (uint64_t)((now - _startTime) / _resolution));
+    t->_expires = current + MIN(MAX(ticks, 1ull), NNTIMINGWHEEL_MAX_TICKS);
+    [self link:t];
+    pthread_mutex_unlock(&_lock);
+    return t;
+}
+
+- (void)cancelTimeout:(NNTimeout *)t
+{
+    pthread_mutex_lock(&_lock);
+    t->_cancelled = YES;
+    t->_block = nil;
+    if (t->_linked) {
+        [self unlink:t];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)link:(NNTimeout *)t
+{
+    uint64_t delta = t->_expires > _tick ? t->_expires - _tick : 0;
+    if (delta > NNTIMINGWHEEL_MAX_TICKS) {
+        delta = NNTIMINGWHEEL_MAX_TICKS;
+        t->_expires = _tick + delta;
+    }
+    NSUInteger level = 0;
+    while (level < NNTIMINGWHEEL_LEVELS - 1 && delta >= (1ull << (NNTIMINGWHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    NSUInteger slot = (NSUInteger)((t->_expires >> (NNTIMINGWHEEL_BITS * level)) & NNTIMINGWHEEL_MASK);
+    t->_level = level;
+    t->_slot = slot;
+    t->_prev = nil;
+    t->_next = _slots[level][slot];
+    if (t->_next) {
+        t->_next->_prev = t;
+    }
+    _slots[level][slot] = t;
+    t->_linked = YES;
+    _count++;
+}
+
+- (void)unlink:(NNTimeout *)t
+{
+    NNTimeout *next = t->_next;
+    if (t->_prev) {
+        t->_prev->_next = next;
+    } else {
+        _slots[t->_level][t->_slot] = next;
+    }
+    if (next) {
+        next->_prev = t->_prev;
+    }
+    t->_next = nil;
+    t->_prev = nil;
+    t->_linked = NO;
+    _count--;
+}
+
+// Takes all deadlines out of a slot.
+- (NNTimeout *)detachSlot:(NSUInteger)slot level:(NSUInteger)level
+{
+    NNTimeout *head = _slots[level][slot];
+    _slots[level][slot] = nil;
+    for (NNTimeout *t = head; t; t = t->_next) {
+        t->_linked = NO;
+        _count--;
+    }
+    return head;
+}
+
+- (void)cascade
+{
+    NSUInteger levels = 0;
+    while (levels + 1 < NNTIMINGWHEEL_LEVELS && (_tick & ((1ull << (NNTIMINGWHEEL_BITS * (levels + 1))) - 1)) == 0) {
+        levels++;
+    }
+    // Higher levels first, so that deadlines moved down are cascaded again on this tick.
+    for (NSUInteger level = levels; level >= 1; level--) {
+        NSUInteger slot = (NSUInteger)((_tick >> (NNTIMINGWHEEL_BITS * level)) & NNTIMINGWHEEL_MASK);
+        NNTimeout *t = [self detachSlot:slot level:level];
+        while (t) {
+            NNTimeout *next = t->_next;
+            [self link:t];
+            t = next;
+        }
+    }
+}
+
+- (void)advance
+{
+    NSMutableArray *expired = nil;
+    pthread_mutex_lock(&_lock);
+    uint64_t target = (uint64_t)((CFAbsoluteTimeGetCurrent() - _startTime) / _resolution);
+    while (_tick < target && _count > 0) {
+        _tick++;
+        [self cascade];
+        NNTimeout *t = [self detachSlot:(NSUInteger)(_tick & NNTIMINGWHEEL_MASK) level:0];
+        while (t) {
+            NNTimeout *next = t->_next;
+            t->_next = nil;
+            if (next) {
+                next->_prev = nil;
+            }
+            if (!expired) {
+                expired = [NSMutableArray array];
+            }
+            [expired addObject:t];
+            t = next;
+        }
+    }
+    if (_count == 0) {
+        _tick = MAX(_tick, target);
+        dispatch_suspend(_source);
+        _running = NO;
+    }
+    NSMutableArray *blocks = [NSMutableArray arrayWithCapacity:expired.count];
+    for (NNTimeout *t in expired) {
+        [blocks addObject:t->_block];
+        t->_block = nil;
+    }
+    pthread_mutex_unlock(&_lock);
+    NSUInteger i = 0;
+    for (NNTimeout *t in expired) {
+        dispatch_block_t block = [blocks objectAtIndex:i++];
+        dispatch_async(t->_queue, ^{
+            if (!t->_cancelled) {
+                block();
+            }
+        });
+    }
+}
+
+@end
+
+// ================================================================
+// NNQueue
+// ================================================================
+#if OS_OBJECT_USE_OBJC
+#define NNQueuePointer(queue) ((__bridge void *)(queue))
+#else
+#define NNQueuePointer(queue) ((void *)(queue))
+#endif
+
+static char NNQueueMarkKey;
+
+void NNMarkQueue(dispatch_queue_t queue)
+{
+    dispatch_queue_set_specific(queue, &NNQueueMarkKey, NNQueuePointer(queue), NULL);
+}
+
+BOOL NNIsCurrentQueue(dispatch_queue_t queue)
+{
+    if (queue == dispatch_get_main_queue() && [NSThread isMainThread]) {
+        return YES;
+    }
+    return dispatch_get_specific(&NNQueueMarkKey) == NNQueuePointer(queue);
+}
+
+// ================================================================
+// NNDataSlice
+// ================================================================
+// A slice keeps the whole owner alive, such as a 64KB read buffer, for as long as the application holds it.
+// Copying costs a memcpy per message instead, so only slices long enough to be a large part of the owner are kept.
+#define NNDATASLICE_MIN_LENGTH 4096
+// Slices shorter than 1/NNDATASLICE_MIN_FRACTION of the owner are copied as well.
+#define NNDATASLICE_MIN_FRACTION 4
+
+@implementation NNDataSlice
+{
+    NSData *_owner;
+    const void *_bytes;
+    NSUInteger _length;
+}
+
++ (NSData *)dataWithOwner:(NSData *)owner bytes:(const void *)bytes length:(NSUInteger)length sliced:(BOOL *)sliced
+{
+    if (length < NNDATASLICE_MIN_LENGTH || length < owner.length / NNDATASLICE_MIN_FRACTION) {
+        return [NSData dataWithBytes:bytes length:length];
+    }
+    if (sliced) {
+        *sliced = YES;
+    }
+    return [[self alloc] initWithOwner:owner bytes:bytes length:length];
+}
+
+- (id)initWithOwner:(NSData *)owner bytes:(const void *)bytes length:(NSUInteger)length
+{
+    self = [super init];
+    if (self) {
+        _owner = owner;
+        _bytes = bytes;
+        _length = length;
+    }
+    return self;
+}
+
+- (const void *)bytes
+{
+    return _bytes;
+}
+
+- (NSUInteger)length
+{
+    return _length;
+}
+
+@end
+
 // ================================================================
 // NSRunloopBroker
 // ================================================================
@@ -60,8 +397,8 @@ void NNCancelTimer(dispatch_source_t timer)
         _name = name;
         _terminated = NO;
         _semaphore = dispatch_semaphore_create(0);
-        NSThread *thread = [[NSThread alloc] initWithTarget:self selector:@selector(setupThread) object:nil];
-        [thread start];
+        _thread = [[NSThread alloc] initWithTarget:self selector:@selector(setupThread) object:nil];
+        [_thread start];
         dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
         #if NEEDS_DISPATCH_RETAIN_RELEASE
         dispatch_release(_semaphore);
@@ -86,7 +423,127 @@ void NNCancelTimer(dispatch_source_t timer)
 
 - (void)terminate
 {
+    if (_terminated) {
+        return;
+    }
     _terminated = YES;
+    // Wakes the runloop up so that the thread notices termination even when no stream is scheduled.
+    [self performSelector:@selector(wakeUp) onThread:_thread withObject:nil waitUntilDone:NO];
+}
+
+- (void)wakeUp
+{
+}
+
+@end
+
+// ================================================================
+// NNRunLoopBrokerPool
+// ================================================================
+@implementation NNRunLoopBrokerPool
+{
+    NSString *_name;
+    NSMutableArray *_brokers;
+    NSUInteger *_users;
+    NSUInteger _next;
+    pthread_mutex_t _lock;
+}
+
++ (instancetype)sharedPoolWithSize:(NSUInteger)size
+{
+    static NSMutableDictionary *pools;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        pools = [NSMutableDictionary dictionary];
+    });
+    if (size == 0) {
+        size = [[NSProcessInfo processInfo] activeProcessorCount];
+    }
+    NSNumber *key = @(size);
+    @synchronized (pools) {
+        NNRunLoopBrokerPool *pool = [pools objectForKey:key];
+        if (!pool) {
+            pool = [[self alloc] initWithName:@"stream" size:size];
+            [pools setObject:pool forKey:key];
+        }
+        return pool;
+    }
+}
+
+- (id)initWithName:(NSString *)name size:(NSUInteger)size
+{
+    self = [super init];
+    if (self) {
+        _name = name;
+        _size = MAX((NSUInteger)1, size);
+        _brokers = [NSMutableArray arrayWithCapacity:_size];
+        for (NSUInteger i=0; i<_size; i++) {
+            [_brokers addObject:[NSNull null]];
+        }
+        _users = calloc(_size, sizeof(NSUInteger));
+        _next = 0;
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    for (id broker in _brokers) {
+        if (broker != [NSNull null]) {
+            [broker terminate];
+        }
+    }
+    free(_users);
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSUInteger)brokerCount
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = 0;
+    for (NSUInteger i=0; i<_size; i++) {
+        if (_users[i] > 0) {
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NNRunLoopBroker *)acquireBroker
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger index = _next;
+    for (NSUInteger n=1; n<_size; n++) {
+        NSUInteger i = (_next + n) % _size;
+        if (_users[i] < _users[index]) {
+            index = i;
+        }
+    }
+    NNRunLoopBroker *broker = [_brokers objectAtIndex:index];
+    if (_users[index] == 0) {
+        broker = [[NNRunLoopBroker alloc] initWithName:[NSString stringWithFormat:@"%@-%lu", _name, (unsigned long)index]];
+        [_brokers replaceObjectAtIndex:index withObject:broker];
+    }
+    _users[index]++;
+    _next = (index + 1) % _size;
+    pthread_mutex_unlock(&_lock);
+    return broker;
+}
+
+- (void)releaseBroker:(NNRunLoopBroker *)broker
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger index = [_brokers indexOfObjectIdenticalTo:broker];
+    if (index != NSNotFound && _users[index] > 0) {
+        _users[index]--;
+        if (_users[index] == 0) {
+            [broker terminate];
+            [_brokers replaceObjectAtIndex:index withObject:[NSNull null]];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
 }
 
 @end
@@ -101,6 +558,32 @@ static const char *kBase64Chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrs
 // URL safe base64 encoded characters
 static const char *kBase64SafeChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
+// Encodes 3 bytes into 4 characters at a time.
+static void Base64Encode(const uint8_t *in, NSUInteger length, char *out, const char *table)
+{
+    NSUInteger i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+        *out++ = table[v >> 18];
+        *out++ = table[(v >> 12) & 0x3f];
+        *out++ = table[(v >> 6) & 0x3f];
+        *out++ = table[v & 0x3f];
+    }
+    NSUInteger rest = length - i;
+    if (rest > 0) {
+        uint32_t v = (uint32_t)in[i] << 16 | (rest > 1 ? (uint32_t)in[i + 1] << 8 : 0);
+        *out++ = table[v >> 18];
+        *out++ = table[(v >> 12) & 0x3f];
+        *out++ = rest > 1 ? table[(v >> 6) & 0x3f] : PADDING_CHAR;
+        *out++ = PADDING_CHAR;
+    }
+}
+
+void NNBase64Encode(const uint8_t *bytes, NSUInteger length, char *out)
+{
+    Base64Encode(bytes, length, out, kBase64Chars);
+}
+
 @implementation NNBase64
 {
     unsigned char *_charTable;
@@ -136,46 +619,12 @@ static const char *kBase64SafeChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmno
 - (NSString *)encode:(NSData *)data
 {
     if (!data || ![data length]) return nil;
-    unsigned char *inBuff = (unsigned char *)[data bytes];
-    int inPos = 0;
-    int inLen = [data length];
-    int outPos = 0;
-    // Calculate number of characters after encoding
-    int outLen = (inLen * 4 + 2) / 3;
-    // Add number of characters for padding
-    outLen += (4 - outLen % 4) % 4;
-    NSMutableData *outData = [NSMutableData dataWithLength:(NSUInteger)outLen];
-    unsigned char *outBuff = (unsigned char *)[outData mutableBytes];
-    unsigned int bitBuff = 0;
-    int bitLen = 0;
-    while (inPos < inLen || bitLen > 0) {
-        // Working bit buffer is not enough
-        if (bitLen < 6) {
-            if (inPos < inLen) {
-                // Accumulate bits from input buffer
-                bitBuff = bitBuff << 8 | inBuff[inPos++];
-                bitLen  += 8;
-            } else {
-                // Adjust remains to 6 bits
-                bitBuff <<= (6 - bitLen);
-                bitLen = 6;
-            }
-        }
-        int shift = bitLen - 6;
-        // Take next 6 bits from bit buffer
-        unsigned int ch = bitBuff >> shift;
-        // Left justify bit buffer
-        bitBuff -= ch << shift;
-        bitLen -= 6;
-        // Get encoded character and write to output buffer
-        outBuff[outPos++] = _charTable[ch];
-    }
-    while(outPos < outLen) {
-        // padding
-        outBuff[outPos++] = '=';
-    }
-    NSString *outStr = [[NSString alloc] initWithData:outData encoding:NSASCIIStringEncoding];
-    return outStr;
+    NSUInteger inLen = [data length];
+    // Number of characters after encoding, including padding
+    NSUInteger outLen = (inLen + 2) / 3 * 4;
+    char *outBuff = malloc(outLen);
+    Base64Encode([data bytes], inLen, outBuff, (const char *)_charTable);
+    return [[NSString alloc] initWithBytesNoCopy:outBuff length:outLen encoding:NSASCIIStringEncoding freeWhenDone:YES];
 }
 
 - (NSData *)decode:(NSString *)str;
@@ -305,13 +754,68 @@ uint32_t decode_utf8(uint32_t *state, uint32_t *codep, uint32_t byte) {
     return *state;
 }
 
+#define ASCII_MASK 0x8080808080808080ull
+
+// Runs the DFA from 'state' over bytes. Runs of ASCII are skipped a word at a time while no sequence is
+// in progress. 'validEnd' is set to the end of the last complete character, or 0 if none completes.
+static BOOL NNUTF8Scan(uint32_t *state, const uint8_t *bytes, NSUInteger length, NSUInteger *validEnd)
+{
+    uint32_t s = *state;
+    NSUInteger i = 0;
+    NSUInteger end = 0;
+    while (i < length) {
+        if (s == UTF8_ACCEPT) {
+            while (i + 16 <= length) {
+                uint64_t a, b;
+                memcpy(&a, bytes + i, 8);
+                memcpy(&b, bytes + i + 8, 8);
+                if ((a | b) & ASCII_MASK) {
+                    break;
+                }
+                i += 16;
+            }
+            while (i < length && bytes[i] < 0x80) {
+                i++;
+            }
+            end = i;
+            if (i == length) {
+                break;
+            }
+        }
+        s = utf8d[256 + s + utf8d[bytes[i++]]];
+        if (s == UTF8_ACCEPT) {
+            end = i;
+        } else if (s == UTF8_REJECT) {
+            break;
+        }
+    }
+    *state = s;
+    *validEnd = end;
+    return s != UTF8_REJECT;
+}
+
+BOOL NNIsValidUTF8(const void *bytes, NSUInteger length)
+{
+    uint32_t state = UTF8_ACCEPT;
+    NSUInteger end;
+    return NNUTF8Scan(&state, bytes, length, &end) && state == UTF8_ACCEPT;
+}
+
+BOOL NNIsValidUTF8Prefix(const void *bytes, NSUInteger length, NSUInteger *completeLength)
+{
+    uint32_t state = UTF8_ACCEPT;
+    return NNUTF8Scan(&state, bytes, length, completeLength);
+}
+
 // ================================================================
 // NNUTF8Buffer
 // ================================================================
+// Bytes are validated once as they are appended. A chunk which is valid by itself is kept without copying.
 @implementation NNUTF8Buffer {
+    NSData *_whole;
     NSMutableData *_data;
-    NSInteger _validLastIndex;
-    NSInteger _invalidStartIndex;
+    uint32_t _state;
+    NSUInteger _validLength;
 }
 
 + (instancetype)buffer
@@ -331,50 +835,176 @@ uint32_t decode_utf8(uint32_t *state, uint32_t *codep, uint32_t byte) {
 
 - (void)reset
 {
+    _whole = nil;
     [_data setLength:0];
-    _validLastIndex = -1;
-    _invalidStartIndex = -1;
+    _state = UTF8_ACCEPT;
+    _validLength = 0;
 }
 
 - (BOOL)appendData:(NSData *)utf8ByteSequence
 {
-    [_data appendData:utf8ByteSequence];
-
-    uint8_t *bytes = (uint8_t *)[_data bytes];
-    uint32_t codepoint;
-    uint32_t state = UTF8_ACCEPT;
-    for (int i=0; i<_data.length; i++) {
-        decode_utf8(&state, &codepoint, bytes[i]);
-        if (state == UTF8_ACCEPT) {
-            _validLastIndex = i;
-        } else if (state == UTF8_REJECT) {
-            _invalidStartIndex = i;
-            break;
+    NSUInteger length = utf8ByteSequence.length;
+    NSUInteger end = 0;
+    if (_whole) {
+        [_data appendData:_whole];
+        _whole = nil;
+    } else if (_data.length == 0 && _state == UTF8_ACCEPT) {
+        BOOL valid = NNUTF8Scan(&_state, utf8ByteSequence.bytes, length, &end);
+        if (valid && end == length) {
+            _whole = utf8ByteSequence;
+            _validLength = length;
+            return YES;
         }
+        [_data appendData:utf8ByteSequence];
+        _validLength = end;
+        return valid;
     }
-    return _invalidStartIndex < 0;
+    NSUInteger base = _data.length;
+    [_data appendData:utf8ByteSequence];
+    BOOL valid = NNUTF8Scan(&_state, (const uint8_t *)_data.bytes + base, length, &end);
+    if (end > 0) {
+        _validLength = base + end;
+    }
+    return valid;
 }
 
 - (NSData *)removeValidUTF8Portion {
-    if (_validLastIndex < 0) {
+    if (_validLength == 0) {
         return nil;
     }
-    NSData *d = [_data subdataWithRange:NSMakeRange(0, _validLastIndex + 1)];
-    NSUInteger  len = _data.length - (_validLastIndex + 1);
-    if (len == 0) {
-        [_data setLength:0];
-    } else if (len > 0) {
-        _data = [[_data subdataWithRange:NSMakeRange(_validLastIndex + 1, len)] mutableCopy];
+    NSData *d = nil;
+    if (_whole) {
+        d = _whole;
+        _whole = nil;
+    } else {
+        // Only an incomplete sequence can be left behind unless the data is invalid.
+        NSUInteger tail = _data.length - _validLength;
+        if (tail == 0) {
+            d = _data;
+            _data = [NSMutableData data];
+        } else {
+            d = [_data subdataWithRange:NSMakeRange(0, _validLength)];
+            memmove(_data.mutableBytes, (const uint8_t *)_data.bytes + _validLength, tail);
+            [_data setLength:tail];
+        }
     }
-    _validLastIndex = -1;
-    _invalidStartIndex = -1;
+    _validLength = 0;
     return d;
 }
 
 - (NSUInteger)length
 {
-    return [_data length];
+    return _whole ? _whole.length : _data.length;
 }
 
 @end
 
+// ================================================================
+// NNMessageBuffer
+// ================================================================
+#define NNMESSAGEBUFFER_MIN_CAPACITY 4096
+// Number of recent message sizes which the capacity is planned from.
+#define NNMESSAGEBUFFER_HISTORY 8
+
+@implementation NNMessageBuffer
+{
+    uint8_t *_bytes;
+    NSUInteger _recentSizes[NNMESSAGEBUFFER_HISTORY];
+    NSUInteger _recentIndex;
+}
+
++ (instancetype)buffer
+{
+    return [[self alloc] init];
+}
+
+- (void)dealloc
+{
+    free(_bytes);
+}
+
+- (const uint8_t *)bytes
+{
+    return _bytes;
+}
+
+- (NSUInteger)recentMaxSize
+{
+    NSUInteger size = 0;
+    for (NSUInteger i=0; i<NNMESSAGEBUFFER_HISTORY; i++) {
+        size = MAX(size, _recentSizes[i]);
+    }
+    return size;
+}
+
+- (void)setCapacity:(NSUInteger)capacity
+{
+    uint8_t *bytes = realloc(_bytes, capacity);
+    if (!bytes) {
+        [NSException raise:NSMallocException format:@"Failed to allocate %lu bytes.", (unsigned long)capacity];
+    }
+    _bytes = bytes;
+    _capacity = capacity;
+}
+
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length
+{
+    NSUInteger required = _length + length;
+    if (required > _capacity) {
+        NSUInteger capacity = MAX(_capacity * 2, NNMESSAGEBUFFER_MIN_CAPACITY);
+        if (_length == 0) {
+            // A message as large as the recent ones is expected.
+            capacity = MAX(capacity, [self recentMaxSize]);
+        }
+        [self setCapacity:MAX(capacity, required)];
+    }
+    memcpy(_bytes + _length, bytes, length);
+    _length = required;
+}
+
+- (void)didRemoveMessageOfSize:(NSUInteger)size
+{
+    _recentSizes[_recentIndex] = size;
+    _recentIndex = (_recentIndex + 1) % NNMESSAGEBUFFER_HISTORY;
+    if (_length > 0) {
+        return;
+    }
+    NSUInteger planned = MAX([self recentMaxSize], (NSUInteger)NNMESSAGEBUFFER_MIN_CAPACITY);
+    if (_capacity > planned * 2) {
+        [self setCapacity:planned];
+    }
+}
+
+- (NSData *)takeData
+{
+    NSUInteger length = _length;
+    NSData *data;
+    if (length > _capacity / 2) {
+        // Shrinking keeps the block in place.
+        data = [[NSData alloc] initWithBytesNoCopy:realloc(_bytes, MAX(length, (NSUInteger)1)) length:length freeWhenDone:YES];
+        _bytes = NULL;
+        _capacity = 0;
+    } else {
+        data = [[NSData alloc] initWithBytes:_bytes length:length];
+    }
+    _length = 0;
+    [self didRemoveMessageOfSize:length];
+    return data;
+}
+
+- (void)removeLeadingBytes:(NSUInteger)length
+{
+    length = MIN(length, _length);
+    if (length < _length) {
+        memmove(_bytes, _bytes + length, _length - length);
+    }
+    _length -= length;
+    [self didRemoveMessageOfSize:length];
+}
+
+- (void)reset
+{
+    _length = 0;
+}
+
+@end
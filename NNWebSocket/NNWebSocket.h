@@ -14,10 +14,16 @@
 
 #import <Foundation/Foundation.h>
 #import "NNWebSocketClient.h"
+#import "NNWebSocketClientPool.h"
+#import "NNWebSocketServer.h"
 #import "NNWebSocketOptions.h"
 
 @interface NNWebSocket : NSObject
 
 + (id<NNWebSocketClient>)client:(NSURL *)url options:(NNWebSocketOptions *)options;
+// 'size' connections to the url used as one client.
++ (NNWebSocketClientPool *)pool:(NSURL *)url options:(NNWebSocketOptions *)options size:(NSUInteger)size;
+// Server which accepts connections on every address. It starts listening by -startWithError:.
++ (NNWebSocketServer *)server:(uint16_t)port options:(NNWebSocketOptions *)options;
 
 @end
\ No newline at end of file
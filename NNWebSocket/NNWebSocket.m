@@ -22,4 +22,14 @@
     return [[NNWebSocketClientRFC6455 alloc] initWithURL:url options:options];
 }
 
++ (NNWebSocketClientPool *)pool:(NSURL *)url options:(NNWebSocketOptions *)options size:(NSUInteger)size
+{
+    return [[NNWebSocketClientPool alloc] initWithURL:url options:options size:size];
+}
+
++ (NNWebSocketServer *)server:(uint16_t)port options:(NNWebSocketOptions *)options
+{
+    return [[NNWebSocketServer alloc] initWithHost:nil port:port options:options];
+}
+
 @end
@@ -14,6 +14,9 @@
 
 #import "NNWebSocketFrame.h"
 #import "NNWebSocketDefine.h"
+#import "NNWebSocketMessageSink.h"
+#import "NNWebSocketStatistics.h"
+#import "NNWebSocketTracer.h"
 
 typedef void (^NNWebSocketOpenListener)(void);
 typedef void (^NNWebSocketOpenFailedListener)(NSError *error);
@@ -23,6 +26,12 @@ typedef void (^NNWebSocketTextListener)(NSString *text);
 typedef void (^NNWebSocketTextChunkListener)(NSString *text, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo);
 typedef void (^NNWebSocketDataListener)(NSData *data);
 typedef void (^NNWebSocketDataChunkListener)(NSData *data, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo);
+typedef void (^NNWebSocketSendBufferListener)(uint64_t bufferedAmount);
+typedef void (^NNWebSocketStatisticsListener)(NNWebSocketStatistics *statistics);
+// Returning nil delivers the message to chunk listeners instead.
+typedef id<NNWebSocketMessageSink> (^NNWebSocketMessageSinkProvider)(NNWebSocketFrameOpcode opcode);
+// Returns next chunk of a message up to 'maxLength' bytes, or nil at the end of the message.
+typedef NSData *(^NNWebSocketChunkProducer)(NSUInteger maxLength);
 
 @protocol NNWebSocketClient <NSObject>
 
@@ -34,12 +43,33 @@ typedef void (^NNWebSocketDataChunkListener)(NSData *data, NSUInteger index, BOO
 @property(copy, nonatomic) NNWebSocketTextChunkListener onTextChunk;
 @property(copy, nonatomic) NNWebSocketDataListener onData;
 @property(copy, nonatomic) NNWebSocketDataChunkListener onDataChunk;
+@property(copy, nonatomic) NNWebSocketSendBufferListener onBackpressure;
+@property(copy, nonatomic) NNWebSocketSendBufferListener onWritable;
+// Called at the start of a message above streamingThresholdByteSize.
+@property(copy, nonatomic) NNWebSocketMessageSinkProvider onMessageSink;
+// Called every statisticsIntervalSec while connected, and once more on close.
+@property(copy, nonatomic) NNWebSocketStatisticsListener onStatistics;
+// Bytes of sent data not written to the network yet, including frames deferred by backpressure.
+@property(readonly, nonatomic) uint64_t bufferedAmount;
+// Snapshot of the counters of this connection. Can be taken on any thread.
+@property(readonly, nonatomic) NNWebSocketStatistics *statistics;
+// Event tracer of this connection, which is enabled by traceEnabled option or later on any thread.
+@property(readonly, nonatomic) NNWebSocketTracer *tracer;
 
 - (void)open;
 - (void)close;
 - (void)closeWithStatus:(NNWebSocketStatus)status;
-- (void)sendFrame:(NNWebSocketFrame *)frame;
-- (void)sendText:(NSString *)text;
-- (void)sendData:(NSData *)data;
+// Returns NO when the frame is rejected by NNWebSocketSendBufferLimitBehaviorReject.
+- (BOOL)sendFrame:(NNWebSocketFrame *)frame;
+- (BOOL)sendText:(NSString *)text;
+- (BOOL)sendData:(NSData *)data;
+// Sends a message in fragments of sendFragmentByteSize. Chunks are read on callback queue as the send buffer
+// drains, so the message is never held in memory at once. Ping and pong can be sent between fragments.
+- (BOOL)sendStream:(NSInputStream *)stream opcode:(NNWebSocketFrameOpcode)opcode;
+- (BOOL)sendMessageWithOpcode:(NNWebSocketFrameOpcode)opcode producer:(NNWebSocketChunkProducer)producer;
+// Stops reading frames from the network until resumed, so that TCP flow control slows the server.
+// Frames already decoded are still delivered.
+- (void)pauseReading;
+- (void)resumeReading;
 
 @end
\ No newline at end of file
@@ -0,0 +1,39 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketClient.h"
+
+@class NNWebSocketOptions;
+
+// Connections to the same URL used as one client. A message is sent on the open connection with the least
+// buffered bytes, so that a large message holds back only the connection it is on. Messages sent with the same
+// key go to the same connection while it is open, which keeps their order. Listeners receive messages of every
+// connection on callbackQueue. A connection which fails or is closed by the server is replaced after
+// reconnectDelaySec.
+//
+// onOpen is called when the first connection opens, onOpenFailed when every connection has failed before
+// any opened, and onClose when all of them have been closed by close. statistics sums up the connections
+// including replaced ones, and tracer is the one of the first connection. callbackOnIOQueue is not supported.
+@interface NNWebSocketClientPool : NSObject<NNWebSocketClient>
+
+@property(readonly, nonatomic) NSUInteger size;
+@property(readonly, nonatomic) NSUInteger openConnectionCount;
+@property(nonatomic) NSTimeInterval reconnectDelaySec;
+
+- (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options size:(NSUInteger)size;
+- (BOOL)sendText:(NSString *)text key:(id)key;
+- (BOOL)sendData:(NSData *)data key:(id)key;
+
+@end
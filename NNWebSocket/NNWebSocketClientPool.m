@@ -0,0 +1,564 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketClientPool.h"
+#import <pthread.h>
+#import <libkern/OSAtomic.h>
+#import "NNWebSocketClientRFC6455.h"
+#import "NNWebSocketOptions.h"
+#import "NNUtils.h"
+#import "NNWebSocketDebug.h"
+
+#define DEFAULT_RECONNECT_DELAY_SEC 1.0
+
+typedef NS_ENUM(NSUInteger, NNWebSocketPoolSlotState) {
+    NNWebSocketPoolSlotStateIdle,
+    NNWebSocketPoolSlotStateConnecting,
+    NNWebSocketPoolSlotStateOpen,
+    // Waiting for the connection to be replaced.
+    NNWebSocketPoolSlotStateWaiting,
+};
+
+// ================================================================
+// NNWebSocketPoolSlot
+// ================================================================
+@interface NNWebSocketPoolSlot : NSObject
+{
+    @package
+    NSUInteger index;
+    id<NNWebSocketClient> client;
+    NNWebSocketPoolSlotState state;
+    BOOL backpressured;
+    BOOL failedBeforeOpen;
+}
+@end
+
+@implementation NNWebSocketPoolSlot
+@end
+
+// ================================================================
+// NNWebSocketClientPool
+// ================================================================
+@implementation NNWebSocketClientPool
+{
+    NSURL *_url;
+    NNWebSocketOptions *_options;
+    NSUInteger _verbose;
+    dispatch_queue_t _callbackQueue;
+    // Slots are fixed. Their clients and states are changed on callbackQueue under the lock, since sends
+    // may come from any thread.
+    NSArray *_slots;
+    pthread_mutex_t _lock;
+    // Sum of the connections which have been replaced.
+    NNWebSocketStatistics *_retiredStatistics;
+    BOOL _opening;
+    BOOL _closing;
+    BOOL _opened;
+    BOOL _backpressured;
+    BOOL _readingPaused;
+    NSUInteger _failuresBeforeOpen;
+    NSUInteger _pendingCloses;
+    NNTimeout *_statisticsTimer;
+    volatile int32_t _nextSlot;
+}
+
+@synthesize onOpen = _onOpen;
+@synthesize onOpenFailed = _onOpenFailed;
+@synthesize onClose = _onClose;
+@synthesize onFrame = _onFrame;
+@synthesize onText = _onText;
+@synthesize onTextChunk = _onTextChunk;
+@synthesize onData = _onData;
+@synthesize onDataChunk = _onDataChunk;
+@synthesize onBackpressure = _onBackpressure;
+@synthesize onWritable = _onWritable;
+@synthesize onMessageSink = _onMessageSink;
+@synthesize onStatistics = _onStatistics;
+
+- (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options size:(NSUInteger)size
+{
+    self = [super init];
+    if (self) {
+        _url = url;
+        _options = options;
+        _verbose = options.verbose;
+        _size = MAX((NSUInteger)1, size);
+        _reconnectDelaySec = DEFAULT_RECONNECT_DELAY_SEC;
+        _callbackQueue = options.callbackQueue ?: dispatch_get_main_queue();
+        #if NEEDS_DISPATCH_RETAIN_RELEASE
+        dispatch_retain(_callbackQueue);
+        #endif
+        if (options.callbackOnIOQueue) {
+            LogWarn(@"callbackOnIOQueue is not supported by pool.");
+        }
+        NNMarkQueue(_callbackQueue);
+        pthread_mutex_init(&_lock, NULL);
+        _retiredStatistics = [[NNWebSocketStatistics alloc] initWithStatistics:@[]];
+        NSMutableArray *slots = [NSMutableArray arrayWithCapacity:_size];
+        for (NSUInteger i=0; i<_size; i++) {
+            NNWebSocketPoolSlot *slot = [[NNWebSocketPoolSlot alloc] init];
+            slot->index = i;
+            slot->client = [self createClientForSlot:slot];
+            [slots addObject:slot];
+        }
+        _slots = slots;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_statisticsTimer cancel];
+    pthread_mutex_destroy(&_lock);
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(_callbackQueue);
+    #endif
+}
+
+#pragma mark public methods
+
+- (void)open
+{
+    [self performBlock:^{
+        if (_opening) {
+            return;
+        }
+        _opening = YES;
+        _closing = NO;
+        _opened = NO;
+        _failuresBeforeOpen = 0;
+        for (NNWebSocketPoolSlot *slot in _slots) {
+            slot->failedBeforeOpen = NO;
+        }
+        for (NNWebSocketPoolSlot *slot in _slots) {
+            if (!_opening) {
+                // Every connection has failed within open.
+                break;
+            }
+            [self connectSlot:slot];
+        }
+    }];
+}
+
+- (void)close
+{
+    [self closeWithStatus:NNWebSocketStatusNormalEnd];
+}
+
+- (void)closeWithStatus:(NNWebSocketStatus)status
+{
+    [self performBlock:^{
+        if (!_opening || _closing) {
+            return;
+        }
+        _closing = YES;
+        // Connecting ones report their failure within close, so every close is counted first.
+        NSMutableArray *clients = [NSMutableArray arrayWithCapacity:_size];
+        pthread_mutex_lock(&_lock);
+        for (NNWebSocketPoolSlot *slot in _slots) {
+            if (slot->state == NNWebSocketPoolSlotStateConnecting || slot->state == NNWebSocketPoolSlotStateOpen) {
+                [clients addObject:slot->client];
+            } else {
+                slot->state = NNWebSocketPoolSlotStateIdle;
+            }
+        }
+        pthread_mutex_unlock(&_lock);
+        _pendingCloses = clients.count;
+        if (_pendingCloses == 0) {
+            [self didClose:status error:nil];
+            return;
+        }
+        for (id<NNWebSocketClient> client in clients) {
+            [client closeWithStatus:status];
+        }
+    }];
+}
+
+- (BOOL)sendFrame:(NNWebSocketFrame *)frame
+{
+    return [[self leastBufferedClient] sendFrame:frame];
+}
+
+- (BOOL)sendText:(NSString *)text
+{
+    return [[self leastBufferedClient] sendText:text];
+}
+
+- (BOOL)sendData:(NSData *)data
+{
+    return [[self leastBufferedClient] sendData:data];
+}
+
+- (BOOL)sendText:(NSString *)text key:(id)key
+{
+    return [[self clientForKey:key] sendText:text];
+}
+
+- (BOOL)sendData:(NSData *)data key:(id)key
+{
+    return [[self clientForKey:key] sendData:data];
+}
+
+- (BOOL)sendStream:(NSInputStream *)stream opcode:(NNWebSocketFrameOpcode)opcode
+{
+    return [[self leastBufferedClient] sendStream:stream opcode:opcode];
+}
+
+- (BOOL)sendMessageWithOpcode:(NNWebSocketFrameOpcode)opcode producer:(NNWebSocketChunkProducer)producer
+{
+    return [[self leastBufferedClient] sendMessageWithOpcode:opcode producer:producer];
+}
+
+- (void)pauseReading
+{
+    [self performBlock:^{
+        _readingPaused = YES;
+        for (NNWebSocketPoolSlot *slot in _slots) {
+            [slot->client pauseReading];
+        }
+    }];
+}
+
+- (void)resumeReading
+{
+    [self performBlock:^{
+        _readingPaused = NO;
+        for (NNWebSocketPoolSlot *slot in _slots) {
+            [slot->client resumeReading];
+        }
+    }];
+}
+
+- (uint64_t)bufferedAmount
+{
+    uint64_t amount = 0;
+    pthread_mutex_lock(&_lock);
+    for (NNWebSocketPoolSlot *slot in _slots) {
+        if (slot->state != NNWebSocketPoolSlotStateWaiting) {
+            amount += slot->client.bufferedAmount;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return amount;
+}
+
+- (NNWebSocketStatistics *)statistics
+{
+    NSMutableArray *statistics = [NSMutableArray arrayWithCapacity:_size + 1];
+    pthread_mutex_lock(&_lock);
+    [statistics addObject:_retiredStatistics];
+    for (NNWebSocketPoolSlot *slot in _slots) {
+        // Connections waiting to be replaced have been added to the retired ones.
+        if (slot->state != NNWebSocketPoolSlotStateWaiting) {
+            [statistics addObject:slot->client.statistics];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return [[NNWebSocketStatistics alloc] initWithStatistics:statistics];
+}
+
+- (NNWebSocketTracer *)tracer
+{
+    pthread_mutex_lock(&_lock);
+    NNWebSocketTracer *tracer = ((NNWebSocketPoolSlot *)[_slots objectAtIndex:0])->client.tracer;
+    pthread_mutex_unlock(&_lock);
+    return tracer;
+}
+
+- (NSUInteger)openConnectionCount
+{
+    NSUInteger count = 0;
+    pthread_mutex_lock(&_lock);
+    for (NNWebSocketPoolSlot *slot in _slots) {
+        if (slot->state == NNWebSocketPoolSlotStateOpen) {
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+#pragma mark listeners
+
+// Message listeners are shared by the connections as they are, so that a connection does no work for a listener
+// which is not set.
+- (void)setOnFrame:(NNWebSocketFrameListener)onFrame
+{
+    _onFrame = [onFrame copy];
+    [self bindMessageListeners];
+}
+
+- (void)setOnText:(NNWebSocketTextListener)onText
+{
+    _onText = [onText copy];
+    [self bindMessageListeners];
+}
+
+- (void)setOnTextChunk:(NNWebSocketTextChunkListener)onTextChunk
+{
+    _onTextChunk = [onTextChunk copy];
+    [self bindMessageListeners];
+}
+
+- (void)setOnData:(NNWebSocketDataListener)onData
+{
+    _onData = [onData copy];
+    [self bindMessageListeners];
+}
+
+- (void)setOnDataChunk:(NNWebSocketDataChunkListener)onDataChunk
+{
+    _onDataChunk = [onDataChunk copy];
+    [self bindMessageListeners];
+}
+
+- (void)setOnMessageSink:(NNWebSocketMessageSinkProvider)onMessageSink
+{
+    _onMessageSink = [onMessageSink copy];
+    [self bindMessageListeners];
+}
+
+- (void)bindMessageListeners
+{
+    pthread_mutex_lock(&_lock);
+    for (NNWebSocketPoolSlot *slot in _slots) {
+        [self bindMessageListenersToClient:slot->client];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)bindMessageListenersToClient:(id<NNWebSocketClient>)client
+{
+    client.onFrame = _onFrame;
+    client.onText = _onText;
+    client.onTextChunk = _onTextChunk;
+    client.onData = _onData;
+    client.onDataChunk = _onDataChunk;
+    client.onMessageSink = _onMessageSink;
+}
+
+#pragma mark private methods
+
+- (void)performBlock:(dispatch_block_t)block
+{
+    if (NNIsCurrentQueue(_callbackQueue)) {
+        block();
+    } else {
+        dispatch_async(_callbackQueue, block);
+    }
+}
+
+- (id<NNWebSocketClient>)createClientForSlot:(NNWebSocketPoolSlot *)slot
+{
+    id<NNWebSocketClient> client = [[NNWebSocketClientRFC6455 alloc] initWithURL:_url options:_options];
+    __weak NNWebSocketClientPool *weakSelf = self;
+    __weak id<NNWebSocketClient> weakClient = client;
+    client.onOpen = ^{
+        [weakSelf slot:slot didOpenClient:weakClient];
+    };
+    client.onOpenFailed = ^(NSError *error) {
+        [weakSelf slot:slot didCloseClient:weakClient status:NNWebSocketStatusAbnormalClosure error:error];
+    };
+    client.onClose = ^(NNWebSocketStatus status, NSError *error) {
+        [weakSelf slot:slot didCloseClient:weakClient status:status error:error];
+    };
+    client.onBackpressure = ^(uint64_t bufferedAmount) {
+        [weakSelf slot:slot didChangeBackpressure:YES client:weakClient];
+    };
+    client.onWritable = ^(uint64_t bufferedAmount) {
+        [weakSelf slot:slot didChangeBackpressure:NO client:weakClient];
+    };
+    [self bindMessageListenersToClient:client];
+    if (_readingPaused) {
+        [client pauseReading];
+    }
+    return client;
+}
+
+- (void)connectSlot:(NNWebSocketPoolSlot *)slot
+{
+    pthread_mutex_lock(&_lock);
+    if (slot->state == NNWebSocketPoolSlotStateWaiting) {
+        slot->client = [self createClientForSlot:slot];
+    }
+    slot->state = NNWebSocketPoolSlotStateConnecting;
+    slot->backpressured = NO;
+    id<NNWebSocketClient> client = slot->client;
+    pthread_mutex_unlock(&_lock);
+    [client open];
+}
+
+// Open connections are preferred, then the one with the least bytes waiting to be written.
+// Ties are broken in turn, so that small messages are spread as well.
+- (id<NNWebSocketClient>)leastBufferedClient
+{
+    id<NNWebSocketClient> best = nil;
+    NSInteger bestRank = -1;
+    uint64_t bestAmount = UINT64_MAX;
+    NSUInteger start = (uint32_t)OSAtomicIncrement32(&_nextSlot) % _size;
+    pthread_mutex_lock(&_lock);
+    for (NSUInteger i=0; i<_size; i++) {
+        NNWebSocketPoolSlot *slot = [_slots objectAtIndex:(start + i) % _size];
+        // Connections being replaced are used only when no other is.
+        NSInteger rank = slot->state == NNWebSocketPoolSlotStateOpen ? 2 : (slot->state == NNWebSocketPoolSlotStateWaiting ? 0 : 1);
+        if (rank < bestRank) {
+            continue;
+        }
+        uint64_t amount = slot->client.bufferedAmount;
+        if (rank > bestRank || amount < bestAmount) {
+            best = slot->client;
+            bestRank = rank;
+            bestAmount = amount;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return best;
+}
+
+// Keys keep to one connection. While it is not open, they are spread as keyless messages are.
+- (id<NNWebSocketClient>)clientForKey:(id)key
+{
+    NNWebSocketPoolSlot *slot = [_slots objectAtIndex:[key hash] % _size];
+    pthread_mutex_lock(&_lock);
+    id<NNWebSocketClient> client = slot->state == NNWebSocketPoolSlotStateOpen ? slot->client : nil;
+    pthread_mutex_unlock(&_lock);
+    return client ?: [self leastBufferedClient];
+}
+
+- (void)slot:(NNWebSocketPoolSlot *)slot didOpenClient:(id<NNWebSocketClient>)client
+{
+    if (client != slot->client) {
+        return;
+    }
+    pthread_mutex_lock(&_lock);
+    slot->state = NNWebSocketPoolSlotStateOpen;
+    pthread_mutex_unlock(&_lock);
+    LogDebug(@"Connection %lu of pool is opened.", (unsigned long)slot->index);
+    if (_opening && !_opened && !_closing) {
+        _opened = YES;
+        [self scheduleStatistics];
+        if (_onOpen) _onOpen();
+    }
+}
+
+- (void)slot:(NNWebSocketPoolSlot *)slot didCloseClient:(id<NNWebSocketClient>)client status:(NNWebSocketStatus)status error:(NSError *)error
+{
+    if (client != slot->client) {
+        return;
+    }
+    if (_closing || !_opening) {
+        pthread_mutex_lock(&_lock);
+        slot->state = NNWebSocketPoolSlotStateIdle;
+        pthread_mutex_unlock(&_lock);
+        if (_pendingCloses > 0 && --_pendingCloses == 0) {
+            [self didClose:status error:error];
+        }
+        return;
+    }
+    LogDebug(@"Connection %lu of pool is lost. Replacing it.", (unsigned long)slot->index);
+    pthread_mutex_lock(&_lock);
+    _retiredStatistics = [[NNWebSocketStatistics alloc] initWithStatistics:@[_retiredStatistics, client.statistics]];
+    slot->state = NNWebSocketPoolSlotStateWaiting;
+    slot->backpressured = NO;
+    pthread_mutex_unlock(&_lock);
+    if (!_opened && !slot->failedBeforeOpen) {
+        slot->failedBeforeOpen = YES;
+        _failuresBeforeOpen++;
+    }
+    if (!_opened && _failuresBeforeOpen >= _size) {
+        LogError(@"Every connection of pool has failed to open.");
+        _opening = NO;
+        for (NNWebSocketPoolSlot *s in _slots) {
+            if (s->state == NNWebSocketPoolSlotStateConnecting) {
+                [s->client close];
+            }
+        }
+        if (_onOpenFailed) _onOpenFailed(error);
+        return;
+    }
+    [self updateBackpressure];
+    __weak NNWebSocketClientPool *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_reconnectDelaySec * NSEC_PER_SEC)), _callbackQueue, ^{
+        NNWebSocketClientPool *pool = weakSelf;
+        if (pool && pool->_opening && !pool->_closing && slot->state == NNWebSocketPoolSlotStateWaiting) {
+            [pool connectSlot:slot];
+        }
+    });
+}
+
+- (void)slot:(NNWebSocketPoolSlot *)slot didChangeBackpressure:(BOOL)backpressured client:(id<NNWebSocketClient>)client
+{
+    if (client != slot->client) {
+        return;
+    }
+    slot->backpressured = backpressured;
+    [self updateBackpressure];
+}
+
+// The pool is backpressured while every open connection is.
+- (void)updateBackpressure
+{
+    BOOL backpressured = NO;
+    for (NNWebSocketPoolSlot *slot in _slots) {
+        if (slot->state == NNWebSocketPoolSlotStateOpen) {
+            if (!slot->backpressured) {
+                backpressured = NO;
+                break;
+            }
+            backpressured = YES;
+        }
+    }
+    if (backpressured == _backpressured) {
+        return;
+    }
+    _backpressured = backpressured;
+    if (backpressured) {
+        if (_onBackpressure) _onBackpressure(self.bufferedAmount);
+    } else {
+        if (_onWritable) _onWritable(self.bufferedAmount);
+    }
+}
+
+- (void)didClose:(NNWebSocketStatus)status error:(NSError *)error
+{
+    _opening = NO;
+    _closing = NO;
+    _backpressured = NO;
+    LogInfo(@"Pool is closed.");
+    if (_statisticsTimer) {
+        [_statisticsTimer cancel];
+        _statisticsTimer = nil;
+        if (_onStatistics) _onStatistics(self.statistics);
+    }
+    if (_onClose) _onClose(status, error);
+}
+
+- (void)scheduleStatistics
+{
+    if (_options.statisticsIntervalSec <= 0) {
+        return;
+    }
+    __weak NNWebSocketClientPool *weakSelf = self;
+    NNTimingWheel *timingWheel = [NNTimingWheel sharedWheelWithResolution:_options.timerResolutionSec];
+    _statisticsTimer = [timingWheel scheduleTimeout:_options.statisticsIntervalSec queue:_callbackQueue block:^{
+        NNWebSocketClientPool *pool = weakSelf;
+        if (!pool || !pool->_statisticsTimer) {
+            return;
+        }
+        if (pool->_onStatistics) pool->_onStatistics(pool.statistics);
+        [pool scheduleStatistics];
+    }];
+}
+
+@end
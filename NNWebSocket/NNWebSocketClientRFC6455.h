@@ -17,8 +17,15 @@
 #import "NNWebSocketStateContext.h"
 #import "NNWebSocketTransportDelegate.h"
 
+@class NNWebSocketServer;
+
 @interface NNWebSocketClientRFC6455 : NSObject<NNWebSocketClient, NNWebSocketStateContext, NNWebSocketTransportDelegate>
 
 - (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options;
+// Server side of a connection accepted by 'server'. open starts the opening handshake on the socket, and the
+// server is told when the connection has opened and closed.
+- (id)initWithAcceptedSocket:(int)descriptor server:(NNWebSocketServer *)server options:(NNWebSocketOptions *)options;
+// Sends a frame encoded by the caller, unless it has to be deferred by backpressure.
+- (BOOL)sendFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data;
 
 @end
\ No newline at end of file
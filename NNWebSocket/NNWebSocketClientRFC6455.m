@@ -13,20 +13,49 @@
 // limitations under the License.
 
 #import "NNWebSocketClientRFC6455.h"
+#import <libkern/OSAtomic.h>
 #import "NNWebSocketOptions.h"
 #import "NNWebSocketState.h"
 #import "NNUtils.h"
 #import "NNWebSocketTransport.h"
+#import "NNWebSocketFragmenter.h"
+#import "NNWebSocketStatistics.h"
+#import "NNWebSocketTracer.h"
+#import "NNWebSocketServer.h"
 #import "NNWebSocketDebug.h"
 
+#define FRAME_POOL_CAPACITY 256
+
 @implementation NNWebSocketClientRFC6455
 {
     BOOL _optDisableAutomaticPingPong;
+    uint64_t _optSendBufferHighWatermark;
+    uint64_t _optSendBufferLowWatermark;
+    NNWebSocketSendBufferLimitBehavior _optSendBufferLimitBehavior;
+    NSUInteger _optSendFragmentSize;
+    uint64_t _optAutoFragmentThreshold;
+    NSTimeInterval _optStatisticsInterval;
+    BOOL _optReassembleFragmentedMessages;
+    uint64_t _optMaxPayloadSize;
+    NNWebSocketPayloadSizeLimitBehavior _optPayloadSizeLimitBehavior;
+    BOOL _backpressured;
+    NSMutableArray *_deferredFrames;
+    volatile int64_t _deferredAmount;
+    // Bytes reserved by accepted sends which have not reached the transport or the deferred frames yet.
+    volatile int64_t _pendingAmount;
     NSUInteger _verbose;
-    NNWebSocketFrame* _fragmentedFirstFrame;
+    // Opcode of the fragmented or streamed message being received. Continuation while none.
+    NNWebSocketFrameOpcode _fragmentedOpcode;
     NSUInteger _chunkIndex;
     NSMutableDictionary *_chunkUserInfo;
     NNUTF8Buffer *_textBuffer;
+    NNMessageBuffer *_messageBuffer;
+    id<NNWebSocketMessageSink> _messageSink;
+    NNWebSocketCounters *_counters;
+    NNTimeout *_statisticsTimer;
+    NNWebSocketTracer *_tracer;
+    NNWebSocketFramePool *_framePool;
+    __weak NNWebSocketServer *_server;
 
     NNWebSocketState *_state;
     NNWebSocketState *_channelStateClosed;
@@ -39,9 +68,12 @@
 @synthesize options = _options;
 @synthesize transport = _transport;
 @synthesize closeTimer = _closeTimer;
+@synthesize deflateExtension = _deflateExtension;
 @synthesize status = _status;
 @synthesize error = _error;
 @synthesize closureType = _closureType;
+@synthesize framePool = _framePool;
+@synthesize serverSide = _serverSide;
 
 @synthesize onOpen = _onOpen;
 @synthesize onOpenFailed = _onOpenFailed;
@@ -51,20 +83,62 @@
 @synthesize onTextChunk = _onTextChunk;
 @synthesize onData = _onData;
 @synthesize onDataChunk = _onDataChunk;
+@synthesize onBackpressure = _onBackpressure;
+@synthesize onWritable = _onWritable;
+@synthesize onMessageSink = _onMessageSink;
+@synthesize onStatistics = _onStatistics;
 
 #pragma mark public methods
 
 - (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options
+{
+    return [self initWithURL:url options:options descriptor:-1];
+}
+
+- (id)initWithAcceptedSocket:(int)descriptor server:(NNWebSocketServer *)server options:(NNWebSocketOptions *)options
+{
+    self = [self initWithURL:nil options:options descriptor:descriptor];
+    if (self) {
+        _server = server;
+    }
+    return self;
+}
+
+- (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options descriptor:(int)descriptor
 {
     self = [super init];
     if (self) {
         _verbose = options.verbose;
-        _transport = [[NNWebSocketTransport alloc] initWithDelegate:self options:options];
+        _serverSide = descriptor >= 0;
+        _transport = NNCreateTransport(self, options, [url.scheme caseInsensitiveCompare:@"wss"] == NSOrderedSame);
         _url = url;
         _options = options;
         _optDisableAutomaticPingPong =  options.disableAutomaticPingPong;
+        _optSendBufferHighWatermark = options.sendBufferHighWatermark;
+        _optSendBufferLowWatermark = MIN(options.sendBufferLowWatermark, options.sendBufferHighWatermark);
+        _optSendBufferLimitBehavior = options.sendBufferLimitBehavior;
+        _optSendFragmentSize = options.sendFragmentByteSize;
+        _optAutoFragmentThreshold = options.autoFragmentThresholdByteSize;
+        _optStatisticsInterval = options.statisticsIntervalSec;
+        _optReassembleFragmentedMessages = options.reassembleFragmentedMessages;
+        _optMaxPayloadSize = options.maxPayloadByteSize;
+        _optPayloadSizeLimitBehavior = options.payloadSizeLimitBehavior;
+        _counters = _transport.counters;
+        _tracer = _transport.tracer;
+        _deferredFrames = [NSMutableArray array];
+        _textBuffer = [NNUTF8Buffer buffer];
+        if (_optReassembleFragmentedMessages) {
+            _messageBuffer = [NNMessageBuffer buffer];
+        }
+        if (options.recycleReceivedFrames) {
+            _framePool = [[NNWebSocketFramePool alloc] initWithCapacity:FRAME_POOL_CAPACITY];
+        }
         _channelStateClosed = [NNWebSocketStateClosed stateWithContext:self name:@"CLOSED"];
-        _channelStateConnecting = [NNWebSocketStateConnecting stateWithContext:self name:@"CONNECTING"];
+        if (_serverSide) {
+            _channelStateConnecting = [NNWebSocketStateAccepting stateWithContext:self name:@"CONNECTING" descriptor:descriptor];
+        } else {
+            _channelStateConnecting = [NNWebSocketStateConnecting stateWithContext:self name:@"CONNECTING"];
+        }
         _channelStateOpen = [NNWebSocketStateOpen stateWithContext:self name:@"OPEN"];
         _channelStateClosing = [NNWebSocketStateClosing stateWithContext:self name:@"CLOSING"];
         _state = _channelStateClosed;
@@ -79,8 +153,14 @@
 
 - (void)open
 {
-    LogInfo(@"Connecting to %@", [_url absoluteString]);
-    [_state open];
+    [self performBlock:^{
+        if (_serverSide) {
+            LogInfo(@"Accepting a connection.");
+        } else {
+            LogInfo(@"Connecting to %@", [_url absoluteString]);
+        }
+        [_state open];
+    }];
 }
 
 - (void)close
@@ -90,91 +170,431 @@
 
 - (void)closeWithStatus:(NNWebSocketStatus)status
 {
-    LogInfo(@"Disconnecting with status %d", status);
-    [_state closeWithStatus:status error:nil];
+    [self performBlock:^{
+        LogInfo(@"Disconnecting with status %d", status);
+        [_state closeWithStatus:status error:nil];
+    }];
 }
 
-- (void)sendFrame:(NNWebSocketFrame *)frame
+- (BOOL)sendFrame:(NNWebSocketFrame *)frame
 {
-    LogInfo(@"Sending a frame(opcode:%d payload:%d)", frame.opcode, frame.data.length);
-    [_state sendFrame:frame];
+    return [self sendFrame:frame encoded:nil];
+}
+
+- (BOOL)sendFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data
+{
+    BOOL isControlFrame = (frame.opcode & 0x08) > 0;
+    uint64_t reserved = 0;
+    if (!isControlFrame && _optSendBufferLimitBehavior == NNWebSocketSendBufferLimitBehaviorReject) {
+        reserved = frame.data.length;
+        if (![self reserveSendBuffer:reserved]) {
+            LogWarn(@"Rejected a frame because send buffer is full.(%qu bytes)", self.bufferedAmount);
+            return NO;
+        }
+    }
+    [self performBlock:^{
+        LogInfo(@"Sending a frame(opcode:%d payload:%d)", frame.opcode, frame.data.length);
+        // Data frames wait behind a fragmented message in progress as well.
+        BOOL defer = _deferredFrames.count > 0 || (_optSendBufferLimitBehavior == NNWebSocketSendBufferLimitBehaviorDefer && [self exceedsHighWatermark:self.bufferedAmount]);
+        if (!isControlFrame && defer) {
+            LogDebug(@"Deferred a frame until send buffer is drained.");
+            [_deferredFrames addObject:frame];
+            OSAtomicAdd64Barrier((int64_t)frame.data.length, &_deferredAmount);
+        } else if (data) {
+            [_state sendFrame:frame encoded:data];
+        } else {
+            [_state sendFrame:frame];
+        }
+        // The bytes are counted by the transport or the deferred frames from here, or have been dropped.
+        [self releaseSendBuffer:reserved];
+        [self updateSendBufferState];
+    }];
+    return YES;
 }
 
-- (void)sendText:(NSString *)text
+- (BOOL)sendText:(NSString *)text
 {
     NNWebSocketFrame *frame = [NNWebSocketFrame frameText];
     frame.text = text;
-    [self sendFrame:frame];
+    if (_optAutoFragmentThreshold > 0 && frame.data.length > _optAutoFragmentThreshold) {
+        return [self sendFragmenter:[NNWebSocketFragmenter fragmenterWithOpcode:NNWebSocketFrameOpcodeText data:frame.data fragmentLength:_optSendFragmentSize]];
+    }
+    return [self sendFrame:frame];
 }
 
-- (void)sendData:(NSData *)data
+- (BOOL)sendData:(NSData *)data
 {
+    if (_optAutoFragmentThreshold > 0 && data.length > _optAutoFragmentThreshold) {
+        return [self sendFragmenter:[NNWebSocketFragmenter fragmenterWithOpcode:NNWebSocketFrameOpcodeBinary data:data fragmentLength:_optSendFragmentSize]];
+    }
     NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
     frame.data = data;
-    [self sendFrame:frame];
+    return [self sendFrame:frame];
+}
+
+- (BOOL)sendStream:(NSInputStream *)stream opcode:(NNWebSocketFrameOpcode)opcode
+{
+    return [self sendFragmenter:[NNWebSocketFragmenter fragmenterWithOpcode:opcode stream:stream fragmentLength:_optSendFragmentSize]];
+}
+
+- (BOOL)sendMessageWithOpcode:(NNWebSocketFrameOpcode)opcode producer:(NNWebSocketChunkProducer)producer
+{
+    return [self sendFragmenter:[[NNWebSocketFragmenter alloc] initWithOpcode:opcode producer:producer fragmentLength:_optSendFragmentSize]];
+}
+
+- (void)pauseReading
+{
+    [_transport pauseReading];
+}
+
+- (void)resumeReading
+{
+    [_transport resumeReading];
+}
+
+- (uint64_t)bufferedAmount
+{
+    return _transport.bufferedAmount + (uint64_t)OSAtomicAdd64Barrier(0, &_deferredAmount) + (uint64_t)OSAtomicAdd64Barrier(0, &_pendingAmount);
+}
+
+- (NNWebSocketStatistics *)statistics
+{
+    return [[NNWebSocketStatistics alloc] initWithCounters:_counters bufferedAmount:self.bufferedAmount];
+}
+
+- (NNWebSocketTracer *)tracer
+{
+    return _tracer;
 }
 
 #pragma private methods
 
+// State machine is only touched on callback queue.
+- (void)performBlock:(dispatch_block_t)block
+{
+    if (NNIsCurrentQueue(_transport.delegateQueue)) {
+        block();
+    } else {
+        dispatch_async(_transport.delegateQueue, block);
+    }
+}
+
+- (BOOL)sendFragmenter:(NNWebSocketFragmenter *)fragmenter
+{
+    // A fragmented message holds a fragment at least until it starts.
+    uint64_t reserved = 0;
+    if (_optSendBufferLimitBehavior == NNWebSocketSendBufferLimitBehaviorReject) {
+        reserved = fragmenter.fragmentLength;
+        if (![self reserveSendBuffer:reserved]) {
+            LogWarn(@"Rejected a message because send buffer is full.(%qu bytes)", self.bufferedAmount);
+            return NO;
+        }
+    }
+    [self performBlock:^{
+        LogInfo(@"Sending a fragmented message.");
+        [_deferredFrames addObject:fragmenter];
+        [self updateSendBufferState];
+        [self releaseSendBuffer:reserved];
+    }];
+    return YES;
+}
+
+// Keeps two fragments in flight at most, so a fragment is waiting whenever the writer becomes free.
+// No more than two fragments are read per call, since a stream read blocks callback queue. The rest follows
+// as the writes complete.
+// Returns YES when the whole message has been passed to the transport, or has been given up by closing.
+- (BOOL)sendFragmentsOf:(NNWebSocketFragmenter *)fragmenter
+{
+    uint64_t window = 2 * (uint64_t)fragmenter.fragmentLength;
+    for (NSUInteger i=0; i<2 && _transport.bufferedAmount < window; i++) {
+        if (_state != _channelStateOpen) {
+            LogDebug(@"Gave up a fragmented message because connection is not open.");
+            [fragmenter cancel];
+            return YES;
+        }
+        NNWebSocketFrame *frame = [fragmenter nextFrame];
+        if (!frame) {
+            if (fragmenter.error) {
+                LogError(@"Failed to read a message to send.");
+                [self failWithStatus:NNWebSocketStatusGoingAway errorCode:NNWebSocketErrorSendStreamRead];
+            }
+            return YES;
+        }
+        [_state sendFrame:frame];
+        if (frame.fin) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
 - (void)didStartFragmentedFrame:(NNWebSocketFrame *)frame
 {
-    _fragmentedFirstFrame = frame;
+    _fragmentedOpcode = frame.opcode;
     _chunkIndex = 0;
-    _chunkUserInfo = [NSMutableDictionary dictionary];
-    if (frame.opcode == NNWebSocketFrameOpcodeText) {
-       _textBuffer = [NNUTF8Buffer buffer];
-    }
+    _chunkUserInfo = nil;
+    [_textBuffer reset];
+    [_messageBuffer reset];
 }
 
 - (void)didEndFragmentedFrame:(__unused NNWebSocketFrame *)frame
 {
-    if (_fragmentedFirstFrame.opcode == NNWebSocketFrameOpcodeText && _textBuffer.length > 0) {
+    if (_fragmentedOpcode == NNWebSocketFrameOpcodeText && _textBuffer.length > 0) {
         [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData errorCode:NNWebSocketErrorInvalidUTF8String];
         return;
     }
-    _fragmentedFirstFrame = nil;
+    _fragmentedOpcode = NNWebSocketFrameOpcodeContinuation;
     _chunkIndex = 0;
     _chunkUserInfo = nil;
+}
 
+// Created when a chunk listener first needs it, and shared by the chunks of a message.
+- (NSMutableDictionary *)chunkUserInfo
+{
+    if (!_chunkUserInfo) {
+        _chunkUserInfo = [NSMutableDictionary dictionary];
+    }
+    return _chunkUserInfo;
 }
 
 - (void)didReceiveTextFrame:(NNWebSocketFrame *)frame
 {
     NSData *data = frame.data;
-    NSString *text = frame.text;
     if ([frame hasTag:NNWebSocketFrameTagSingleTextDataFrame]) {
-        if (data.length > 0 && text.length == 0) {
+        if (!NNIsValidUTF8(data.bytes, data.length)) {
             [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData errorCode:NNWebSocketErrorInvalidUTF8String];
             return;
         }
-        if (self.onText) self.onText(text);
+        if (self.onText) self.onText(frame.text);
     } else {
         if (![_textBuffer appendData:data]) {
             [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData errorCode:NNWebSocketErrorInvalidUTF8String];
             return;
         }
-        NSString *validUTF8String = [[NSString alloc] initWithData:[_textBuffer removeValidUTF8Portion] encoding:NSUTF8StringEncoding];
+        NSData *validUTF8Data = [_textBuffer removeValidUTF8Portion];
         if (self.onTextChunk) {
-            self.onTextChunk(validUTF8String, _chunkIndex, frame.fin, _chunkUserInfo);
+            NSString *validUTF8String = [[NSString alloc] initWithData:validUTF8Data encoding:NSUTF8StringEncoding];
+            self.onTextChunk(validUTF8String, _chunkIndex, frame.fin, [self chunkUserInfo]);
         }
         _chunkIndex++;
     }
 }
+
+- (void)didReceiveFragment:(NNWebSocketFrame *)frame
+{
+    NSData *data = frame.data;
+    if (_messageBuffer.length + data.length > _optMaxPayloadSize) {
+        if (_optPayloadSizeLimitBehavior == NNWebSocketPayloadSizeLimitBehaviorError) {
+            LogError(@"Reassembled message size is too large.");
+            [self failWithStatus:NNWebSocketStatusMessageTooBig errorCode:NNWebSocketErrorMessageTooBig];
+            return;
+        }
+        if (![self deliverReassembledMessage:NO]) {
+            return;
+        }
+    }
+    [_messageBuffer appendBytes:data.bytes length:data.length];
+    if (frame.fin) {
+        [self deliverReassembledMessage:YES];
+    }
+}
+
+// Delivers the assembled bytes, or a part of them when the message is going to exceed the limit.
+// Text is validated as a whole here. A part ends before an incomplete character, which stays for the next part.
+- (BOOL)deliverReassembledMessage:(BOOL)fin
+{
+    if (_fragmentedOpcode == NNWebSocketFrameOpcodeText) {
+        NSUInteger length = _messageBuffer.length;
+        BOOL valid = fin ? NNIsValidUTF8(_messageBuffer.bytes, length) : NNIsValidUTF8Prefix(_messageBuffer.bytes, length, &length);
+        if (!valid) {
+            [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData errorCode:NNWebSocketErrorInvalidUTF8String];
+            return NO;
+        }
+        if (length == 0 && !fin) {
+            return YES;
+        }
+        NSString *text = self.onText ? [[NSString alloc] initWithBytes:_messageBuffer.bytes length:length encoding:NSUTF8StringEncoding] : nil;
+        [_messageBuffer removeLeadingBytes:length];
+        if (self.onText) self.onText(text);
+    } else {
+        NSData *data = [_messageBuffer takeData];
+        if (self.onData) self.onData(data);
+    }
+    return YES;
+}
+
+- (BOOL)didStartStreamedMessage:(NNWebSocketFrame *)frame
+{
+    if (!_onMessageSink) {
+        return NO;
+    }
+    _messageSink = _onMessageSink(frame.opcode);
+    if (!_messageSink) {
+        return NO;
+    }
+    LogDebug(@"Streaming a message to sink.");
+    _fragmentedOpcode = frame.opcode;
+    [_textBuffer reset];
+    [_messageSink messageDidStartWithOpcode:frame.opcode];
+    return YES;
+}
+
+- (void)didReceiveStreamedFrame:(NNWebSocketFrame *)frame
+{
+    NSData *data = frame.data;
+    if (_fragmentedOpcode == NNWebSocketFrameOpcodeText) {
+        if (![_textBuffer appendData:data]) {
+            [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData errorCode:NNWebSocketErrorInvalidUTF8String];
+            return;
+        }
+        data = [_textBuffer removeValidUTF8Portion];
+    }
+    if (data.length > 0 && ![_messageSink messageDidReceiveData:data]) {
+        LogError(@"Message sink refused data.");
+        [self failWithStatus:NNWebSocketStatusGoingAway errorCode:NNWebSocketErrorMessageSinkWrite];
+        return;
+    }
+    if (frame.fin) {
+        if (_textBuffer.length > 0) {
+            [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData errorCode:NNWebSocketErrorInvalidUTF8String];
+            return;
+        }
+        id<NNWebSocketMessageSink> sink = _messageSink;
+        _messageSink = nil;
+        _fragmentedOpcode = NNWebSocketFrameOpcodeContinuation;
+        [sink messageDidEndWithError:nil];
+    }
+}
+
+- (void)endMessageSinkWithError:(NSError *)error
+{
+    if (!_messageSink) {
+        return;
+    }
+    id<NNWebSocketMessageSink> sink = _messageSink;
+    _messageSink = nil;
+    _fragmentedOpcode = NNWebSocketFrameOpcodeContinuation;
+    [_textBuffer reset];
+    [sink messageDidEndWithError:error ?: [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorMessageSinkInterrupted userInfo:nil]];
+}
+
 - (void)didReceiveBinaryFrame:(NNWebSocketFrame *)frame
 {
     if ([frame hasTag:NNWebSocketFrameTagSingleBinaryDataFrame]) {
         if (self.onData) self.onData(frame.data);
     } else {
         if (self.onDataChunk) {
-            self.onDataChunk(frame.data, _chunkIndex, frame.fin, _chunkUserInfo);
+            self.onDataChunk(frame.data, _chunkIndex, frame.fin, [self chunkUserInfo]);
         }
         _chunkIndex++;
     }
 }
 
+// Amount is the bytes buffered ahead of a data frame. High watermark itself is still within the limit.
+- (BOOL)exceedsHighWatermark:(uint64_t)amount
+{
+    return amount > _optSendBufferHighWatermark;
+}
+
+// Checks high watermark and reserves 'length' bytes in one step, so that senders on other threads
+// cannot pass the check together before their frames reach the callback queue.
+- (BOOL)reserveSendBuffer:(uint64_t)length
+{
+    int64_t pending;
+    do {
+        pending = _pendingAmount;
+        uint64_t amount = _transport.bufferedAmount + (uint64_t)OSAtomicAdd64Barrier(0, &_deferredAmount) + (uint64_t)pending;
+        if ([self exceedsHighWatermark:amount]) {
+            return NO;
+        }
+    } while (!OSAtomicCompareAndSwap64Barrier(pending, pending + (int64_t)length, &_pendingAmount));
+    return YES;
+}
+
+- (void)releaseSendBuffer:(uint64_t)length
+{
+    if (length > 0) {
+        OSAtomicAdd64Barrier(-(int64_t)length, &_pendingAmount);
+    }
+}
+
+// Sends deferred frames while the transport is within high watermark, then notifies watermark crossings.
+- (void)updateSendBufferState
+{
+    while (_deferredFrames.count > 0) {
+        id item = [_deferredFrames objectAtIndex:0];
+        if ([item isKindOfClass:[NNWebSocketFragmenter class]]) {
+            if (_state != _channelStateOpen || ![self sendFragmentsOf:item]) {
+                break;
+            }
+            if (_deferredFrames.count > 0 && [_deferredFrames objectAtIndex:0] == item) {
+                [_deferredFrames removeObjectAtIndex:0];
+            }
+            continue;
+        }
+        // Bytes ahead of the first deferred frame are those in the transport.
+        if (_optSendBufferLimitBehavior == NNWebSocketSendBufferLimitBehaviorDefer && [self exceedsHighWatermark:_transport.bufferedAmount]) {
+            break;
+        }
+        NNWebSocketFrame *frame = item;
+        [_deferredFrames removeObjectAtIndex:0];
+        OSAtomicAdd64Barrier(-(int64_t)frame.data.length, &_deferredAmount);
+        [_state sendFrame:frame];
+    }
+    uint64_t amount = self.bufferedAmount;
+    if (!_backpressured && [self exceedsHighWatermark:amount]) {
+        LogDebug(@"Send buffer exceeded high watermark.(%qu bytes)", amount);
+        _backpressured = YES;
+        if (_onBackpressure) _onBackpressure(amount);
+    } else if (_backpressured && amount <= _optSendBufferLowWatermark) {
+        LogDebug(@"Send buffer fell to low watermark.(%qu bytes)", amount);
+        _backpressured = NO;
+        if (_onWritable) _onWritable(amount);
+    }
+}
+
+- (void)discardDeferredFrames
+{
+    for (id item in _deferredFrames) {
+        if ([item isKindOfClass:[NNWebSocketFragmenter class]]) {
+            [item cancel];
+        }
+    }
+    [_deferredFrames removeAllObjects];
+    int64_t current;
+    do {
+        current = _deferredAmount;
+    } while (!OSAtomicCompareAndSwap64Barrier(current, 0, &_deferredAmount));
+    _backpressured = NO;
+}
+
+- (void)scheduleStatistics
+{
+    if (_optStatisticsInterval <= 0) {
+        return;
+    }
+    __weak NNWebSocketClientRFC6455 *weakSelf = self;
+    NNTimingWheel *timingWheel = [NNTimingWheel sharedWheelWithResolution:_options.timerResolutionSec];
+    _statisticsTimer = [timingWheel scheduleTimeout:_optStatisticsInterval queue:self.callbackQueue block:^{
+        NNWebSocketClientRFC6455 *client = weakSelf;
+        if (!client || !client->_statisticsTimer) {
+            return;
+        }
+        if (client->_onStatistics) client->_onStatistics(client.statistics);
+        [client scheduleStatistics];
+    }];
+}
+
+- (void)stopStatistics
+{
+    [_statisticsTimer cancel];
+    _statisticsTimer = nil;
+}
+
 - (void)failWithStatus:(NNWebSocketStatus)status errorCode:(NNWebSocketError)code
 {
     NSError* error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:code userInfo:nil];
+    [self endMessageSinkWithError:error];
     [_state closeWithStatus:status error:error];
 }
 
@@ -182,13 +602,27 @@
 {
     NNWebSocketState *from = _state;
     LogInfo(@"State(%@ -> %@)", from.name, to.name);
+    NNTrace(_tracer, NNWebSocketTraceEventStateChanged, [self traceIdOfState:from], [self traceIdOfState:to]);
     [from didExit];
     _state = to;
     [to didEnter];
 }
 
+- (int64_t)traceIdOfState:(NNWebSocketState *)state
+{
+    if (state == _channelStateConnecting) return 1;
+    if (state == _channelStateOpen) return 2;
+    if (state == _channelStateClosing) return 3;
+    return 0;
+}
+
 #pragma mark NNWebSocketStateContext
 
+- (dispatch_queue_t)callbackQueue
+{
+    return _transport.delegateQueue;
+}
+
 - (void)performOpeningHandshaking
 {
     [self changeState:_channelStateConnecting];
@@ -206,15 +640,28 @@
     } else {
         LogError(@"Failed to connect.");
     }
+    [self discardDeferredFrames];
+    [_counters setCloseStatus:NNWebSocketStatusAbnormalClosure error:error];
     [self changeState:_channelStateClosed];
     if (_onOpenFailed) _onOpenFailed(error);
+    [_server connectionDidClose:self];
 }
 
 - (void)didOpen
 {
+    // A message left unfinished by the previous connection is forgotten.
+    _fragmentedOpcode = NNWebSocketFrameOpcodeContinuation;
+    _chunkIndex = 0;
+    _chunkUserInfo = nil;
+    [_messageBuffer reset];
     [self changeState:_channelStateOpen];
     LogInfo(@"Websocket is opened.");
+    [self scheduleStatistics];
+    // Listeners of an accepted connection are set by the server's onConnection.
+    [_server connectionDidOpen:self];
     if (_onOpen) _onOpen();
+    // Starts messages which have been queued while connecting.
+    [self updateSendBufferState];
 }
 
 - (void)didReceiveFrame:(NNWebSocketFrame *)frame
@@ -227,52 +674,36 @@
         pong.data = frame.data;
         [self sendFrame:pong];
     }
-    // Tagging
-    NNWebSocketFrameTag tags = (NNWebSocketFrameTag)0;
-    if (opcode == NNWebSocketFrameOpcodeText) {
-        tags |= NNWebSocketFrameTagTextDataFrame;
-        if (frame.fin) {
-            tags |= NNWebSocketFrameTagSingleTextDataFrame;
-        } else {
-            tags |= NNWebSocketFrameTagFragmentedTextDataFrame;
-        }
-    } else if (opcode == NNWebSocketFrameOpcodeBinary) {
-        tags |= NNWebSocketFrameTagBinaryDataFrame;
-        if (frame.fin) {
-            tags |= NNWebSocketFrameTagSingleBinaryDataFrame;
-        } else {
-            tags |= NNWebSocketFrameTagFragmentedBinaryDataFrame;
-        }
-    } else if (opcode == NNWebSocketFrameOpcodeContinuation) {
-        if (_fragmentedFirstFrame) {
-            NNWebSocketFrameOpcode firstOpcode = _fragmentedFirstFrame.opcode;
-            if (firstOpcode == NNWebSocketFrameOpcodeText) {
-                tags |= NNWebSocketFrameTagTextDataFrame;
-                tags |= NNWebSocketFrameTagFragmentedTextDataFrame;
-            } else if (firstOpcode == NNWebSocketFrameOpcodeBinary) {
-                tags |= NNWebSocketFrameTagBinaryDataFrame;
-                tags |= NNWebSocketFrameTagFragmentedBinaryDataFrame;
-            }
-        }
-    }
-    [frame addTags:tags];
-    if ([frame hasTag:NNWebSocketFrameTagDataFrame]) {
-        if (!_fragmentedFirstFrame && opcode == NNWebSocketFrameOpcodeContinuation) {
+    // Message type has been tagged by the parser.
+    NNWebSocketFrameTag tags = frame.tags;
+    if (tags & NNWebSocketFrameTagDataFrame) {
+        BOOL fragmented = _fragmentedOpcode != NNWebSocketFrameOpcodeContinuation;
+        if (!fragmented && opcode == NNWebSocketFrameOpcodeContinuation) {
             LogError(@"Detected invalid headless continuation frame.");
             [self failWithStatus:NNWebSocketStatusProtocolError errorCode:NNWebSocketErrorHeadlessContinuationFrame];
             return;
         }
-        if (_fragmentedFirstFrame && frame.fin && opcode != NNWebSocketFrameOpcodeContinuation) {
+        if (fragmented && frame.fin && opcode != NNWebSocketFrameOpcodeContinuation) {
             LogError(@"Detected lack of termination of conitinucation frames.");
             [self failWithStatus:NNWebSocketStatusProtocolError errorCode:NNWebSocketErrorLackOfContinuationFrameTermination];
             return;
         }
+        if (opcode != NNWebSocketFrameOpcodeContinuation && (tags & NNWebSocketFrameTagStreamedDataFrame)) {
+            [self didStartStreamedMessage:frame];
+        }
+        if (_messageSink) {
+            [self didReceiveStreamedFrame:frame];
+            if (self.onFrame) self.onFrame(frame);
+            return;
+        }
         if  (opcode != NNWebSocketFrameOpcodeContinuation && !frame.fin) {
             [self didStartFragmentedFrame:frame];
         }
-        if ([frame hasTag:NNWebSocketFrameTagTextDataFrame]) {
+        if (_messageBuffer && (tags & (NNWebSocketFrameTagFragmentedTextDataFrame | NNWebSocketFrameTagFragmentedBinaryDataFrame))) {
+            [self didReceiveFragment:frame];
+        } else if (tags & NNWebSocketFrameTagTextDataFrame) {
             [self didReceiveTextFrame:frame];
-        } else if ([frame hasTag:NNWebSocketFrameTagBinaryDataFrame]) {
+        } else if (tags & NNWebSocketFrameTagBinaryDataFrame) {
             [self didReceiveBinaryFrame:frame];
         }
         if (self.onFrame) self.onFrame(frame);
@@ -286,31 +717,66 @@
 
 - (void)didClose
 {
+    [self endMessageSinkWithError:self.error];
+    [self discardDeferredFrames];
+    [_counters setCloseStatus:self.status error:self.error];
     [self changeState:_channelStateClosed];
     LogInfo(@"Websocket is closed by %@ with status %d.", _closureType == NNWebSocketClosureTypeServerInitiated ? @"server" : @"client", self.status);
+    if (_statisticsTimer) {
+        [self stopStatistics];
+        if (_onStatistics) _onStatistics(self.statistics);
+    }
     if (_onClose) _onClose(self.status, self.error);
+    [_server connectionDidClose:self];
 }
 
 #pragma mark NNWebSocketTransportDelegate
 
-- (void)transportDidConnect:(NNWebSocketTransport *)transport
+- (void)transportDidConnect:(id<NNWebSocketTransport>)transport
 {
     [_state transportDidConnect:transport];
 }
 
-- (void)transportDidDisconnect:(NNWebSocketTransport *)transport error:(NSError *)error
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error
 {
     [_state transportDidDisconnect:transport error:error];
 }
 
-- (void)transport:(NNWebSocketTransport *)transport didReadData:(NSData *)data tag:(long)tag
+- (void)transport:(id<NNWebSocketTransport>)transport didReadData:(NSData *)data tag:(long)tag
 {
     [_state transport:transport didReadData:data tag:tag];
 }
 
-- (void)transport:(NNWebSocketTransport *)transport didWriteDataWithTag:(long)tag
+- (void)transport:(id<NNWebSocketTransport>)transport didReadFrames:(NSArray *)frames
+{
+    // Each frame goes to the state at that time, since a frame in the batch may change the state.
+    if (_tracer->active) {
+        for (NNWebSocketFrame *frame in frames) {
+            NNTracerRecord(_tracer, NNWebSocketTraceEventListenerBegin, frame.opcode, frame.data.length);
+            [_state transport:transport didReadFrame:frame];
+            NNTracerRecord(_tracer, NNWebSocketTraceEventListenerEnd, frame.opcode, frame.data.length);
+        }
+    } else {
+        for (NNWebSocketFrame *frame in frames) {
+            [_state transport:transport didReadFrame:frame];
+        }
+    }
+    if (_framePool) {
+        for (NNWebSocketFrame *frame in frames) {
+            [_framePool recycleFrame:frame];
+        }
+    }
+}
+
+- (void)transport:(id<NNWebSocketTransport>)transport didFailToReadFrameWithStatus:(NNWebSocketStatus)status error:(NSError *)error
+{
+    [_state transport:transport didFailToReadFrameWithStatus:status error:error];
+}
+
+- (void)transport:(id<NNWebSocketTransport>)transport didWriteDataWithTag:(long)tag
 {
     [_state transport:transport didWriteDataWithTag:tag];
+    [self updateSendBufferState];
 }
 
 @end
\ No newline at end of file
@@ -19,6 +19,17 @@ typedef NS_ENUM(NSUInteger, NNWebSocketPayloadSizeLimitBehavior) {
     NNWebSocketPayloadSizeLimitBehaviorSplit,
 };
 
+typedef NS_ENUM(NSUInteger, NNWebSocketSendBufferLimitBehavior) {
+    NNWebSocketSendBufferLimitBehaviorNone,
+    NNWebSocketSendBufferLimitBehaviorReject,
+    NNWebSocketSendBufferLimitBehaviorDefer,
+};
+
+typedef NS_ENUM(NSUInteger, NNWebSocketTransportType) {
+    NNWebSocketTransportTypeStream,
+    NNWebSocketTransportTypeSocket,
+};
+
 typedef NSUInteger NNWebSocketStatus;
 static const NNWebSocketStatus NNWebSocketStatusNormalEnd = 1000;
 static const NNWebSocketStatus NNWebSocketStatusGoingAway = 1001;
@@ -42,22 +53,34 @@ typedef NS_ENUM(NSUInteger, NNWebSocketError) {
     NNWebSocketErrorHttpResponseHeaderConnection,
     NNWebSocketErrorHttpResponseHeaderWebSocketAccept,
     NNWebSocketErrorCloseTimeout,
+    NNWebSocketErrorHttpResponseHeaderWebSocketExtensions,
+    NNWebSocketErrorPongTimeout,
+    NNWebSocketErrorHttpRequestHeader,
+    NNWebSocketErrorHttpHeaderTooLarge,
     // 2xx: websocket frame format error
     NNWebSocketErrorReceiveFrameMask = 200,
     NNWebSocketErrorControlFramePayloadSize,
     NNWebSocketErrorInvalidRsvBit,
     NNWebSocketErrorControlFrameFin,
     NNWebSocketErrorInvalidUTF8String,
+    NNWebSocketErrorInvalidCompressedData,
+    NNWebSocketErrorReceiveFrameUnmasked,
     // 3xx: websocket framing error
     NNWebSocketErrorUnkownControlFrameType = 300,
     NNWebSocketErrorUnkownDataFrameType,
     NNWebSocketErrorHeadlessContinuationFrame,
     NNWebSocketErrorLackOfContinuationFrameTermination,
+    NNWebSocketErrorMessageTooBig,
     // 4xx: transport error
     NNWebSocketErrorConnectTimeout = 400,
     NNWebSocketErrorReadTimeout,
     NNWebSocketErrorWriteTimeout,
     NNWebSocketErrorKeepWorkingOnBackground,
+    NNWebSocketErrorResolveHost,
+    // 5xx: streaming error
+    NNWebSocketErrorMessageSinkWrite = 500,
+    NNWebSocketErrorMessageSinkInterrupted,
+    NNWebSocketErrorSendStreamRead,
 };
 
 typedef NS_ENUM(NSUInteger, NNWebSocketFrameOpcode)
@@ -0,0 +1,62 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+@class NNWebSocketOptions;
+
+// ================================================================
+// NNWebSocketDeflateExtension
+// ================================================================
+// permessage-deflate(RFC 7692) parameters agreed in opening handshake.
+@interface NNWebSocketDeflateExtension : NSObject
+
+@property(readonly, nonatomic) NSUInteger clientMaxWindowBits;
+@property(readonly, nonatomic) NSUInteger serverMaxWindowBits;
+@property(readonly, nonatomic) BOOL clientNoContextTakeover;
+@property(readonly, nonatomic) BOOL serverNoContextTakeover;
+
+// Value of Sec-WebSocket-Extensions header which offers the extension.
++ (NSString *)offerWithOptions:(NNWebSocketOptions *)options;
+// Returns nil when the response does not accept what has been offered.
+- (id)initWithResponse:(NSString *)response options:(NNWebSocketOptions *)options;
+
+@end
+
+// ================================================================
+// NNWebSocketDeflater
+// ================================================================
+@interface NNWebSocketDeflater : NSObject
+
+- (id)initWithWindowBits:(NSUInteger)windowBits noContextTakeover:(BOOL)noContextTakeover;
+// Compresses a part of message. Parts can be sent as fragments of the compressed message as they are.
+- (NSData *)deflateData:(NSData *)data fin:(BOOL)fin;
+
+@end
+
+// ================================================================
+// NNWebSocketInflater
+// ================================================================
+// Always inflates with the largest window, which decodes data compressed with any smaller one.
+@interface NNWebSocketInflater : NSObject
+
+- (id)initWithNoContextTakeover:(BOOL)noContextTakeover;
+// Decompresses a part of message into chunks of 'maxChunkLength' bytes at most. Returns NO on corrupted data.
+- (BOOL)inflateData:(NSData *)data fin:(BOOL)fin maxChunkLength:(NSUInteger)maxChunkLength chunks:(NSMutableArray *)chunks;
+// Given 'overflowed', inflating stops as soon as the output exceeds one chunk and *overflowed is set to YES,
+// so that a message which is too large is rejected without decompressing the rest of it.
+- (BOOL)inflateData:(NSData *)data fin:(BOOL)fin maxChunkLength:(NSUInteger)maxChunkLength chunks:(NSMutableArray *)chunks overflowed:(BOOL *)overflowed;
+
+@end
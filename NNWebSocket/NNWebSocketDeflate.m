@@ -0,0 +1,304 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketDeflate.h"
+#import "NNWebSocketOptions.h"
+#import <zlib.h>
+
+#define EXTENSION_NAME @"permessage-deflate"
+#define MIN_WINDOW_BITS 8
+#define MAX_WINDOW_BITS 15
+#define MIN_INFLATE_CHUNK_LENGTH 4096
+
+// Empty stored block which Z_SYNC_FLUSH emits. It is removed from the end of each compressed message.
+static const uint8_t kDeflateTail[4] = {0x00, 0x00, 0xff, 0xff};
+
+static NSUInteger ClampWindowBits(NSUInteger bits)
+{
+    return MAX(MIN_WINDOW_BITS, MIN(MAX_WINDOW_BITS, bits));
+}
+
+// ================================================================
+// NNWebSocketDeflateExtension
+// ================================================================
+@implementation NNWebSocketDeflateExtension
+
++ (NSString *)offerWithOptions:(NNWebSocketOptions *)options
+{
+    NSMutableString *offer = [NSMutableString stringWithString:EXTENSION_NAME];
+    NSUInteger clientBits = ClampWindowBits(options.deflateClientMaxWindowBits);
+    NSUInteger serverBits = ClampWindowBits(options.deflateServerMaxWindowBits);
+    if (clientBits < MAX_WINDOW_BITS) {
+        [offer appendFormat:@"; client_max_window_bits=%lu", (unsigned long)clientBits];
+    } else {
+        [offer appendString:@"; client_max_window_bits"];
+    }
+    if (serverBits < MAX_WINDOW_BITS) {
+        [offer appendFormat:@"; server_max_window_bits=%lu", (unsigned long)serverBits];
+    }
+    if (options.deflateClientNoContextTakeover) {
+        [offer appendString:@"; client_no_context_takeover"];
+    }
+    if (options.deflateServerNoContextTakeover) {
+        [offer appendString:@"; server_no_context_takeover"];
+    }
+    return offer;
+}
+
+- (id)initWithResponse:(NSString *)response options:(NNWebSocketOptions *)options
+{
+    self = [super init];
+    if (self) {
+        _clientMaxWindowBits = ClampWindowBits(options.deflateClientMaxWindowBits);
+        _serverMaxWindowBits = MAX_WINDOW_BITS;
+        _clientNoContextTakeover = options.deflateClientNoContextTakeover;
+        _serverNoContextTakeover = NO;
+        NSCharacterSet *ws = [NSCharacterSet whitespaceCharacterSet];
+        NSArray *extensions = [response componentsSeparatedByString:@","];
+        // Only one extension has been offered, so it must be the only one accepted.
+        if (extensions.count != 1) {
+            return nil;
+        }
+        NSArray *params = [[extensions objectAtIndex:0] componentsSeparatedByString:@";"];
+        if (![[[params objectAtIndex:0] stringByTrimmingCharactersInSet:ws] isEqualToString:EXTENSION_NAME]) {
+            return nil;
+        }
+        NSMutableSet *seen = [NSMutableSet set];
+        for (NSUInteger i=1; i<params.count; i++) {
+            NSString *param = [[params objectAtIndex:i] stringByTrimmingCharactersInSet:ws];
+            NSString *name = param;
+            NSString *value = nil;
+            NSRange eq = [param rangeOfString:@"="];
+            if (eq.location != NSNotFound) {
+                name = [[param substringToIndex:eq.location] stringByTrimmingCharactersInSet:ws];
+                value = [[param substringFromIndex:eq.location + 1] stringByTrimmingCharactersInSet:ws];
+                value = [value stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"\""]];
+            }
+            if ([seen containsObject:name]) {
+                return nil;
+            }
+            [seen addObject:name];
+            if ([name isEqualToString:@"server_no_context_takeover"] && !value) {
+                _serverNoContextTakeover = YES;
+            } else if ([name isEqualToString:@"client_no_context_takeover"] && !value) {
+                _clientNoContextTakeover = YES;
+            } else if ([name isEqualToString:@"server_max_window_bits"]) {
+                NSInteger bits = [self windowBitsFromValue:value];
+                if (bits < 0 || (NSUInteger)bits > ClampWindowBits(options.deflateServerMaxWindowBits)) {
+                    return nil;
+                }
+                _serverMaxWindowBits = (NSUInteger)bits;
+            } else if ([name isEqualToString:@"client_max_window_bits"]) {
+                NSInteger bits = [self windowBitsFromValue:value];
+                if (bits < 0) {
+                    return nil;
+                }
+                _clientMaxWindowBits = MIN(_clientMaxWindowBits, (NSUInteger)bits);
+            } else {
+                return nil;
+            }
+        }
+    }
+    return self;
+}
+
+- (NSInteger)windowBitsFromValue:(NSString *)value
+{
+    if (value.length == 0 || value.length > 2) {
+        return -1;
+    }
+    NSCharacterSet *nonDigits = [[NSCharacterSet decimalDigitCharacterSet] invertedSet];
+    if ([value rangeOfCharacterFromSet:nonDigits].location != NSNotFound) {
+        return -1;
+    }
+    NSInteger bits = [value integerValue];
+    return (bits < MIN_WINDOW_BITS || bits > MAX_WINDOW_BITS) ? -1 : bits;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketDeflater
+// ================================================================
+@implementation NNWebSocketDeflater
+{
+    z_stream _stream;
+    BOOL _noContextTakeover;
+}
+
+- (id)initWithWindowBits:(NSUInteger)windowBits noContextTakeover:(BOOL)noContextTakeover
+{
+    self = [super init];
+    if (self) {
+        // zlib does not support 8 bits window for raw deflate. 9 bits window never refers farther than 256 bytes.
+        int bits = (int)MAX(9, ClampWindowBits(windowBits));
+        if (deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return nil;
+        }
+        _noContextTakeover = noContextTakeover;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    deflateEnd(&_stream);
+}
+
+- (NSData *)deflateData:(NSData *)data fin:(BOOL)fin
+{
+    NSMutableData *output = [NSMutableData dataWithLength:deflateBound(&_stream, (uLong)data.length) + 8];
+    NSUInteger outputLength = 0;
+    _stream.next_in = (Bytef *)data.bytes;
+    _stream.avail_in = (uInt)data.length;
+    do {
+        if (outputLength == output.length) {
+            [output setLength:output.length * 2];
+        }
+        _stream.next_out = (Bytef *)output.mutableBytes + outputLength;
+        _stream.avail_out = (uInt)(output.length - outputLength);
+        deflate(&_stream, Z_SYNC_FLUSH);
+        outputLength = output.length - _stream.avail_out;
+    } while (_stream.avail_out == 0);
+    if (fin) {
+        if (outputLength >= sizeof(kDeflateTail) && memcmp((const uint8_t *)output.bytes + outputLength - sizeof(kDeflateTail), kDeflateTail, sizeof(kDeflateTail)) == 0) {
+            outputLength -= sizeof(kDeflateTail);
+        }
+        if (outputLength == 0) {
+            // Empty stored block, which is the smallest message RFC 7692 allows.
+            outputLength = 1;
+            ((uint8_t *)output.mutableBytes)[0] = 0x00;
+        }
+        if (_noContextTakeover) {
+            deflateReset(&_stream);
+        }
+    }
+    [output setLength:outputLength];
+    return output;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketInflater
+// ================================================================
+@implementation NNWebSocketInflater
+{
+    z_stream _stream;
+    BOOL _noContextTakeover;
+    NSMutableData *_chunk;
+    NSUInteger _chunkLength;
+    BOOL _overflowed;
+}
+
+- (id)initWithNoContextTakeover:(BOOL)noContextTakeover
+{
+    self = [super init];
+    if (self) {
+        if (inflateInit2(&_stream, -MAX_WINDOW_BITS) != Z_OK) {
+            return nil;
+        }
+        _noContextTakeover = noContextTakeover;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    inflateEnd(&_stream);
+}
+
+- (BOOL)inflateData:(NSData *)data fin:(BOOL)fin maxChunkLength:(NSUInteger)maxChunkLength chunks:(NSMutableArray *)chunks
+{
+    return [self inflateData:data fin:fin maxChunkLength:maxChunkLength chunks:chunks overflowed:NULL];
+}
+
+- (BOOL)inflateData:(NSData *)data fin:(BOOL)fin maxChunkLength:(NSUInteger)maxChunkLength chunks:(NSMutableArray *)chunks overflowed:(BOOL *)overflowed
+{
+    maxChunkLength = MAX((NSUInteger)1, maxChunkLength);
+    BOOL singleChunk = overflowed != NULL;
+    _overflowed = NO;
+    BOOL result = [self inflateBytes:data.bytes length:data.length maxChunkLength:maxChunkLength singleChunk:singleChunk chunks:chunks];
+    if (result && fin && !_overflowed) {
+        result = [self inflateBytes:kDeflateTail length:sizeof(kDeflateTail) maxChunkLength:maxChunkLength singleChunk:singleChunk chunks:chunks];
+        if (_noContextTakeover) {
+            inflateReset(&_stream);
+        }
+    }
+    if (result && !_overflowed && _chunkLength > 0) {
+        [_chunk setLength:_chunkLength];
+        [chunks addObject:_chunk];
+    }
+    if (overflowed) {
+        *overflowed = _overflowed;
+    }
+    _chunk = nil;
+    _chunkLength = 0;
+    return result;
+}
+
+- (BOOL)inflateBytes:(const uint8_t *)bytes length:(NSUInteger)length maxChunkLength:(NSUInteger)maxChunkLength singleChunk:(BOOL)singleChunk chunks:(NSMutableArray *)chunks
+{
+    _stream.next_in = (Bytef *)bytes;
+    _stream.avail_in = (uInt)length;
+    while (YES) {
+        if (!_chunk) {
+            _chunk = [NSMutableData dataWithLength:MIN(maxChunkLength, MAX(length * 4, (NSUInteger)MIN_INFLATE_CHUNK_LENGTH))];
+            _chunkLength = 0;
+        }
+        if (_chunkLength == _chunk.length) {
+            if (_chunk.length == maxChunkLength) {
+                if (singleChunk) {
+                    // Full chunk may be the whole output. Inflating a byte more tells whether it is not.
+                    uint8_t probe;
+                    _stream.next_out = &probe;
+                    _stream.avail_out = 1;
+                    int ret = inflate(&_stream, Z_SYNC_FLUSH);
+                    if (_stream.avail_out == 0) {
+                        _overflowed = YES;
+                        return YES;
+                    }
+                    if (ret == Z_STREAM_END) {
+                        inflateReset(&_stream);
+                    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                        return NO;
+                    }
+                    if (_stream.avail_in == 0 || ret == Z_BUF_ERROR) {
+                        return YES;
+                    }
+                    continue;
+                }
+                [chunks addObject:_chunk];
+                _chunk = nil;
+                continue;
+            }
+            [_chunk setLength:MIN(maxChunkLength, _chunk.length * 2)];
+        }
+        _stream.next_out = (Bytef *)_chunk.mutableBytes + _chunkLength;
+        _stream.avail_out = (uInt)(_chunk.length - _chunkLength);
+        int ret = inflate(&_stream, Z_SYNC_FLUSH);
+        _chunkLength = _chunk.length - _stream.avail_out;
+        if (ret == Z_STREAM_END) {
+            // The sender has finished the deflate stream with BFINAL. Next message starts a new one.
+            inflateReset(&_stream);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return NO;
+        }
+        if (_stream.avail_in == 0 && _stream.avail_out > 0) {
+            return YES;
+        }
+    }
+}
+
+@end
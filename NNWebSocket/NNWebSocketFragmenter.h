@@ -0,0 +1,35 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+@class NNWebSocketFrame;
+
+// Splits a message into fragment frames as they are requested, so that the message is never held at once.
+// One chunk is read ahead to know which fragment is final.
+@interface NNWebSocketFragmenter : NSObject
+
+@property(readonly, nonatomic) NSUInteger fragmentLength;
+// Set when the input stream fails. No more frames are returned then.
+@property(readonly, nonatomic) NSError *error;
+
++ (instancetype)fragmenterWithOpcode:(NNWebSocketFrameOpcode)opcode data:(NSData *)data fragmentLength:(NSUInteger)fragmentLength;
++ (instancetype)fragmenterWithOpcode:(NNWebSocketFrameOpcode)opcode stream:(NSInputStream *)stream fragmentLength:(NSUInteger)fragmentLength;
+- (id)initWithOpcode:(NNWebSocketFrameOpcode)opcode producer:(NSData *(^)(NSUInteger maxLength))producer fragmentLength:(NSUInteger)fragmentLength;
+// Returns nil after the final fragment.
+- (NNWebSocketFrame *)nextFrame;
+- (void)cancel;
+
+@end
@@ -0,0 +1,116 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketFragmenter.h"
+#import "NNWebSocketFrame.h"
+#import "NNUtils.h"
+
+@implementation NNWebSocketFragmenter
+{
+    NNWebSocketFrameOpcode _opcode;
+    NSData *(^_producer)(NSUInteger maxLength);
+    NSInputStream *_stream;
+    NSData *_lookahead;
+    BOOL _started;
+    BOOL _finished;
+}
+
++ (instancetype)fragmenterWithOpcode:(NNWebSocketFrameOpcode)opcode data:(NSData *)data fragmentLength:(NSUInteger)fragmentLength
+{
+    __block NSUInteger offset = 0;
+    return [[self alloc] initWithOpcode:opcode producer:^NSData *(NSUInteger maxLength) {
+        if (offset >= data.length) {
+            return nil;
+        }
+        NSUInteger len = MIN(maxLength, data.length - offset);
+        // The message is kept until the last fragment anyway, so its fragments always refer to it.
+        NSData *chunk = [[NNDataSlice alloc] initWithOwner:data bytes:(const uint8_t *)data.bytes + offset length:len];
+        offset += len;
+        return chunk;
+    } fragmentLength:fragmentLength];
+}
+
++ (instancetype)fragmenterWithOpcode:(NNWebSocketFrameOpcode)opcode stream:(NSInputStream *)stream fragmentLength:(NSUInteger)fragmentLength
+{
+    NNWebSocketFragmenter *fragmenter = [[self alloc] initWithOpcode:opcode producer:nil fragmentLength:fragmentLength];
+    fragmenter->_stream = stream;
+    return fragmenter;
+}
+
+- (id)initWithOpcode:(NNWebSocketFrameOpcode)opcode producer:(NSData *(^)(NSUInteger maxLength))producer fragmentLength:(NSUInteger)fragmentLength
+{
+    self = [super init];
+    if (self) {
+        _opcode = opcode;
+        _producer = [producer copy];
+        _fragmentLength = MAX((NSUInteger)1, fragmentLength);
+    }
+    return self;
+}
+
+- (NNWebSocketFrame *)nextFrame
+{
+    if (_finished) {
+        return nil;
+    }
+    NSData *chunk = _started ? _lookahead : [self readChunk];
+    NSData *next = chunk && !_error ? [self readChunk] : nil;
+    if (_error) {
+        [self cancel];
+        return nil;
+    }
+    _lookahead = next;
+    BOOL fin = next == nil;
+    NNWebSocketFrameOpcode opcode = _started ? NNWebSocketFrameOpcodeContinuation : _opcode;
+    _started = YES;
+    if (fin) {
+        [self cancel];
+    }
+    return [[NNWebSocketFrame alloc] initWithOpcode:opcode fin:fin payload:chunk ?: [NSData data]];
+}
+
+- (void)cancel
+{
+    _finished = YES;
+    _lookahead = nil;
+    _producer = nil;
+    if (_stream) {
+        [_stream close];
+        _stream = nil;
+    }
+}
+
+- (NSData *)readChunk
+{
+    if (_producer) {
+        NSData *chunk = _producer(_fragmentLength);
+        return chunk.length > 0 ? chunk : nil;
+    }
+    if (_stream.streamStatus == NSStreamStatusNotOpen) {
+        [_stream open];
+    }
+    NSMutableData *chunk = [NSMutableData dataWithLength:_fragmentLength];
+    NSInteger len = [_stream read:chunk.mutableBytes maxLength:_fragmentLength];
+    if (len < 0) {
+        _error = _stream.streamError ?: [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorSendStreamRead userInfo:nil];
+        return nil;
+    }
+    if (len == 0) {
+        return nil;
+    }
+    [chunk setLength:(NSUInteger)len];
+    return chunk;
+}
+
+@end
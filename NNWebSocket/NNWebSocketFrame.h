@@ -26,6 +26,18 @@ typedef NS_OPTIONS(NSUInteger, NNWebSocketFrameTag)
     NNWebSocketFrameTagSingleBinaryDataFrame = 1 << 5,
     NNWebSocketFrameTagFragmentedTextDataFrame = 1 << 6,
     NNWebSocketFrameTagFragmentedBinaryDataFrame = 1 << 7,
+    NNWebSocketFrameTagStreamedDataFrame = 1 << 8,
+};
+
+typedef NS_ENUM(NSUInteger, NNWebSocketFrameMask)
+{
+    NNWebSocketFrameMaskFin = 0x80,
+    NNWebSocketFrameMaskRsv1 = 0x40,
+    NNWebSocketFrameMaskRsv2 = 0x20,
+    NNWebSocketFrameMaskRsv3 = 0x10,
+    NNWebSocketFrameMaskOpcode = 0x0f,
+    NNWebSocketFrameMaskMask = 0x80,
+    NNWebSocketFrameMaskPayloadLength = 0x7f
 };
 
 @interface NNWebSocketFrame : NSObject
@@ -33,7 +45,9 @@ typedef NS_OPTIONS(NSUInteger, NNWebSocketFrameTag)
 @property(nonatomic) BOOL fin;
 @property(readonly, nonatomic) NNWebSocketFrameOpcode opcode;
 @property(nonatomic) NSData *data;
+// Decoded from data on first access and cached.
 @property(nonatomic) NSString *text;
+@property(readonly, nonatomic) NNWebSocketFrameTag tags;
 
 + (id)frameText;
 + (id)frameBinary;
@@ -46,4 +60,15 @@ typedef NS_OPTIONS(NSUInteger, NNWebSocketFrameTag)
 - (BOOL)hasTag:(NNWebSocketFrameTag)tag;
 - (NSData *)data;
 
+@end
+
+// Keeps received frames for reuse. Frames are taken on the io queue and given back on the callback queue
+// once listeners have returned.
+@interface NNWebSocketFramePool : NSObject
+
+- (id)initWithCapacity:(NSUInteger)capacity;
+- (NNWebSocketFrame *)frameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin payload:(NSData *)data tags:(NNWebSocketFrameTag)tags;
+// Drops the payload of the frame. Frames over capacity are released.
+- (void)recycleFrame:(NNWebSocketFrame *)frame;
+
 @end
\ No newline at end of file
@@ -13,13 +13,24 @@
 // limitations under the License.
 
 #import "NNWebSocketFrame.h"
+#import <pthread.h>
 
+@interface NNWebSocketFrame ()
+
+- (void)reuseWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin payload:(NSData *)data tags:(NNWebSocketFrameTag)tags;
+
+@end
+
+// ================================================================
+// NNWebSocketFrame
+// ================================================================
 @implementation NNWebSocketFrame
 {
-    NSUInteger _tags;
+    NSString *_text;
 }
 
 @synthesize opcode = _opcode;
+@synthesize tags = _tags;
 
 + (id)frameText
 {
@@ -67,18 +78,91 @@
     return (_tags & tag) > 0;
 }
 
+// Decoded once and kept until data is replaced.
 - (NSString *)text
 {
-    if (!self.data) {
-        return nil;
+    if (!_text && _data) {
+        _text = [[NSString alloc] initWithData:_data encoding:NSUTF8StringEncoding];
     }
-    return [[NSString alloc] initWithData:self.data encoding:NSUTF8StringEncoding];
+    return _text;
 }
 
 - (void)setText:(NSString *)text
 {
-    NSData *data = [text dataUsingEncoding:NSUTF8StringEncoding];
-    self.data = data;
+    _data = [text dataUsingEncoding:NSUTF8StringEncoding];
+    _text = text;
+}
+
+- (void)setData:(NSData *)data
+{
+    _data = data;
+    _text = nil;
+}
+
+- (void)reuseWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin payload:(NSData *)data tags:(NNWebSocketFrameTag)tags
+{
+    _opcode = opcode;
+    _fin = fin;
+    _data = data;
+    _text = nil;
+    _tags = tags;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketFramePool
+// ================================================================
+@implementation NNWebSocketFramePool
+{
+    pthread_mutex_t _lock;
+    NSMutableArray *_frames;
+    NSUInteger _capacity;
+}
+
+- (id)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        pthread_mutex_init(&_lock, NULL);
+        _frames = [NSMutableArray arrayWithCapacity:capacity];
+        _capacity = capacity;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NNWebSocketFrame *)frameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin payload:(NSData *)data tags:(NNWebSocketFrameTag)tags
+{
+    NNWebSocketFrame *frame = nil;
+    pthread_mutex_lock(&_lock);
+    if (_frames.count > 0) {
+        frame = [_frames lastObject];
+        [_frames removeLastObject];
+    }
+    pthread_mutex_unlock(&_lock);
+    if (!frame) {
+        frame = [[NNWebSocketFrame alloc] initWithOpcode:opcode fin:fin payload:data];
+        [frame addTags:tags];
+        return frame;
+    }
+    [frame reuseWithOpcode:opcode fin:fin payload:data tags:tags];
+    return frame;
+}
+
+- (void)recycleFrame:(NNWebSocketFrame *)frame
+{
+    // Payload may refer to the read buffer, which should not be held by an idle frame.
+    [frame reuseWithOpcode:NNWebSocketFrameOpcodeContinuation fin:NO payload:nil tags:NNWebSocketFrameTagNone];
+    pthread_mutex_lock(&_lock);
+    if (_frames.count < _capacity) {
+        [_frames addObject:frame];
+    }
+    pthread_mutex_unlock(&_lock);
 }
 
 @end
\ No newline at end of file
@@ -0,0 +1,44 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+@class NNWebSocketFrame;
+
+// ================================================================
+// NNWebSocketMask
+// ================================================================
+// XORs 'length' bytes of 'src' with the masking key into 'dst'.
+// 'keyOffset' is the position of src[0] within the whole payload, so a payload can be masked part by part.
+// 'dst' and 'src' may be the same buffer.
+void NNWebSocketMask(uint8_t *dst, const uint8_t *src, size_t length, const uint8_t key[4], uint64_t keyOffset);
+
+// ================================================================
+// NNWebSocketFrameEncoder
+// ================================================================
+@interface NNWebSocketFrameEncoder : NSObject
+
+@property(readonly, nonatomic) BOOL masking;
+
++ (instancetype)encoder;
+- (id)initWithMasking:(BOOL)masking;
+- (NSData *)encodeFrame:(NNWebSocketFrame *)frame;
+// 'parts' is an array of NSData or dispatch_data_t which are encoded as one contiguous payload.
+// dispatch_data_t is accepted only with OS_OBJECT_USE_OBJC. Returns nil for any other part.
+- (NSData *)encodeFrameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin parts:(NSArray *)parts;
+// 'rsv1' marks the first frame of a compressed message.
+- (NSData *)encodeFrameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin rsv1:(BOOL)rsv1 parts:(NSArray *)parts;
+
+@end
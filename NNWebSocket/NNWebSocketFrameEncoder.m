@@ -0,0 +1,190 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketFrameEncoder.h"
+#import "NNWebSocketFrame.h"
+
+#define MAX_HEADER_LENGTH 14
+
+// ================================================================
+// NNWebSocketMask
+// ================================================================
+typedef uint8_t NNMaskVector __attribute__((vector_size(16)));
+
+void NNWebSocketMask(uint8_t *dst, const uint8_t *src, size_t length, const uint8_t key[4], uint64_t keyOffset)
+{
+    // Rotate masking key so that pattern[0] is applied to src[0]
+    uint8_t pattern[16];
+    for (int i=0; i<16; i++) {
+        pattern[i] = key[(keyOffset + i) & 3];
+    }
+    size_t pos = 0;
+    if (length >= 64) {
+        NNMaskVector k;
+        memcpy(&k, pattern, sizeof(k));
+        for (; pos + 64 <= length; pos += 64) {
+            NNMaskVector v0, v1, v2, v3;
+            memcpy(&v0, src + pos, 16);
+            memcpy(&v1, src + pos + 16, 16);
+            memcpy(&v2, src + pos + 32, 16);
+            memcpy(&v3, src + pos + 48, 16);
+            v0 ^= k; v1 ^= k; v2 ^= k; v3 ^= k;
+            memcpy(dst + pos, &v0, 16);
+            memcpy(dst + pos + 16, &v1, 16);
+            memcpy(dst + pos + 32, &v2, 16);
+            memcpy(dst + pos + 48, &v3, 16);
+        }
+    }
+    uint64_t k64;
+    memcpy(&k64, pattern, sizeof(k64));
+    for (; pos + 8 <= length; pos += 8) {
+        uint64_t w;
+        memcpy(&w, src + pos, 8);
+        w ^= k64;
+        memcpy(dst + pos, &w, 8);
+    }
+    for (; pos < length; pos++) {
+        dst[pos] = src[pos] ^ pattern[pos & 3];
+    }
+}
+
+// ================================================================
+// NNWebSocketFrameEncoder
+// ================================================================
+// dispatch_data_t can be in an array only where it is an object.
+static BOOL IsPayloadPart(id part)
+{
+    if ([part isKindOfClass:[NSData class]]) {
+        return YES;
+    }
+    #if OS_OBJECT_USE_OBJC
+    return [part conformsToProtocol:@protocol(OS_dispatch_data)];
+    #else
+    return NO;
+    #endif
+}
+
+@implementation NNWebSocketFrameEncoder
+
++ (instancetype)encoder
+{
+    return [[self alloc] initWithMasking:YES];
+}
+
+- (id)init
+{
+    return [self initWithMasking:YES];
+}
+
+- (id)initWithMasking:(BOOL)masking
+{
+    self = [super init];
+    if (self) {
+        _masking = masking;
+    }
+    return self;
+}
+
+- (NSData *)encodeFrame:(NNWebSocketFrame *)frame
+{
+    NSData *data = frame.data;
+    return [self encodeFrameWithOpcode:frame.opcode fin:frame.fin parts:data ? @[data] : nil];
+}
+
+- (NSData *)encodeFrameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin parts:(NSArray *)parts
+{
+    return [self encodeFrameWithOpcode:opcode fin:fin rsv1:NO parts:parts];
+}
+
+- (NSData *)encodeFrameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin rsv1:(BOOL)rsv1 parts:(NSArray *)parts
+{
+    uint64_t payloadLen = 0;
+    for (id part in parts) {
+        if (!IsPayloadPart(part)) {
+            NSAssert(NO, @"Unsupported payload part %@", part);
+            return nil;
+        }
+        payloadLen += [self lengthOfPart:part];
+    }
+    uint8_t header[MAX_HEADER_LENGTH];
+    NSUInteger headerLen = 0;
+    header[headerLen++] = (uint8_t)((fin ? NNWebSocketFrameMaskFin : 0) | (rsv1 ? NNWebSocketFrameMaskRsv1 : 0) | (opcode & NNWebSocketFrameMaskOpcode));
+    uint8_t maskBit = _masking ? NNWebSocketFrameMaskMask : 0;
+    if (payloadLen <= 125) {
+        header[headerLen++] = (uint8_t)(maskBit | payloadLen);
+    } else if (payloadLen <= UINT16_MAX) {
+        header[headerLen++] = (uint8_t)(maskBit | 126);
+        header[headerLen++] = (uint8_t)(payloadLen >> 8);
+        header[headerLen++] = (uint8_t)(payloadLen & 0xff);
+    } else {
+        header[headerLen++] = (uint8_t)(maskBit | 127);
+        for (int shift=56; shift>=0; shift-=8) {
+            header[headerLen++] = (uint8_t)((payloadLen >> shift) & 0xff);
+        }
+    }
+    uint8_t *key = NULL;
+    if (_masking) {
+        uint32_t src = arc4random();
+        key = header + headerLen;
+        memcpy(key, &src, 4);
+        headerLen += 4;
+    }
+    // Allocate the final frame buffer once, then mask each part while copying it in.
+    NSUInteger frameLen = headerLen + (NSUInteger)payloadLen;
+    uint8_t *frameBuff = malloc(frameLen);
+    if (!frameBuff) {
+        return nil;
+    }
+    memcpy(frameBuff, header, headerLen);
+    uint8_t *payloadBuff = frameBuff + headerLen;
+    __block uint64_t offset = 0;
+    void (^copyBytes)(const void *, size_t) = ^(const void *bytes, size_t len) {
+        if (key) {
+            NNWebSocketMask(payloadBuff + offset, bytes, len, key, offset);
+        } else {
+            memcpy(payloadBuff + offset, bytes, len);
+        }
+        offset += len;
+    };
+    for (id part in parts) {
+        if ([part isKindOfClass:[NSData class]]) {
+            NSData *d = part;
+            if (d.length > 0) copyBytes(d.bytes, d.length);
+        }
+        #if OS_OBJECT_USE_OBJC
+        else {
+            dispatch_data_apply((dispatch_data_t)part, ^bool(dispatch_data_t region, size_t regionOffset, const void *buffer, size_t size) {
+                copyBytes(buffer, size);
+                return true;
+            });
+        }
+        #endif
+    }
+    return [NSData dataWithBytesNoCopy:frameBuff length:frameLen freeWhenDone:YES];
+}
+
+// Parts have been checked by IsPayloadPart.
+- (uint64_t)lengthOfPart:(id)part
+{
+    if ([part isKindOfClass:[NSData class]]) {
+        return [(NSData *)part length];
+    }
+    #if OS_OBJECT_USE_OBJC
+    return dispatch_data_get_size((dispatch_data_t)part);
+    #else
+    return 0;
+    #endif
+}
+
+@end
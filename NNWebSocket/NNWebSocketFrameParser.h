@@ -0,0 +1,53 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+@class NNWebSocketOptions;
+@class NNWebSocketDeflateExtension;
+@class NNWebSocketFramePool;
+
+// Incremental frame decoder. It is driven by NNWebSocketTransportReader on the io queue and
+// decodes every complete frame in the given bytes at once. Data frames are tagged with the type of the message
+// they belong to and whether it is fragmented.
+@interface NNWebSocketFrameParser : NSObject
+
+@property(nonatomic) NSUInteger verbose;
+// YES after a close frame has been decoded or a protocol error has been detected.
+@property(readonly, nonatomic) BOOL finished;
+@property(readonly, nonatomic) BOOL failed;
+@property(readonly, nonatomic) NNWebSocketStatus failureStatus;
+@property(readonly, nonatomic) NSError *failureError;
+@property(readonly, nonatomic) BOOL hasPartialFrame;
+// Number of payload bytes which can be written by -fillPayloadUsingBlock:frames: right now.
+@property(readonly, nonatomic) NSUInteger remainingPayloadLength;
+// Frames are taken from the pool when set.
+@property(nonatomic) NNWebSocketFramePool *framePool;
+// Set on the server side, where every frame from the client is masked and unmasked ones are rejected.
+// Payload bytes given to -parseBytes:length:owner:sliced:frames: are unmasked in place then.
+@property(nonatomic) BOOL expectsMask;
+
+- (id)initWithOptions:(NNWebSocketOptions *)options;
+// Messages compressed with negotiated permessage-deflate are inflated before they are added to frames.
+- (id)initWithOptions:(NNWebSocketOptions *)options deflate:(NNWebSocketDeflateExtension *)deflate;
+// Decodes frames from bytes and adds them to 'frames'. Returns the number of consumed bytes, which is
+// 'length' unless the parser has finished. Payloads may refer to 'owner' without copying, in which case
+// 'sliced' is set to YES.
+- (NSUInteger)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length owner:(NSData *)owner sliced:(BOOL *)sliced frames:(NSMutableArray *)frames;
+// Lets 'block' write payload bytes directly into the destination of the current frame.
+// 'block' returns the number of written bytes or a negative value on error.
+- (NSInteger)fillPayloadUsingBlock:(NSInteger (^)(uint8_t *bytes, NSUInteger length))block frames:(NSMutableArray *)frames;
+
+@end
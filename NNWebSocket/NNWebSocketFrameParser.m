@@ -0,0 +1,415 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketFrameParser.h"
+#import "NNWebSocketFrame.h"
+#import "NNWebSocketFrameEncoder.h"
+#import "NNWebSocketOptions.h"
+#import "NNWebSocketDeflate.h"
+#import "NNUtils.h"
+#import "NNWebSocketDebug.h"
+
+#define MAX_HEADER_LENGTH 14
+#define MASKING_KEY_LENGTH 4
+
+typedef NS_ENUM(NSUInteger, NNWebSocketFrameParserPhase) {
+    NNWebSocketFrameParserPhaseHeader,
+    NNWebSocketFrameParserPhasePayload,
+    NNWebSocketFrameParserPhaseFinished,
+};
+
+@implementation NNWebSocketFrameParser
+{
+    uint64_t _optMaxPayloadSize;
+    NNWebSocketPayloadSizeLimitBehavior _optPayloadSizeLimitBehavior;
+    uint64_t _optStreamingThreshold;
+    NSUInteger _optStreamingChunkSize;
+    NNWebSocketFrameParserPhase _phase;
+    uint8_t _header[MAX_HEADER_LENGTH];
+    NSUInteger _headerLength;
+    NSUInteger _headerLengthToRead;
+    NNWebSocketFrameTag _tags;
+    NNWebSocketFrameOpcode _opcode;
+    // Opcode of the fragmented message being read. Continuation while none.
+    NNWebSocketFrameOpcode _messageOpcode;
+    BOOL _fin;
+    BOOL _masked;
+    uint8_t _maskingKey[MASKING_KEY_LENGTH];
+    uint64_t _payloadSize;
+    uint64_t _payloadReadOffset;
+    uint8_t *_chunkBytes;
+    NSUInteger _chunkLength;
+    NSUInteger _chunkOffset;
+    NNWebSocketInflater *_inflater;
+    BOOL _messageCompressed;
+}
+
+- (id)initWithOptions:(NNWebSocketOptions *)options
+{
+    return [self initWithOptions:options deflate:nil];
+}
+
+- (id)initWithOptions:(NNWebSocketOptions *)options deflate:(NNWebSocketDeflateExtension *)deflate
+{
+    self = [super init];
+    if (self) {
+        _optMaxPayloadSize = options.maxPayloadByteSize;
+        _optPayloadSizeLimitBehavior = options.payloadSizeLimitBehavior;
+        _optStreamingThreshold = options.streamingThresholdByteSize;
+        _optStreamingChunkSize = MAX((NSUInteger)1, options.streamingChunkByteSize);
+        _verbose = options.verbose;
+        if (deflate) {
+            _inflater = [[NNWebSocketInflater alloc] initWithNoContextTakeover:deflate.serverNoContextTakeover];
+        }
+        [self resetHeader];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_chunkBytes);
+}
+
+- (BOOL)hasPartialFrame
+{
+    return _phase == NNWebSocketFrameParserPhasePayload || (_phase == NNWebSocketFrameParserPhaseHeader && _headerLength > 0);
+}
+
+- (NSUInteger)remainingPayloadLength
+{
+    if (_phase != NNWebSocketFrameParserPhasePayload) {
+        return 0;
+    }
+    return _chunkBytes ? _chunkLength - _chunkOffset : [self nextChunkLength];
+}
+
+- (NSUInteger)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length owner:(NSData *)owner sliced:(BOOL *)sliced frames:(NSMutableArray *)frames
+{
+    NSUInteger pos = 0;
+    while (pos < length && _phase != NNWebSocketFrameParserPhaseFinished) {
+        if (_phase == NNWebSocketFrameParserPhaseHeader) {
+            NSUInteger len = MIN(length - pos, _headerLengthToRead - _headerLength);
+            memcpy(_header + _headerLength, bytes + pos, len);
+            _headerLength += len;
+            pos += len;
+            if (_headerLength == _headerLengthToRead) {
+                [self didReadHeader:frames];
+            }
+            continue;
+        }
+        NSUInteger available = length - pos;
+        if (!_chunkBytes) {
+            NSUInteger chunkLength = [self nextChunkLength];
+            if (available >= chunkLength) {
+                // Entire payload is in the given bytes. Refer to them without copying.
+                if (_masked) {
+                    // The bytes are the reader's buffer, which are consumed only once.
+                    NNWebSocketMask((uint8_t *)bytes + pos, bytes + pos, chunkLength, _maskingKey, _payloadReadOffset);
+                }
+                NSData *data = [NNDataSlice dataWithOwner:owner bytes:bytes + pos length:chunkLength sliced:sliced];
+                pos += chunkLength;
+                [self didReadPayload:data frames:frames];
+                continue;
+            }
+            [self allocateChunk:chunkLength];
+        }
+        NSUInteger len = MIN(available, _chunkLength - _chunkOffset);
+        if (_masked) {
+            NNWebSocketMask(_chunkBytes + _chunkOffset, bytes + pos, len, _maskingKey, _payloadReadOffset + _chunkOffset);
+        } else {
+            memcpy(_chunkBytes + _chunkOffset, bytes + pos, len);
+        }
+        _chunkOffset += len;
+        pos += len;
+        [self completeChunkIfNeeded:frames];
+    }
+    return pos;
+}
+
+- (NSInteger)fillPayloadUsingBlock:(NSInteger (^)(uint8_t *bytes, NSUInteger length))block frames:(NSMutableArray *)frames
+{
+    if (_phase != NNWebSocketFrameParserPhasePayload) {
+        return 0;
+    }
+    if (!_chunkBytes) {
+        [self allocateChunk:[self nextChunkLength]];
+    }
+    NSInteger result = block(_chunkBytes + _chunkOffset, _chunkLength - _chunkOffset);
+    if (result > 0) {
+        if (_masked) {
+            uint8_t *p = _chunkBytes + _chunkOffset;
+            NNWebSocketMask(p, p, (NSUInteger)result, _maskingKey, _payloadReadOffset + _chunkOffset);
+        }
+        _chunkOffset += (NSUInteger)result;
+        [self completeChunkIfNeeded:frames];
+    }
+    return result;
+}
+
+#pragma mark Header
+
+- (void)resetHeader
+{
+    _phase = NNWebSocketFrameParserPhaseHeader;
+    _headerLength = 0;
+    _headerLengthToRead = 2;
+    _tags = NNWebSocketFrameTagNone;
+    _payloadSize = 0;
+    _payloadReadOffset = 0;
+}
+
+- (void)didReadHeader:(NSMutableArray *)frames
+{
+    uint8_t payloadLength = _header[1] & NNWebSocketFrameMaskPayloadLength;
+    if (_headerLength == 2) {
+        if (![self validateFirstTwoBytes]) {
+            return;
+        }
+        NSUInteger extendedLength = payloadLength == 127 ? 8 : (payloadLength == 126 ? 2 : 0);
+        NSUInteger rest = extendedLength + (_masked ? MASKING_KEY_LENGTH : 0);
+        if (rest > 0) {
+            _headerLengthToRead += rest;
+            return;
+        }
+    }
+    NSUInteger lengthEnd = _masked ? _headerLength - MASKING_KEY_LENGTH : _headerLength;
+    _payloadSize = payloadLength;
+    if (lengthEnd > 2) {
+        _payloadSize = 0;
+        for (NSUInteger i=2; i<lengthEnd; i++) {
+            _payloadSize = (_payloadSize << 8) | _header[i];
+        }
+    }
+    if (_masked) {
+        memcpy(_maskingKey, _header + lengthEnd, MASKING_KEY_LENGTH);
+    }
+    LogDebug(@"Reading payload data(%qu bytes)", _payloadSize);
+    if (_payloadSize == 0) {
+        [self didReadPayload:[NSData data] frames:frames];
+        return;
+    }
+    if (_optStreamingThreshold > 0 && _payloadSize >= _optStreamingThreshold && (_tags & NNWebSocketFrameTagDataFrame)) {
+        LogDebug(@"Streaming payload in chunks.");
+        _tags |= NNWebSocketFrameTagStreamedDataFrame;
+    } else if (_payloadSize > _optMaxPayloadSize && _optPayloadSizeLimitBehavior == NNWebSocketPayloadSizeLimitBehaviorError) {
+        LogError(@"Payload size is too large.(%qu bytes)", _payloadSize);
+        [self failWithStatus:NNWebSocketStatusMessageTooBig error:nil];
+        return;
+    }
+    _phase = NNWebSocketFrameParserPhasePayload;
+}
+
+- (BOOL)validateFirstTwoBytes
+{
+    uint8_t *b = _header;
+    _opcode = (NNWebSocketFrameOpcode)(b[0] & NNWebSocketFrameMaskOpcode);
+    LogDebug(@"Reading frame header(opcode:%d)", _opcode);
+    if (_opcode >= NNWebSocketFrameOpcodeReservedDataFrame1 && _opcode <= NNWebSocketFrameOpcodeReservedDataFrame5) {
+        LogError(@"Invalid reserved non control frame.");
+        [self failWithCode:NNWebSocketErrorUnkownDataFrameType];
+        return NO;
+    }
+    if (_opcode >= NNWebSocketFrameOpcodeReservedControlFrame1 && _opcode <= NNWebSocketFrameOpcodeReservedControlFrame5) {
+        LogError(@"Invalid reserved control frame.");
+        [self failWithCode:NNWebSocketErrorUnkownControlFrameType];
+        return NO;
+    }
+    if ((_opcode & 0x08) > 0) {
+        _tags |= NNWebSocketFrameTagControlFrame;
+    } else {
+        _tags |= NNWebSocketFrameTagDataFrame;
+    }
+    _fin = (b[0] & NNWebSocketFrameMaskFin) > 0;
+    BOOL rsv1 = (b[0] & NNWebSocketFrameMaskRsv1) > 0;
+    BOOL rsv2 = (b[0] & NNWebSocketFrameMaskRsv2) > 0;
+    BOOL rsv3 = (b[0] & NNWebSocketFrameMaskRsv3) > 0;
+    if (rsv1 && _inflater && _opcode != NNWebSocketFrameOpcodeContinuation && (_tags & NNWebSocketFrameTagDataFrame)) {
+        // RSV1 of the first frame marks a compressed message.
+        rsv1 = NO;
+        _messageCompressed = YES;
+    } else if (_opcode == NNWebSocketFrameOpcodeText || _opcode == NNWebSocketFrameOpcodeBinary) {
+        _messageCompressed = NO;
+    }
+    if (rsv1 || rsv2 || rsv3) {
+        LogError(@"Invalid RSV bits");
+        [self failWithCode:NNWebSocketErrorInvalidRsvBit];
+        return NO;
+    }
+    _masked = (b[1] & NNWebSocketFrameMaskMask) > 0;
+    if (_masked && !_expectsMask) {
+        LogError(@"Invalid mask.");
+        [self failWithCode:NNWebSocketErrorReceiveFrameMask];
+        return NO;
+    }
+    if (!_masked && _expectsMask) {
+        LogError(@"Frame is not masked.");
+        [self failWithCode:NNWebSocketErrorReceiveFrameUnmasked];
+        return NO;
+    }
+    uint8_t payloadLength = b[1] & NNWebSocketFrameMaskPayloadLength;
+    if (_tags & NNWebSocketFrameTagControlFrame) {
+        if (payloadLength > 125) {
+            [self failWithCode:NNWebSocketErrorControlFramePayloadSize];
+            return NO;
+        }
+        if (!_fin) {
+            [self failWithCode:NNWebSocketErrorControlFrameFin];
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)failWithCode:(NNWebSocketError)code
+{
+    [self failWithStatus:NNWebSocketStatusProtocolError error:[NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:code userInfo:nil]];
+}
+
+- (void)failWithStatus:(NNWebSocketStatus)status error:(NSError *)error
+{
+    _failed = YES;
+    _failureStatus = status;
+    _failureError = error;
+    _finished = YES;
+    _phase = NNWebSocketFrameParserPhaseFinished;
+}
+
+#pragma mark Payload
+
+// Payload larger than maxPayloadByteSize is split into chunks when the limit behavior is split.
+- (NSUInteger)nextChunkLength
+{
+    return (NSUInteger)MIN(_payloadSize - _payloadReadOffset, [self maxChunkLength]);
+}
+
+- (uint64_t)maxChunkLength
+{
+    return (_tags & NNWebSocketFrameTagStreamedDataFrame) ? _optStreamingChunkSize : _optMaxPayloadSize;
+}
+
+- (void)allocateChunk:(NSUInteger)length
+{
+    _chunkBytes = malloc(length);
+    _chunkLength = length;
+    _chunkOffset = 0;
+}
+
+- (void)completeChunkIfNeeded:(NSMutableArray *)frames
+{
+    if (_chunkOffset < _chunkLength) {
+        return;
+    }
+    NSData *data = [NSData dataWithBytesNoCopy:_chunkBytes length:_chunkLength freeWhenDone:YES];
+    _chunkBytes = NULL;
+    _chunkLength = 0;
+    _chunkOffset = 0;
+    [self didReadPayload:data frames:frames];
+}
+
+- (void)didReadPayload:(NSData *)data frames:(NSMutableArray *)frames
+{
+    NNWebSocketFrameOpcode opcode = _payloadReadOffset == 0 ? _opcode : NNWebSocketFrameOpcodeContinuation;
+    _payloadReadOffset += data.length;
+    BOOL completed = _payloadReadOffset >= _payloadSize;
+    BOOL fin = completed ? _fin : NO;
+    if (_messageCompressed && (_tags & NNWebSocketFrameTagDataFrame)) {
+        if (![self inflatePayload:data opcode:opcode fin:fin frames:frames]) {
+            return;
+        }
+    } else {
+        [self addFrameWithOpcode:opcode fin:fin payload:data frames:frames];
+    }
+    if (_opcode == NNWebSocketFrameOpcodeClose) {
+        // Nothing is read after a close frame.
+        _finished = YES;
+        _phase = NNWebSocketFrameParserPhaseFinished;
+    } else if (completed) {
+        [self resetHeader];
+    } else {
+        _phase = NNWebSocketFrameParserPhasePayload;
+    }
+}
+
+- (void)addFrameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin payload:(NSData *)data frames:(NSMutableArray *)frames
+{
+    NNWebSocketFrameTag tags = [self tagsOfFrameWithOpcode:opcode fin:fin];
+    NNWebSocketFrame *frame;
+    if (_framePool) {
+        frame = [_framePool frameWithOpcode:opcode fin:fin payload:data tags:tags];
+    } else {
+        frame = [[NNWebSocketFrame alloc] initWithOpcode:opcode fin:fin payload:data];
+        [frame addTags:tags];
+    }
+    [frames addObject:frame];
+}
+
+- (NNWebSocketFrameTag)tagsOfFrameWithOpcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin
+{
+    NNWebSocketFrameTag tags = _tags;
+    if (!(tags & NNWebSocketFrameTagDataFrame)) {
+        return tags;
+    }
+    BOOL single = NO;
+    NNWebSocketFrameOpcode messageOpcode = _messageOpcode;
+    if (opcode == NNWebSocketFrameOpcodeContinuation) {
+        if (fin) {
+            _messageOpcode = NNWebSocketFrameOpcodeContinuation;
+        }
+    } else {
+        messageOpcode = opcode;
+        single = fin;
+        _messageOpcode = fin ? NNWebSocketFrameOpcodeContinuation : opcode;
+    }
+    if (messageOpcode == NNWebSocketFrameOpcodeText) {
+        tags |= NNWebSocketFrameTagTextDataFrame;
+        tags |= single ? NNWebSocketFrameTagSingleTextDataFrame : NNWebSocketFrameTagFragmentedTextDataFrame;
+    } else if (messageOpcode == NNWebSocketFrameOpcodeBinary) {
+        tags |= NNWebSocketFrameTagBinaryDataFrame;
+        tags |= single ? NNWebSocketFrameTagSingleBinaryDataFrame : NNWebSocketFrameTagFragmentedBinaryDataFrame;
+    }
+    return tags;
+}
+
+// Inflated payload is limited by maxPayloadByteSize as well as payload on the wire.
+- (BOOL)inflatePayload:(NSData *)data opcode:(NNWebSocketFrameOpcode)opcode fin:(BOOL)fin frames:(NSMutableArray *)frames
+{
+    NSMutableArray *chunks = [NSMutableArray array];
+    NSUInteger maxChunkLength = (NSUInteger)MIN([self maxChunkLength], (uint64_t)NSUIntegerMax);
+    BOOL streamed = (_tags & NNWebSocketFrameTagStreamedDataFrame) > 0;
+    // Limited payload must fit in one chunk. Inflating stops beyond it rather than decompressing all of it.
+    BOOL limited = !streamed && _optPayloadSizeLimitBehavior == NNWebSocketPayloadSizeLimitBehaviorError;
+    BOOL overflowed = NO;
+    if (![_inflater inflateData:data fin:fin maxChunkLength:maxChunkLength chunks:chunks overflowed:limited ? &overflowed : NULL]) {
+        LogError(@"Failed to inflate compressed payload.");
+        [self failWithStatus:NNWebSocketStatusInvalidFramePayloadData error:[NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorInvalidCompressedData userInfo:nil]];
+        return NO;
+    }
+    if (overflowed) {
+        LogError(@"Inflated payload size is too large.");
+        [self failWithStatus:NNWebSocketStatusMessageTooBig error:nil];
+        return NO;
+    }
+    if (chunks.count == 0) {
+        [chunks addObject:[NSData data]];
+    }
+    NSUInteger last = chunks.count - 1;
+    for (NSUInteger i=0; i<=last; i++) {
+        NNWebSocketFrameOpcode op = i == 0 ? opcode : NNWebSocketFrameOpcodeContinuation;
+        [self addFrameWithOpcode:op fin:i == last ? fin : NO payload:[chunks objectAtIndex:i] frames:frames];
+    }
+    return YES;
+}
+
+@end
@@ -0,0 +1,89 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+@class NNWebSocketOptions;
+
+#define NNWEBSOCKET_KEY_LENGTH 24
+#define NNWEBSOCKET_ACCEPT_LENGTH 28
+
+// Fills 'key' with a random Sec-WebSocket-Key.
+void NNWebSocketCreateKey(char *key);
+// Fills 'accept' with Sec-WebSocket-Accept which the server returns for 'key'.
+void NNWebSocketCreateAccept(const char *key, char *accept);
+
+// ================================================================
+// NNWebSocketHandshakeRequest
+// ================================================================
+// Opening handshake request built once per URL and options. Only the key differs between requests.
+@interface NNWebSocketHandshakeRequest : NSObject
+
+- (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options;
+- (NSData *)requestWithKey:(const char *)key;
+
+@end
+
+// ================================================================
+// NNWebSocketHandshakeResponse
+// ================================================================
+// HTTP/1.1 response to the opening handshake. Header names are matched case insensitively, and values of
+// a repeated header are joined with commas. Headers which the handshake does not look at are skipped.
+@interface NNWebSocketHandshakeResponse : NSObject
+
+@property(readonly, nonatomic) NSInteger statusCode;
+@property(readonly, nonatomic) NSString *upgrade;
+@property(readonly, nonatomic) NSString *connection;
+@property(readonly, nonatomic) NSString *accept;
+@property(readonly, nonatomic) NSString *extensions;
+
+// Returns nil unless 'data' is a well formed response header which ends with an empty line.
++ (instancetype)responseWithData:(NSData *)data;
+// Whether Connection header lists the token.
+- (BOOL)hasConnectionToken:(NSString *)token;
+// Whether Sec-WebSocket-Accept is the one for 'key'.
+- (BOOL)isAcceptedKey:(const char *)key;
+
+@end
+
+// ================================================================
+// NNWebSocketHandshakeIncomingRequest
+// ================================================================
+// Opening handshake request received by the server side, parsed like the response.
+@interface NNWebSocketHandshakeIncomingRequest : NSObject
+
+@property(readonly, nonatomic) NSString *method;
+@property(readonly, nonatomic) NSString *resource;
+@property(readonly, nonatomic) NSString *httpVersion;
+@property(readonly, nonatomic) NSString *host;
+@property(readonly, nonatomic) NSString *upgrade;
+@property(readonly, nonatomic) NSString *connection;
+@property(readonly, nonatomic) NSString *key;
+@property(readonly, nonatomic) NSString *version;
+@property(readonly, nonatomic) NSString *protocols;
+
+// Returns nil unless 'data' is a well formed request header which ends with an empty line.
++ (instancetype)requestWithData:(NSData *)data;
+// Response which refuses a request that is not a valid opening handshake.
++ (NSData *)badRequestResponse;
+// Response which refuses a request header longer than the server accepts.
++ (NSData *)headerTooLargeResponse;
+- (BOOL)hasConnectionToken:(NSString *)token;
+// Whether Sec-WebSocket-Key is base64 of 16 bytes.
+- (BOOL)hasValidKey;
+// 101 response which selects the first of 'protocols' the client has offered. nil when the key is not valid.
+- (NSData *)acceptResponseWithProtocols:(NSArray *)protocols;
+
+@end
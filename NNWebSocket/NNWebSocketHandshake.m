@@ -0,0 +1,318 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketHandshake.h"
+#import <CommonCrypto/CommonDigest.h>
+#import "NNUtils.h"
+#import "NNWebSocketOptions.h"
+#import "NNWebSocketDeflate.h"
+
+#define WEBSOCKET_CLIENT_NAME @"NNWebSocket"
+#define WEBSOCKET_CLIENT_VERSION @"1"
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WEBSOCKET_GUID_LENGTH 36
+#define WEBSOCKET_PROTOCOL_VERSION 13
+#define KEY_SOURCE_LENGTH 16
+
+void NNWebSocketCreateKey(char *key)
+{
+    uint8_t source[KEY_SOURCE_LENGTH];
+    arc4random_buf(source, KEY_SOURCE_LENGTH);
+    NNBase64Encode(source, KEY_SOURCE_LENGTH, key);
+}
+
+void NNWebSocketCreateAccept(const char *key, char *accept)
+{
+    char source[NNWEBSOCKET_KEY_LENGTH + WEBSOCKET_GUID_LENGTH];
+    memcpy(source, key, NNWEBSOCKET_KEY_LENGTH);
+    memcpy(source + NNWEBSOCKET_KEY_LENGTH, WEBSOCKET_GUID, WEBSOCKET_GUID_LENGTH);
+    uint8_t digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(source, sizeof(source), digest);
+    NNBase64Encode(digest, CC_SHA1_DIGEST_LENGTH, accept);
+}
+
+// ================================================================
+// NNWebSocketHandshakeRequest
+// ================================================================
+@implementation NNWebSocketHandshakeRequest
+{
+    NSData *_template;
+    NSUInteger _keyOffset;
+}
+
+- (id)initWithURL:(NSURL *)url options:(NNWebSocketOptions *)options
+{
+    self = [super init];
+    if (self) {
+        NSMutableString* handshake = [[NSMutableString alloc] init];
+        NSString *path = (__bridge_transfer NSString*)CFURLCopyPath((__bridge CFURLRef)url);
+        NSMutableString* resource = [NSMutableString stringWithString:path];
+        if ([resource length] == 0) {
+            [resource appendString:@"/"];
+        }
+        if (url.query) {
+            [resource appendFormat:@"?%@", url.query];
+        }
+        [handshake appendFormat:@"GET %@ HTTP/1.1\r\n", resource];
+        [handshake appendFormat:@"Host:%@:%d\r\n", url.host, [url.port unsignedIntValue]];
+        [handshake appendString:@"Upgrade: websocket\r\n"];
+        [handshake appendString:@"Connection: Upgrade\r\n"];
+        [handshake appendString:@"Sec-WebSocket-Key:"];
+        // Placeholder of the key, which is written into a copy of the template.
+        _keyOffset = [handshake lengthOfBytesUsingEncoding:NSASCIIStringEncoding];
+        [handshake appendString:[@"" stringByPaddingToLength:NNWEBSOCKET_KEY_LENGTH withString:@" " startingAtIndex:0]];
+        [handshake appendString:@"\r\n"];
+        [handshake appendFormat:@"Sec-WebSocket-Origin:%@\r\n", options.origin];
+        [handshake appendFormat:@"Sec-WebSocket-Protocol-Client:%@\r\n", WEBSOCKET_CLIENT_NAME];
+        [handshake appendFormat:@"Sec-WebSocket-Version-Client:%@\r\n", WEBSOCKET_CLIENT_VERSION];
+        NSArray *protocols = options.protocols;
+        if (protocols && [protocols count] > 0) {
+            [handshake appendFormat:@"Sec-WebSocket-Protocol:%@\r\n", [protocols componentsJoinedByString:@","]];
+        }
+        [handshake appendFormat:@"Sec-WebSocket-Version:%d\r\n", WEBSOCKET_PROTOCOL_VERSION];
+        if (options.perMessageDeflate) {
+            [handshake appendFormat:@"Sec-WebSocket-Extensions: %@\r\n", [NNWebSocketDeflateExtension offerWithOptions:options]];
+        }
+        [handshake appendString:@"\r\n"];
+        _template = [handshake dataUsingEncoding:NSASCIIStringEncoding];
+    }
+    return self;
+}
+
+- (NSData *)requestWithKey:(const char *)key
+{
+    NSMutableData *request = [_template mutableCopy];
+    memcpy((uint8_t *)request.mutableBytes + _keyOffset, key, NNWEBSOCKET_KEY_LENGTH);
+    return request;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketHandshakeResponse
+// ================================================================
+static BOOL IsHeaderName(const uint8_t *name, NSUInteger length, const char *expected)
+{
+    return strlen(expected) == length && strncasecmp((const char *)name, expected, length) == 0;
+}
+
+static NSString *AppendHeaderValue(NSString *current, const uint8_t *value, NSUInteger length)
+{
+    NSString *str = [[NSString alloc] initWithBytes:value length:length encoding:NSISOLatin1StringEncoding];
+    return current ? [NSString stringWithFormat:@"%@, %@", current, str] : str;
+}
+
+// Lines end with CRLF, or LF alone as RFC 7230 allows recipients to accept.
+static const uint8_t *NextLine(const uint8_t *p, const uint8_t *end, NSUInteger *length)
+{
+    const uint8_t *lf = memchr(p, '\n', (size_t)(end - p));
+    if (!lf) {
+        return NULL;
+    }
+    *length = (NSUInteger)(lf - p) - (lf > p && lf[-1] == '\r' ? 1 : 0);
+    return lf + 1;
+}
+
+// Parses header fields after the start line up to an empty line, and passes each of them to 'field'.
+static BOOL ParseHeaderFields(const uint8_t *next, const uint8_t *end, void (^field)(const uint8_t *name, NSUInteger nameLength, const uint8_t *value, NSUInteger valueLength))
+{
+    NSUInteger len = 0;
+    while (YES) {
+        const uint8_t *line = next;
+        next = NextLine(line, end, &len);
+        if (!next) {
+            // Header has not been terminated by an empty line.
+            return NO;
+        }
+        if (len == 0) {
+            return YES;
+        }
+        const uint8_t *colon = memchr(line, ':', len);
+        if (!colon || colon == line || line[0] == ' ' || line[0] == '\t') {
+            // Obsolete line folding is rejected as well.
+            return NO;
+        }
+        NSUInteger nameLength = (NSUInteger)(colon - line);
+        const uint8_t *value = colon + 1;
+        const uint8_t *valueEnd = line + len;
+        while (value < valueEnd && (*value == ' ' || *value == '\t')) value++;
+        while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) valueEnd--;
+        field(line, nameLength, value, (NSUInteger)(valueEnd - value));
+    }
+}
+
+static BOOL HasToken(NSString *list, NSString *token)
+{
+    for (NSString *item in [list componentsSeparatedByString:@","]) {
+        NSString *trimmed = [item stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([trimmed caseInsensitiveCompare:token] == NSOrderedSame) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+@implementation NNWebSocketHandshakeResponse
+
++ (instancetype)responseWithData:(NSData *)data
+{
+    NNWebSocketHandshakeResponse *response = [[self alloc] init];
+    return [response parseBytes:data.bytes length:data.length] ? response : nil;
+}
+
+- (BOOL)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    const uint8_t *end = bytes + length;
+    NSUInteger len = 0;
+    // Status line: HTTP/1.x SP 3DIGIT SP reason
+    const uint8_t *next = NextLine(bytes, end, &len);
+    if (!next || len < 12 || memcmp(bytes, "HTTP/1.", 7) != 0 || bytes[8] != ' ') {
+        return NO;
+    }
+    for (NSUInteger i=9; i<12; i++) {
+        if (bytes[i] < '0' || bytes[i] > '9') {
+            return NO;
+        }
+    }
+    _statusCode = (bytes[9] - '0') * 100 + (bytes[10] - '0') * 10 + (bytes[11] - '0');
+    return ParseHeaderFields(next, end, ^(const uint8_t *name, NSUInteger nameLength, const uint8_t *value, NSUInteger valueLength) {
+        if (IsHeaderName(name, nameLength, "Upgrade")) {
+            _upgrade = AppendHeaderValue(_upgrade, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Connection")) {
+            _connection = AppendHeaderValue(_connection, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Sec-WebSocket-Accept")) {
+            _accept = AppendHeaderValue(_accept, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Sec-WebSocket-Extensions")) {
+            _extensions = AppendHeaderValue(_extensions, value, valueLength);
+        }
+    });
+}
+
+- (BOOL)hasConnectionToken:(NSString *)token
+{
+    return HasToken(_connection, token);
+}
+
+- (BOOL)isAcceptedKey:(const char *)key
+{
+    char expected[NNWEBSOCKET_ACCEPT_LENGTH];
+    NNWebSocketCreateAccept(key, expected);
+    char actual[NNWEBSOCKET_ACCEPT_LENGTH + 1];
+    if (_accept.length != NNWEBSOCKET_ACCEPT_LENGTH || ![_accept getCString:actual maxLength:sizeof(actual) encoding:NSASCIIStringEncoding]) {
+        return NO;
+    }
+    return memcmp(expected, actual, NNWEBSOCKET_ACCEPT_LENGTH) == 0;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketHandshakeIncomingRequest
+// ================================================================
+@implementation NNWebSocketHandshakeIncomingRequest
+
++ (instancetype)requestWithData:(NSData *)data
+{
+    NNWebSocketHandshakeIncomingRequest *request = [[self alloc] init];
+    return [request parseBytes:data.bytes length:data.length] ? request : nil;
+}
+
++ (NSData *)badRequestResponse
+{
+    NSString *response = [NSString stringWithFormat:@"HTTP/1.1 400 Bad Request\r\n"
+                          "Sec-WebSocket-Version: %d\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n"
+                          "\r\n", WEBSOCKET_PROTOCOL_VERSION];
+    return [response dataUsingEncoding:NSASCIIStringEncoding];
+}
+
++ (NSData *)headerTooLargeResponse
+{
+    NSString *response = @"HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n"
+                          "\r\n";
+    return [response dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+- (BOOL)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    const uint8_t *end = bytes + length;
+    NSUInteger len = 0;
+    // Request line: method SP request-target SP HTTP/1.x
+    const uint8_t *next = NextLine(bytes, end, &len);
+    if (!next) {
+        return NO;
+    }
+    const uint8_t *sp1 = memchr(bytes, ' ', len);
+    const uint8_t *sp2 = sp1 ? memchr(sp1 + 1, ' ', (size_t)(bytes + len - sp1 - 1)) : NULL;
+    if (!sp1 || !sp2 || sp1 == bytes || sp2 == sp1 + 1 || bytes + len - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0) {
+        return NO;
+    }
+    _method = [[NSString alloc] initWithBytes:bytes length:(NSUInteger)(sp1 - bytes) encoding:NSASCIIStringEncoding];
+    _resource = [[NSString alloc] initWithBytes:sp1 + 1 length:(NSUInteger)(sp2 - sp1 - 1) encoding:NSISOLatin1StringEncoding];
+    _httpVersion = [[NSString alloc] initWithBytes:sp2 + 1 length:8 encoding:NSASCIIStringEncoding];
+    return ParseHeaderFields(next, end, ^(const uint8_t *name, NSUInteger nameLength, const uint8_t *value, NSUInteger valueLength) {
+        if (IsHeaderName(name, nameLength, "Host")) {
+            _host = AppendHeaderValue(_host, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Upgrade")) {
+            _upgrade = AppendHeaderValue(_upgrade, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Connection")) {
+            _connection = AppendHeaderValue(_connection, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Sec-WebSocket-Key")) {
+            _key = AppendHeaderValue(_key, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Sec-WebSocket-Version")) {
+            _version = AppendHeaderValue(_version, value, valueLength);
+        } else if (IsHeaderName(name, nameLength, "Sec-WebSocket-Protocol")) {
+            _protocols = AppendHeaderValue(_protocols, value, valueLength);
+        }
+    });
+}
+
+- (BOOL)hasConnectionToken:(NSString *)token
+{
+    return HasToken(_connection, token);
+}
+
+- (BOOL)hasValidKey
+{
+    // Base64 of 16 bytes.
+    return _key.length == NNWEBSOCKET_KEY_LENGTH && [_key hasSuffix:@"=="] && [_key canBeConvertedToEncoding:NSASCIIStringEncoding];
+}
+
+- (NSData *)acceptResponseWithProtocols:(NSArray *)protocols
+{
+    char key[NNWEBSOCKET_KEY_LENGTH + 1];
+    if (![self hasValidKey] || ![_key getCString:key maxLength:sizeof(key) encoding:NSASCIIStringEncoding]) {
+        return nil;
+    }
+    char accept[NNWEBSOCKET_ACCEPT_LENGTH + 1];
+    NNWebSocketCreateAccept(key, accept);
+    accept[NNWEBSOCKET_ACCEPT_LENGTH] = '\0';
+    NSMutableString *response = [NSMutableString stringWithString:@"HTTP/1.1 101 Switching Protocols\r\n"];
+    [response appendString:@"Upgrade: websocket\r\n"];
+    [response appendString:@"Connection: Upgrade\r\n"];
+    [response appendFormat:@"Sec-WebSocket-Accept: %s\r\n", accept];
+    for (NSString *protocol in protocols) {
+        if (HasToken(_protocols, protocol)) {
+            [response appendFormat:@"Sec-WebSocket-Protocol: %@\r\n", protocol];
+            break;
+        }
+    }
+    [response appendString:@"\r\n"];
+    return [response dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+@end
@@ -0,0 +1,46 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+typedef NS_ENUM(NSUInteger, NNWebSocketMessageSinkEvent) {
+    NNWebSocketMessageSinkEventStart,
+    NNWebSocketMessageSinkEventData,
+    NNWebSocketMessageSinkEventEnd,
+};
+
+// Receives a message larger than streamingThresholdByteSize in chunks of streamingChunkByteSize at most.
+// Text messages are given as valid UTF-8 bytes.
+@protocol NNWebSocketMessageSink <NSObject>
+
+- (void)messageDidStartWithOpcode:(NNWebSocketFrameOpcode)opcode;
+// Returning NO fails the connection.
+- (BOOL)messageDidReceiveData:(NSData *)data;
+// 'error' is nil when the whole message has been received.
+- (void)messageDidEndWithError:(NSError *)error;
+
+@end
+
+// 'data' is given with data event and 'error' with end event. Returning NO from data event fails the connection.
+typedef BOOL (^NNWebSocketMessageSinkBlock)(NNWebSocketMessageSinkEvent event, NSData *data, NSError *error);
+
+@interface NNWebSocketStreamSink : NSObject <NNWebSocketMessageSink>
+
+// The stream is opened if needed at start and closed at end.
++ (instancetype)sinkWithOutputStream:(NSOutputStream *)stream;
++ (instancetype)sinkWithFilePath:(NSString *)path;
++ (instancetype)sinkWithBlock:(NNWebSocketMessageSinkBlock)block;
+
+@end
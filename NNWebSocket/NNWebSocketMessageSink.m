@@ -0,0 +1,77 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketMessageSink.h"
+
+@implementation NNWebSocketStreamSink
+{
+    NSOutputStream *_stream;
+    NNWebSocketMessageSinkBlock _block;
+}
+
++ (instancetype)sinkWithOutputStream:(NSOutputStream *)stream
+{
+    NNWebSocketStreamSink *sink = [[self alloc] init];
+    sink->_stream = stream;
+    return sink;
+}
+
++ (instancetype)sinkWithFilePath:(NSString *)path
+{
+    return [self sinkWithOutputStream:[NSOutputStream outputStreamToFileAtPath:path append:NO]];
+}
+
++ (instancetype)sinkWithBlock:(NNWebSocketMessageSinkBlock)block
+{
+    NNWebSocketStreamSink *sink = [[self alloc] init];
+    sink->_block = [block copy];
+    return sink;
+}
+
+- (void)messageDidStartWithOpcode:(__unused NNWebSocketFrameOpcode)opcode
+{
+    if (_block) {
+        _block(NNWebSocketMessageSinkEventStart, nil, nil);
+    } else if (_stream.streamStatus == NSStreamStatusNotOpen) {
+        [_stream open];
+    }
+}
+
+- (BOOL)messageDidReceiveData:(NSData *)data
+{
+    if (_block) {
+        return _block(NNWebSocketMessageSinkEventData, data, nil);
+    }
+    const uint8_t *bytes = data.bytes;
+    NSUInteger written = 0;
+    while (written < data.length) {
+        NSInteger len = [_stream write:bytes + written maxLength:data.length - written];
+        if (len <= 0) {
+            return NO;
+        }
+        written += (NSUInteger)len;
+    }
+    return YES;
+}
+
+- (void)messageDidEndWithError:(NSError *)error
+{
+    if (_block) {
+        _block(NNWebSocketMessageSinkEventEnd, nil, error);
+    } else {
+        [_stream close];
+    }
+}
+
+@end
@@ -23,11 +23,83 @@
 @property(nonatomic) NSTimeInterval readTimeoutSec;
 @property(nonatomic) NSTimeInterval writeTimeoutSec;
 @property(nonatomic) NSTimeInterval closeTimeoutSec;
+// Accuracy of the timeouts above. Clamped to 0.01-0.1 sec.
+@property(nonatomic) NSTimeInterval timerResolutionSec;
 @property(nonatomic) NSDictionary* tlsSettings;
+// Opening handshake fails with NNWebSocketErrorHttpHeaderTooLarge when the request or response header is longer.
+// Server side answers 431 then.
+@property(nonatomic) NSUInteger maxHandshakeHeaderByteSize;
+// Reconnects to the same host, port and server name resume the TLS session for tlsSessionLifetimeSec.
+// Connections with the same size and lifetime share one process-wide cache. 0 disables resumption.
+@property(nonatomic) NSUInteger tlsSessionCacheSize;
+@property(nonatomic) NSTimeInterval tlsSessionLifetimeSec;
 @property(nonatomic) uint64_t maxPayloadByteSize;
 @property(nonatomic) NNWebSocketPayloadSizeLimitBehavior payloadSizeLimitBehavior;
+// Frames with payload of this size or larger are read in chunks of streamingChunkByteSize and are not subject to
+// maxPayloadByteSize. Messages starting with such frame go to the sink given by onMessageSink. 0 disables streaming.
+@property(nonatomic) uint64_t streamingThresholdByteSize;
+@property(nonatomic) NSUInteger streamingChunkByteSize;
+// Fragmented messages are assembled and delivered to onText and onData instead of onTextChunk and onDataChunk.
+// Assembled messages are subject to maxPayloadByteSize. With NNWebSocketPayloadSizeLimitBehaviorSplit, they are
+// delivered in parts of up to that size.
+@property(nonatomic) BOOL reassembleFragmentedMessages;
+@property(nonatomic) NSUInteger readBufferByteSize;
+// Pending frames are gathered into one stream write up to this size.
+@property(nonatomic) NSUInteger writeBatchByteSize;
+// onBackpressure is called when buffered bytes exceed high watermark, then onWritable when they fall to low watermark.
+// Both are inclusive: buffered bytes equal to high watermark are within the limit, and equal to low watermark
+// have fallen to it. Buffered bytes include data frames deferred by NNWebSocketSendBufferLimitBehaviorDefer.
+@property(nonatomic) uint64_t sendBufferHighWatermark;
+@property(nonatomic) uint64_t sendBufferLowWatermark;
+// What happens to data frames sent while buffered bytes ahead of them exceed high watermark. Both Reject and
+// Defer compare the same amount. Control frames are never held back.
+@property(nonatomic) NNWebSocketSendBufferLimitBehavior sendBufferLimitBehavior;
+// Frames are no longer read from the network while frames decoded and not delivered to listeners exceed either
+// high watermark, so that TCP flow control slows the sender. Reading resumes when both have fallen to low watermarks.
+// 0 means no limit.
+@property(nonatomic) uint64_t receiveQueueHighWatermark;
+@property(nonatomic) uint64_t receiveQueueLowWatermark;
+@property(nonatomic) NSUInteger receiveQueueHighWatermarkFrames;
+@property(nonatomic) NSUInteger receiveQueueLowWatermarkFrames;
+// Size of fragments which streamed sends are split into.
+@property(nonatomic) NSUInteger sendFragmentByteSize;
+// sendData: and sendText: larger than this are split into fragments as well. 0 disables it.
+@property(nonatomic) uint64_t autoFragmentThresholdByteSize;
+// Socket transport drives a non-blocking socket on the io queue without a runloop thread nor CFNetwork.
+// It does not support TLS, so wss always uses the stream transport.
+@property(nonatomic) NNWebSocketTransportType transportType;
+// Size of the process-wide pool of runloop threads which connections share. 0 means the number of cores.
+// Connections with the same size share the same pool.
+@property(nonatomic) NSUInteger ioThreadCount;
 @property(nonatomic) BOOL keepWorkingOnBackground;
+// Queue which the state machine and listeners run on. Main queue is used when nil. Retained by the options.
+// It should be serial. Each connection runs on a serial queue targeting it, so that a concurrent queue does not
+// run the unsynchronized state machine in parallel, but listeners of different connections may still overlap then.
+@property(nonatomic) dispatch_queue_t callbackQueue;
+// Calls listeners directly on the io queue of the connection instead of callbackQueue.
+@property(nonatomic) BOOL callbackOnIOQueue;
 @property(nonatomic) BOOL disableAutomaticPingPong;
+// Sends a ping carrying a timestamp every pingIntervalSec while open, and measures round trip from its pong.
+// 0 disables it.
+@property(nonatomic) NSTimeInterval pingIntervalSec;
+// Connection fails with NNWebSocketErrorPongTimeout when this many pings in a row have not been answered.
+@property(nonatomic) NSUInteger maxMissedPongs;
+// Skips a ping when a frame has been received within pingIntervalSec.
+@property(nonatomic) BOOL skipPingOnInboundTraffic;
+// Reuses received frame objects once listeners have returned. onFrame must not keep the frame then.
+@property(nonatomic) BOOL recycleReceivedFrames;
+// Interval of onStatistics. 0 disables it.
+@property(nonatomic) NSTimeInterval statisticsIntervalSec;
+// Starts the tracer of the client enabled. It can be enabled and disabled later through the client as well.
+@property(nonatomic) BOOL traceEnabled;
+// Number of events the tracer keeps.
+@property(nonatomic) NSUInteger traceBufferCapacity;
+// Offers permessage-deflate(RFC 7692). Window bits are 8-15, 15 means no restriction.
+@property(nonatomic) BOOL perMessageDeflate;
+@property(nonatomic) NSUInteger deflateClientMaxWindowBits;
+@property(nonatomic) NSUInteger deflateServerMaxWindowBits;
+@property(nonatomic) BOOL deflateClientNoContextTakeover;
+@property(nonatomic) BOOL deflateServerNoContextTakeover;
 @property(nonatomic) NSUInteger verbose;
 
 + (NNWebSocketOptions*)options;
@@ -15,6 +15,9 @@
 #import "NNWebSocketOptions.h"
 
 @implementation NNWebSocketOptions
+{
+    dispatch_queue_t _callbackQueue;
+}
 
 +(NNWebSocketOptions *)options
 {
@@ -29,13 +32,69 @@
         self.closeTimeoutSec = 5;
         self.readTimeoutSec =  5;
         self.writeTimeoutSec = 5;
+        self.timerResolutionSec = 0.05;
+        self.maxHandshakeHeaderByteSize = 16 * 1024;
+        self.tlsSessionCacheSize = 64;
+        self.tlsSessionLifetimeSec = 600;
         self.maxPayloadByteSize = 1073741824ull;
         self.payloadSizeLimitBehavior = NNWebSocketPayloadSizeLimitBehaviorError;
+        self.streamingThresholdByteSize = 0;
+        self.streamingChunkByteSize = 64 * 1024;
+        self.reassembleFragmentedMessages = NO;
+        self.readBufferByteSize = 64 * 1024;
+        self.writeBatchByteSize = 64 * 1024;
+        self.sendBufferHighWatermark = 1024 * 1024;
+        self.sendBufferLowWatermark = 256 * 1024;
+        self.sendBufferLimitBehavior = NNWebSocketSendBufferLimitBehaviorNone;
+        self.receiveQueueHighWatermark = 0;
+        self.receiveQueueLowWatermark = 0;
+        self.receiveQueueHighWatermarkFrames = 0;
+        self.receiveQueueLowWatermarkFrames = 0;
+        self.sendFragmentByteSize = 64 * 1024;
+        self.autoFragmentThresholdByteSize = 0;
+        self.transportType = NNWebSocketTransportTypeStream;
+        self.ioThreadCount = 0;
         self.keepWorkingOnBackground = NO;
+        self.callbackQueue = nil;
+        self.callbackOnIOQueue = NO;
         self.disableAutomaticPingPong = NO;
+        self.pingIntervalSec = 0;
+        self.maxMissedPongs = 2;
+        self.skipPingOnInboundTraffic = NO;
+        self.recycleReceivedFrames = NO;
+        self.statisticsIntervalSec = 0;
+        self.traceEnabled = NO;
+        self.traceBufferCapacity = 16384;
+        self.perMessageDeflate = NO;
+        self.deflateClientMaxWindowBits = 15;
+        self.deflateServerMaxWindowBits = 15;
+        self.deflateClientNoContextTakeover = NO;
+        self.deflateServerNoContextTakeover = NO;
         self.verbose = 0;
     }
     return self;
 }
 
+- (void)dealloc
+{
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    if (_callbackQueue) dispatch_release(_callbackQueue);
+    #endif
+}
+
+- (dispatch_queue_t)callbackQueue
+{
+    return _callbackQueue;
+}
+
+// Queues are not objects to ARC before OS_OBJECT_USE_OBJC, so the property alone would not retain them.
+- (void)setCallbackQueue:(dispatch_queue_t)callbackQueue
+{
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    if (callbackQueue) dispatch_retain(callbackQueue);
+    if (_callbackQueue) dispatch_release(_callbackQueue);
+    #endif
+    _callbackQueue = callbackQueue;
+}
+
 @end
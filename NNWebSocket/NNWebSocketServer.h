@@ -0,0 +1,57 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketClient.h"
+
+@class NNWebSocketOptions;
+@class NNWebSocketClientRFC6455;
+
+typedef void (^NNWebSocketConnectionListener)(id<NNWebSocketClient> connection);
+
+// Accepts WebSocket connections on a TCP port. A connection is a client running the same state machine, parser
+// and transport on the server side: frames from the peer must be masked and frames to it are not. Connections
+// share options, which chooses the transport, callbackQueue and the subprotocols offered by protocols.
+// TLS and permessage-deflate are not supported.
+//
+// onConnection is called on the callbackQueue of the connection when its opening handshake has completed, before
+// any of its messages, so that listeners are set there. The server keeps a connection until it has been closed.
+@interface NNWebSocketServer : NSObject
+
+// Given 0, the port chosen by the system once started.
+@property(readonly, nonatomic) uint16_t port;
+// Number of open connections.
+@property(readonly, nonatomic) NSUInteger connectionCount;
+@property(copy, nonatomic) NNWebSocketConnectionListener onConnection;
+// Sum of the open connections.
+@property(readonly, nonatomic) NNWebSocketStatistics *statistics;
+
+// 'host' is the local address to listen on. nil means every address.
+- (id)initWithHost:(NSString *)host port:(uint16_t)port options:(NNWebSocketOptions *)options;
+// Returns NO with an error of NSPOSIXErrorDomain when the port cannot be listened on.
+- (BOOL)startWithError:(NSError **)error;
+// Stops accepting and closes every connection with NNWebSocketStatusGoingAway.
+- (void)stop;
+- (void)stopWithStatus:(NNWebSocketStatus)status;
+// The frame is encoded once and the same bytes are written to every open connection.
+// Returns the number of connections it has been passed to.
+- (NSUInteger)broadcastFrame:(NNWebSocketFrame *)frame;
+- (NSUInteger)broadcastText:(NSString *)text;
+- (NSUInteger)broadcastData:(NSData *)data;
+
+// Called by accepted connections on their callbackQueue.
+- (void)connectionDidOpen:(NNWebSocketClientRFC6455 *)connection;
+- (void)connectionDidClose:(NNWebSocketClientRFC6455 *)connection;
+
+@end
@@ -0,0 +1,336 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketServer.h"
+#import <pthread.h>
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <netdb.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import "NNWebSocketClientRFC6455.h"
+#import "NNWebSocketFrameEncoder.h"
+#import "NNWebSocketOptions.h"
+#import "NNUtils.h"
+#import "NNWebSocketDebug.h"
+
+// Accepting pauses for a while when the process runs out of descriptors, since the listener stays readable.
+#define ACCEPT_RETRY_DELAY_SEC 0.1
+
+static NSError* POSIXError(int code)
+{
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
+
+@implementation NNWebSocketServer
+{
+    NSString *_host;
+    NNWebSocketOptions *_options;
+    NSUInteger _verbose;
+    NNWebSocketFrameEncoder *_encoder;
+    dispatch_queue_t _acceptQueue;
+    // Touched only on the accept queue.
+    int _listener;
+    dispatch_source_t _acceptSource;
+    BOOL _acceptSuspended;
+    // Connections are added on the accept queue and moved and removed on their callbackQueue.
+    pthread_mutex_t _lock;
+    NSMutableSet *_acceptedConnections;
+    NSMutableSet *_openConnections;
+    // Snapshot of _openConnections for broadcasts, made again after connections have changed.
+    NSArray *_openConnectionList;
+}
+
+- (id)initWithHost:(NSString *)host port:(uint16_t)port options:(NNWebSocketOptions *)options
+{
+    self = [super init];
+    if (self) {
+        _host = host;
+        _port = port;
+        _options = options;
+        _verbose = options.verbose;
+        _encoder = [[NNWebSocketFrameEncoder alloc] initWithMasking:NO];
+        _acceptQueue = dispatch_queue_create("NNWebSocketServer", DISPATCH_QUEUE_SERIAL);
+        _listener = -1;
+        pthread_mutex_init(&_lock, NULL);
+        _acceptedConnections = [NSMutableSet set];
+        _openConnections = [NSMutableSet set];
+        if (options.perMessageDeflate) {
+            LogWarn(@"perMessageDeflate is not supported by server.");
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stopListening];
+    pthread_mutex_destroy(&_lock);
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(_acceptQueue);
+    #endif
+}
+
+#pragma mark public methods
+
+- (BOOL)startWithError:(NSError **)error
+{
+    __block int code = 0;
+    dispatch_sync(_acceptQueue, ^{
+        if (_listener >= 0) {
+            return;
+        }
+        code = [self startListening];
+    });
+    if (code != 0 && error) {
+        *error = POSIXError(code);
+    }
+    return code == 0;
+}
+
+- (void)stop
+{
+    [self stopWithStatus:NNWebSocketStatusGoingAway];
+}
+
+- (void)stopWithStatus:(NNWebSocketStatus)status
+{
+    dispatch_sync(_acceptQueue, ^{
+        [self stopListening];
+    });
+    pthread_mutex_lock(&_lock);
+    NSArray *connections = [[_acceptedConnections allObjects] arrayByAddingObjectsFromArray:[_openConnections allObjects]];
+    pthread_mutex_unlock(&_lock);
+    LogInfo(@"Stopped listening. Closing %lu connections.", (unsigned long)connections.count);
+    for (NNWebSocketClientRFC6455 *connection in connections) {
+        [connection closeWithStatus:status];
+    }
+}
+
+- (NSUInteger)connectionCount
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _openConnections.count;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NNWebSocketStatistics *)statistics
+{
+    NSArray *connections = [self openConnectionList];
+    NSMutableArray *statistics = [NSMutableArray arrayWithCapacity:connections.count];
+    for (NNWebSocketClientRFC6455 *connection in connections) {
+        [statistics addObject:connection.statistics];
+    }
+    return [[NNWebSocketStatistics alloc] initWithStatistics:statistics];
+}
+
+- (NSUInteger)broadcastFrame:(NNWebSocketFrame *)frame
+{
+    NSArray *connections = [self openConnectionList];
+    if (connections.count == 0) {
+        return 0;
+    }
+    NSData *data = [_encoder encodeFrame:frame];
+    NSUInteger count = 0;
+    for (NNWebSocketClientRFC6455 *connection in connections) {
+        if ([connection sendFrame:frame encoded:data]) {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (NSUInteger)broadcastText:(NSString *)text
+{
+    NNWebSocketFrame *frame = [NNWebSocketFrame frameText];
+    frame.text = text;
+    return [self broadcastFrame:frame];
+}
+
+- (NSUInteger)broadcastData:(NSData *)data
+{
+    NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+    frame.data = data;
+    return [self broadcastFrame:frame];
+}
+
+- (void)connectionDidOpen:(NNWebSocketClientRFC6455 *)connection
+{
+    pthread_mutex_lock(&_lock);
+    [_acceptedConnections removeObject:connection];
+    [_openConnections addObject:connection];
+    _openConnectionList = nil;
+    pthread_mutex_unlock(&_lock);
+    if (_onConnection) _onConnection(connection);
+}
+
+- (void)connectionDidClose:(NNWebSocketClientRFC6455 *)connection
+{
+    pthread_mutex_lock(&_lock);
+    [_acceptedConnections removeObject:connection];
+    if ([_openConnections containsObject:connection]) {
+        [_openConnections removeObject:connection];
+        _openConnectionList = nil;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+#pragma mark private methods
+
+- (NSArray *)openConnectionList
+{
+    pthread_mutex_lock(&_lock);
+    if (!_openConnectionList) {
+        _openConnectionList = [_openConnections allObjects];
+    }
+    NSArray *list = _openConnectionList;
+    pthread_mutex_unlock(&_lock);
+    return list;
+}
+
+// Returns errno on failure.
+- (int)startListening
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    // Without a host, one IPv6 socket accepts IPv4 as well.
+    hints.ai_family = _host ? AF_UNSPEC : AF_INET6;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *addresses = NULL;
+    NSString *service = [NSString stringWithFormat:@"%u", _port];
+    int result = getaddrinfo([_host UTF8String], [service UTF8String], &hints, &addresses);
+    if (result != 0) {
+        LogError(@"Failed to resolve host. %s", gai_strerror(result));
+        return EADDRNOTAVAIL;
+    }
+    int code = 0;
+    for (struct addrinfo *address = addresses; address; address = address->ai_next) {
+        int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            code = errno;
+            continue;
+        }
+        int on = 1;
+        int off = 0;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (address->ai_family == AF_INET6 && !_host) {
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if (bind(fd, address->ai_addr, address->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+            code = errno;
+            LogDebug(@"Failed to listen. errno:%d", code);
+            close(fd);
+            continue;
+        }
+        struct sockaddr_storage bound;
+        socklen_t len = sizeof(bound);
+        if (getsockname(fd, (struct sockaddr *)&bound, &len) == 0) {
+            _port = ntohs(bound.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&bound)->sin6_port : ((struct sockaddr_in *)&bound)->sin_port);
+        }
+        _listener = fd;
+        code = 0;
+        break;
+    }
+    freeaddrinfo(addresses);
+    if (_listener < 0) {
+        LogError(@"Failed to listen on port %u. errno:%d", _port, code);
+        return code ?: EADDRNOTAVAIL;
+    }
+    LogInfo(@"Listening on port %u", _port);
+    int fd = _listener;
+    _acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, _acceptQueue);
+    __weak NNWebSocketServer *weakSelf = self;
+    dispatch_source_set_event_handler(_acceptSource, ^{
+        [weakSelf acceptConnections];
+    });
+    dispatch_source_set_cancel_handler(_acceptSource, ^{
+        close(fd);
+    });
+    _acceptSuspended = NO;
+    dispatch_resume(_acceptSource);
+    return 0;
+}
+
+- (void)stopListening
+{
+    if (!_acceptSource) {
+        return;
+    }
+    // A suspended source never runs its cancel handler, so it is resumed before being cancelled.
+    dispatch_source_cancel(_acceptSource);
+    if (_acceptSuspended) {
+        dispatch_resume(_acceptSource);
+    }
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(_acceptSource);
+    #endif
+    _acceptSource = NULL;
+    _acceptSuspended = NO;
+    _listener = -1;
+}
+
+// Accepts every pending connection at once.
+- (void)acceptConnections
+{
+    while (_listener >= 0) {
+        int fd = accept(_listener, NULL, NULL);
+        if (fd >= 0) {
+            [self didAcceptSocket:fd];
+            continue;
+        }
+        int code = errno;
+        if (code == EINTR || code == ECONNABORTED) {
+            continue;
+        }
+        if (code == EMFILE || code == ENFILE) {
+            LogError(@"Failed to accept a connection. errno:%d", code);
+            [self suspendAccepting];
+        } else if (code != EAGAIN && code != EWOULDBLOCK) {
+            LogError(@"Failed to accept a connection. errno:%d", code);
+        }
+        return;
+    }
+}
+
+- (void)suspendAccepting
+{
+    if (_acceptSuspended) {
+        return;
+    }
+    dispatch_source_t source = _acceptSource;
+    _acceptSuspended = YES;
+    dispatch_suspend(source);
+    __weak NNWebSocketServer *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(ACCEPT_RETRY_DELAY_SEC * NSEC_PER_SEC)), _acceptQueue, ^{
+        NNWebSocketServer *server = weakSelf;
+        if (server && server->_acceptSource == source && server->_acceptSuspended) {
+            server->_acceptSuspended = NO;
+            dispatch_resume(source);
+        }
+    });
+}
+
+- (void)didAcceptSocket:(int)descriptor
+{
+    NNWebSocketClientRFC6455 *connection = [[NNWebSocketClientRFC6455 alloc] initWithAcceptedSocket:descriptor server:self options:_options];
+    pthread_mutex_lock(&_lock);
+    [_acceptedConnections addObject:connection];
+    pthread_mutex_unlock(&_lock);
+    [connection open];
+}
+
+@end
@@ -0,0 +1,23 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketStreamTransport.h"
+
+// Transport on a non-blocking BSD socket. Readiness is watched by dispatch sources targeting the io queue,
+// so reads and writes run there without a thread hop, and gathered writes go out by one writev.
+// It reuses the task handling of the stream transport, so like the rest of the library it depends on
+// Foundation and CFNetwork and runs on Apple platforms only.
+@interface NNWebSocketSocketTransport : NNWebSocketStreamTransport
+@end
@@ -0,0 +1,582 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketSocketTransport.h"
+#import <sys/socket.h>
+#import <sys/uio.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <netdb.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import "NNWebSocketOptions.h"
+#import "NNUtils.h"
+#import "NNWebSocketStatistics.h"
+#import "NNWebSocketTracer.h"
+#import "NNWebSocketDebug.h"
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+static NSError* POSIXError(int code)
+{
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
+
+static BOOL IsWouldBlock(int code)
+{
+    return code == EAGAIN || code == EWOULDBLOCK || code == EINTR;
+}
+
+static void ConfigureSocket(int fd)
+{
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    #ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    #endif
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void ReleaseSource(dispatch_source_t source, BOOL suspended)
+{
+    // A suspended source never runs its cancel handler, so it is resumed before being cancelled.
+    dispatch_source_cancel(source);
+    if (suspended) {
+        dispatch_resume(source);
+    }
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(source);
+    #endif
+}
+
+// ================================================================
+// NNWebSocketSocket
+// ================================================================
+// Owns a descriptor. It is closed when the last dispatch source watching it has been cancelled.
+@interface NNWebSocketSocket : NSObject
+@property(readonly, nonatomic) int descriptor;
+- (id)initWithDescriptor:(int)descriptor;
+- (dispatch_source_t)createSourceOfType:(dispatch_source_type_t)type queue:(dispatch_queue_t)queue;
+@end
+
+@implementation NNWebSocketSocket
+
+- (id)initWithDescriptor:(int)descriptor
+{
+    self = [super init];
+    if (self) {
+        _descriptor = descriptor;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    close(_descriptor);
+}
+
+- (dispatch_source_t)createSourceOfType:(dispatch_source_type_t)type queue:(dispatch_queue_t)queue
+{
+    dispatch_source_t source = dispatch_source_create(type, (uintptr_t)_descriptor, 0, queue);
+    NNWebSocketSocket *socket = self;
+    dispatch_source_set_cancel_handler(source, ^{
+        // Keeps the descriptor open until the source has stopped watching it.
+        [socket descriptor];
+    });
+    return source;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketSocketReader
+// ================================================================
+@interface NNWebSocketSocketReader : NNWebSocketTransportReader
+- (id)initWithSocket:(NNWebSocketSocket *)socket queue:(dispatch_queue_t)queue bufferLength:(NSUInteger)bufferLength;
+@end
+
+@implementation NNWebSocketSocketReader
+{
+    NNWebSocketSocket *_socket;
+    dispatch_source_t _source;
+    BOOL _suspended;
+    BOOL _readable;
+    BOOL _finished;
+}
+
+- (id)initWithSocket:(NNWebSocketSocket *)socket queue:(dispatch_queue_t)queue bufferLength:(NSUInteger)bufferLength
+{
+    self = [self initWithQueue:queue bufferLength:bufferLength];
+    if (self) {
+        _socket = socket;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_source) {
+        ReleaseSource(_source, _suspended);
+    }
+}
+
+- (void)open:(NSTimeInterval)timeout
+{
+    dispatch_async(self.queue, ^{
+        // Socket is connected already. Bytes may have arrived before the source is set up, so try reading first.
+        _readable = YES;
+        _source = [_socket createSourceOfType:DISPATCH_SOURCE_TYPE_READ queue:self.queue];
+        __weak NNWebSocketSocketReader *weakSelf = self;
+        dispatch_source_set_event_handler(_source, ^{
+            NNWebSocketSocketReader *reader = weakSelf;
+            if (reader) {
+                reader->_readable = YES;
+                NNTrace(reader.tracer, NNWebSocketTraceEventStreamReadable, 0, 0);
+                [reader pump];
+            }
+        });
+        _suspended = YES;
+        [self didOpen];
+        [self pump];
+    });
+}
+
+- (void)close
+{
+    dispatch_async(self.queue, ^{
+        [self stopWatching];
+    });
+}
+
+- (void)stopWatching
+{
+    _readable = NO;
+    _finished = YES;
+    if (_source) {
+        ReleaseSource(_source, _suspended);
+        _source = NULL;
+        _suspended = NO;
+    }
+}
+
+- (void)pump
+{
+    [super pump];
+    if (!_source) {
+        return;
+    }
+    // The source fires as long as unread bytes remain. It is suspended while the reader leaves them
+    // because of a full buffer, and resumed when they have been drained.
+    if (_readable && !_suspended) {
+        dispatch_suspend(_source);
+        _suspended = YES;
+    } else if (!_readable && _suspended) {
+        dispatch_resume(_source);
+        _suspended = NO;
+    }
+}
+
+- (BOOL)hasBytesAvailable
+{
+    return _readable && !_finished;
+}
+
+- (NSInteger)readBytes:(uint8_t *)bytes maxLength:(NSUInteger)length
+{
+    ssize_t result = recv(_socket.descriptor, bytes, length, 0);
+    return [self didReadWithResult:result];
+}
+
+- (BOOL)canScatter
+{
+    return YES;
+}
+
+- (NSInteger)readVector:(struct iovec *)iov count:(int)count
+{
+    ssize_t result = readv(_socket.descriptor, iov, count);
+    return [self didReadWithResult:result];
+}
+
+- (NSInteger)didReadWithResult:(ssize_t)result
+{
+    if (result > 0) {
+        return result;
+    }
+    int code = errno;
+    if (result < 0 && IsWouldBlock(code)) {
+        _readable = NO;
+        return -1;
+    }
+    NSUInteger _verbose = self.verbose;
+    // Closing is reported after the current pump like stream events are.
+    [self stopWatching];
+    dispatch_async(self.queue, ^{
+        if (result == 0) {
+            LogDebug("Socket has been closed by peer.");
+            [self didClose];
+        } else {
+            LogError("Failed to read socket. errno:%d", code);
+            [self didError:POSIXError(code)];
+        }
+    });
+    return result;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketSocketWriter
+// ================================================================
+@interface NNWebSocketSocketWriter : NNWebSocketTransportWriter
+- (id)initWithSocket:(NNWebSocketSocket *)socket queue:(dispatch_queue_t)queue batchLength:(NSUInteger)batchLength;
+@end
+
+@implementation NNWebSocketSocketWriter
+{
+    NNWebSocketSocket *_socket;
+    dispatch_source_t _source;
+    BOOL _suspended;
+    BOOL _writable;
+    BOOL _finished;
+}
+
+- (id)initWithSocket:(NNWebSocketSocket *)socket queue:(dispatch_queue_t)queue batchLength:(NSUInteger)batchLength
+{
+    self = [self initWithQueue:queue batchLength:batchLength];
+    if (self) {
+        _socket = socket;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_source) {
+        ReleaseSource(_source, _suspended);
+    }
+}
+
+- (void)open:(NSTimeInterval)timeout
+{
+    dispatch_async(self.queue, ^{
+        _writable = YES;
+        _source = [_socket createSourceOfType:DISPATCH_SOURCE_TYPE_WRITE queue:self.queue];
+        __weak NNWebSocketSocketWriter *weakSelf = self;
+        dispatch_source_set_event_handler(_source, ^{
+            NNWebSocketSocketWriter *writer = weakSelf;
+            if (writer) {
+                writer->_writable = YES;
+                NNTrace(writer.tracer, NNWebSocketTraceEventStreamWritable, 0, 0);
+                [writer flush];
+            }
+        });
+        _suspended = YES;
+        [self didOpen];
+        [self flush];
+    });
+}
+
+- (void)close
+{
+    dispatch_async(self.queue, ^{
+        [self stopWatching];
+    });
+}
+
+- (void)stopWatching
+{
+    _writable = NO;
+    _finished = YES;
+    if (_source) {
+        ReleaseSource(_source, _suspended);
+        _source = NULL;
+        _suspended = NO;
+    }
+}
+
+- (void)flush
+{
+    [super flush];
+    if (!_source) {
+        return;
+    }
+    // The source fires whenever the socket has space, so it is watched only while writes are blocked.
+    BOOL waiting = self.hasPendingTasks && !_writable;
+    if (waiting && _suspended) {
+        dispatch_resume(_source);
+        _suspended = NO;
+    } else if (!waiting && !_suspended) {
+        dispatch_suspend(_source);
+        _suspended = YES;
+    }
+}
+
+- (BOOL)hasSpaceAvailable
+{
+    return _writable && !_finished;
+}
+
+- (NSInteger)writeBytes:(const uint8_t *)bytes maxLength:(NSUInteger)length
+{
+    ssize_t result = send(_socket.descriptor, bytes, length, SEND_FLAGS);
+    return [self didWriteWithResult:result];
+}
+
+- (BOOL)canGather
+{
+    return YES;
+}
+
+- (NSInteger)writeVector:(const struct iovec *)iov count:(int)count
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = count;
+    ssize_t result = sendmsg(_socket.descriptor, &msg, SEND_FLAGS);
+    return [self didWriteWithResult:result];
+}
+
+- (NSInteger)didWriteWithResult:(ssize_t)result
+{
+    if (result >= 0) {
+        return result;
+    }
+    int code = errno;
+    _writable = NO;
+    if (IsWouldBlock(code)) {
+        return 0;
+    }
+    [self stopWatching];
+    NSUInteger _verbose = self.verbose;
+    dispatch_async(self.queue, ^{
+        LogError("Failed to write socket. errno:%d", code);
+        [self didError:POSIXError(code)];
+    });
+    return -1;
+}
+
+@end
+
+// ================================================================
+// NNWebSocketSocketTransport
+// ================================================================
+@implementation NNWebSocketSocketTransport
+{
+    NSUInteger _readBufferLength;
+    NSUInteger _writeBatchLength;
+    NNTimingWheel *_timingWheel;
+    struct addrinfo *_addresses;
+    struct addrinfo *_nextAddress;
+    int _lastErrno;
+    NNWebSocketSocket *_connectingSocket;
+    dispatch_source_t _connectSource;
+    NNTimeout *_connectTimer;
+    NSUInteger _attempt;
+    CFAbsoluteTime _resolveStartTime;
+    CFAbsoluteTime _resolvedTime;
+}
+
+- (id)initWithDelegate:(id<NNWebSocketTransportDelegate>)delegate options:(NNWebSocketOptions *)options
+{
+    self = [super initWithDelegate:delegate options:options];
+    if (self) {
+        _readBufferLength = options.readBufferByteSize;
+        _writeBatchLength = options.writeBatchByteSize;
+        _timingWheel = [NNTimingWheel sharedWheelWithResolution:options.timerResolutionSec];
+        if (options.keepWorkingOnBackground) {
+            NSUInteger _verbose = options.verbose;
+            LogWarn(@"keepWorkingOnBackground is not supported by socket transport.");
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stopConnecting];
+}
+
+- (void)connectToHost:(NSString *)host port:(uint16_t)port secure:(BOOL)secure
+{
+    dispatch_queue_t ioQueue = self.ioQueue;
+    dispatch_async(ioQueue, ^{
+        NSUInteger _verbose = self.verbose;
+        [self stopConnecting];
+        NSUInteger attempt = _attempt;
+        LogDebug(@"Resolving %@:%u", host, port);
+        _resolveStartTime = CFAbsoluteTimeGetCurrent();
+        self.counters->tlsDuration = 0;
+        _connectTimer = [_timingWheel scheduleTimeout:self.connectTimeout queue:ioQueue block:^{
+            LogError("Timeout while attempting to connect a socket.");
+            self.counters->connectTimeouts++;
+            [self failToConnectWithError:[NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorConnectTimeout userInfo:nil]];
+        }];
+        // Name resolution blocks, so it runs off the io queue.
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            struct addrinfo *addresses = NULL;
+            NSString *service = [NSString stringWithFormat:@"%u", port];
+            int result = getaddrinfo([host UTF8String], [service UTF8String], &hints, &addresses);
+            dispatch_async(ioQueue, ^{
+                if (attempt != _attempt) {
+                    // Connecting has been cancelled meanwhile.
+                    if (addresses) {
+                        freeaddrinfo(addresses);
+                    }
+                    return;
+                }
+                if (result != 0) {
+                    LogError("Failed to resolve host. %s", gai_strerror(result));
+                    [self failToConnectWithError:[NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorResolveHost userInfo:nil]];
+                    return;
+                }
+                _resolvedTime = CFAbsoluteTimeGetCurrent();
+                self.counters->dnsDuration = _resolvedTime - _resolveStartTime;
+                _addresses = addresses;
+                _nextAddress = addresses;
+                _lastErrno = 0;
+                [self connectToNextAddress];
+            });
+        });
+    });
+}
+
+- (void)disconnect
+{
+    dispatch_async(self.ioQueue, ^{
+        [self stopConnecting];
+    });
+    [super disconnect];
+}
+
+// Tries addresses in the order getaddrinfo returned them, until one of them accepts.
+- (void)connectToNextAddress
+{
+    NSUInteger _verbose = self.verbose;
+    while (_nextAddress) {
+        struct addrinfo *address = _nextAddress;
+        _nextAddress = address->ai_next;
+        int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            _lastErrno = errno;
+            continue;
+        }
+        NNWebSocketSocket *socket = [[NNWebSocketSocket alloc] initWithDescriptor:fd];
+        ConfigureSocket(fd);
+        if (connect(fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            _lastErrno = errno;
+            LogDebug("Failed to connect socket. errno:%d", _lastErrno);
+            continue;
+        }
+        // Socket becomes writable when connecting has finished whether it succeeded or not.
+        _connectingSocket = socket;
+        _connectSource = [socket createSourceOfType:DISPATCH_SOURCE_TYPE_WRITE queue:self.ioQueue];
+        __weak NNWebSocketSocketTransport *weakSelf = self;
+        dispatch_source_set_event_handler(_connectSource, ^{
+            [weakSelf didFinishConnecting];
+        });
+        dispatch_resume(_connectSource);
+        return;
+    }
+    [self failToConnectWithError:POSIXError(_lastErrno ?: ECONNREFUSED)];
+}
+
+- (void)didFinishConnecting
+{
+    if (!_connectSource) {
+        return;
+    }
+    NSUInteger _verbose = self.verbose;
+    NNWebSocketSocket *socket = _connectingSocket;
+    int code = 0;
+    socklen_t len = sizeof(code);
+    if (getsockopt(socket.descriptor, SOL_SOCKET, SO_ERROR, &code, &len) < 0) {
+        code = errno;
+    }
+    ReleaseSource(_connectSource, NO);
+    _connectSource = NULL;
+    _connectingSocket = nil;
+    if (code != 0) {
+        _lastErrno = code;
+        LogDebug("Failed to connect socket. errno:%d", code);
+        [self connectToNextAddress];
+        return;
+    }
+    LogDebug("Socket has been connected.");
+    self.counters->tcpConnectDuration = CFAbsoluteTimeGetCurrent() - _resolvedTime;
+    [self stopConnecting];
+    [self startSocket:socket];
+}
+
+- (void)acceptSocket:(int)descriptor
+{
+    dispatch_async(self.ioQueue, ^{
+        NNWebSocketSocket *socket = [[NNWebSocketSocket alloc] initWithDescriptor:descriptor];
+        ConfigureSocket(descriptor);
+        [self startSocket:socket];
+    });
+}
+
+- (void)startSocket:(NNWebSocketSocket *)socket
+{
+    NNWebSocketSocketReader *reader = [[NNWebSocketSocketReader alloc] initWithSocket:socket queue:self.ioQueue bufferLength:_readBufferLength];
+    NNWebSocketSocketWriter *writer = [[NNWebSocketSocketWriter alloc] initWithSocket:socket queue:self.ioQueue batchLength:_writeBatchLength];
+    [self startReader:reader writer:writer];
+}
+
+- (void)failToConnectWithError:(NSError *)error
+{
+    [self stopConnecting];
+    [self didError:error];
+}
+
+- (void)stopConnecting
+{
+    // Name resolution still in flight is ignored when it returns.
+    _attempt++;
+    [_connectTimer cancel];
+    _connectTimer = nil;
+    if (_connectSource) {
+        ReleaseSource(_connectSource, NO);
+        _connectSource = NULL;
+    }
+    _connectingSocket = nil;
+    if (_addresses) {
+        freeaddrinfo(_addresses);
+        _addresses = NULL;
+        _nextAddress = NULL;
+    }
+}
+
+@end
+
+// ================================================================
+// NNCreateTransport
+// ================================================================
+id<NNWebSocketTransport> NNCreateTransport(id<NNWebSocketTransportDelegate> delegate, NNWebSocketOptions *options, BOOL secure)
+{
+    if (options.transportType == NNWebSocketTransportTypeSocket && !secure) {
+        return [[NNWebSocketSocketTransport alloc] initWithDelegate:delegate options:options];
+    }
+    return [[NNWebSocketStreamTransport alloc] initWithDelegate:delegate options:options];
+}
@@ -30,6 +30,9 @@
 - (void)open;
 - (void)closeWithStatus:(NNWebSocketStatus)status error:(NSError *)error;
 - (void)sendFrame:(NNWebSocketFrame *)frame;
+// Sends a frame which has been encoded already, such as one broadcast to many connections.
+- (void)sendFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data;
+- (void)transport:(id<NNWebSocketTransport>)transport didReadFrame:(NNWebSocketFrame *)frame;
 @end
 
 @interface NNWebSocketStateClosed : NNWebSocketState
@@ -38,6 +41,12 @@
 @interface NNWebSocketStateConnecting : NNWebSocketState
 @end
 
+// Connecting state on the server side. It starts the transport on an accepted socket and answers the opening
+// handshake. The socket is closed with the state unless it has been entered.
+@interface NNWebSocketStateAccepting : NNWebSocketState
++ (instancetype)stateWithContext:(id<NNWebSocketStateContext>)context name:(NSString *)name descriptor:(int)descriptor;
+@end
+
 @interface NNWebSocketStateOpen : NNWebSocketState
 @end
 
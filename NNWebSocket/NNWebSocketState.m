@@ -13,42 +13,52 @@
 // limitations under the License.
 
 #import "NNWebSocketState.h"
-#import <CommonCrypto/CommonDigest.h>
+#import <unistd.h>
 #import "NNUtils.h"
 #import "NNWebSocketStateContext.h"
 #import "NNWebSocketOptions.h"
 #import "NNWebSocketTransport.h"
+#import "NNWebSocketFrameEncoder.h"
+#import "NNWebSocketFrameParser.h"
+#import "NNWebSocketDeflate.h"
+#import "NNWebSocketHandshake.h"
+#import "NNWebSocketStatistics.h"
 #import "NNWebSocketDebug.h"
 
-#define WEBSOCKET_CLIENT_NAME @"NNWebSocket"
-#define WEBSOCKET_CLIENT_VERSION @"1"
-#define WEBSOCKET_GUID @"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#define WEBSOCKET_PROTOCOL_VERSION 13
+#define KEEPALIVE_PAYLOAD_LENGTH 16
 
-typedef NS_ENUM(NSUInteger, NNWebSocketFrameMask)
-{
-    NNWebSocketFrameMaskFin = 0x80,
-    NNWebSocketFrameMaskRsv1 = 0x40,
-    NNWebSocketFrameMaskRsv2 = 0x20,
-    NNWebSocketFrameMaskRsv3 = 0x10,
-    NNWebSocketFrameMaskOpcode = 0x0f,
-    NNWebSocketFrameMaskMask = 0x80,
-    NNWebSocketFrameMaskPayloadLength = 0x7f
-};
+// Keepalive ping payload is the magic, a sequence number and the time it was sent.
+static const uint8_t kKeepaliveMagic[4] = {'N', 'N', 'K', 'A'};
 
 typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
     NNWebSocketAsyncIOTagOpeningHandshake = 100,
-    NNWebSocketAsyncIOTagReadFrameHeader,
-    NNWebSocketAsyncIOTagReadExtPayloadLength,
-    NNWebSocketAsyncIOTagReadPayload,
+    NNWebSocketAsyncIOTagReadFrames,
     NNWebSocketAsyncIOTagWriteFrame,
+    NNWebSocketAsyncIOTagWriteCloseFrame,
 };
 
+static NSData* HeaderTerminator()
+{
+    return [NSData dataWithBytes:"\r\n\r\n" length:4];
+}
+
+// Header read with a length limit ends with the terminator unless the limit was hit.
+static BOOL IsHeaderTruncated(NSData *data)
+{
+    return data.length < 4 || memcmp((const uint8_t *)data.bytes + data.length - 4, "\r\n\r\n", 4) != 0;
+}
+
+@interface NNWebSocketStateOpen ()
+- (NSData *)encodeFrame:(NNWebSocketFrame *)frame;
+- (void)writeFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data tag:(long)tag;
+@end
+
 @implementation NNWebSocketState
 {
     @protected
     __weak id<NNWebSocketStateContext> _context;
-    __weak NNWebSocketTransport *_transport;
+    __weak id<NNWebSocketTransport> _transport;
+    NNWebSocketCounters *_counters;
     NSUInteger _verbose;
 }
 
@@ -66,6 +76,7 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
         _name = name;
         _context = context;
         _transport = context.transport;
+        _counters = context.transport.counters;
         _verbose = context.options.verbose;
     }
     return self;
@@ -75,10 +86,19 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
 - (void)open {}
 - (void)closeWithStatus:(NNWebSocketStatus)status error:(NSError *)error{}
 - (void)sendFrame:(NNWebSocketFrame *)frame {}
-- (void)transportDidConnect:(NNWebSocketTransport *)transport {}
-- (void)transportDidDisconnect:(NNWebSocketTransport *)transport error:(NSError *)error {}
-- (void)transport:(NNWebSocketTransport *)transport didReadData:(NSData *)data tag:(long)tag {}
-- (void)transport:(NNWebSocketTransport *)transport didWriteDataWithTag:(long)tag {}
+- (void)sendFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data {}
+- (void)transportDidConnect:(id<NNWebSocketTransport>)transport {}
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error {}
+- (void)transport:(id<NNWebSocketTransport>)transport didReadData:(NSData *)data tag:(long)tag {}
+- (void)transport:(id<NNWebSocketTransport>)transport didReadFrames:(NSArray *)frames
+{
+    for (NNWebSocketFrame *frame in frames) {
+        [self transport:transport didReadFrame:frame];
+    }
+}
+- (void)transport:(id<NNWebSocketTransport>)transport didReadFrame:(NNWebSocketFrame *)frame {}
+- (void)transport:(id<NNWebSocketTransport>)transport didFailToReadFrameWithStatus:(NNWebSocketStatus)status error:(NSError *)error {}
+- (void)transport:(id<NNWebSocketTransport>)transport didWriteDataWithTag:(long)tag {}
 @end
 
 @implementation NNWebSocketStateClosed
@@ -96,11 +116,14 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
 @implementation NNWebSocketStateConnecting
 {
    @private
-    NSString *_expectedAcceptKey;
+    NNWebSocketHandshakeRequest *_request;
+    char _key[NNWEBSOCKET_KEY_LENGTH];
+    CFAbsoluteTime _upgradeStartTime;
 }
 - (void)didEnter
 {
-    _expectedAcceptKey = nil;
+    _context.deflateExtension = nil;
+    _counters->openingStartTime = CFAbsoluteTimeGetCurrent();
     NSString *host = _context.url.host;
     uint16_t port = (uint16_t)[_context.url.port unsignedIntValue];
     NSString *scheme = _context.url.scheme;
@@ -118,144 +141,224 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
 {
     [_context didOpenFailedWithError:nil];
 }
-- (void)transportDidConnect:(NNWebSocketTransport *)transport
+- (void)transportDidConnect:(id<NNWebSocketTransport>)transport
 {
     [self handshake];
 }
-- (void)transportDidDisconnect:(NNWebSocketTransport *)transport error:(NSError *)error
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error
 {
     [_context didOpenFailedWithError:error];
 }
-- (void)transport:(NNWebSocketTransport *)transport didWriteDataWithTag:(long)tag
+- (void)transport:(id<NNWebSocketTransport>)transport didWriteDataWithTag:(long)tag
 {
     NSAssert(tag == NNWebSocketAsyncIOTagOpeningHandshake, @"");
-    [_transport readDataToData:[NSData dataWithBytes:"\r\n\r\n" length:4] tag:NNWebSocketAsyncIOTagOpeningHandshake];
+    _upgradeStartTime = CFAbsoluteTimeGetCurrent();
+    [_transport readDataToData:HeaderTerminator() maxLength:_context.options.maxHandshakeHeaderByteSize tag:NNWebSocketAsyncIOTagOpeningHandshake];
 }
-- (void)transport:(NNWebSocketTransport *)transport didReadData:(NSData *)data tag:(long)tag
+- (void)transport:(id<NNWebSocketTransport>)transport didReadData:(NSData *)data tag:(long)tag
 {
     NSAssert(tag == NNWebSocketAsyncIOTagOpeningHandshake, @"");
     void (^fail)(NSUInteger code) = ^(NSUInteger code) {
         NSError* error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:code userInfo:nil];
         [_context didOpenFailedWithError:error];
     };
-    CFHTTPMessageRef response = CFHTTPMessageCreateEmpty(kCFAllocatorDefault, FALSE);
-    NSUInteger errCd = 0;
-    if (!CFHTTPMessageAppendBytes(response, [data bytes], [data length])) {
-        LogError(@"Failed to create CFHTTPMessage.");
-        errCd = NNWebSocketErrorHttpResponse;
-    } else if (!CFHTTPMessageIsHeaderComplete(response)) {
+    if (IsHeaderTruncated(data)) {
+        LogError(@"Server returned too large http response header.");
+        fail(NNWebSocketErrorHttpHeaderTooLarge);
+        return;
+    }
+    NNWebSocketHandshakeResponse *response = [NNWebSocketHandshakeResponse responseWithData:data];
+    if (!response) {
         LogError(@"Failed to validate http response header.");
-        errCd = NNWebSocketErrorHttpResponseHeader;
-    } else {
-        CFIndex statusCode = CFHTTPMessageGetResponseStatusCode(response);
-        if (statusCode != 101) {
-            LogError(@"Failed to opening handshake. server returned http status %lu", statusCode);
-            errCd = NNWebSocketErrorHttpResponseStatus;
-        }
+        fail(NNWebSocketErrorHttpResponseHeader);
+        return;
     }
-    if (errCd > 0) {
-        CFRelease(response);
-        fail(errCd);
+    if (response.statusCode != 101) {
+        LogError(@"Failed to opening handshake. server returned http status %ld", (long)response.statusCode);
+        fail(NNWebSocketErrorHttpResponseStatus);
         return;
     }
-    NSString* upgrade = (__bridge_transfer NSString*)CFHTTPMessageCopyHeaderFieldValue(response, CFSTR("Upgrade"));
-    NSString* connection = (__bridge_transfer NSString*)CFHTTPMessageCopyHeaderFieldValue(response, CFSTR("Connection"));
-    NSString* acceptKey = (__bridge_transfer NSString*)CFHTTPMessageCopyHeaderFieldValue(response, CFSTR("Sec-WebSocket-Accept"));
-    CFRelease(response);
-    if ([upgrade caseInsensitiveCompare:@"websocket"] != NSOrderedSame) {
+    NSString* upgrade = response.upgrade;
+    if (!upgrade || [upgrade caseInsensitiveCompare:@"websocket"] != NSOrderedSame) {
         LogError(@"Server returned invalid upgrade protocol name '%@'", upgrade);
         fail(NNWebSocketErrorHttpResponseHeaderUpgrade);
         return;
     }
-    if ([connection caseInsensitiveCompare:@"upgrade"]!= NSOrderedSame)  {
-        LogError(@"Server returned invalid connection field value '%@'", connection);
+    if (!response.connection || ![response hasConnectionToken:@"upgrade"])  {
+        LogError(@"Server returned invalid connection field value '%@'", response.connection);
         fail(NNWebSocketErrorHttpResponseHeaderConnection);
         return;
     }
-    if (![acceptKey isEqualToString:_expectedAcceptKey]) {
-        LogError(@"Server returned unexpected accept key '%@'", acceptKey);
+    if (![response isAcceptedKey:_key]) {
+        LogError(@"Server returned unexpected accept key '%@'", response.accept);
         fail(NNWebSocketErrorHttpResponseHeaderWebSocketAccept);
         return;
     }
+    NSString* extensions = response.extensions;
+    if (extensions) {
+        NNWebSocketDeflateExtension *deflate = nil;
+        if (_context.options.perMessageDeflate) {
+            deflate = [[NNWebSocketDeflateExtension alloc] initWithResponse:extensions options:_context.options];
+        }
+        if (!deflate) {
+            LogError(@"Server returned unexpected extensions '%@'", extensions);
+            fail(NNWebSocketErrorHttpResponseHeaderWebSocketExtensions);
+            return;
+        }
+        LogDebug(@"permessage-deflate is negotiated.");
+        _context.deflateExtension = deflate;
+    }
     LogDebug(@"Open handshake is completed successfully");
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    _counters->upgradeDuration = now - _upgradeStartTime;
+    _counters->handshakeDuration = now - _counters->openingStartTime;
     [_context didOpen];
 }
-- (NSString*)createWebsocketKey
+- (void)handshake
 {
-    unsigned char keySrc[16];
-    for (int i=0; i<16; i++) {
-        unsigned char byte = (unsigned char)(arc4random() % 254);
-        keySrc[i] = byte;
+    if (!_request) {
+        _request = [[NNWebSocketHandshakeRequest alloc] initWithURL:_context.url options:_context.options];
     }
-    NSData* keyData = [NSData dataWithBytes:keySrc length:16];
-    NNBase64* base64 = [NNBase64 base64];
-    return [base64 encode:keyData];
+    NNWebSocketCreateKey(_key);
+    LogDebug(@"Start open handshake.");
+    [_transport  writeData:[_request requestWithKey:_key] tag:NNWebSocketAsyncIOTagOpeningHandshake];
 }
-- (NSString*)createExpectedWebsocketAccept:(NSString*)key
+@end
+
+@implementation NNWebSocketStateAccepting
 {
-    NSMutableString* str = [NSMutableString stringWithString:key];
-    [str appendString:WEBSOCKET_GUID];
-    NSData* src = [str dataUsingEncoding:NSASCIIStringEncoding];
-    unsigned char wk[CC_SHA1_DIGEST_LENGTH];
-    CC_SHA1([src bytes], [src length], wk);
-    NSData* result = [NSData dataWithBytes:wk length:CC_SHA1_DIGEST_LENGTH];
-    NNBase64* base64 = [NNBase64 base64];
-    return [base64 encode:result];
+    @private
+    int _descriptor;
+    NSError *_rejectionError;
 }
-- (void)handshake
++ (instancetype)stateWithContext:(id<NNWebSocketStateContext>)context name:(NSString *)name descriptor:(int)descriptor
 {
-    NSString* websocketKey = [self createWebsocketKey];
-    _expectedAcceptKey = [self createExpectedWebsocketAccept:websocketKey];
-    NSMutableString* handshake = [[NSMutableString alloc] init];
-    NSURL *url = _context.url;
-    NSString *path = (__bridge_transfer NSString*)CFURLCopyPath((__bridge CFURLRef)url);
-    NSMutableString* resource = [NSMutableString stringWithString:path];
-    if ([resource length] == 0) {
-        [resource appendString:@"/"];
-    }
-    if (url.query) {
-        [resource appendFormat:@"?%@", url.query];
-    }
-    [handshake appendFormat:@"GET %@ HTTP/1.1\r\n", resource];
-    [handshake appendFormat:@"Host:%@:%d\r\n", url.host, [url.port unsignedIntValue]];
-    [handshake appendFormat:@"Upgrade: websocket\r\n"];
-    [handshake appendFormat:@"Connection: Upgrade\r\n"];
-    [handshake appendFormat:@"Sec-WebSocket-Key:%@\r\n", websocketKey];
-    [handshake appendFormat:@"Sec-WebSocket-Origin:%@\r\n", _context.options.origin];
-    [handshake appendFormat:@"Sec-WebSocket-Protocol-Client:%@\r\n", WEBSOCKET_CLIENT_NAME];
-    [handshake appendFormat:@"Sec-WebSocket-Version-Client:%@\r\n", WEBSOCKET_CLIENT_VERSION];
-    NSArray *protocols = _context.options.protocols;
-    if (protocols && [protocols count] > 0) {
-        [handshake appendFormat:@"Sec-WebSocket-Protocol:%@\r\n", [protocols componentsJoinedByString:@","]];
-    }
-    [handshake appendFormat:@"Sec-WebSocket-Version:%d\r\n", WEBSOCKET_PROTOCOL_VERSION];
-    [handshake appendFormat:@"\r\n"];
-    NSData* request = [handshake dataUsingEncoding:NSASCIIStringEncoding];
-    LogDebug(@"Start open handshake.");
-    [_transport  writeData:request tag:NNWebSocketAsyncIOTagOpeningHandshake];
+    NNWebSocketStateAccepting *state = [self stateWithContext:context name:name];
+    state->_descriptor = descriptor;
+    return state;
+}
+- (id)initWithContext:(id<NNWebSocketStateContext>)context name:(NSString *)name
+{
+    self = [super initWithContext:context name:name];
+    if (self) {
+        _descriptor = -1;
+    }
+    return self;
+}
+- (void)dealloc
+{
+    if (_descriptor >= 0) {
+        close(_descriptor);
+    }
+}
+- (void)didEnter
+{
+    _context.deflateExtension = nil;
+    _rejectionError = nil;
+    _counters->openingStartTime = CFAbsoluteTimeGetCurrent();
+    if (_descriptor < 0) {
+        LogError(@"Accepted connection cannot be opened again.");
+        [_context didOpenFailedWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:ENOTCONN userInfo:nil]];
+        return;
+    }
+    int descriptor = _descriptor;
+    _descriptor = -1;
+    [_transport acceptSocket:descriptor];
+}
+- (void)closeWithStatus:(NNWebSocketStatus)status error:(NSError *)error
+{
+    [_context didOpenFailedWithError:nil];
+}
+- (void)transportDidConnect:(id<NNWebSocketTransport>)transport
+{
+    LogDebug(@"Wait for open handshake.");
+    [_transport readDataToData:HeaderTerminator() maxLength:_context.options.maxHandshakeHeaderByteSize tag:NNWebSocketAsyncIOTagOpeningHandshake];
+}
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error
+{
+    [_context didOpenFailedWithError:error];
+}
+- (void)transport:(id<NNWebSocketTransport>)transport didReadData:(NSData *)data tag:(long)tag
+{
+    NSAssert(tag == NNWebSocketAsyncIOTagOpeningHandshake, @"");
+    if (IsHeaderTruncated(data)) {
+        LogError(@"Client sent too large http request header.");
+        _rejectionError = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorHttpHeaderTooLarge userInfo:nil];
+        [_transport writeData:[NNWebSocketHandshakeIncomingRequest headerTooLargeResponse] tag:NNWebSocketAsyncIOTagOpeningHandshake];
+        return;
+    }
+    NSData *response = [self responseToRequest:[NNWebSocketHandshakeIncomingRequest requestWithData:data]];
+    if (!response) {
+        // The connection fails once the client has been told why.
+        _rejectionError = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorHttpRequestHeader userInfo:nil];
+        response = [NNWebSocketHandshakeIncomingRequest badRequestResponse];
+    }
+    [_transport writeData:response tag:NNWebSocketAsyncIOTagOpeningHandshake];
+}
+- (void)transport:(id<NNWebSocketTransport>)transport didWriteDataWithTag:(long)tag
+{
+    NSAssert(tag == NNWebSocketAsyncIOTagOpeningHandshake, @"");
+    if (_rejectionError) {
+        [_context didOpenFailedWithError:_rejectionError];
+        return;
+    }
+    LogDebug(@"Open handshake is completed successfully");
+    _counters->handshakeDuration = CFAbsoluteTimeGetCurrent() - _counters->openingStartTime;
+    [_context didOpen];
+}
+- (NSData *)responseToRequest:(NNWebSocketHandshakeIncomingRequest *)request
+{
+    if (!request) {
+        LogError(@"Failed to validate http request header.");
+        return nil;
+    }
+    if (![request.method isEqualToString:@"GET"] || ![request.httpVersion isEqualToString:@"HTTP/1.1"] || !request.host) {
+        LogError(@"Client sent invalid request '%@ %@ %@'", request.method, request.resource, request.httpVersion);
+        return nil;
+    }
+    if (!request.upgrade || [request.upgrade caseInsensitiveCompare:@"websocket"] != NSOrderedSame) {
+        LogError(@"Client sent invalid upgrade protocol name '%@'", request.upgrade);
+        return nil;
+    }
+    if (![request hasConnectionToken:@"upgrade"]) {
+        LogError(@"Client sent invalid connection field value '%@'", request.connection);
+        return nil;
+    }
+    if (![request.version isEqualToString:@"13"]) {
+        LogError(@"Client sent unsupported version '%@'", request.version);
+        return nil;
+    }
+    if (![request hasValidKey]) {
+        LogError(@"Client sent invalid key '%@'", request.key);
+        return nil;
+    }
+    // Extensions are not negotiated on the server side.
+    return [request acceptResponseWithProtocols:_context.options.protocols];
 }
 @end
 
 @implementation NNWebSocketStateOpen
 {
     @private
-    uint64_t _optMaxPayloadSize;
-    NNWebSocketPayloadSizeLimitBehavior _optPayloadSizeLimitBehavior;
-    NNWebSocketFrame* _currentFrame;
-    NNWebSocketFrameTag _tags;
-    uint8_t _opcode;
-    BOOL _fin;
-    uint8_t _payloadLength;
-    uint64_t _extendedPayloadLength;
-    uint64_t _payloadSize;
-    uint64_t _payloadReadOffset;
+    NNWebSocketFrameEncoder *_encoder;
+    NNWebSocketDeflater *_deflater;
+    NSTimeInterval _pingInterval;
+    NSUInteger _maxMissedPongs;
+    BOOL _skipPingOnInboundTraffic;
+    NNTimeout *_pingTimer;
+    uint32_t _pingSequence;
+    BOOL _awaitingPong;
+    NSUInteger _missedPongs;
+    CFAbsoluteTime _lastInboundTime;
 }
 - (id)initWithContext:(id <NNWebSocketStateContext>)context name:(NSString *)name
 {
     self = [super initWithContext:context name:name];
     if (self) {
-        _optMaxPayloadSize = context.options.maxPayloadByteSize;
-        _optPayloadSizeLimitBehavior = context.options.payloadSizeLimitBehavior;
+        _encoder = [[NNWebSocketFrameEncoder alloc] initWithMasking:!context.serverSide];
+        _pingInterval = context.options.pingIntervalSec;
+        _maxMissedPongs = MAX((NSUInteger)1, context.options.maxMissedPongs);
+        _skipPingOnInboundTraffic = context.options.skipPingOnInboundTraffic;
     }
     return self;
 }
@@ -280,218 +383,148 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
 }
 - (void)sendFrame:(NNWebSocketFrame *)frame
 {
-    // Calculate frame byte size
-    NSUInteger payloadLen = frame.data.length;
-    NSUInteger headerLen = 0;
-    if (payloadLen <= 125) {
-        headerLen = 2;
-    } else if (payloadLen <= UINT16_MAX) {
-        headerLen = 4;
-    } else {
-        headerLen = 10;
-    }
-    headerLen += 4;
-    // Init buffers
-    NSUInteger cnt = 0;
-    uint8_t headerBuff[headerLen];
-    memset(headerBuff, 0, sizeof(headerBuff));
-    // fin
-    if (frame.fin) {
-        headerBuff[cnt] += NNWebSocketFrameMaskFin;
-    }
-    // opcode
-    headerBuff[cnt] += frame.opcode & 0xf;
-    // mask
-    cnt++;
-    headerBuff[cnt] += NNWebSocketFrameMaskMask;
-    // payload len
-    if (payloadLen <= 125) {
-        headerBuff[cnt] += payloadLen;
-    } else if (payloadLen <= UINT16_MAX) {
-        headerBuff[cnt] += 126;
-        uint16_t l = (uint16_t)payloadLen;
-        headerBuff[++cnt] = (uint8_t)((l & 0xff00) >> 8);
-        headerBuff[++cnt] = (uint8_t)(l & 0x00ff);
-    } else {
-        headerBuff[cnt] += 127;
-        uint64_t l = payloadLen;
-        for (int i=8; i>0; i--) {
-            int shift = (i - 1) * 8;
-            headerBuff[++cnt] = (uint8_t)((l >> shift) & 0xff);
-        }
-    }
-    // masking key
-    uint8_t maskingKey[4];
-    uint32_t src = arc4random();
-    for (int i=4; i>0; i--) {
-        int shift = (i -1) * 8;
-        uint8_t k = (uint8_t)((src >> shift) & 0xff);
-        maskingKey[4- i] = k;
-        headerBuff[++cnt] = k;
-    }
-    // payload
-    NSMutableData *maskedData = [NSMutableData dataWithData:frame.data];
-    uint8_t *payloadBuff = (uint8_t *)[maskedData mutableBytes];
-    for (int i=0; i<payloadLen; i++) {
-        payloadBuff[i] ^= maskingKey[i % 4];
-    }
-    NSMutableData *f = [NSMutableData data];
-    [f appendBytes:headerBuff length:headerLen];
-    [f appendData:maskedData];
-
-    [_transport writeData:f tag:NNWebSocketAsyncIOTagWriteFrame];
+    [self writeFrame:frame encoded:[self encodeFrame:frame] tag:NNWebSocketAsyncIOTagWriteFrame];
 }
-- (void)didEnter
+- (void)sendFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data
 {
-    [self readFrameHeader];
+    // A frame encoded for other connections does not carry the compression of this one.
+    [self writeFrame:frame encoded:_deflater ? [self encodeFrame:frame] : data tag:NNWebSocketAsyncIOTagWriteFrame];
 }
-- (void)transportDidDisconnect:(NNWebSocketTransport *)transport error:(NSError *)error
+- (NSData *)encodeFrame:(NNWebSocketFrame *)frame
 {
-    if (!error) {
-        LogInfo(@"TCP Socket is disconnected.");
-    } else {
-        LogError(@"TCP Socket is disconnected with error(domain:%@ code:%d)", error.domain, error.code);
+    BOOL isControlFrame = (frame.opcode & 0x08) > 0;
+    if (_deflater && !isControlFrame) {
+        NSData *payload = [_deflater deflateData:frame.data fin:frame.fin];
+        BOOL first = frame.opcode != NNWebSocketFrameOpcodeContinuation;
+        return [_encoder encodeFrameWithOpcode:frame.opcode fin:frame.fin rsv1:first parts:@[payload]];
     }
-    [self changeToClosedWithError:error closureType:NNWebSocketClosureTypeUnclean];
+    return [_encoder encodeFrame:frame];
 }
-- (void)transport:(NNWebSocketTransport *)transport didReadData:(NSData *)data tag:(long)tag
+- (void)writeFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data tag:(long)tag
 {
-    if (tag == NNWebSocketAsyncIOTagReadFrameHeader) {
-        [self didReadFrameHeader:data];
-    } else if (tag == NNWebSocketAsyncIOTagReadExtPayloadLength) {
-        [self didReadFrameExtPayloadLength:data];
-    } else if (tag == NNWebSocketAsyncIOTagReadPayload) {
-        [self didReadFramePayload:data];
+    NSUInteger i = frame.opcode & 0x0f;
+    _counters->framesOut[i]++;
+    _counters->payloadBytesOut[i] += frame.data.length;
+    if (frame.opcode == NNWebSocketFrameOpcodePing) {
+        _counters->pingSentTime = CFAbsoluteTimeGetCurrent();
     }
+    // Ping and pong may go between fragments of a large message. Close frame has to follow data frames.
+    BOOL urgent = frame.opcode == NNWebSocketFrameOpcodePing || frame.opcode == NNWebSocketFrameOpcodePong;
+    [_transport writeData:data tag:tag urgent:urgent];
 }
-- (void)readFrameHeader
+- (void)didEnter
 {
-    _currentFrame = nil;
-    _tags = NNWebSocketFrameTagNone;
-    _opcode = 0;
-    _fin = NO;
-    _payloadLength = 0;
-    _extendedPayloadLength = 0;
-    _payloadSize = 0;
-    _payloadReadOffset = 0;
-    [_transport readDataToLength:2 timeout:-1 tag:NNWebSocketAsyncIOTagReadFrameHeader];
+    NNWebSocketDeflateExtension *deflate = _context.deflateExtension;
+    _deflater = nil;
+    if (deflate) {
+        _deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:deflate.clientMaxWindowBits noContextTakeover:deflate.clientNoContextTakeover];
+    }
+    NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:_context.options deflate:deflate];
+    parser.framePool = _context.framePool;
+    parser.expectsMask = _context.serverSide;
+    [_transport readFramesWithParser:parser tag:NNWebSocketAsyncIOTagReadFrames];
+    if (_pingInterval > 0) {
+        _awaitingPong = NO;
+        _missedPongs = 0;
+        _lastInboundTime = CFAbsoluteTimeGetCurrent();
+        [self schedulePing];
+    }
 }
-- (void)didReadFrameHeader:(NSData *)data
+- (void)didExit
 {
-    void (^fail)(NNWebSocketStatus, NNWebSocketError) = ^(NNWebSocketStatus status, NNWebSocketError code) {
-        _context.status = status;
-        _context.error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:code userInfo:nil];
-        [self changeToClosing];
-    };
-    uint8_t *b = (uint8_t*)[data bytes];
-    _opcode = (NNWebSocketFrameOpcode)(b[0] & NNWebSocketFrameMaskOpcode);
-    LogDebug(@"Reading frame header(opcode:%d)", _opcode);
-    if (_opcode >= NNWebSocketFrameOpcodeReservedDataFrame1 && _opcode <= NNWebSocketFrameOpcodeReservedDataFrame5) {
-        LogError(@"Invalid reserved non control frame.");
-        fail(NNWebSocketStatusProtocolError, NNWebSocketErrorUnkownDataFrameType);
-        return;
-    }
-    if (_opcode >= NNWebSocketFrameOpcodeReservedControlFrame1 && _opcode <= NNWebSocketFrameOpcodeReservedControlFrame5) {
-        LogError(@"Invalid reserved control frame.");
-        fail(NNWebSocketStatusProtocolError, NNWebSocketErrorUnkownControlFrameType);
+    [_pingTimer cancel];
+    _pingTimer = nil;
+}
+- (void)schedulePing
+{
+    __weak NNWebSocketStateOpen *weakSelf = self;
+    NNTimingWheel *timingWheel = [NNTimingWheel sharedWheelWithResolution:_context.options.timerResolutionSec];
+    _pingTimer = [timingWheel scheduleTimeout:_pingInterval queue:_context.callbackQueue block:^{
+        [weakSelf keepalive];
+    }];
+}
+- (void)keepalive
+{
+    if (!_pingTimer) {
         return;
     }
-    if ((_opcode & 0x08) > 0) {
-        _tags |= NNWebSocketFrameTagControlFrame;
-    } else {
-        _tags |= NNWebSocketFrameTagDataFrame;
-    }
-    _fin = (b[0] & NNWebSocketFrameMaskFin) > 0;
-    BOOL rsv1 = (b[0] & NNWebSocketFrameMaskRsv1) > 0;
-    BOOL rsv2 = (b[0] & NNWebSocketFrameMaskRsv2) > 0;
-    BOOL rsv3 = (b[0] & NNWebSocketFrameMaskRsv3) > 0;
-    if (rsv1 || rsv2 || rsv3) {
-        LogError(@"Invalid RSV bits");
-        fail(NNWebSocketStatusProtocolError, NNWebSocketErrorInvalidRsvBit);
+    _pingTimer = nil;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (_awaitingPong && ++_missedPongs >= _maxMissedPongs) {
+        LogError(@"No pong has been received for %lu pings.", (unsigned long)_missedPongs);
+        NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorPongTimeout userInfo:nil];
+        [self changeToClosedWithError:error closureType:NNWebSocketClosureTypeUnclean];
         return;
     }
-    BOOL mask = (b[1] & NNWebSocketFrameMaskMask) > 0;
-    if (mask) {
-        LogError(@"Invalid mask.");
-        fail(NNWebSocketStatusProtocolError, NNWebSocketErrorReceiveFrameMask);
+    if (_skipPingOnInboundTraffic && now - _lastInboundTime < _pingInterval) {
+        // Peer is alive as long as frames arrive.
+        _awaitingPong = NO;
+        _missedPongs = 0;
+        [self schedulePing];
         return;
     }
-    _payloadLength = b[1] & NNWebSocketFrameMaskPayloadLength;
-    if (_tags & NNWebSocketFrameTagControlFrame) {
-        if (_payloadLength > 125) {
-            fail(NNWebSocketStatusProtocolError, NNWebSocketErrorControlFramePayloadSize);
-            return;
-        }
-        if (!_fin) {
-            fail(NNWebSocketStatusProtocolError, NNWebSocketErrorControlFrameFin);
-            return;
-        }
-    }
-    if (_payloadLength > 125) {
-        [self readFrameExtPayloadLength];
+    uint8_t payload[KEEPALIVE_PAYLOAD_LENGTH];
+    uint32_t sequence = CFSwapInt32HostToBig(++_pingSequence);
+    memcpy(payload, kKeepaliveMagic, 4);
+    memcpy(payload + 4, &sequence, 4);
+    memcpy(payload + 8, &now, 8);
+    NNWebSocketFrame *ping = [NNWebSocketFrame framePing];
+    ping.data = [NSData dataWithBytes:payload length:KEEPALIVE_PAYLOAD_LENGTH];
+    LogDebug(@"Send keepalive ping %u.", _pingSequence);
+    [self sendFrame:ping];
+    _awaitingPong = YES;
+    [self schedulePing];
+}
+// Returns NO when the pong does not answer a keepalive ping.
+- (BOOL)didReceiveKeepalivePong:(NSData *)data at:(CFAbsoluteTime)now
+{
+    if (data.length != KEEPALIVE_PAYLOAD_LENGTH || memcmp(data.bytes, kKeepaliveMagic, 4) != 0) {
+        return NO;
+    }
+    // Pong may answer an earlier ping, which proves the peer alive as well.
+    CFAbsoluteTime sent;
+    memcpy(&sent, (const uint8_t *)data.bytes + 8, 8);
+    [_counters addPingRoundTripTime:now - sent];
+    _counters->pingSentTime = 0;
+    _awaitingPong = NO;
+    _missedPongs = 0;
+    return YES;
+}
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error
+{
+    if (!error) {
+        LogInfo(@"TCP Socket is disconnected.");
     } else {
-        [self readFramePayload];
+        LogError(@"TCP Socket is disconnected with error(domain:%@ code:%d)", error.domain, error.code);
     }
+    [self changeToClosedWithError:error closureType:NNWebSocketClosureTypeUnclean];
 }
-- (void)readFrameExtPayloadLength
-{
-    NSAssert(_payloadLength == 126 || _payloadLength == 127, @"");
-    NSUInteger readLen = _payloadLength == 126 ? 2 : 8;
-    [_transport  readDataToLength:readLen tag:NNWebSocketAsyncIOTagReadExtPayloadLength];
-}
-- (void)didReadFrameExtPayloadLength:(NSData *)data
+- (void)transport:(id<NNWebSocketTransport>)transport didReadFrame:(NNWebSocketFrame *)frame
 {
-    NSUInteger dataLen = [data length];
-    NSAssert(dataLen == 2 || dataLen == 8, @"");
-    uint8_t* b = (uint8_t*)[data bytes];
-    int cnt = 0;
-    uint64_t extPayloadLen = 0;
-    for (int i=dataLen; i>0; i--) {
-        int shift = (i -1) * 8;
-        extPayloadLen += b[cnt++] << shift;
+    NSUInteger i = frame.opcode & 0x0f;
+    _counters->framesIn[i]++;
+    _counters->payloadBytesIn[i] += frame.data.length;
+    if (_skipPingOnInboundTraffic && _pingInterval > 0) {
+        _lastInboundTime = CFAbsoluteTimeGetCurrent();
     }
-    _extendedPayloadLength = extPayloadLen;
-    [self readFramePayload];
-}
-- (void)readFramePayload
-{
-    _payloadSize = _payloadLength <= 125 ? (uint64_t) _payloadLength : _extendedPayloadLength;
-    LogDebug(@"Reading payload data(%qu bytes)", _payloadSize);
-    if (_payloadSize == 0) {
-        [self didReadFramePayload:[NSData data]];
-        return;
-    } else if (_payloadSize > _optMaxPayloadSize && _optPayloadSizeLimitBehavior == NNWebSocketPayloadSizeLimitBehaviorError) {
-        LogError(@"Payload size is too large.(%qu bytes)", _payloadSize);
-        _context.status = NNWebSocketStatusMessageTooBig;
-        _context.error = nil;
-        _context.closureType = NNWebSocketClosureTypeClientInitiated;
-        [self changeToClosing];
+    if (frame.opcode == NNWebSocketFrameOpcodePong) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        if (![self didReceiveKeepalivePong:frame.data at:now]) {
+            [_counters didReceivePongAt:now];
+        }
+    }
+    if (frame.opcode == NNWebSocketFrameOpcodeClose) {
+        [self didReadCloseFramePayload:frame.data];
         return;
     }
-    NSUInteger readLen = (NSUInteger)MIN(_payloadSize, _optMaxPayloadSize);
-    [_transport readDataToLength:readLen tag:NNWebSocketAsyncIOTagReadPayload];
+    [_context didReceiveFrame:frame];
 }
-- (void)didReadFramePayload:(NSData*)data
+- (void)transport:(id<NNWebSocketTransport>)transport didFailToReadFrameWithStatus:(NNWebSocketStatus)status error:(NSError *)error
 {
-    if (_opcode == NNWebSocketFrameOpcodeClose) {
-        [self didReadCloseFramePayload:data];
-        return;
-    }
-    NSUInteger len =  data.length;
-    NNWebSocketFrameOpcode opcode = _payloadReadOffset == 0 ? (NNWebSocketFrameOpcode)_opcode : NNWebSocketFrameOpcodeContinuation;
-    _payloadReadOffset += len;
-    if (_payloadReadOffset < _payloadSize) {
-        NNWebSocketFrame * frame = [[NNWebSocketFrame alloc] initWithOpcode:opcode fin:NO payload:data];
-        [frame addTags:_tags];
-        [_context didReceiveFrame:frame];
-        NSUInteger readLen = (NSUInteger)MIN(_payloadSize - _payloadReadOffset, _optMaxPayloadSize);
-        [_transport readDataToLength:readLen tag:NNWebSocketAsyncIOTagReadPayload];
-    } else {
-         NNWebSocketFrame * frame = [[NNWebSocketFrame alloc] initWithOpcode:(NNWebSocketFrameOpcode)opcode fin:_fin payload:data];
-        [frame addTags:_tags];
-        [_context didReceiveFrame:frame];
-        [self readFrameHeader];
-    }
+    _context.status = status;
+    _context.error = error;
+    _context.closureType = NNWebSocketClosureTypeClientInitiated;
+    [self changeToClosing];
 }
 
 - (void)didReadCloseFramePayload:(NSData *)data
@@ -503,8 +536,7 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
         status = b[0] << 8;
         status += b[1];
         if (len > 2) {
-            NNUTF8Buffer *buff = [NNUTF8Buffer buffer];
-            if (![buff appendData:[data subdataWithRange:NSMakeRange(2, len -2)]]) {
+            if (!NNIsValidUTF8(b + 2, len - 2)) {
                 LogError(@"Received a close frame with invalid UTF8 payload.");
                 status = NNWebSocketStatusInvalidFramePayloadData;
             }
@@ -552,6 +584,10 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
 {
     // Do nothing.
 }
+- (void)sendFrame:(NNWebSocketFrame *)frame encoded:(NSData *)data
+{
+    // Do nothing.
+}
 - (void)didEnter
 {
     if (_context.closureType == NNWebSocketClosureTypeClientInitiated) {
@@ -572,30 +608,41 @@ typedef NS_ENUM(NSUInteger, NNWebSocketAsyncIOTag) {
     } else {
         LogDebug(@"Send close frame. (status:%d)", s);
     }
-    [super sendFrame:frame];
+    [self writeFrame:frame encoded:[self encodeFrame:frame] tag:NNWebSocketAsyncIOTagWriteCloseFrame];
     NSTimeInterval closeTimeout = _context.options.closeTimeoutSec;
     LogDebug(@"Set close timer which waits %.1f sec.", closeTimeout);
-    _context.closeTimer = NNCreateTimer(dispatch_get_main_queue(), closeTimeout, ^{
+    NNTimingWheel *timingWheel = [NNTimingWheel sharedWheelWithResolution:_context.options.timerResolutionSec];
+    _context.closeTimer = [timingWheel scheduleTimeout:closeTimeout queue:_context.callbackQueue block:^{
         LogInfo(@"Close timeout.");
+        _counters->closeTimeouts++;
         NSError* error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorCloseTimeout userInfo:nil];
         _context.error = error;
         [_context didClose];
-    });
+    }];
 }
 - (void)didExit
 {
-    NNCancelTimer(_context.closeTimer);
-    #if NEEDS_DISPATCH_RETAIN_RELEASE
-    dispatch_release(_context.closeTimer);
-    #endif
+    [_context.closeTimer cancel];
+    _context.closeTimer = nil;
 }
 - (void)didReceiveCloseFrame:(NNWebSocketStatus)status
 {
     LogDebug(@"Got close response frame from server. (status:%d)",status);
     LogDebug(@"Close handshake is completed successfully");
+    if (_context.serverSide) {
+        // Server closes TCP connection first.
+        [_context didClose];
+    }
+}
+- (void)transport:(id<NNWebSocketTransport>)transport didWriteDataWithTag:(long)tag
+{
+    if (tag == NNWebSocketAsyncIOTagWriteCloseFrame && _context.serverSide && _context.closureType == NNWebSocketClosureTypeServerInitiated) {
+        LogDebug(@"Close reply has been sent. Closing TCP connection.");
+        [_context didClose];
+    }
 }
 
-- (void)transportDidDisconnect:(NNWebSocketTransport *)transport error:(NSError *)error
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error
 {
     LogDebug(@"TCP Socket is disconnected by server.")
     NSError *err = error;
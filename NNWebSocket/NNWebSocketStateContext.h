@@ -14,8 +14,12 @@
 
 @class NNWebSocketFrame;
 @class NNWebSocketOptions;
-@class NNWebSocketTransport;
+@protocol NNWebSocketTransport;
+@class NNTimeout;
+@class NNWebSocketDeflateExtension;
+@class NNWebSocketFramePool;
 
+// On the server side, client initiated means initiated by this end and server initiated means by the peer.
 typedef NS_ENUM(NSUInteger, NNWebSocketClosureType)  {
     NNWebSocketClosureTypeClientInitiated,
     NNWebSocketClosureTypeServerInitiated,
@@ -26,11 +30,19 @@ typedef NS_ENUM(NSUInteger, NNWebSocketClosureType)  {
 
 @property(readonly, nonatomic) NSURL *url;
 @property(readonly, nonatomic) NNWebSocketOptions *options;
-@property(readonly, nonatomic) NNWebSocketTransport *transport;
+@property(readonly, nonatomic) id<NNWebSocketTransport> transport;
 @property(nonatomic) NNWebSocketStatus status;
 @property(nonatomic) NSError *error;
 @property(nonatomic) NNWebSocketClosureType closureType;
-@property(nonatomic) dispatch_source_t closeTimer;
+@property(nonatomic) NNTimeout *closeTimer;
+// permessage-deflate parameters accepted by the server. nil when not negotiated.
+@property(nonatomic) NNWebSocketDeflateExtension *deflateExtension;
+// Queue which the state machine runs on.
+@property(readonly, nonatomic) dispatch_queue_t callbackQueue;
+// Pool which received frames are taken from. nil unless recycleReceivedFrames is set.
+@property(readonly, nonatomic) NNWebSocketFramePool *framePool;
+// YES for a connection accepted by NNWebSocketServer. It receives masked frames and sends unmasked ones.
+@property(readonly, nonatomic) BOOL serverSide;
 
 - (void)performOpeningHandshaking;
 - (void)performClosingHandshaking;
@@ -0,0 +1,117 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketDefine.h"
+
+#define NNWEBSOCKET_OPCODE_COUNT 16
+#define NNWEBSOCKET_RTT_BUCKET_COUNT 16
+
+// ================================================================
+// Counters
+// ================================================================
+// Live counters of a connection. Each field is written from one queue only, by a plain add, and is read
+// without locking. Fields of the io queue are bytes, queue depths, transport timeouts, TLS sessions and
+// connecting phases but upgrade. The others are written on the callback queue.
+@interface NNWebSocketCounters : NSObject
+{
+    @package
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t framesIn[NNWEBSOCKET_OPCODE_COUNT];
+    uint64_t framesOut[NNWEBSOCKET_OPCODE_COUNT];
+    uint64_t payloadBytesIn[NNWEBSOCKET_OPCODE_COUNT];
+    uint64_t payloadBytesOut[NNWEBSOCKET_OPCODE_COUNT];
+    NSUInteger readQueueDepth;
+    NSUInteger writeQueueDepth;
+    NSUInteger connectTimeouts;
+    NSUInteger readTimeouts;
+    NSUInteger writeTimeouts;
+    NSUInteger closeTimeouts;
+    CFAbsoluteTime openingStartTime;
+    NSTimeInterval handshakeDuration;
+    NSTimeInterval dnsDuration;
+    NSTimeInterval tcpConnectDuration;
+    NSTimeInterval tlsDuration;
+    NSTimeInterval upgradeDuration;
+    uint64_t tlsSessionHits;
+    uint64_t tlsSessionMisses;
+    CFAbsoluteTime pingSentTime;
+    NSTimeInterval pingRoundTripTime;
+    NSTimeInterval smoothedPingRoundTripTime;
+    uint64_t pingRoundTripTimeBuckets[NNWEBSOCKET_RTT_BUCKET_COUNT];
+}
+
+// Close reason is an object, so it is set under a lock.
+- (void)setCloseStatus:(NNWebSocketStatus)status error:(NSError *)error;
+// Measures the round trip from pingSentTime.
+- (void)didReceivePongAt:(CFAbsoluteTime)time;
+- (void)addPingRoundTripTime:(NSTimeInterval)rtt;
+
+@end
+
+// ================================================================
+// Statistics
+// ================================================================
+// Snapshot of the counters of a connection. Counters keep counting across reconnects.
+@interface NNWebSocketStatistics : NSObject
+
+@property(readonly, nonatomic) CFAbsoluteTime timestamp;
+// Bytes read from and written to the network, including frame headers and the handshake.
+@property(readonly, nonatomic) uint64_t bytesReceived;
+@property(readonly, nonatomic) uint64_t bytesSent;
+@property(readonly, nonatomic) uint64_t framesReceived;
+@property(readonly, nonatomic) uint64_t framesSent;
+// Read tasks waiting in the transport, and write tasks not written to the network yet.
+@property(readonly, nonatomic) NSUInteger readQueueDepth;
+@property(readonly, nonatomic) NSUInteger writeQueueDepth;
+@property(readonly, nonatomic) uint64_t bufferedAmount;
+// From the start of connecting to the end of the opening handshake. 0 until the first open.
+@property(readonly, nonatomic) NSTimeInterval handshakeDuration;
+// Phases of the latest connecting. Name resolution is told apart by socket transport only, and is included
+// in tcpConnectDuration otherwise. TLS covers until the upgrade request has been written. Upgrade is from then
+// until the response has been validated.
+@property(readonly, nonatomic) NSTimeInterval dnsDuration;
+@property(readonly, nonatomic) NSTimeInterval tcpConnectDuration;
+@property(readonly, nonatomic) NSTimeInterval tlsDuration;
+@property(readonly, nonatomic) NSTimeInterval upgradeDuration;
+// Secure connects which offered a cached TLS session, and which made a full handshake.
+@property(readonly, nonatomic) uint64_t tlsSessionHits;
+@property(readonly, nonatomic) uint64_t tlsSessionMisses;
+// Round trip of the latest ping answered by a pong, and its moving average. 0 until the first pong.
+@property(readonly, nonatomic) NSTimeInterval pingRoundTripTime;
+@property(readonly, nonatomic) NSTimeInterval smoothedPingRoundTripTime;
+// Counts of round trips by bucket. Bucket i counts ones under 2^i msec, and the last one counts the rest.
+@property(readonly, nonatomic) NSArray *pingRoundTripTimeHistogram;
+@property(readonly, nonatomic) NSUInteger connectTimeoutCount;
+@property(readonly, nonatomic) NSUInteger readTimeoutCount;
+@property(readonly, nonatomic) NSUInteger writeTimeoutCount;
+@property(readonly, nonatomic) NSUInteger closeTimeoutCount;
+// Reason of the last close. NNWebSocketStatusNoStatus until closed.
+@property(readonly, nonatomic) NNWebSocketStatus closeStatus;
+@property(readonly, nonatomic) NSError *closeError;
+
+- (id)initWithCounters:(NNWebSocketCounters *)counters bufferedAmount:(uint64_t)bufferedAmount;
+// Sum of snapshots of several connections. Durations and round trips are the largest ones, and close reason
+// is the last one of the connections which have been closed.
+- (id)initWithStatistics:(NSArray *)statistics;
+- (uint64_t)framesReceivedWithOpcode:(NNWebSocketFrameOpcode)opcode;
+- (uint64_t)framesSentWithOpcode:(NNWebSocketFrameOpcode)opcode;
+// Payload bytes before compression.
+- (uint64_t)payloadBytesReceivedWithOpcode:(NNWebSocketFrameOpcode)opcode;
+- (uint64_t)payloadBytesSentWithOpcode:(NNWebSocketFrameOpcode)opcode;
+// Plain values keyed by property names, with per opcode counts under "opcodes", for exporting.
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
@@ -0,0 +1,264 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketStatistics.h"
+
+// Weight of a new sample in the smoothed round trip time, as TCP does for SRTT.
+#define RTT_SMOOTHING_FACTOR 0.125
+
+static NSString *const kOpcodeNames[NNWEBSOCKET_OPCODE_COUNT] = {
+    @"continuation", @"text", @"binary", nil, nil, nil, nil, nil,
+    @"close", @"ping", @"pong", nil, nil, nil, nil, nil,
+};
+
+// ================================================================
+// NNWebSocketCounters
+// ================================================================
+@implementation NNWebSocketCounters
+{
+    NNWebSocketStatus _closeStatus;
+    NSError *_closeError;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _closeStatus = NNWebSocketStatusNoStatus;
+    }
+    return self;
+}
+
+- (void)setCloseStatus:(NNWebSocketStatus)status error:(NSError *)error
+{
+    @synchronized(self) {
+        _closeStatus = status;
+        _closeError = error;
+    }
+}
+
+- (void)getCloseStatus:(NNWebSocketStatus *)status error:(NSError **)error
+{
+    @synchronized(self) {
+        *status = _closeStatus;
+        *error = _closeError;
+    }
+}
+
+- (void)didReceivePongAt:(CFAbsoluteTime)time
+{
+    if (pingSentTime <= 0) {
+        // Unsolicited pong.
+        return;
+    }
+    NSTimeInterval rtt = time - pingSentTime;
+    pingSentTime = 0;
+    [self addPingRoundTripTime:rtt];
+}
+
+- (void)addPingRoundTripTime:(NSTimeInterval)rtt
+{
+    NSUInteger bucket = 0;
+    double limit = 0.001;
+    while (bucket < NNWEBSOCKET_RTT_BUCKET_COUNT - 1 && rtt >= limit) {
+        bucket++;
+        limit *= 2;
+    }
+    pingRoundTripTimeBuckets[bucket]++;
+    pingRoundTripTime = rtt;
+    if (smoothedPingRoundTripTime <= 0) {
+        smoothedPingRoundTripTime = rtt;
+    } else {
+        smoothedPingRoundTripTime += (rtt - smoothedPingRoundTripTime) * RTT_SMOOTHING_FACTOR;
+    }
+}
+
+@end
+
+// ================================================================
+// NNWebSocketStatistics
+// ================================================================
+@implementation NNWebSocketStatistics
+{
+    uint64_t _framesIn[NNWEBSOCKET_OPCODE_COUNT];
+    uint64_t _framesOut[NNWEBSOCKET_OPCODE_COUNT];
+    uint64_t _payloadBytesIn[NNWEBSOCKET_OPCODE_COUNT];
+    uint64_t _payloadBytesOut[NNWEBSOCKET_OPCODE_COUNT];
+}
+
+- (id)initWithCounters:(NNWebSocketCounters *)counters bufferedAmount:(uint64_t)bufferedAmount
+{
+    self = [super init];
+    if (self) {
+        _timestamp = CFAbsoluteTimeGetCurrent();
+        _bytesReceived = counters->bytesIn;
+        _bytesSent = counters->bytesOut;
+        for (NSUInteger i=0; i<NNWEBSOCKET_OPCODE_COUNT; i++) {
+            _framesIn[i] = counters->framesIn[i];
+            _framesOut[i] = counters->framesOut[i];
+            _payloadBytesIn[i] = counters->payloadBytesIn[i];
+            _payloadBytesOut[i] = counters->payloadBytesOut[i];
+            _framesReceived += _framesIn[i];
+            _framesSent += _framesOut[i];
+        }
+        _readQueueDepth = counters->readQueueDepth;
+        _writeQueueDepth = counters->writeQueueDepth;
+        _bufferedAmount = bufferedAmount;
+        _handshakeDuration = counters->handshakeDuration;
+        _dnsDuration = counters->dnsDuration;
+        _tcpConnectDuration = counters->tcpConnectDuration;
+        _tlsDuration = counters->tlsDuration;
+        _upgradeDuration = counters->upgradeDuration;
+        _tlsSessionHits = counters->tlsSessionHits;
+        _tlsSessionMisses = counters->tlsSessionMisses;
+        _pingRoundTripTime = counters->pingRoundTripTime;
+        _smoothedPingRoundTripTime = counters->smoothedPingRoundTripTime;
+        NSMutableArray *histogram = [NSMutableArray arrayWithCapacity:NNWEBSOCKET_RTT_BUCKET_COUNT];
+        for (NSUInteger i=0; i<NNWEBSOCKET_RTT_BUCKET_COUNT; i++) {
+            [histogram addObject:@(counters->pingRoundTripTimeBuckets[i])];
+        }
+        _pingRoundTripTimeHistogram = histogram;
+        _connectTimeoutCount = counters->connectTimeouts;
+        _readTimeoutCount = counters->readTimeouts;
+        _writeTimeoutCount = counters->writeTimeouts;
+        _closeTimeoutCount = counters->closeTimeouts;
+        NNWebSocketStatus status;
+        NSError *error;
+        [counters getCloseStatus:&status error:&error];
+        _closeStatus = status;
+        _closeError = error;
+    }
+    return self;
+}
+
+- (id)initWithStatistics:(NSArray *)statistics
+{
+    self = [super init];
+    if (self) {
+        _timestamp = CFAbsoluteTimeGetCurrent();
+        _closeStatus = NNWebSocketStatusNoStatus;
+        uint64_t buckets[NNWEBSOCKET_RTT_BUCKET_COUNT] = {0};
+        for (NNWebSocketStatistics *s in statistics) {
+            _bytesReceived += s->_bytesReceived;
+            _bytesSent += s->_bytesSent;
+            for (NSUInteger i=0; i<NNWEBSOCKET_OPCODE_COUNT; i++) {
+                _framesIn[i] += s->_framesIn[i];
+                _framesOut[i] += s->_framesOut[i];
+                _payloadBytesIn[i] += s->_payloadBytesIn[i];
+                _payloadBytesOut[i] += s->_payloadBytesOut[i];
+            }
+            _framesReceived += s->_framesReceived;
+            _framesSent += s->_framesSent;
+            _readQueueDepth += s->_readQueueDepth;
+            _writeQueueDepth += s->_writeQueueDepth;
+            _bufferedAmount += s->_bufferedAmount;
+            _handshakeDuration = MAX(_handshakeDuration, s->_handshakeDuration);
+            _dnsDuration = MAX(_dnsDuration, s->_dnsDuration);
+            _tcpConnectDuration = MAX(_tcpConnectDuration, s->_tcpConnectDuration);
+            _tlsDuration = MAX(_tlsDuration, s->_tlsDuration);
+            _upgradeDuration = MAX(_upgradeDuration, s->_upgradeDuration);
+            _tlsSessionHits += s->_tlsSessionHits;
+            _tlsSessionMisses += s->_tlsSessionMisses;
+            _pingRoundTripTime = MAX(_pingRoundTripTime, s->_pingRoundTripTime);
+            _smoothedPingRoundTripTime = MAX(_smoothedPingRoundTripTime, s->_smoothedPingRoundTripTime);
+            NSUInteger i = 0;
+            for (NSNumber *count in s->_pingRoundTripTimeHistogram) {
+                buckets[i++] += [count unsignedLongLongValue];
+            }
+            _connectTimeoutCount += s->_connectTimeoutCount;
+            _readTimeoutCount += s->_readTimeoutCount;
+            _writeTimeoutCount += s->_writeTimeoutCount;
+            _closeTimeoutCount += s->_closeTimeoutCount;
+            if (s->_closeStatus != NNWebSocketStatusNoStatus) {
+                _closeStatus = s->_closeStatus;
+                _closeError = s->_closeError;
+            }
+        }
+        NSMutableArray *histogram = [NSMutableArray arrayWithCapacity:NNWEBSOCKET_RTT_BUCKET_COUNT];
+        for (NSUInteger i=0; i<NNWEBSOCKET_RTT_BUCKET_COUNT; i++) {
+            [histogram addObject:@(buckets[i])];
+        }
+        _pingRoundTripTimeHistogram = histogram;
+    }
+    return self;
+}
+
+- (uint64_t)framesReceivedWithOpcode:(NNWebSocketFrameOpcode)opcode
+{
+    return _framesIn[opcode & 0x0f];
+}
+
+- (uint64_t)framesSentWithOpcode:(NNWebSocketFrameOpcode)opcode
+{
+    return _framesOut[opcode & 0x0f];
+}
+
+- (uint64_t)payloadBytesReceivedWithOpcode:(NNWebSocketFrameOpcode)opcode
+{
+    return _payloadBytesIn[opcode & 0x0f];
+}
+
+- (uint64_t)payloadBytesSentWithOpcode:(NNWebSocketFrameOpcode)opcode
+{
+    return _payloadBytesOut[opcode & 0x0f];
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    NSMutableDictionary *opcodes = [NSMutableDictionary dictionary];
+    for (NSUInteger i=0; i<NNWEBSOCKET_OPCODE_COUNT; i++) {
+        if (!kOpcodeNames[i]) {
+            continue;
+        }
+        opcodes[kOpcodeNames[i]] = @{
+            @"framesReceived" : @(_framesIn[i]),
+            @"framesSent" : @(_framesOut[i]),
+            @"payloadBytesReceived" : @(_payloadBytesIn[i]),
+            @"payloadBytesSent" : @(_payloadBytesOut[i]),
+        };
+    }
+    NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithDictionary:@{
+        @"timestamp" : @(_timestamp),
+        @"bytesReceived" : @(_bytesReceived),
+        @"bytesSent" : @(_bytesSent),
+        @"framesReceived" : @(_framesReceived),
+        @"framesSent" : @(_framesSent),
+        @"readQueueDepth" : @(_readQueueDepth),
+        @"writeQueueDepth" : @(_writeQueueDepth),
+        @"bufferedAmount" : @(_bufferedAmount),
+        @"handshakeDuration" : @(_handshakeDuration),
+        @"dnsDuration" : @(_dnsDuration),
+        @"tcpConnectDuration" : @(_tcpConnectDuration),
+        @"tlsDuration" : @(_tlsDuration),
+        @"upgradeDuration" : @(_upgradeDuration),
+        @"tlsSessionHits" : @(_tlsSessionHits),
+        @"tlsSessionMisses" : @(_tlsSessionMisses),
+        @"pingRoundTripTime" : @(_pingRoundTripTime),
+        @"smoothedPingRoundTripTime" : @(_smoothedPingRoundTripTime),
+        @"pingRoundTripTimeHistogram" : _pingRoundTripTimeHistogram,
+        @"connectTimeoutCount" : @(_connectTimeoutCount),
+        @"readTimeoutCount" : @(_readTimeoutCount),
+        @"writeTimeoutCount" : @(_writeTimeoutCount),
+        @"closeTimeoutCount" : @(_closeTimeoutCount),
+        @"closeStatus" : @(_closeStatus),
+        @"opcodes" : opcodes,
+    }];
+    if (_closeError) {
+        dict[@"closeErrorDomain"] = _closeError.domain;
+        dict[@"closeErrorCode"] = @(_closeError.code);
+    }
+    return dict;
+}
+
+@end
@@ -0,0 +1,35 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "NNWebSocketTransport.h"
+#import "NNWebSocketTransportReader.h"
+#import "NNWebSocketTransportWriter.h"
+
+// Transport on CFStream, whose stream events are delivered on a runloop thread shared with other connections.
+// Subclasses connect by themselves and hand a reader and a writer to -startReader:writer:.
+@interface NNWebSocketStreamTransport : NSObject<NNWebSocketTransport, NNWebSocketTransportReaderDelegate, NNWebSocketTransportWriterDelegate>
+
+// Serial queue which the reader, the writer and connecting run on.
+@property(readonly, nonatomic) dispatch_queue_t ioQueue;
+@property(readonly, nonatomic) NSTimeInterval connectTimeout;
+@property(readonly, nonatomic) NSUInteger verbose;
+
+- (id)initWithDelegate:(id<NNWebSocketTransportDelegate>)delegate options:(NNWebSocketOptions *)options;
+// Must be called on the io queue.
+- (void)startReader:(NNWebSocketTransportReader *)reader writer:(NNWebSocketTransportWriter *)writer;
+// Reports a failure to connect before a reader and a writer are started.
+- (void)didError:(NSError *)error;
+
+@end
@@ -0,0 +1,500 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketStreamTransport.h"
+#import <unistd.h>
+#import <libkern/OSAtomic.h>
+#import <Security/SecureTransport.h>
+#import "NNWebSocketTransportDelegate.h"
+#import "NNWebSocketOptions.h"
+#import "NNWebSocketFrameParser.h"
+#import "NNWebSocketStatistics.h"
+#import "NNWebSocketTracer.h"
+#import "NNWebSocketTLSSessionCache.h"
+#import "NNUtils.h"
+#import "NNWebSocketDebug.h"
+
+@implementation NNWebSocketStreamTransport
+{
+    NSTimeInterval _connectTimeout;
+    NSTimeInterval _readTimeout;
+    NSTimeInterval _writeTimeout;
+    NNTimingWheel *_timingWheel;
+    NSDictionary *_tlsSettings;
+    NNWebSocketTLSSessionCache *_tlsSessionCache;
+    NSString *_tlsHost;
+    uint16_t _tlsPort;
+    NSString *_tlsServerName;
+    NSUInteger _readBufferLength;
+    NSUInteger _writeBatchLength;
+    BOOL _keepWorkingOnBackground;
+    NSUInteger _verbose;
+    NNRunLoopBrokerPool *_runLoopBrokerPool;
+    NNRunLoopBroker *_streamRunloopBroker;
+    dispatch_queue_t _ioQueue;
+    NNWebSocketTransportReader *_reader;
+    NNWebSocketTransportWriter *_writer;
+    volatile int64_t _bufferedAmount;
+    int64_t _hopCount;
+    uint64_t _receiveQueueHighWatermark;
+    uint64_t _receiveQueueLowWatermark;
+    NSUInteger _receiveQueueHighWatermarkFrames;
+    NSUInteger _receiveQueueLowWatermarkFrames;
+    BOOL _readingPaused;
+    CFAbsoluteTime _connectStartTime;
+    CFAbsoluteTime _tlsStartTime;
+    BOOL _secure;
+}
+
+@synthesize delegate = _delegate;
+@synthesize delegateQueue = _delegateQueue;
+@synthesize counters = _counters;
+@synthesize tracer = _tracer;
+
+- (id)initWithDelegate:(id <NNWebSocketTransportDelegate>)delegate options:(NNWebSocketOptions *)options
+{
+    self = [super init];
+    if (self) {
+        _delegate = delegate;
+        _connectTimeout = options.connectTimeoutSec;
+        _readTimeout = options.readTimeoutSec;
+        _writeTimeout =  options.writeTimeoutSec;
+        _timingWheel = [NNTimingWheel sharedWheelWithResolution:options.timerResolutionSec];
+        _tlsSettings = options.tlsSettings;
+        if (options.tlsSessionCacheSize > 0) {
+            _tlsSessionCache = [NNWebSocketTLSSessionCache sharedCacheWithSize:options.tlsSessionCacheSize lifetime:options.tlsSessionLifetimeSec];
+        }
+        _readBufferLength = options.readBufferByteSize;
+        _writeBatchLength = options.writeBatchByteSize;
+        _receiveQueueHighWatermark = options.receiveQueueHighWatermark;
+        _receiveQueueLowWatermark = options.receiveQueueLowWatermark;
+        _receiveQueueHighWatermarkFrames = options.receiveQueueHighWatermarkFrames;
+        _receiveQueueLowWatermarkFrames = options.receiveQueueLowWatermarkFrames;
+        _keepWorkingOnBackground = options.keepWorkingOnBackground;
+        _runLoopBrokerPool = [NNRunLoopBrokerPool sharedPoolWithSize:options.ioThreadCount];
+        _verbose =  options.verbose;
+        _counters = [[NNWebSocketCounters alloc] init];
+        _tracer = [[NNWebSocketTracer alloc] initWithCapacity:options.traceBufferCapacity];
+        _tracer.enabled = options.traceEnabled;
+        _ioQueue = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+        if (options.callbackQueue && !options.callbackOnIOQueue) {
+            // The state machine is not synchronized, so it runs on a serial queue of its own even when callbackQueue is concurrent.
+            _delegateQueue = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+            dispatch_set_target_queue(_delegateQueue, options.callbackQueue);
+        } else {
+            _delegateQueue = options.callbackOnIOQueue ? _ioQueue : dispatch_get_main_queue();
+            #if NEEDS_DISPATCH_RETAIN_RELEASE
+            dispatch_retain(_delegateQueue);
+            #endif
+        }
+        NNMarkQueue(_delegateQueue);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    LogDebug(@"dealloc");
+    #if NEEDS_DISPATCH_RETAIN_RELEASE
+    dispatch_release(_ioQueue);
+    dispatch_release(_delegateQueue);
+    #endif
+    if (_streamRunloopBroker) {
+        [_runLoopBrokerPool releaseBroker:_streamRunloopBroker];
+    }
+}
+
+// Delegate is called directly when it runs on io queue.
+- (void)notifyDelegate:(dispatch_block_t)block
+{
+    if (_delegateQueue == _ioQueue) {
+        block();
+    } else if (_tracer->active) {
+        int64_t hop = ++_hopCount;
+        NNTracerRecord(_tracer, NNWebSocketTraceEventDelegateHopScheduled, hop, 0);
+        dispatch_async(_delegateQueue, ^{
+            NNTrace(_tracer, NNWebSocketTraceEventDelegateHopStarted, hop, 0);
+            block();
+        });
+    } else {
+        dispatch_async(_delegateQueue, block);
+    }
+}
+
+- (uint64_t)bufferedAmount
+{
+    return (uint64_t)OSAtomicAdd64Barrier(0, &_bufferedAmount);
+}
+
+// Pending writes are discarded with the connection.
+- (void)resetBufferedAmount
+{
+    int64_t current;
+    do {
+        current = _bufferedAmount;
+    } while (!OSAtomicCompareAndSwap64Barrier(current, 0, &_bufferedAmount));
+    _counters->readQueueDepth = 0;
+    _counters->writeQueueDepth = 0;
+}
+
+// Streams are removed from the runloop by close on the io queue, so the broker is released after that.
+- (void)releaseRunLoopBroker
+{
+    NNRunLoopBroker *broker = _streamRunloopBroker;
+    NNRunLoopBrokerPool *pool = _runLoopBrokerPool;
+    _streamRunloopBroker = nil;
+    if (broker) {
+        dispatch_async(_ioQueue, ^{
+            [pool releaseBroker:broker];
+        });
+    }
+}
+
+- (void)didOpen
+{
+    [self notifyDelegate:^{
+        [_delegate transportDidConnect:self];
+    }];
+}
+
+- (void)startReader:(NNWebSocketTransportReader *)reader writer:(NNWebSocketTransportWriter *)writer
+{
+    _reader = reader;
+    _reader.delegate = self;
+    _reader.verbose = _verbose;
+    _reader.timingWheel = _timingWheel;
+    _reader.counters = _counters;
+    _reader.tracer = _tracer;
+    _reader.receiveQueueHighWatermark = _receiveQueueHighWatermark;
+    _reader.receiveQueueLowWatermark = _receiveQueueLowWatermark;
+    _reader.receiveQueueHighWatermarkFrames = _receiveQueueHighWatermarkFrames;
+    _reader.receiveQueueLowWatermarkFrames = _receiveQueueLowWatermarkFrames;
+    if (_readingPaused) {
+        [_reader pauseReading];
+    }
+    _writer = writer;
+    _writer.delegate = self;
+    _writer.verbose = _verbose;
+    _writer.timingWheel = _timingWheel;
+    _writer.counters = _counters;
+    _writer.tracer = _tracer;
+    [_reader open:_connectTimeout];
+    [_writer open:_connectTimeout];
+}
+
+// Gives Secure Transport the peer ID which the session of the host has been cached under.
+// The SSL context exists once the stream has been opened and is used when TCP has been connected, which is
+// handled on the runloop. So both streams are opened there and the peer ID is set in the same turn.
+- (void)resumeTLSSessionWithReader:(NNWebSocketTransportReader *)reader writer:(NNWebSocketTransportWriter *)writer
+{
+    id serverName = [_tlsSettings objectForKey:(NSString *)kCFStreamSSLPeerName];
+    _tlsServerName = [serverName isKindOfClass:[NSString class]] ? serverName : (serverName ? nil : _tlsHost);
+    BOOL hit = NO;
+    NSData *peerID = [_tlsSessionCache peerIDForHost:_tlsHost port:_tlsPort serverName:_tlsServerName hit:&hit];
+    dispatch_queue_t ioQueue = _ioQueue;
+    NNWebSocketCounters *counters = _counters;
+    NSUInteger _verbose = self.verbose;
+    reader.streamOpenHandler = ^(NSInputStream *stream) {
+        SSLContextRef context = (SSLContextRef)CFReadStreamCopyProperty((__bridge CFReadStreamRef)stream, kCFStreamPropertySSLContext);
+        OSStatus status = context ? SSLSetPeerID(context, peerID.bytes, peerID.length) : errSSLInternal;
+        if (context) {
+            CFRelease(context);
+        }
+        if (status != noErr) {
+            LogWarn(@"Failed to set TLS peer ID. TLS session is not resumed. status:%d", (int)status);
+        }
+        // Only a session which has actually been offered counts as a hit.
+        BOOL resumed = hit && status == noErr;
+        dispatch_async(ioQueue, ^{
+            if (resumed) {
+                counters->tlsSessionHits++;
+            } else {
+                counters->tlsSessionMisses++;
+            }
+        });
+    };
+    writer.opensOnRunLoop = YES;
+}
+
+- (void)didError:(NSError *)error
+{
+    if (_tlsStartTime > 0 && _tlsHost) {
+        // Failed before TLS had been established. The session must not be offered again.
+        [_tlsSessionCache removePeerIDForHost:_tlsHost port:_tlsPort serverName:_tlsServerName];
+    }
+    [self resetBufferedAmount];
+    [_reader close];
+    [_writer close];
+    [self releaseRunLoopBroker];
+    [self notifyDelegate:^{
+        [_delegate transportDidDisconnect:self error:error];
+    }];
+}
+
+- (void)didClose
+{
+    [self resetBufferedAmount];
+    [_reader close];
+    [_writer close];
+    [self releaseRunLoopBroker];
+    [self notifyDelegate:^{
+        [_delegate transportDidDisconnect:self error:nil];
+    }];
+}
+
+#pragma mark NNWebSocketTransport
+
+- (void)connectToHost:(NSString *)host port:(uint16_t)port secure:(BOOL)secure
+{
+    dispatch_async(_ioQueue, ^{
+        _connectStartTime = CFAbsoluteTimeGetCurrent();
+        _tlsStartTime = 0;
+        _secure = secure;
+        _counters->dnsDuration = 0;
+        _counters->tlsDuration = 0;
+        CFReadStreamRef readStream = NULL;
+        CFWriteStreamRef writeStream = NULL;
+        CFStreamCreatePairWithSocketToHost(NULL, (__bridge CFStringRef)host, port, &readStream, &writeStream);
+        if (secure) {
+            CFReadStreamSetProperty(readStream, kCFStreamSSLLevel, (CFTypeRef) kCFStreamSocketSecurityLevelNegotiatedSSL);
+            CFWriteStreamSetProperty(writeStream, kCFStreamSSLLevel, (CFTypeRef) kCFStreamSocketSecurityLevelNegotiatedSSL);
+            CFReadStreamSetProperty(readStream, kCFStreamPropertySSLSettings, (__bridge CFTypeRef) _tlsSettings);
+            CFWriteStreamSetProperty(writeStream, kCFStreamPropertySSLSettings, (__bridge CFTypeRef) _tlsSettings);
+        }
+        NSOutputStream *outputStream = CFBridgingRelease(writeStream);
+        NSInputStream *inputStream = CFBridgingRelease(readStream);
+        if (_keepWorkingOnBackground) {
+            BOOL r1 = CFReadStreamSetProperty(readStream, kCFStreamNetworkServiceType, (CFTypeRef) kCFStreamNetworkServiceTypeVoIP);
+            BOOL r2 = CFWriteStreamSetProperty(writeStream, kCFStreamNetworkServiceType, (CFTypeRef) kCFStreamNetworkServiceTypeVoIP);
+            if (!r1 || !r2) {
+                LogError("Failed to enable working on background.");
+                [inputStream close];
+                [outputStream close];
+                [self notifyDelegate:^{
+                    NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorKeepWorkingOnBackground userInfo:nil];
+                    [_delegate transportDidDisconnect:self error:error];
+                }];
+                return;
+            }
+        }
+        _tlsHost = secure && _tlsSessionCache ? host : nil;
+        _tlsPort = port;
+        [self startInputStream:inputStream outputStream:outputStream];
+    });
+}
+
+- (void)acceptSocket:(int)descriptor
+{
+    dispatch_async(_ioQueue, ^{
+        _connectStartTime = 0;
+        _tlsStartTime = 0;
+        _tlsHost = nil;
+        _secure = NO;
+        CFReadStreamRef readStream = NULL;
+        CFWriteStreamRef writeStream = NULL;
+        CFStreamCreatePairWithSocket(NULL, descriptor, &readStream, &writeStream);
+        if (!readStream || !writeStream) {
+            LogError("Failed to create streams on accepted socket.");
+            if (readStream) CFRelease(readStream);
+            if (writeStream) CFRelease(writeStream);
+            close(descriptor);
+            [self notifyDelegate:^{
+                [_delegate transportDidDisconnect:self error:[NSError errorWithDomain:NSPOSIXErrorDomain code:EBADF userInfo:nil]];
+            }];
+            return;
+        }
+        CFReadStreamSetProperty(readStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
+        CFWriteStreamSetProperty(writeStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
+        [self startInputStream:CFBridgingRelease(readStream) outputStream:CFBridgingRelease(writeStream)];
+    });
+}
+
+- (void)startInputStream:(NSInputStream *)inputStream outputStream:(NSOutputStream *)outputStream
+{
+    [self releaseRunLoopBroker];
+    _streamRunloopBroker = [_runLoopBrokerPool acquireBroker];
+    NSRunLoop *runLoop = _streamRunloopBroker.runLoop;
+    NNWebSocketTransportReader *reader = [[NNWebSocketTransportReader alloc] initWithStream:inputStream runLoop:runLoop queue:_ioQueue bufferLength:_readBufferLength];
+    NNWebSocketTransportWriter *writer = [[NNWebSocketTransportWriter alloc] initWithStream:outputStream runLoop:runLoop queue:_ioQueue batchLength:_writeBatchLength];
+    if (_tlsHost) {
+        [self resumeTLSSessionWithReader:reader writer:writer];
+    }
+    [self startReader:reader writer:writer];
+}
+
+- (void)disconnect
+{
+    [_reader close];
+    [_writer close];
+}
+
+- (void)readDataToData:(NSData *)data tag:(long)tag
+{
+    [self readDataToData:data maxLength:0 tag:tag];
+}
+
+- (void)readDataToData:(NSData *)data maxLength:(NSUInteger)maxLength tag:(long)tag
+{
+    NNWebSocketTransportReadTask *task = [[NNWebSocketTransportReadTask alloc] init];
+    task->terminator = data;
+    task->maxLength = maxLength;
+    task->tag = tag;
+    task->timeout = _readTimeout;
+    [_reader addTask:task];
+}
+
+- (void)readDataToLength:(NSUInteger)length tag:(long)tag
+{
+    [self readDataToLength:length timeout:_readTimeout tag:tag];
+}
+
+- (void)readDataToLength:(NSUInteger)length timeout:(NSTimeInterval)timeout tag:(long)tag
+{
+    NNWebSocketTransportReadTask *task = [[NNWebSocketTransportReadTask alloc] init];
+    task->lengthToRead = length;
+    task->tag = tag;
+    task->timeout = timeout;
+    [_reader addTask:task];
+}
+
+- (void)readFramesWithParser:(NNWebSocketFrameParser *)parser tag:(long)tag
+{
+    NNWebSocketTransportReadTask *task = [[NNWebSocketTransportReadTask alloc] init];
+    task->parser = parser;
+    task->tag = tag;
+    task->timeout = _readTimeout;
+    [_reader addTask:task];
+}
+
+- (void)pauseReading
+{
+    dispatch_async(_ioQueue, ^{
+        _readingPaused = YES;
+        [_reader pauseReading];
+    });
+}
+
+- (void)resumeReading
+{
+    dispatch_async(_ioQueue, ^{
+        _readingPaused = NO;
+        [_reader resumeReading];
+    });
+}
+
+- (void)writeData:(NSData *)data tag:(long)tag
+{
+    [self writeData:data tag:tag urgent:NO];
+}
+
+- (void)writeData:(NSData *)data tag:(long)tag urgent:(BOOL)urgent
+{
+    NNWebSocketTransportWriteTask *task = [[NNWebSocketTransportWriteTask alloc] init];
+    task->data = data;
+    task->tag = tag;
+    task->urgent = urgent;
+    task->timeout = _writeTimeout;
+    OSAtomicAdd64Barrier((int64_t)data.length, &_bufferedAmount);
+    [_writer addTask:task];
+}
+
+#pragma mark NNWebSocketTransportReaderDelegate
+
+- (void)readerDidOpen:(NNWebSocketTransportReader *)reader
+{
+    // CFStream resolves the name and connects at once.
+    if (_connectStartTime > 0) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        _counters->tcpConnectDuration = now - _connectStartTime;
+        _connectStartTime = 0;
+        if (_secure) {
+            _tlsStartTime = now;
+        }
+    }
+    [self didOpen];
+}
+
+
+- (void)reader:(NNWebSocketTransportReader *)reader didRead:(NNWebSocketTransportReadTask *)task data:(NSData *)data
+{
+    [self notifyDelegate:^{
+        [_delegate transport:self didReadData:data tag:task->tag];
+    }];
+}
+
+- (void)reader:(NNWebSocketTransportReader *)reader didRead:(NNWebSocketTransportReadTask *)task frames:(NSArray *)frames bytes:(uint64_t)bytes
+{
+    // Parser is only touched on io queue, so take its result here.
+    NNWebSocketFrameParser *parser = task->parser;
+    BOOL failed = parser.failed;
+    NNWebSocketStatus status = parser.failureStatus;
+    NSError *error = parser.failureError;
+    [self notifyDelegate:^{
+        if (frames.count > 0) {
+            [_delegate transport:self didReadFrames:frames];
+            [reader didDeliverFrames:frames.count bytes:bytes];
+        }
+        if (failed) {
+            [_delegate transport:self didFailToReadFrameWithStatus:status error:error];
+        }
+    }];
+}
+
+- (void)reader:(NNWebSocketTransportReader *)reader didError:(NSError *)error
+{
+    [self didError:error];
+}
+
+- (void)readerDidClose:(NNWebSocketTransportReader *)reader
+{
+    [self didClose];
+}
+
+#pragma mark NNWebSocketTransportReaderDelegate
+
+- (void)writerDidOpen:(NNWebSocketTransportWriter *)writer
+{
+    // Do nothing.
+}
+
+- (void)writer:(NNWebSocketTransportWriter *)writer didWriteTasks:(NSArray *)tasks
+{
+    int64_t written = 0;
+    for (NNWebSocketTransportWriteTask *task in tasks) {
+        written += task->data.length;
+    }
+    OSAtomicAdd64Barrier(-written, &_bufferedAmount);
+    // Nothing is written to a secure stream before TLS has been established.
+    if (_tlsStartTime > 0) {
+        _counters->tlsDuration = CFAbsoluteTimeGetCurrent() - _tlsStartTime;
+        _tlsStartTime = 0;
+    }
+    [self notifyDelegate:^{
+        for (NNWebSocketTransportWriteTask *task in tasks) {
+            [_delegate transport:self didWriteDataWithTag:task->tag];
+        }
+    }];
+}
+
+- (void)writer:(NNWebSocketTransportWriter *)writer didError:(NSError *)error
+{
+    [self didError:error];
+}
+
+- (void)writerDidClose:(NNWebSocketTransportWriter *)writer
+{
+    // Do nothing.
+}
+
+@end
\ No newline at end of file
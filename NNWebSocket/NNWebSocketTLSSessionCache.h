@@ -0,0 +1,39 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+// Process-wide cache of TLS sessions keyed by host, port and server name. Sessions themselves are kept by
+// Secure Transport under the peer ID of the connection, so that a connection given the same peer ID resumes
+// the session. The cache decides which peer ID a connection gets: the one of a live entry, or a new one which
+// makes a full handshake. Entries expire after 'lifetime' and the least recently used one is dropped when
+// 'size' is exceeded.
+@interface NNWebSocketTLSSessionCache : NSObject
+
+@property(readonly, nonatomic) NSUInteger size;
+@property(readonly, nonatomic) NSTimeInterval lifetime;
+@property(readonly) uint64_t hits;
+@property(readonly) uint64_t misses;
+@property(readonly) NSUInteger count;
+
+// Caches with the same size and lifetime are shared.
++ (instancetype)sharedCacheWithSize:(NSUInteger)size lifetime:(NSTimeInterval)lifetime;
+- (id)initWithSize:(NSUInteger)size lifetime:(NSTimeInterval)lifetime;
+// Returns the peer ID to connect with. 'hit' is set to YES when it refers to a cached session.
+- (NSData *)peerIDForHost:(NSString *)host port:(uint16_t)port serverName:(NSString *)serverName hit:(BOOL *)hit;
+// Drops the entry, so that the next connection makes a full handshake. Called when a handshake has failed.
+- (void)removePeerIDForHost:(NSString *)host port:(uint16_t)port serverName:(NSString *)serverName;
+- (void)removeAllPeerIDs;
+
+@end
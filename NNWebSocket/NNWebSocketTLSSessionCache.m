@@ -0,0 +1,152 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketTLSSessionCache.h"
+#import <pthread.h>
+
+#define PEER_ID_NONCE_LENGTH 16
+
+// ================================================================
+// NNWebSocketTLSSessionEntry
+// ================================================================
+@interface NNWebSocketTLSSessionEntry : NSObject
+{
+    @package
+    NSData *peerID;
+    CFAbsoluteTime createdTime;
+}
+@end
+
+@implementation NNWebSocketTLSSessionEntry
+@end
+
+// ================================================================
+// NNWebSocketTLSSessionCache
+// ================================================================
+@implementation NNWebSocketTLSSessionCache
+{
+    pthread_mutex_t _lock;
+    NSMutableDictionary *_entries;
+    // Keys from the least recently used.
+    NSMutableArray *_keys;
+}
+
++ (instancetype)sharedCacheWithSize:(NSUInteger)size lifetime:(NSTimeInterval)lifetime
+{
+    static NSMutableDictionary *caches;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        caches = [NSMutableDictionary dictionary];
+    });
+    NSString *key = [NSString stringWithFormat:@"%lu/%lu", (unsigned long)size, (unsigned long)(lifetime * 1000)];
+    @synchronized (caches) {
+        NNWebSocketTLSSessionCache *cache = [caches objectForKey:key];
+        if (!cache) {
+            cache = [[self alloc] initWithSize:size lifetime:lifetime];
+            [caches setObject:cache forKey:key];
+        }
+        return cache;
+    }
+}
+
+- (id)initWithSize:(NSUInteger)size lifetime:(NSTimeInterval)lifetime
+{
+    self = [super init];
+    if (self) {
+        _size = size;
+        _lifetime = lifetime;
+        pthread_mutex_init(&_lock, NULL);
+        _entries = [NSMutableDictionary dictionaryWithCapacity:size];
+        _keys = [NSMutableArray arrayWithCapacity:size];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSUInteger)count
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _entries.count;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NSData *)peerIDForHost:(NSString *)host port:(uint16_t)port serverName:(NSString *)serverName hit:(BOOL *)hit
+{
+    NSString *key = [self keyWithHost:host port:port serverName:serverName];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    pthread_mutex_lock(&_lock);
+    NNWebSocketTLSSessionEntry *entry = [_entries objectForKey:key];
+    if (entry && now - entry->createdTime < _lifetime) {
+        _hits++;
+        [_keys removeObject:key];
+        [_keys addObject:key];
+        pthread_mutex_unlock(&_lock);
+        *hit = YES;
+        return entry->peerID;
+    }
+    _misses++;
+    if (entry) {
+        [_keys removeObject:key];
+    }
+    // A new nonce keeps Secure Transport from resuming the expired session.
+    uint8_t nonce[PEER_ID_NONCE_LENGTH];
+    arc4random_buf(nonce, PEER_ID_NONCE_LENGTH);
+    NSMutableData *peerID = [NSMutableData dataWithData:[key dataUsingEncoding:NSUTF8StringEncoding]];
+    [peerID appendBytes:nonce length:PEER_ID_NONCE_LENGTH];
+    entry = [[NNWebSocketTLSSessionEntry alloc] init];
+    entry->peerID = peerID;
+    entry->createdTime = now;
+    if (_size > 0) {
+        while (_keys.count >= _size) {
+            [_entries removeObjectForKey:[_keys objectAtIndex:0]];
+            [_keys removeObjectAtIndex:0];
+        }
+        [_entries setObject:entry forKey:key];
+        [_keys addObject:key];
+    }
+    pthread_mutex_unlock(&_lock);
+    *hit = NO;
+    return peerID;
+}
+
+- (void)removePeerIDForHost:(NSString *)host port:(uint16_t)port serverName:(NSString *)serverName
+{
+    NSString *key = [self keyWithHost:host port:port serverName:serverName];
+    pthread_mutex_lock(&_lock);
+    if ([_entries objectForKey:key]) {
+        [_entries removeObjectForKey:key];
+        [_keys removeObject:key];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)removeAllPeerIDs
+{
+    pthread_mutex_lock(&_lock);
+    [_entries removeAllObjects];
+    [_keys removeAllObjects];
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSString *)keyWithHost:(NSString *)host port:(uint16_t)port serverName:(NSString *)serverName
+{
+    return [NSString stringWithFormat:@"%@:%u/%@", [host lowercaseString], port, serverName ? [serverName lowercaseString] : @""];
+}
+
+@end
@@ -0,0 +1,66 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(uint32_t, NNWebSocketTraceEvent) {
+    // arg0: task id, arg1: tag
+    NNWebSocketTraceEventReadTaskEnqueued = 1,
+    NNWebSocketTraceEventReadTaskDequeued,
+    // arg0: task id, arg1: bytes
+    NNWebSocketTraceEventWriteTaskEnqueued,
+    NNWebSocketTraceEventWriteTaskDequeued,
+    NNWebSocketTraceEventStreamReadable,
+    NNWebSocketTraceEventStreamWritable,
+    // arg0: bytes
+    NNWebSocketTraceEventBytesRead,
+    NNWebSocketTraceEventBytesWritten,
+    // arg0: opcode, arg1: payload bytes
+    NNWebSocketTraceEventFrameDecoded,
+    // From the io queue to the callback queue. arg0: hop id
+    NNWebSocketTraceEventDelegateHopScheduled,
+    NNWebSocketTraceEventDelegateHopStarted,
+    // Around the state machine and listeners handling a frame. arg0: opcode, arg1: payload bytes
+    NNWebSocketTraceEventListenerBegin,
+    NNWebSocketTraceEventListenerEnd,
+    // arg0: state left, arg1: state entered. 0:CLOSED 1:CONNECTING 2:OPEN 3:CLOSING
+    NNWebSocketTraceEventStateChanged,
+};
+
+// Records fixed size events of a connection into a ring buffer, overwriting the oldest ones.
+// Any thread can record without locking. Recording while disabled costs a load and a branch by NNTrace.
+@interface NNWebSocketTracer : NSObject
+{
+    @package
+    volatile BOOL active;
+}
+
+@property(nonatomic, getter=isEnabled) BOOL enabled;
+// Number of events kept. Rounded up to a power of 2.
+@property(readonly, nonatomic) NSUInteger capacity;
+
+- (id)initWithCapacity:(NSUInteger)capacity;
+- (void)clear;
+// Events kept in the buffer, in Chrome trace event format, which Perfetto and chrome://tracing load.
+- (NSData *)chromeTraceData;
+- (BOOL)writeChromeTraceToFile:(NSString *)path error:(NSError **)error;
+
+@end
+
+void NNTracerRecord(__unsafe_unretained NNWebSocketTracer *tracer, NNWebSocketTraceEvent event, int64_t arg0, int64_t arg1);
+
+#define NNTrace(tracer, event, a0, a1) \
+if ((tracer)->active) { \
+NNTracerRecord((tracer), (event), (int64_t)(a0), (int64_t)(a1)); \
+}
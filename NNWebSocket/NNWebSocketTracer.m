@@ -0,0 +1,233 @@
+// Copyright 2013 growthfield.jp
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#import "NNWebSocketTracer.h"
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
+#import <pthread.h>
+#import <unistd.h>
+
+#define DEFAULT_CAPACITY 16384
+
+typedef struct {
+    // Index of the event plus 1 once the event has been written. 0 while it is being written.
+    volatile int64_t sequence;
+    uint64_t time;
+    uint32_t event;
+    uint32_t thread;
+    int64_t arg0;
+    int64_t arg1;
+} NNWebSocketTraceRecord;
+
+static NSString *const kStateNames[] = {@"CLOSED", @"CONNECTING", @"OPEN", @"CLOSING"};
+
+@implementation NNWebSocketTracer
+{
+    NNWebSocketTraceRecord *_records;
+    NSUInteger _mask;
+    volatile int64_t _next;
+}
+
+- (id)init
+{
+    return [self initWithCapacity:DEFAULT_CAPACITY];
+}
+
+- (id)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        NSUInteger size = 1;
+        while (size < MAX(capacity, (NSUInteger)2)) {
+            size <<= 1;
+        }
+        _capacity = size;
+        _mask = size - 1;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_records);
+}
+
+- (BOOL)isEnabled
+{
+    return active;
+}
+
+// Buffer is allocated on first enabling and kept until dealloc, so recorders never see it go away.
+- (void)setEnabled:(BOOL)enabled
+{
+    @synchronized(self) {
+        if (enabled && !_records) {
+            _records = calloc(_capacity, sizeof(NNWebSocketTraceRecord));
+            OSMemoryBarrier();
+        }
+        active = enabled;
+    }
+}
+
+- (void)clear
+{
+    @synchronized(self) {
+        if (_records) {
+            for (NSUInteger i=0; i<_capacity; i++) {
+                _records[i].sequence = 0;
+            }
+        }
+        OSMemoryBarrier();
+    }
+}
+
+void NNTracerRecord(__unsafe_unretained NNWebSocketTracer *tracer, NNWebSocketTraceEvent event, int64_t arg0, int64_t arg1)
+{
+    int64_t index = OSAtomicIncrement64(&tracer->_next) - 1;
+    NNWebSocketTraceRecord *record = &tracer->_records[(NSUInteger)index & tracer->_mask];
+    record->sequence = 0;
+    OSMemoryBarrier();
+    record->time = mach_absolute_time();
+    record->event = event;
+    record->thread = pthread_mach_thread_np(pthread_self());
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    OSMemoryBarrier();
+    record->sequence = index + 1;
+}
+
+// Copies events out of the buffer. Events being overwritten meanwhile are skipped.
+- (NSUInteger)copyRecords:(NNWebSocketTraceRecord *)records
+{
+    int64_t next = OSAtomicAdd64Barrier(0, &_next);
+    int64_t first = MAX((int64_t)0, next - (int64_t)_capacity);
+    NSUInteger count = 0;
+    for (int64_t i=first; i<next; i++) {
+        NNWebSocketTraceRecord *record = &_records[(NSUInteger)i & _mask];
+        if (record->sequence != i + 1) {
+            continue;
+        }
+        records[count] = *record;
+        OSMemoryBarrier();
+        if (record->sequence == i + 1) {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (NSData *)chromeTraceData
+{
+    NSMutableArray *events = [NSMutableArray array];
+    @synchronized(self) {
+        if (_records) {
+            NNWebSocketTraceRecord *records = malloc(_capacity * sizeof(NNWebSocketTraceRecord));
+            NSUInteger count = [self copyRecords:records];
+            mach_timebase_info_data_t timebase;
+            mach_timebase_info(&timebase);
+            for (NSUInteger i=0; i<count; i++) {
+                [events addObject:[self chromeTraceEventOf:&records[i] timebase:timebase]];
+            }
+            free(records);
+        }
+    }
+    NSDictionary *trace = @{@"traceEvents" : events, @"displayTimeUnit" : @"ns"};
+    return [NSJSONSerialization dataWithJSONObject:trace options:(NSJSONWritingOptions)0 error:NULL];
+}
+
+- (BOOL)writeChromeTraceToFile:(NSString *)path error:(NSError **)error
+{
+    return [[self chromeTraceData] writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
+// Tasks and queue hops become async slices from enqueue to dequeue. Listener calls become duration slices.
+- (NSDictionary *)chromeTraceEventOf:(NNWebSocketTraceRecord *)record timebase:(mach_timebase_info_data_t)timebase
+{
+    double ts = (double)record->time * timebase.numer / timebase.denom / 1000.0;
+    NSString *name = nil;
+    NSString *phase = @"i";
+    NSDictionary *args = nil;
+    NSString *asyncId = nil;
+    switch ((NNWebSocketTraceEvent)record->event) {
+        case NNWebSocketTraceEventReadTaskEnqueued:
+        case NNWebSocketTraceEventReadTaskDequeued:
+            name = @"read task";
+            phase = record->event == NNWebSocketTraceEventReadTaskEnqueued ? @"b" : @"e";
+            asyncId = [NSString stringWithFormat:@"0x%llx", record->arg0];
+            args = @{@"tag" : @(record->arg1)};
+            break;
+        case NNWebSocketTraceEventWriteTaskEnqueued:
+        case NNWebSocketTraceEventWriteTaskDequeued:
+            name = @"write task";
+            phase = record->event == NNWebSocketTraceEventWriteTaskEnqueued ? @"b" : @"e";
+            asyncId = [NSString stringWithFormat:@"0x%llx", record->arg0];
+            args = @{@"bytes" : @(record->arg1)};
+            break;
+        case NNWebSocketTraceEventStreamReadable:
+            name = @"readable";
+            break;
+        case NNWebSocketTraceEventStreamWritable:
+            name = @"writable";
+            break;
+        case NNWebSocketTraceEventBytesRead:
+            name = @"read";
+            args = @{@"bytes" : @(record->arg0)};
+            break;
+        case NNWebSocketTraceEventBytesWritten:
+            name = @"written";
+            args = @{@"bytes" : @(record->arg0)};
+            break;
+        case NNWebSocketTraceEventFrameDecoded:
+            name = @"frame decoded";
+            args = @{@"opcode" : @(record->arg0), @"bytes" : @(record->arg1)};
+            break;
+        case NNWebSocketTraceEventDelegateHopScheduled:
+        case NNWebSocketTraceEventDelegateHopStarted:
+            name = @"callback queue hop";
+            phase = record->event == NNWebSocketTraceEventDelegateHopScheduled ? @"b" : @"e";
+            asyncId = [NSString stringWithFormat:@"hop%lld", record->arg0];
+            break;
+        case NNWebSocketTraceEventListenerBegin:
+        case NNWebSocketTraceEventListenerEnd:
+            name = @"listener";
+            phase = record->event == NNWebSocketTraceEventListenerBegin ? @"B" : @"E";
+            args = @{@"opcode" : @(record->arg0), @"bytes" : @(record->arg1)};
+            break;
+        case NNWebSocketTraceEventStateChanged:
+            name = [NSString stringWithFormat:@"%@ -> %@", kStateNames[record->arg0 & 3], kStateNames[record->arg1 & 3]];
+            break;
+        default:
+            name = [NSString stringWithFormat:@"event %u", record->event];
+    }
+    NSMutableDictionary *event = [NSMutableDictionary dictionaryWithDictionary:@{
+        @"name" : name,
+        @"cat" : @"nnwebsocket",
+        @"ph" : phase,
+        @"ts" : @(ts),
+        @"pid" : @(getpid()),
+        @"tid" : @(record->thread),
+    }];
+    if ([phase isEqualToString:@"i"]) {
+        event[@"s"] = @"t";
+    }
+    if (asyncId) {
+        event[@"id"] = asyncId;
+    }
+    if (args) {
+        event[@"args"] = args;
+    }
+    return event;
+}
+
+@end
@@ -13,22 +13,46 @@
 // limitations under the License.
 
 #import <Foundation/Foundation.h>
-#import "NNWebSocketTransport.h"
-#import "NNWebSocketTransportReader.h"
-#import "NNWebSocketTransportWriter.h"
+#import "NNWebSocketDefine.h"
 
 @class NNWebSocketOptions;
+@class NNWebSocketFrameParser;
+@class NNWebSocketCounters;
+@class NNWebSocketTracer;
+@protocol NNWebSocketTransportDelegate;
 
-@interface NNWebSocketTransport : NSObject<NNWebSocketTransportReaderDelegate, NNWebSocketTransportWriterDelegate>
+// Byte transport under the state machine. Reads and writes are queued as tasks, which complete in order
+// and are reported to the delegate on delegateQueue.
+@protocol NNWebSocketTransport <NSObject>
 
 @property(weak, nonatomic) id<NNWebSocketTransportDelegate> delegate;
+// Queue which the delegate is called on.
+@property(readonly, nonatomic) dispatch_queue_t delegateQueue;
+// Bytes passed to -writeData:tag: and not written to the stream yet. Can be read on any thread.
+@property(readonly, nonatomic) uint64_t bufferedAmount;
+// Counters which reading and writing add to. The state machine adds to the same counters.
+@property(readonly, nonatomic) NNWebSocketCounters *counters;
+@property(readonly, nonatomic) NNWebSocketTracer *tracer;
 
-- (id)initWithDelegate:(id<NNWebSocketTransportDelegate>)delegate options:(NNWebSocketOptions *)options;
 - (void)connectToHost:(NSString *)host port:(uint16_t)port secure:(BOOL)secure;
+// Starts on a socket accepted by a listener instead of connecting. The transport closes the socket.
+- (void)acceptSocket:(int)descriptor;
 - (void)disconnect;
 - (void)readDataToData:(NSData *)data tag:(long)tag;
+// Reads 'maxLength' bytes at most. The data does not end with 'data' when it was not found within them.
+// 0 means no limit.
+- (void)readDataToData:(NSData *)data maxLength:(NSUInteger)maxLength tag:(long)tag;
 - (void)readDataToLength:(NSUInteger)length tag:(long)tag;
 - (void)readDataToLength:(NSUInteger)length timeout:(NSTimeInterval)timeout tag:(long)tag;
+- (void)readFramesWithParser:(NNWebSocketFrameParser *)parser tag:(long)tag;
 - (void)writeData:(NSData *)data tag:(long)tag;
+// Urgent data, such as control frames, is written ahead of pending data.
+- (void)writeData:(NSData *)data tag:(long)tag urgent:(BOOL)urgent;
+// Frames are not read from the network while paused. It lasts across reconnects until resumed.
+- (void)pauseReading;
+- (void)resumeReading;
 
-@end
\ No newline at end of file
+@end
+
+// Creates the transport chosen by options.transportType. Secure connections always use CFStream.
+id<NNWebSocketTransport> NNCreateTransport(id<NNWebSocketTransportDelegate> delegate, NNWebSocketOptions *options, BOOL secure);
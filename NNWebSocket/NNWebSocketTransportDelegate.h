@@ -12,13 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-@class NNWebSocketTransport;
+#import "NNWebSocketDefine.h"
+
+@protocol NNWebSocketTransport;
 
 @protocol NNWebSocketTransportDelegate <NSObject>
 
-- (void)transportDidConnect:(NNWebSocketTransport *)transport;
-- (void)transportDidDisconnect:(NNWebSocketTransport *)transport error:(NSError *)error;
-- (void)transport:(NNWebSocketTransport *)transport didReadData:(NSData *)data tag:(long)tag;
-- (void)transport:(NNWebSocketTransport *)transport didWriteDataWithTag:(long)tag;
+- (void)transportDidConnect:(id<NNWebSocketTransport>)transport;
+- (void)transportDidDisconnect:(id<NNWebSocketTransport>)transport error:(NSError *)error;
+- (void)transport:(id<NNWebSocketTransport>)transport didReadData:(NSData *)data tag:(long)tag;
+- (void)transport:(id<NNWebSocketTransport>)transport didReadFrames:(NSArray *)frames;
+- (void)transport:(id<NNWebSocketTransport>)transport didFailToReadFrameWithStatus:(NNWebSocketStatus)status error:(NSError *)error;
+- (void)transport:(id<NNWebSocketTransport>)transport didWriteDataWithTag:(long)tag;
 
 @end
\ No newline at end of file
@@ -16,6 +16,10 @@
 #import "NNWebSocketDefine.h"
 
 @protocol NNWebSocketTransportDelegate;
+@class NNWebSocketFrameParser;
+@class NNTimingWheel;
+@class NNWebSocketCounters;
+@class NNWebSocketTracer;
 
 // ================================================================
 // ReadTask
@@ -27,6 +31,10 @@
     NSTimeInterval timeout;
     NSUInteger lengthToRead;
     NSData *terminator;
+    // Limit of the bytes read to terminator. 0 means no limit.
+    NSUInteger maxLength;
+    // Frame reading task never completes until the parser finishes. Timeout applies while a frame is partially read.
+    NNWebSocketFrameParser *parser;
 }
 
 @end
@@ -39,6 +47,8 @@
 
 - (void)readerDidOpen:(NNWebSocketTransportReader *)reader;
 - (void)reader:(NNWebSocketTransportReader *)reader didRead:(NNWebSocketTransportReadTask *)task data:(NSData *)data;
+// 'bytes' is the sum of payload lengths, which is passed back to -didDeliverFrames:bytes:.
+- (void)reader:(NNWebSocketTransportReader *)reader didRead:(NNWebSocketTransportReadTask *)task frames:(NSArray *)frames bytes:(uint64_t)bytes;
 - (void)reader:(NNWebSocketTransportReader *)reader didError:(NSError *)error;
 - (void)readerDidClose:(NNWebSocketTransportReader *)reader;
 
@@ -51,12 +61,52 @@
 
 @property(weak, nonatomic) id<NNWebSocketTransportReaderDelegate> delegate;
 @property(nonatomic) NSUInteger verbose;
+@property(nonatomic) NNTimingWheel *timingWheel;
+// Bytes read, read queue depth and timeouts are counted into it on the queue.
+@property(nonatomic) NNWebSocketCounters *counters;
+@property(nonatomic) NNWebSocketTracer *tracer;
+// Frames passed to the delegate and not delivered yet are limited by these. 0 means no limit.
+@property(nonatomic) uint64_t receiveQueueHighWatermark;
+@property(nonatomic) uint64_t receiveQueueLowWatermark;
+@property(nonatomic) NSUInteger receiveQueueHighWatermarkFrames;
+@property(nonatomic) NSUInteger receiveQueueLowWatermarkFrames;
+// Given, the stream is opened on the runloop and the handler is called there right after it, before any
+// event of the stream is handled. Set before open:.
+@property(copy, nonatomic) void (^streamOpenHandler)(NSInputStream *stream);
 
 - (id)initWithStream:(NSInputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue;
+- (id)initWithStream:(NSInputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue bufferLength:(NSUInteger)bufferLength;
 - (void)open:(NSTimeInterval)timeout;
 - (void)close;
 - (void)addTask:(NNWebSocketTransportReadTask *)task;
 - (void)pump;
+- (void)pauseReading;
+- (void)resumeReading;
+// Tells that listeners have returned from frames passed to the delegate. Can be called on any thread.
+- (void)didDeliverFrames:(NSUInteger)count bytes:(uint64_t)bytes;
+
+@end
+
+// ================================================================
+// Reader(Subclassing)
+// ================================================================
+// Subclasses read from other sources by overriding open:, close and the primitives below.
+// Everything runs on the queue.
+struct iovec;
+@interface NNWebSocketTransportReader (Subclassing)
+
+@property(readonly, nonatomic) dispatch_queue_t queue;
+
+- (id)initWithQueue:(dispatch_queue_t)queue bufferLength:(NSUInteger)bufferLength;
+- (BOOL)hasBytesAvailable;
+// Returns a negative value when nothing could be read.
+- (NSInteger)readBytes:(uint8_t *)bytes maxLength:(NSUInteger)length;
+// Returns YES to have -readVector:count: called for reads which bypass the buffer.
+- (BOOL)canScatter;
+- (NSInteger)readVector:(struct iovec *)iov count:(int)count;
+- (void)didOpen;
+- (void)didError:(NSError *)error;
+- (void)didClose;
 
 @end
 
@@ -13,9 +13,17 @@
 // limitations under the License.
 
 #import "NNWebSocketTransportReader.h"
+#import <sys/uio.h>
+#import <libkern/OSAtomic.h>
+#import "NNWebSocketFrame.h"
+#import "NNWebSocketFrameParser.h"
+#import "NNWebSocketStatistics.h"
+#import "NNWebSocketTracer.h"
 #import "NNUtils.h"
 #import "NNWebSocketDebug.h"
 
+#define DEFAULT_BUFFER_LENGTH (64 * 1024)
+
 @implementation NNWebSocketTransportReadTask
 @end
 
@@ -24,45 +32,74 @@
     NSInputStream *_stream;
     NSRunLoop *_runLoop;
     dispatch_queue_t _queue;
-    uint8_t *_work;
     NSMutableData *_buffer;
+    uint8_t *_bufferBytes;
+    NSUInteger _bufferHead;
+    NSUInteger _bufferTail;
     NSUInteger _bufferMaxLength;
+    BOOL _bufferShared;
     dispatch_queue_t _delegateQueue;
     NNWebSocketTransportReadTask *_currentTask;
     NSMutableData *_currentData;
+    uint8_t *_currentBytes;
+    NSUInteger _currentOffset;
     NSMutableArray *_tasks;
-    dispatch_source_t _timer;
+    NNTimeout *_timer;
     dispatch_once_t _onceOpenToken;
     BOOL _closed;
+    BOOL _paused;
+    volatile BOOL _throttled;
+    volatile int64_t _receiveQueueBytes;
+    volatile int64_t _receiveQueueFrames;
 }
 
 - (id)initWithStream:(NSInputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue
 {
-    self = [super init];
+    return [self initWithStream:stream runLoop:runLoop queue:queue bufferLength:DEFAULT_BUFFER_LENGTH];
+}
+
+- (id)initWithStream:(NSInputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue bufferLength:(NSUInteger)bufferLength
+{
+    self = [self initWithQueue:queue bufferLength:bufferLength];
     if (self) {
         stream.delegate = self;
         _stream = stream;
         _runLoop = runLoop;
         [stream scheduleInRunLoop:_runLoop forMode:NSDefaultRunLoopMode];
+    }
+    return self;
+}
+
+- (id)initWithQueue:(dispatch_queue_t)queue bufferLength:(NSUInteger)bufferLength
+{
+    self = [super init];
+    if (self) {
         _queue = queue;
         #if NEEDS_DISPATCH_RETAIN_RELEASE
         dispatch_retain(_queue);
         #endif
-        _bufferMaxLength = 1024 * 4;
-        _work = malloc(_bufferMaxLength);
-        _buffer = [NSMutableData dataWithCapacity:_bufferMaxLength];
+        _bufferMaxLength = bufferLength > 0 ? bufferLength : DEFAULT_BUFFER_LENGTH;
+        [self allocateBuffer];
         _tasks = [NSMutableArray array];
         _verbose = 0;
+        _timingWheel = [NNTimingWheel sharedWheelWithResolution:0.05];
+        _counters = [[NNWebSocketCounters alloc] init];
+        _tracer = [[NNWebSocketTracer alloc] init];
         _closed = YES;
     }
     return self;
 }
 
+- (dispatch_queue_t)queue
+{
+    return _queue;
+}
+
 - (void)dealloc
 {
     LogDebug(@"dealloc");
     _stream.delegate = nil;
-    free(_work);
+    free(_currentBytes);
     #if NEEDS_DISPATCH_RETAIN_RELEASE
     dispatch_release(_queue);
     #endif
@@ -72,12 +109,26 @@
 {
     dispatch_async(_queue, ^{
         LogDebug("Opening input stream.");
-        _timer = NNCreateTimer(_queue, timeout, ^{
+        _timer = [self.timingWheel scheduleTimeout:timeout queue:_queue block:^{
             LogError("Timeout while attempting to open a input stream.");
+            _counters->connectTimeouts++;
             NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorConnectTimeout userInfo:nil];
             [self didError:error];
+        }];
+        if (!_streamOpenHandler) {
+            [_stream open];
+            return;
+        }
+        NSInputStream *stream = _stream;
+        void (^handler)(NSInputStream *) = _streamOpenHandler;
+        CFRunLoopRef runLoop = [_runLoop getCFRunLoop];
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopDefaultMode, ^{
+            if (stream.streamStatus == NSStreamStatusNotOpen) {
+                [stream open];
+                handler(stream);
+            }
         });
-        [_stream open];
+        CFRunLoopWakeUp(runLoop);
     });
 }
 
@@ -100,100 +151,387 @@
     dispatch_async(_queue, ^{
         LogTrace(@"Add new read task. length:%lu terminator:%@ tag:%lu",(unsigned long)task->lengthToRead, task->terminator, task->tag);
         [_tasks addObject:task];
+        NNTrace(_tracer, NNWebSocketTraceEventReadTaskEnqueued, (uintptr_t)(__bridge void *)task, task->tag);
+        [self updateQueueDepth];
         [self pump];
     });
 }
 
-- (void)pump
+- (void)pauseReading
 {
-    BOOL hasStreamBytesAvailable = _stream.hasBytesAvailable;
-    BOOL hasBufferFreeSpace  = _bufferMaxLength - _buffer.length > 0;
-    BOOL hasBufferBytesAvailable = _buffer.length > 0;
-    BOOL canReadStream = hasStreamBytesAvailable && hasBufferFreeSpace;
-
-    while (canReadStream || hasBufferBytesAvailable) { @autoreleasepool {
-        if (canReadStream) {
-            LogTrace("Attempting to read maximum %d bytes from stream", _bufferMaxLength - _buffer.length);
-            NSInteger result = [_stream read:_work maxLength:_bufferMaxLength - _buffer.length];
-            if (result <= 0) {
-                LogDebug("Failed to read stream. result:%d", result);
-                return;
-            }
-            [_buffer appendBytes:_work length:(NSUInteger)result];
-            LogTrace("Read %d bytes into buffer. buffer length:%d", result, _buffer.length);
+    dispatch_async(_queue, ^{
+        LogDebug(@"Pause reading frames.");
+        _paused = YES;
+    });
+}
+
+- (void)resumeReading
+{
+    dispatch_async(_queue, ^{
+        if (!_paused) {
+            return;
         }
+        LogDebug(@"Resume reading frames.");
+        _paused = NO;
+        [self pump];
+    });
+}
+
+- (void)didDeliverFrames:(NSUInteger)count bytes:(uint64_t)bytes
+{
+    OSAtomicAdd64Barrier(-(int64_t)count, &_receiveQueueFrames);
+    OSAtomicAdd64Barrier(-(int64_t)bytes, &_receiveQueueBytes);
+    if (_throttled && [self isReceiveQueueBelowLowWatermark]) {
+        dispatch_async(_queue, ^{
+            [self pump];
+        });
+    }
+}
+
+- (BOOL)isReceiveQueueAboveHighWatermark
+{
+    return (_receiveQueueHighWatermark > 0 && (uint64_t)_receiveQueueBytes > _receiveQueueHighWatermark) ||
+        (_receiveQueueHighWatermarkFrames > 0 && (uint64_t)_receiveQueueFrames > _receiveQueueHighWatermarkFrames);
+}
+
+- (BOOL)isReceiveQueueBelowLowWatermark
+{
+    OSMemoryBarrier();
+    return (_receiveQueueHighWatermark == 0 || (uint64_t)_receiveQueueBytes <= MIN(_receiveQueueLowWatermark, _receiveQueueHighWatermark)) &&
+        (_receiveQueueHighWatermarkFrames == 0 || (uint64_t)_receiveQueueFrames <= MIN(_receiveQueueLowWatermarkFrames, _receiveQueueHighWatermarkFrames));
+}
+
+// Frames are left in the socket while listeners lag behind, so that the sender is slowed by TCP.
+- (BOOL)shouldHoldFrames
+{
+    if (!_throttled) {
+        if (!_paused && ![self isReceiveQueueAboveHighWatermark]) {
+            return NO;
+        }
+        _throttled = YES;
+        LogDebug(@"Hold reading frames.(%lld frames %lld bytes)", _receiveQueueFrames, _receiveQueueBytes);
+        // Read timeout does not apply while frames are held.
+        [self stopTimer];
+    }
+    // Checked after _throttled is set, since delivery checks it after counting down.
+    if (_paused || ![self isReceiveQueueBelowLowWatermark]) {
+        return YES;
+    }
+    _throttled = NO;
+    LogDebug(@"Resume reading frames.");
+    if (_currentTask->parser.hasPartialFrame) {
+        [self startTimer];
+    }
+    return NO;
+}
+
+- (void)pump
+{
+    while (YES) { @autoreleasepool {
         if (!_currentTask) {
             if (_tasks.count == 0) {
                 LogTrace(@"No read task.");
+                // Read ahead while the buffer has space so that next task can be completed without waiting.
+                [self readStreamIntoBuffer];
                 return;
             }
             _currentTask = [_tasks objectAtIndex:0];
             [_tasks removeObjectAtIndex:0];
-            _currentData = [NSMutableData data];
-            if (_currentTask->timeout > 0) {
-                _timer = NNCreateTimer(_queue, _currentTask->timeout, ^{
-                    NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorReadTimeout userInfo:nil];
-                    [self didError:error];
-                });
+            NNTrace(_tracer, NNWebSocketTraceEventReadTaskDequeued, (uintptr_t)(__bridge void *)_currentTask, _currentTask->tag);
+            if (!_currentTask->parser) {
+                [self startTimer];
+            }
+        }
+        if (_currentTask->parser && [self shouldHoldFrames]) {
+            return;
+        }
+        if (_bufferHead == _bufferTail) {
+            if ([self readStreamIntoCurrentBytes]) {
+                continue;
+            }
+            if (![self readStreamIntoBuffer]) {
+                return;
             }
         }
         NSData *terminator = _currentTask->terminator;
-        if (terminator) {
+        if (_currentTask->parser) {
+            [self performReadFrames];
+        } else if (terminator) {
             [self performReadToData];
         } else {
             [self performReadToLength];
         }
-        hasStreamBytesAvailable = _stream.hasBytesAvailable;
-        hasBufferFreeSpace  = _bufferMaxLength - _buffer.length > 0;
-        hasBufferBytesAvailable = _buffer.length > 0;
-        canReadStream = hasStreamBytesAvailable && hasBufferFreeSpace;
     }}
 }
 
+- (void)startTimer
+{
+    if (_timer || _currentTask->timeout <= 0) {
+        return;
+    }
+    _timer = [self.timingWheel scheduleTimeout:_currentTask->timeout queue:_queue block:^{
+        _counters->readTimeouts++;
+        NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorReadTimeout userInfo:nil];
+        [self didError:error];
+    }];
+}
+
+- (void)stopTimer
+{
+    [_timer cancel];
+    _timer = nil;
+}
+
+- (void)updateQueueDepth
+{
+    _counters->readQueueDepth = _tasks.count + (_currentTask ? 1 : 0);
+}
+
+- (void)allocateBuffer
+{
+    _buffer = [NSMutableData dataWithLength:_bufferMaxLength];
+    _bufferBytes = (uint8_t *)_buffer.mutableBytes;
+    _bufferShared = NO;
+}
+
+- (void)compactBuffer
+{
+    NSUInteger remains = _bufferTail - _bufferHead;
+    if (_bufferShared) {
+        // Slices handed out still refer to the current buffer, so it must not be overwritten.
+        uint8_t *old = _bufferBytes + _bufferHead;
+        NSData *retired = _buffer;
+        [self allocateBuffer];
+        memcpy(_bufferBytes, old, remains);
+        // Retired buffer is released here at the earliest, after its remains have been copied.
+        retired = nil;
+    } else if (_bufferHead > 0) {
+        memmove(_bufferBytes, _bufferBytes + _bufferHead, remains);
+    }
+    _bufferHead = 0;
+    _bufferTail = remains;
+}
+
+- (BOOL)readStreamIntoBuffer
+{
+    if (_bufferHead == _bufferTail && !_bufferShared) {
+        _bufferHead = _bufferTail = 0;
+    }
+    if (_bufferTail == _bufferMaxLength) {
+        [self compactBuffer];
+    }
+    NSUInteger space = _bufferMaxLength - _bufferTail;
+    if (space == 0 || ![self hasBytesAvailable]) {
+        return NO;
+    }
+    LogTrace("Attempting to read maximum %d bytes from stream", space);
+    NSInteger result = [self readBytes:_bufferBytes + _bufferTail maxLength:space];
+    if (result <= 0) {
+        LogDebug("Failed to read stream. result:%d", result);
+        return NO;
+    }
+    _bufferTail += (NSUInteger)result;
+    _counters->bytesIn += (NSUInteger)result;
+    NNTrace(_tracer, NNWebSocketTraceEventBytesRead, result, 0);
+    LogTrace("Read %d bytes into buffer. buffer length:%d", result, _bufferTail - _bufferHead);
+    return YES;
+}
+
+// Large fixed length reads bypass the buffer and are read into their destination directly.
+- (BOOL)readStreamIntoCurrentBytes
+{
+    if (_currentTask->parser) {
+        return [self readStreamIntoPayload];
+    }
+    if (_currentTask->terminator || _currentTask->lengthToRead - _currentOffset < _bufferMaxLength) {
+        return NO;
+    }
+    if (![self hasBytesAvailable]) {
+        return NO;
+    }
+    if (!_currentBytes) {
+        _currentBytes = malloc(_currentTask->lengthToRead);
+        _currentOffset = 0;
+    }
+    NSInteger result = [self readDirectly:_currentBytes + _currentOffset maxLength:_currentTask->lengthToRead - _currentOffset];
+    if (result <= 0) {
+        LogDebug("Failed to read stream. result:%d", result);
+        return NO;
+    }
+    _currentOffset += (NSUInteger)result;
+    LogTrace("Read %d bytes into task directly. %d/%d", result, _currentOffset, _currentTask->lengthToRead);
+    [self completeReadToLengthIfNeeded];
+    return YES;
+}
+
+- (BOOL)readStreamIntoPayload
+{
+    NNWebSocketFrameParser *parser = _currentTask->parser;
+    if (parser.remainingPayloadLength < _bufferMaxLength || ![self hasBytesAvailable]) {
+        return NO;
+    }
+    NSMutableArray *frames = [NSMutableArray array];
+    NSInteger result = [parser fillPayloadUsingBlock:^NSInteger(uint8_t *bytes, NSUInteger length) {
+        return [self readDirectly:bytes maxLength:length];
+    } frames:frames];
+    if (result <= 0) {
+        LogDebug("Failed to read stream. result:%d", result);
+        return NO;
+    }
+    LogTrace("Read %d bytes into payload directly.", result);
+    [self didReadFrames:frames];
+    return YES;
+}
+
+// Reads into a destination out of the buffer. When the reader can scatter, bytes following the destination
+// are read into the buffer by the same call. This is only used while the buffer is empty.
+- (NSInteger)readDirectly:(uint8_t *)bytes maxLength:(NSUInteger)length
+{
+    if (![self canScatter]) {
+        NSInteger result = [self readBytes:bytes maxLength:length];
+        if (result > 0) {
+            _counters->bytesIn += (NSUInteger)result;
+            NNTrace(_tracer, NNWebSocketTraceEventBytesRead, result, 0);
+        }
+        return result;
+    }
+    if (_bufferHead == _bufferTail && !_bufferShared) {
+        _bufferHead = _bufferTail = 0;
+    }
+    NSUInteger space = _bufferMaxLength - _bufferTail;
+    struct iovec iov[2];
+    iov[0].iov_base = bytes;
+    iov[0].iov_len = length;
+    iov[1].iov_base = _bufferBytes + _bufferTail;
+    iov[1].iov_len = space;
+    NSInteger result = [self readVector:iov count:space > 0 ? 2 : 1];
+    if (result > 0) {
+        _counters->bytesIn += (NSUInteger)result;
+        NNTrace(_tracer, NNWebSocketTraceEventBytesRead, result, 0);
+    }
+    if (result > (NSInteger)length) {
+        _bufferTail += (NSUInteger)result - length;
+        LogTrace("Read %d bytes ahead into buffer.", (NSUInteger)result - length);
+        return (NSInteger)length;
+    }
+    return result;
+}
+
+#pragma mark Primitives
+
+- (BOOL)hasBytesAvailable
+{
+    return _stream.hasBytesAvailable;
+}
+
+- (NSInteger)readBytes:(uint8_t *)bytes maxLength:(NSUInteger)length
+{
+    return [_stream read:bytes maxLength:length];
+}
+
+- (BOOL)canScatter
+{
+    return NO;
+}
+
+- (NSInteger)readVector:(struct iovec *)iov count:(int)count
+{
+    return [self readBytes:iov[0].iov_base maxLength:iov[0].iov_len];
+}
+
+- (void)performReadFrames
+{
+    NNWebSocketFrameParser *parser = _currentTask->parser;
+    NSMutableArray *frames = [NSMutableArray array];
+    BOOL sliced = NO;
+    NSUInteger consumed = [parser parseBytes:_bufferBytes + _bufferHead length:_bufferTail - _bufferHead owner:_buffer sliced:&sliced frames:frames];
+    _bufferHead += consumed;
+    if (sliced) {
+        _bufferShared = YES;
+    }
+    LogTrace(@"Decoded %d frames from %d bytes.", frames.count, consumed);
+    [self didReadFrames:frames];
+}
+
 - (void)performReadToLength
 {
     LogTrace("Read buffer until %d bytes completed.", _currentTask->lengthToRead);
-    NSUInteger remains = _currentTask->lengthToRead - _currentData.length;
-    if (remains < _buffer.length) {
-        [_currentData appendBytes:_buffer.bytes length:remains];
-        _buffer = [[NSMutableData alloc] initWithBytes:_buffer.bytes + remains length:_buffer.length - remains];
-        LogTrace(@"Fnished to read entire %d bytes on task.", _currentTask->lengthToRead);
-    } else {
-        [_currentData appendData:_buffer];
-        LogTrace(@"Read %d bytes from buffer.", _buffer.length);
-        [_buffer setLength:0];
-    }
-    if (_currentData.length == _currentTask->lengthToRead) {
+    NSUInteger length = _currentTask->lengthToRead;
+    NSUInteger available = _bufferTail - _bufferHead;
+    if (!_currentBytes && available >= length) {
+        // Entire data is in the buffer. Hand out a part of the buffer without copying.
+        BOOL sliced = NO;
+        NSData *data = [NNDataSlice dataWithOwner:_buffer bytes:_bufferBytes + _bufferHead length:length sliced:&sliced];
+        if (sliced) {
+            _bufferShared = YES;
+        }
+        _bufferHead += length;
+        LogTrace(@"Fnished to read entire %d bytes on task.", length);
         NNWebSocketTransportReadTask *capturedTask = _currentTask;
-        NSData *capturedData = _currentData;
-        [self didRead:capturedTask data:capturedData];
         _currentTask = nil;
-        _currentData = nil;
+        [self didRead:capturedTask data:data];
+        return;
     }
+    if (!_currentBytes) {
+        // Allocate destination once at requested length.
+        _currentBytes = malloc(length);
+        _currentOffset = 0;
+    }
+    NSUInteger len = MIN(available, length - _currentOffset);
+    memcpy(_currentBytes + _currentOffset, _bufferBytes + _bufferHead, len);
+    _bufferHead += len;
+    _currentOffset += len;
+    LogTrace(@"Read %d bytes from buffer.", len);
+    [self completeReadToLengthIfNeeded];
+}
+
+- (void)completeReadToLengthIfNeeded
+{
+    if (_currentOffset < _currentTask->lengthToRead) {
+        return;
+    }
+    LogTrace(@"Fnished to read entire %d bytes on task.", _currentTask->lengthToRead);
+    NSData *data = [NSData dataWithBytesNoCopy:_currentBytes length:_currentOffset freeWhenDone:YES];
+    NNWebSocketTransportReadTask *capturedTask = _currentTask;
+    _currentTask = nil;
+    _currentBytes = NULL;
+    _currentOffset = 0;
+    [self didRead:capturedTask data:data];
 }
 
 - (void)performReadToData
 {
     NSData *terminator = _currentTask->terminator;
     LogTrace("Read buffer until terminator.");
+    if (!_currentData) {
+        _currentData = [NSMutableData dataWithCapacity:_bufferTail - _bufferHead];
+    }
     NSUInteger lastCurrentDataLen = _currentData.length;
-    [_currentData appendData:_buffer];
-    NSRange range = [_currentData rangeOfData:terminator options:(NSDataSearchOptions)0 range:NSMakeRange((NSUInteger) 0, _currentData.length)];
+    [_currentData appendBytes:_bufferBytes + _bufferHead length:_bufferTail - _bufferHead];
+    // Resumes where the last search left off. Only a terminator across the boundary needs earlier bytes.
+    NSUInteger searchFrom = lastCurrentDataLen >= terminator.length ? lastCurrentDataLen - terminator.length + 1 : 0;
+    NSRange range = [_currentData rangeOfData:terminator options:(NSDataSearchOptions)0 range:NSMakeRange(searchFrom, _currentData.length - searchFrom)];
     NSUInteger indexInCurrentData = range.location;
-    if (indexInCurrentData == NSNotFound) {
+    NSUInteger length = indexInCurrentData == NSNotFound ? _currentData.length : indexInCurrentData + terminator.length;
+    NSUInteger maxLength = _currentTask->maxLength;
+    if (maxLength > 0 && length > maxLength) {
+        // The task ends with bytes which do not end with terminator, so the delegate knows the limit is hit.
+        LogTrace(@"Terminator not found within %d bytes.", maxLength);
+        length = maxLength;
+    } else if (indexInCurrentData == NSNotFound) {
         LogTrace(@"Terminator not found. %d bytes has been read from a buffer.", _currentData.length);
-        [_buffer setLength:0];
+        _bufferHead = _bufferTail;
+        return;
     } else {
         LogTrace("Terminator found. finished to read entire %d bytes.", _currentData.length);
-        [_currentData setLength:indexInCurrentData + terminator.length];
-        NSUInteger indexInBuffer = indexInCurrentData - lastCurrentDataLen + terminator.length;
-        _buffer = [[_buffer subdataWithRange:NSMakeRange(indexInBuffer, _buffer.length - indexInBuffer)] mutableCopy];
-        NNWebSocketTransportReadTask *capturedTask = _currentTask;
-        NSData *capturedData = _currentData;
-        [self didRead:capturedTask data:capturedData];
-        _currentTask = nil;
-        _currentData = nil;
     }
+    [_currentData setLength:length];
+    _bufferHead += length - lastCurrentDataLen;
+    NNWebSocketTransportReadTask *capturedTask = _currentTask;
+    NSData *capturedData = _currentData;
+    _currentTask = nil;
+    _currentData = nil;
+    [self didRead:capturedTask data:capturedData];
 }
 
 - (void)didOpen
@@ -202,26 +540,58 @@
     dispatch_once(&_onceOpenToken, ^{
         LogDebug("Input stream has been opened.");
         _closed = NO;
-        NNCancelTimer(_timer);
+        [self stopTimer];
         [_delegate readerDidOpen:self];
     });
 }
 
 - (void)didError:(NSError *)error
 {
-    NNCancelTimer(_timer);
+    [self stopTimer];
     [_delegate reader:self didError:error];
 }
 
 - (void)didRead:(NNWebSocketTransportReadTask *)task data:(NSData *)data
 {
-    NNCancelTimer(_timer);
+    [self stopTimer];
+    [self updateQueueDepth];
     [_delegate reader:self didRead:task data:data];
 }
 
+- (void)didReadFrames:(NSArray *)frames
+{
+    if (_tracer->active) {
+        for (NNWebSocketFrame *frame in frames) {
+            NNTracerRecord(_tracer, NNWebSocketTraceEventFrameDecoded, frame.opcode, frame.data.length);
+        }
+    }
+    NNWebSocketTransportReadTask *task = _currentTask;
+    NNWebSocketFrameParser *parser = task->parser;
+    if (parser.finished) {
+        _currentTask = nil;
+        [self stopTimer];
+        [self updateQueueDepth];
+    } else if (parser.hasPartialFrame) {
+        [self startTimer];
+    } else {
+        [self stopTimer];
+    }
+    uint64_t bytes = 0;
+    if (frames.count > 0) {
+        for (NNWebSocketFrame *frame in frames) {
+            bytes += frame.data.length;
+        }
+        OSAtomicAdd64Barrier((int64_t)frames.count, &_receiveQueueFrames);
+        OSAtomicAdd64Barrier((int64_t)bytes, &_receiveQueueBytes);
+    }
+    if (frames.count > 0 || parser.finished) {
+        [_delegate reader:self didRead:task frames:frames bytes:bytes];
+    }
+}
+
 - (void)didClose
 {
-    NNCancelTimer(_timer);
+    [self stopTimer];
     [_delegate readerDidClose:self];
 }
 
@@ -246,6 +616,7 @@
         });
     } else if (eventCode == NSStreamEventHasBytesAvailable) {
         LogTrace(@"Fire NSStreamEventHasBytesAvaiable.");
+        NNTrace(_tracer, NNWebSocketTraceEventStreamReadable, 0, 0);
         dispatch_async(_queue, ^{
             [self pump];
         });
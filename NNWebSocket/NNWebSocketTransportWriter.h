@@ -25,18 +25,24 @@
     long tag;
     NSTimeInterval timeout;
     NSData *data;
+    // Urgent tasks are written before other pending tasks, but never in the middle of a batch.
+    BOOL urgent;
 }
 @end
 
 
 @class NNWebSocketTransportWriter;
+@class NNTimingWheel;
+@class NNWebSocketCounters;
+@class NNWebSocketTracer;
 // ================================================================
 // WriterDelegate
 // ================================================================
  @protocol NNWebSocketTransportWriterDelegate
 
 - (void)writerDidOpen:(NNWebSocketTransportWriter *)writer;
-- (void)writer:(NNWebSocketTransportWriter *)writer didWrite:(NNWebSocketTransportWriteTask *)task;
+// Tasks completed by one flush, in the order they were written.
+- (void)writer:(NNWebSocketTransportWriter *)writer didWriteTasks:(NSArray *)tasks;
 - (void)writer:(NNWebSocketTransportWriter *)writer didError:(NSError *)error;
 - (void)writerDidClose:(NNWebSocketTransportWriter *)writer;
 
@@ -49,11 +55,44 @@
 
 @property(weak, nonatomic) id<NNWebSocketTransportWriterDelegate> delegate;
 @property(nonatomic) NSUInteger verbose;
+@property(nonatomic) NNTimingWheel *timingWheel;
+// Bytes written, write queue depth and timeouts are counted into it on the queue.
+@property(nonatomic) NNWebSocketCounters *counters;
+@property(nonatomic) NNWebSocketTracer *tracer;
+// Opens the stream on the runloop instead of the queue, after whatever has been performed there before.
+// Set before open:.
+@property(nonatomic) BOOL opensOnRunLoop;
 
 - (id)initWithStream:(NSOutputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue;
+- (id)initWithStream:(NSOutputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue batchLength:(NSUInteger)batchLength;
 - (void)open:(NSTimeInterval)timeout;
 - (void)close;
 - (void)addTask:(NNWebSocketTransportWriteTask *)task;
 - (void)flush;
 
 @end
+
+// ================================================================
+// Writer(Subclassing)
+// ================================================================
+// Subclasses write to other sinks by overriding open:, close and the primitives below.
+// Everything runs on the queue.
+struct iovec;
+@interface NNWebSocketTransportWriter (Subclassing)
+
+@property(readonly, nonatomic) dispatch_queue_t queue;
+// Whether flush has something left to write.
+@property(readonly, nonatomic) BOOL hasPendingTasks;
+
+- (id)initWithQueue:(dispatch_queue_t)queue batchLength:(NSUInteger)batchLength;
+- (BOOL)hasSpaceAvailable;
+// Returns 0 or a negative value when nothing could be written.
+- (NSInteger)writeBytes:(const uint8_t *)bytes maxLength:(NSUInteger)length;
+// Returns YES to have small tasks written by -writeVector:count: instead of copying them into one buffer.
+- (BOOL)canGather;
+- (NSInteger)writeVector:(const struct iovec *)iov count:(int)count;
+- (void)didOpen;
+- (void)didError:(NSError *)error;
+- (void)didClose;
+
+@end
@@ -6,9 +6,15 @@
 
 
 #import "NNWebSocketTransportWriter.h"
+#import <sys/uio.h>
 #import "NNUtils.h"
+#import "NNWebSocketStatistics.h"
+#import "NNWebSocketTracer.h"
 #import "NNWebSocketDebug.h"
 
+#define DEFAULT_BATCH_LENGTH (64 * 1024)
+#define MAX_GATHERED_TASKS 64
+
 @implementation NNWebSocketTransportWriteTask
 @end
 
@@ -18,9 +24,18 @@
     NSRunLoop *_runLoop;
     dispatch_queue_t _queue;
     NSMutableArray *_tasks;
-    NNWebSocketTransportWriteTask *_currentTask;
+    NSMutableArray *_urgentTasks;
+    NSMutableArray *_batchTasks;
+    NSUInteger _batchMaxLength;
+    NSMutableData *_staging;
+    NSData *_batchData;
+    NSUInteger _batchLength;
+    BOOL _batching;
     NSUInteger _offset;
-    dispatch_source_t _timer;
+    NSUInteger _completedOffset;
+    NNTimeout *_timer;
+    NSTimeInterval _timeout;
+    CFAbsoluteTime _lastProgressTime;
     dispatch_once_t _onceOpenToken;
     BOOL _closed;
 }
@@ -28,30 +43,58 @@
 
 - (id)initWithStream:(NSOutputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue
 {
-    self = [super init];
+    return [self initWithStream:stream runLoop:runLoop queue:queue batchLength:DEFAULT_BATCH_LENGTH];
+}
+
+- (id)initWithStream:(NSOutputStream *)stream runLoop:(NSRunLoop *)runLoop queue:(dispatch_queue_t)queue batchLength:(NSUInteger)batchLength
+{
+    self = [self initWithQueue:queue batchLength:batchLength];
     if (self) {
         stream.delegate = self;
         _stream = stream;
         _runLoop = runLoop;
         [stream scheduleInRunLoop:_runLoop forMode:NSDefaultRunLoopMode];
+    }
+    return self;
+}
+
+- (id)initWithQueue:(dispatch_queue_t)queue batchLength:(NSUInteger)batchLength
+{
+    self = [super init];
+    if (self) {
         _queue = queue;
         #if NEEDS_DISPATCH_RETAIN_RELEASE
         dispatch_retain(_queue);
         #endif
         _tasks = [NSMutableArray array];
+        _urgentTasks = [NSMutableArray array];
+        _batchTasks = [NSMutableArray array];
+        _batchMaxLength = batchLength > 0 ? batchLength : DEFAULT_BATCH_LENGTH;
         _verbose = 0;
+        _timingWheel = [NNTimingWheel sharedWheelWithResolution:0.05];
+        _counters = [[NNWebSocketCounters alloc] init];
+        _tracer = [[NNWebSocketTracer alloc] init];
         _closed = YES;
     }
     return self;
 }
 
+- (dispatch_queue_t)queue
+{
+    return _queue;
+}
+
+- (BOOL)hasPendingTasks
+{
+    return _batching || _tasks.count > 0 || _urgentTasks.count > 0;
+}
+
 - (void)dealloc
 {
     LogDebug(@"dealloc");
     _stream.delegate = nil;
     #if NEEDS_DISPATCH_RETAIN_RELEASE
     dispatch_release(_queue);
-    dispatch_release(_timer);
     #endif
 }
 
@@ -60,12 +103,23 @@
 {
     dispatch_async(_queue, ^{
         LogDebug("Opening output stream.");
-        _timer = NNCreateTimer(_queue, timeout, ^{
+        _timer = [self.timingWheel scheduleTimeout:timeout queue:_queue block:^{
             LogError("Timeout while attempting to open a output stream.");
             NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorConnectTimeout userInfo:nil];
             [self didError:error];
+        }];
+        if (!_opensOnRunLoop) {
+            [_stream open];
+            return;
+        }
+        NSOutputStream *stream = _stream;
+        CFRunLoopRef runLoop = [_runLoop getCFRunLoop];
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopDefaultMode, ^{
+            if (stream.streamStatus == NSStreamStatusNotOpen) {
+                [stream open];
+            }
         });
-        [_stream open];
+        CFRunLoopWakeUp(runLoop);
     });
 }
 
@@ -87,7 +141,9 @@
 {
     dispatch_async(_queue, ^{
         LogTrace(@"Add new task. bytes:%d tag:%lu",task->data.length,  task->tag);
-        [_tasks addObject:task];
+        [(task->urgent ? _urgentTasks : _tasks) addObject:task];
+        _counters->writeQueueDepth++;
+        NNTrace(_tracer, NNWebSocketTraceEventWriteTaskEnqueued, (uintptr_t)(__bridge void *)task, task->data.length);
         [self flush];
     });
 }
@@ -95,36 +151,202 @@
 - (void)flush
 {
     LogTrace("Checking tasks.");
-    if (!_currentTask) {
-        if (_tasks.count == 0) {
-            LogTrace(@"No write task.");
-            return;
+    NSMutableArray *completedTasks = nil;
+    while ([self hasSpaceAvailable]) { @autoreleasepool {
+        if (!_batching && ![self prepareBatch]) {
+            break;
         }
-        _currentTask = [_tasks objectAtIndex:0];
-        LogTrace(@"Task found. bytes:%d tag:%lu",_currentTask->data.length,  _currentTask->tag);
-        _offset = 0;
-        [_tasks removeObjectAtIndex:0];
-        _timer = NNCreateTimer(_queue, _currentTask->timeout, ^{
-            NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorWriteTimeout userInfo:nil];
-            [self didError:error];
-        });
-    }
-    while (_currentTask && _stream.hasSpaceAvailable) { @autoreleasepool {
-        NSData *data = _currentTask->data;
-        NSUInteger dataLen = data.length;
-        NSInteger len = [_stream write:data.bytes + _offset maxLength:dataLen - _offset];
-        if (len > 0) {
-            _offset += len;
-            if (_offset == dataLen) {
-                LogTrace("All data of current task has been writen. bytes:%d", dataLen);
-                NNWebSocketTransportWriteTask *capturedTask =  _currentTask;
-                [self didWrite:capturedTask];
-                _currentTask = nil;
-            } else {
-                LogTrace("%d bytes has been written. %d/%d", len, _offset, dataLen);
+        NSUInteger batchLen = _batchLength;
+        if (_offset < batchLen) {
+            NSInteger len = [self writeBatch];
+            if (len <= 0) {
+                break;
             }
+            _offset += len;
+            _counters->bytesOut += (NSUInteger)len;
+            NNTrace(_tracer, NNWebSocketTraceEventBytesWritten, len, 0);
+            _lastProgressTime = CFAbsoluteTimeGetCurrent();
+            LogTrace("%d bytes has been written. %d/%d", len, _offset, batchLen);
+        }
+        if (!completedTasks) {
+            completedTasks = [NSMutableArray array];
+        }
+        [self collectWrittenTasks:completedTasks];
+        if (_offset == batchLen) {
+            LogTrace("All data of current batch has been writen. bytes:%d", batchLen);
+            _batchData = nil;
+            _batching = NO;
         }
     }}
+    if (![self hasPendingTasks]) {
+        [self stopTimer];
+    } else {
+        [self startTimer];
+    }
+    if (completedTasks.count > 0) {
+        _counters->writeQueueDepth -= completedTasks.count;
+        [_delegate writer:self didWriteTasks:completedTasks];
+    }
+}
+
+// Takes pending tasks into the next batch. Small frames are gathered into the staging buffer
+// up to the batch length so that they go out by one stream write. Others are written from their own data.
+// Writers which can gather write the tasks of a batch from their own data by one call instead.
+- (BOOL)prepareBatch
+{
+    NSMutableArray *tasks = _urgentTasks.count > 0 ? _urgentTasks : _tasks;
+    if (tasks.count == 0) {
+        return NO;
+    }
+    _offset = 0;
+    _completedOffset = 0;
+    _batching = YES;
+    NNWebSocketTransportWriteTask *first = [tasks objectAtIndex:0];
+    NSUInteger firstLen = first->data.length;
+    if (tasks.count == 1 || firstLen >= _batchMaxLength) {
+        _batchData = first->data ?: [NSData data];
+        _batchLength = _batchData.length;
+        [_batchTasks addObject:first];
+        [tasks removeObjectAtIndex:0];
+        return YES;
+    }
+    if ([self canGather]) {
+        NSUInteger length = 0;
+        NSUInteger count = 0;
+        for (NNWebSocketTransportWriteTask *task in tasks) {
+            NSUInteger len = task->data.length;
+            if (count == MAX_GATHERED_TASKS || (count > 0 && length + len > _batchMaxLength)) {
+                break;
+            }
+            length += len;
+            [_batchTasks addObject:task];
+            count++;
+        }
+        [tasks removeObjectsInRange:NSMakeRange(0, count)];
+        _batchData = nil;
+        _batchLength = length;
+        LogTrace(@"Gathered %d tasks into a batch. bytes:%d", count, length);
+        return YES;
+    }
+    if (!_staging) {
+        _staging = [NSMutableData dataWithLength:_batchMaxLength];
+    }
+    uint8_t *dst = (uint8_t *)_staging.mutableBytes;
+    NSUInteger length = 0;
+    NSUInteger count = 0;
+    for (NNWebSocketTransportWriteTask *task in tasks) {
+        NSUInteger len = task->data.length;
+        if (length + len > _batchMaxLength) {
+            break;
+        }
+        memcpy(dst + length, task->data.bytes, len);
+        length += len;
+        [_batchTasks addObject:task];
+        count++;
+    }
+    [tasks removeObjectsInRange:NSMakeRange(0, count)];
+    _batchData = [NSData dataWithBytesNoCopy:dst length:length freeWhenDone:NO];
+    _batchLength = length;
+    LogTrace(@"Gathered %d tasks into a batch. bytes:%d", count, length);
+    return YES;
+}
+
+- (NSInteger)writeBatch
+{
+    if (_batchData) {
+        return [self writeBytes:(const uint8_t *)_batchData.bytes + _offset maxLength:_batchLength - _offset];
+    }
+    // Tasks before _completedOffset have been removed from _batchTasks already.
+    struct iovec iov[MAX_GATHERED_TASKS];
+    int count = 0;
+    NSUInteger skip = _offset - _completedOffset;
+    for (NNWebSocketTransportWriteTask *task in _batchTasks) {
+        NSUInteger len = task->data.length;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        iov[count].iov_base = (uint8_t *)task->data.bytes + skip;
+        iov[count].iov_len = len - skip;
+        skip = 0;
+        count++;
+    }
+    return [self writeVector:iov count:count];
+}
+
+#pragma mark Primitives
+
+- (BOOL)hasSpaceAvailable
+{
+    return _stream.hasSpaceAvailable;
+}
+
+- (NSInteger)writeBytes:(const uint8_t *)bytes maxLength:(NSUInteger)length
+{
+    return [_stream write:bytes maxLength:length];
+}
+
+- (BOOL)canGather
+{
+    return NO;
+}
+
+- (NSInteger)writeVector:(const struct iovec *)iov count:(int)count
+{
+    return [self writeBytes:iov[0].iov_base maxLength:iov[0].iov_len];
+}
+
+- (void)collectWrittenTasks:(NSMutableArray *)completedTasks
+{
+    while (_batchTasks.count > 0) {
+        NNWebSocketTransportWriteTask *task = [_batchTasks objectAtIndex:0];
+        NSUInteger len = task->data.length;
+        if (_completedOffset + len > _offset) {
+            break;
+        }
+        _completedOffset += len;
+        NNTrace(_tracer, NNWebSocketTraceEventWriteTaskDequeued, (uintptr_t)(__bridge void *)task, len);
+        [completedTasks addObject:task];
+        [_batchTasks removeObjectAtIndex:0];
+    }
+}
+
+// One timer covers the whole queue. It fires when no bytes have been written for the timeout.
+- (void)startTimer
+{
+    if (_timer) {
+        return;
+    }
+    NNWebSocketTransportWriteTask *task = nil;
+    if (_batchTasks.count > 0) {
+        task = [_batchTasks objectAtIndex:0];
+    } else {
+        task = _urgentTasks.count > 0 ? [_urgentTasks objectAtIndex:0] : [_tasks objectAtIndex:0];
+    }
+    _timeout = task->timeout;
+    _lastProgressTime = CFAbsoluteTimeGetCurrent();
+    [self scheduleTimer:_timeout];
+}
+
+- (void)scheduleTimer:(NSTimeInterval)timeout
+{
+    _timer = [self.timingWheel scheduleTimeout:timeout queue:_queue block:^{
+        _timer = nil;
+        NSTimeInterval idle = CFAbsoluteTimeGetCurrent() - _lastProgressTime;
+        if (idle < _timeout) {
+            [self scheduleTimer:_timeout - idle];
+            return;
+        }
+        _counters->writeTimeouts++;
+        NSError *error = [NSError errorWithDomain:NNWEBSOCKET_ERROR_DOMAIN code:NNWebSocketErrorWriteTimeout userInfo:nil];
+        [self didError:error];
+    }];
+}
+
+- (void)stopTimer
+{
+    [_timer cancel];
+    _timer = nil;
 }
 
 - (void)didOpen
@@ -133,26 +355,20 @@
     dispatch_once(&_onceOpenToken, ^{
         LogDebug("Output stream has been opened.");
         _closed = NO;
-        NNCancelTimer(_timer);
+        [self stopTimer];
         [_delegate writerDidOpen:self];
     });
 }
 
-- (void)didWrite:(NNWebSocketTransportWriteTask *)task
-{
-    NNCancelTimer(_timer);
-    [_delegate writer:self didWrite:task];
-}
-
 - (void)didError:(NSError *)error
 {
-    NNCancelTimer(_timer);
+    [self stopTimer];
     [_delegate writer:self didError:error];
 }
 
 - (void)didClose
 {
-    NNCancelTimer(_timer);
+    [self stopTimer];
     [_delegate writerDidClose:self];
 }
 
@@ -177,6 +393,7 @@
         });
     } else if (eventCode == NSStreamEventHasSpaceAvailable) {
         LogTrace(@"Fire NSStreamEventHasSpaceAvailable.");
+        NNTrace(_tracer, NNWebSocketTraceEventStreamWritable, 0, 0);
         dispatch_async(_queue, ^{
             [self flush];
         });
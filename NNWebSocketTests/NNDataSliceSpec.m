@@ -0,0 +1,54 @@
+#import "Kiwi.h"
+#import "NNUtils.h"
+
+SPEC_BEGIN(NNDataSliceSpec)
+
+describe(@"NNDataSlice", ^{
+
+    __block NSMutableData *owner;
+
+    beforeEach(^{
+        owner = [NSMutableData dataWithBytes:"abcdefgh" length:8];
+    });
+
+    it(@"should refer to bytes of owner without copying", ^{
+        NNDataSlice *slice = [[NNDataSlice alloc] initWithOwner:owner bytes:owner.bytes + 2 length:3];
+        [[theValue(slice.length) should] equal:theValue(3)];
+        [[theValue(slice.bytes == owner.bytes + 2) should] beYes];
+        [[slice should] equal:[NSData dataWithBytes:"cde" length:3]];
+    });
+
+    it(@"should keep owner alive", ^{
+        __weak NSMutableData *weakOwner = owner;
+        NNDataSlice *slice = [[NNDataSlice alloc] initWithOwner:owner bytes:owner.bytes length:8];
+        owner = nil;
+        [weakOwner shouldNotBeNil];
+        [[slice should] equal:[NSData dataWithBytes:"abcdefgh" length:8]];
+    });
+
+    it(@"should be usable as a range of data", ^{
+        NNDataSlice *slice = [[NNDataSlice alloc] initWithOwner:owner bytes:owner.bytes + 4 length:4];
+        [[[slice subdataWithRange:NSMakeRange(1, 2)] should] equal:[NSData dataWithBytes:"fg" length:2]];
+    });
+
+    it(@"should copy a range which is a small part of owner", ^{
+        NSMutableData *buffer = [NSMutableData dataWithLength:64 * 1024];
+        BOOL sliced = NO;
+        NSData *small = [NNDataSlice dataWithOwner:buffer bytes:buffer.bytes length:1024 sliced:&sliced];
+        [[theValue(sliced) should] beNo];
+        [[theValue(small.bytes == buffer.bytes) should] beNo];
+        NSData *fraction = [NNDataSlice dataWithOwner:buffer bytes:buffer.bytes length:8 * 1024 sliced:&sliced];
+        [[theValue(sliced) should] beNo];
+        [[theValue(fraction.length) should] equal:theValue(8 * 1024)];
+    });
+
+    it(@"should slice a range which is a large part of owner", ^{
+        NSMutableData *buffer = [NSMutableData dataWithLength:64 * 1024];
+        BOOL sliced = NO;
+        NSData *large = [NNDataSlice dataWithOwner:buffer bytes:buffer.bytes + 1024 length:32 * 1024 sliced:&sliced];
+        [[theValue(sliced) should] beYes];
+        [[theValue(large.bytes == buffer.bytes + 1024) should] beYes];
+    });
+});
+
+SPEC_END
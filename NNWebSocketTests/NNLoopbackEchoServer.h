@@ -0,0 +1,15 @@
+#import <Foundation/Foundation.h>
+
+// Minimal websocket echo server on 127.0.0.1 for benchmarks. Each connection is served by its own thread
+// with fixed buffers, so the server itself does not allocate while echoing.
+// Frames are echoed one by one with the same opcode and fin bit, like testserver/echoserver.js.
+@interface NNLoopbackEchoServer : NSObject
+
+@property(readonly, nonatomic) uint16_t port;
+@property(readonly, nonatomic) NSString *url;
+
+// Listens on an ephemeral port. Returns NO when the socket could not be set up.
+- (BOOL)start;
+- (void)stop;
+
+@end
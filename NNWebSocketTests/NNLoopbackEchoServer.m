@@ -0,0 +1,318 @@
+#import "NNLoopbackEchoServer.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <arpa/inet.h>
+#import <pthread.h>
+#import <CommonCrypto/CommonDigest.h>
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define CONNECTION_BUFFER_LENGTH (64 * 1024)
+#define MAX_REQUEST_LENGTH 8192
+
+typedef struct {
+    int fd;
+    uint8_t in[CONNECTION_BUFFER_LENGTH];
+    size_t head;
+    size_t tail;
+    uint8_t out[CONNECTION_BUFFER_LENGTH];
+} EchoConnection;
+
+static BOOL WriteAll(int fd, const uint8_t *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = send(fd, bytes, length, SEND_FLAGS);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return NO;
+        }
+        bytes += n;
+        length -= (size_t)n;
+    }
+    return YES;
+}
+
+// Reads up to length bytes, from buffered bytes first.
+static ssize_t ReadSome(EchoConnection *conn, uint8_t *dst, size_t length)
+{
+    if (conn->head < conn->tail) {
+        size_t n = MIN(length, conn->tail - conn->head);
+        memcpy(dst, conn->in + conn->head, n);
+        conn->head += n;
+        return (ssize_t)n;
+    }
+    ssize_t n;
+    do {
+        n = recv(conn->fd, dst, length, 0);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static BOOL ReadExact(EchoConnection *conn, uint8_t *dst, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = ReadSome(conn, dst, length);
+        if (n <= 0) {
+            return NO;
+        }
+        dst += n;
+        length -= (size_t)n;
+    }
+    return YES;
+}
+
+static void Base64Encode(const uint8_t *src, size_t length, char *dst)
+{
+    static const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 2 < length; i += 3) {
+        *dst++ = chars[src[i] >> 2];
+        *dst++ = chars[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+        *dst++ = chars[((src[i + 1] & 0x0f) << 2) | (src[i + 2] >> 6)];
+        *dst++ = chars[src[i + 2] & 0x3f];
+    }
+    if (i < length) {
+        *dst++ = chars[src[i] >> 2];
+        if (i + 1 < length) {
+            *dst++ = chars[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+            *dst++ = chars[(src[i + 1] & 0x0f) << 2];
+        } else {
+            *dst++ = chars[(src[i] & 0x03) << 4];
+            *dst++ = '=';
+        }
+        *dst++ = '=';
+    }
+    *dst = '\0';
+}
+
+static BOOL Handshake(EchoConnection *conn)
+{
+    char *request = (char *)conn->in;
+    const char *end = NULL;
+    while (!end) {
+        if (conn->tail >= MAX_REQUEST_LENGTH) {
+            return NO;
+        }
+        ssize_t n = recv(conn->fd, conn->in + conn->tail, MAX_REQUEST_LENGTH - conn->tail, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return NO;
+        }
+        conn->tail += (size_t)n;
+        request[conn->tail] = '\0';
+        end = strstr(request, "\r\n\r\n");
+    }
+    // Bytes after the request belong to frames.
+    conn->head = (size_t)(end + 4 - request);
+    const char *key = strcasestr(request, "\r\nSec-WebSocket-Key:");
+    if (!key || key > end) {
+        return NO;
+    }
+    key += strlen("\r\nSec-WebSocket-Key:");
+    while (*key == ' ') {
+        key++;
+    }
+    size_t keyLength = strcspn(key, " \r");
+    char source[128];
+    if (keyLength + strlen(WEBSOCKET_GUID) >= sizeof(source)) {
+        return NO;
+    }
+    memcpy(source, key, keyLength);
+    strcpy(source + keyLength, WEBSOCKET_GUID);
+    uint8_t digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(source, (CC_LONG)strlen(source), digest);
+    char accept[32];
+    Base64Encode(digest, sizeof(digest), accept);
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+            "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    return WriteAll(conn->fd, (const uint8_t *)response, (size_t)length);
+}
+
+// Echoes frames as they arrive. Payload is streamed through the output buffer, so frames of any size
+// are echoed without allocation.
+static void EchoFrames(EchoConnection *conn)
+{
+    while (YES) {
+        uint8_t header[14];
+        if (!ReadExact(conn, header, 2)) {
+            return;
+        }
+        uint8_t opcode = header[0] & 0x0f;
+        BOOL masked = (header[1] & 0x80) != 0;
+        uint64_t length = header[1] & 0x7f;
+        if (length == 126) {
+            if (!ReadExact(conn, header + 2, 2)) {
+                return;
+            }
+            length = ((uint64_t)header[2] << 8) | header[3];
+        } else if (length == 127) {
+            if (!ReadExact(conn, header + 2, 8)) {
+                return;
+            }
+            length = 0;
+            for (int i=0; i<8; i++) {
+                length = (length << 8) | header[2 + i];
+            }
+        }
+        uint8_t mask[4] = {0, 0, 0, 0};
+        if (masked && !ReadExact(conn, mask, 4)) {
+            return;
+        }
+        size_t outLength = 0;
+        conn->out[outLength++] = header[0];
+        if (length < 126) {
+            conn->out[outLength++] = (uint8_t)length;
+        } else if (length <= 0xffff) {
+            conn->out[outLength++] = 126;
+            conn->out[outLength++] = (uint8_t)(length >> 8);
+            conn->out[outLength++] = (uint8_t)length;
+        } else {
+            conn->out[outLength++] = 127;
+            for (int i=7; i>=0; i--) {
+                conn->out[outLength++] = (uint8_t)(length >> (i * 8));
+            }
+        }
+        uint64_t offset = 0;
+        while (offset < length) {
+            size_t space = sizeof(conn->out) - outLength;
+            size_t want = (size_t)MIN((uint64_t)space, length - offset);
+            ssize_t n = ReadSome(conn, conn->out + outLength, want);
+            if (n <= 0) {
+                return;
+            }
+            if (masked) {
+                uint8_t *p = conn->out + outLength;
+                for (ssize_t i=0; i<n; i++) {
+                    p[i] ^= mask[(offset + (uint64_t)i) & 3];
+                }
+            }
+            offset += (uint64_t)n;
+            outLength += (size_t)n;
+            if (outLength == sizeof(conn->out) && !WriteAll(conn->fd, conn->out, outLength)) {
+                return;
+            }
+            if (outLength == sizeof(conn->out)) {
+                outLength = 0;
+            }
+        }
+        if (outLength > 0 && !WriteAll(conn->fd, conn->out, outLength)) {
+            return;
+        }
+        if (opcode == 0x8) {
+            return;
+        }
+    }
+}
+
+static void *ServeConnection(void *arg)
+{
+    EchoConnection *conn = arg;
+    int on = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    #ifdef SO_NOSIGPIPE
+    setsockopt(conn->fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    #endif
+    if (Handshake(conn)) {
+        EchoFrames(conn);
+    }
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static void *AcceptConnections(void *arg)
+{
+    int listener = (int)(intptr_t)arg;
+    while (YES) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return NULL;
+        }
+        EchoConnection *conn = calloc(1, sizeof(EchoConnection));
+        conn->fd = fd;
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, ServeConnection, conn) != 0) {
+            close(fd);
+            free(conn);
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+@implementation NNLoopbackEchoServer
+{
+    int _listener;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _listener = -1;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stop];
+}
+
+- (BOOL)start
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NO;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 || getsockname(fd, (struct sockaddr *)&addr, &len) < 0) {
+        close(fd);
+        return NO;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, AcceptConnections, (void *)(intptr_t)fd) != 0) {
+        close(fd);
+        return NO;
+    }
+    pthread_detach(thread);
+    _listener = fd;
+    _port = ntohs(addr.sin_port);
+    _url = [NSString stringWithFormat:@"ws://127.0.0.1:%u/", _port];
+    return YES;
+}
+
+// Connections being served are left to finish by their clients.
+- (void)stop
+{
+    if (_listener >= 0) {
+        shutdown(_listener, SHUT_RDWR);
+        close(_listener);
+        _listener = -1;
+    }
+}
+
+@end
@@ -0,0 +1,73 @@
+#import "kiwi.h"
+#import "NNUtils.h"
+
+SPEC_BEGIN(NNMessageBufferSpec)
+
+describe(@"NNMessageBuffer", ^{
+
+    __block NNMessageBuffer *buffer;
+    __block NSMutableData *bytes;
+
+    beforeEach(^{
+        buffer = [NNMessageBuffer buffer];
+        bytes = [NSMutableData dataWithLength:100 * 1024];
+        uint8_t *b = bytes.mutableBytes;
+        for (NSUInteger i=0; i<bytes.length; i++) {
+            b[i] = (uint8_t)(i % 251);
+        }
+    });
+
+    it(@"should assemble appended bytes", ^{
+        [buffer appendBytes:bytes.bytes length:10];
+        [buffer appendBytes:(const uint8_t *)bytes.bytes + 10 length:90];
+        [[theValue(buffer.length) should] equal:theValue(100)];
+        [[[buffer takeData] should] equal:[bytes subdataWithRange:NSMakeRange(0, 100)]];
+        [[theValue(buffer.length) should] equal:theValue(0)];
+    });
+    it(@"should keep the rest when leading bytes are removed", ^{
+        [buffer appendBytes:bytes.bytes length:100];
+        [buffer removeLeadingBytes:40];
+        [[theValue(buffer.length) should] equal:theValue(60)];
+        [[theValue(memcmp(buffer.bytes, (const uint8_t *)bytes.bytes + 40, 60)) should] equal:theValue(0)];
+    });
+    it(@"should reserve the size of recent messages when a message starts", ^{
+        [buffer appendBytes:bytes.bytes length:bytes.length];
+        [buffer takeData];
+        [buffer appendBytes:bytes.bytes length:1];
+        [[theValue(buffer.capacity) should] beGreaterThanOrEqualTo:theValue(bytes.length)];
+    });
+    it(@"should give back capacity once large messages are no longer seen", ^{
+        [buffer appendBytes:bytes.bytes length:bytes.length];
+        [buffer removeLeadingBytes:bytes.length];
+        for (NSUInteger i=0; i<8; i++) {
+            [buffer appendBytes:bytes.bytes length:100];
+            [buffer removeLeadingBytes:100];
+        }
+        [[theValue(buffer.capacity) should] beLessThan:theValue(bytes.length)];
+    });
+    it(@"should hand over bytes filling most of the buffer without copying", ^{
+        [buffer appendBytes:bytes.bytes length:4096];
+        const uint8_t *p = buffer.bytes;
+        NSData *data = [buffer takeData];
+        [[theValue(data.bytes == p) should] beYes];
+        [[theValue(buffer.capacity) should] equal:theValue(0)];
+    });
+});
+
+describe(@"NNIsValidUTF8Prefix", ^{
+
+    it(@"should exclude an incomplete character at the end", ^{
+        const uint8_t b[] = {0x61, 0xe3, 0x81, 0x82, 0xe3, 0x81};
+        NSUInteger length = 0;
+        [[theValue(NNIsValidUTF8Prefix(b, sizeof(b), &length)) should] beYes];
+        [[theValue(length) should] equal:theValue(4)];
+        [[theValue(NNIsValidUTF8(b, sizeof(b))) should] beNo];
+    });
+    it(@"should reject an invalid sequence", ^{
+        const uint8_t b[] = {0x61, 0xc0, 0xaf};
+        NSUInteger length = 0;
+        [[theValue(NNIsValidUTF8Prefix(b, sizeof(b), &length)) should] beNo];
+    });
+});
+
+SPEC_END
@@ -19,7 +19,50 @@ describe(@"NNRunLoopBorker", ^{
         });
     });
 
+    context(@"terminate", ^{
+        it(@"should finish thread even when nothing is scheduled", ^{
+            NNRunLoopBroker *b = [[NNRunLoopBroker alloc] initWithName:@"test"];
+            [b terminate];
+            [NSThread sleepForTimeInterval:0.5];
+            [[theValue(b.thread.isFinished) should] beYes];
+        });
+    });
 
 });
-SPEC_END
 
+describe(@"NNRunLoopBrokerPool", ^{
+
+    it(@"should default to the number of cores", ^{
+        NNRunLoopBrokerPool *pool = [NNRunLoopBrokerPool sharedPoolWithSize:0];
+        [[theValue(pool.size) should] equal:theValue([[NSProcessInfo processInfo] activeProcessorCount])];
+        [[theValue(pool == [NNRunLoopBrokerPool sharedPoolWithSize:pool.size]) should] beYes];
+    });
+
+    it(@"should assign brokers to the least loaded thread", ^{
+        NNRunLoopBrokerPool *pool = [[NNRunLoopBrokerPool alloc] initWithName:@"test" size:2];
+        NNRunLoopBroker *b1 = [pool acquireBroker];
+        NNRunLoopBroker *b2 = [pool acquireBroker];
+        NNRunLoopBroker *b3 = [pool acquireBroker];
+        [[theValue(b1 == b2) should] beNo];
+        [[theValue(b3 == b1) should] beYes];
+        [[theValue(pool.brokerCount) should] equal:theValue(2)];
+        [pool releaseBroker:b2];
+        [[theValue([pool acquireBroker] == b1) should] beNo];
+    });
+
+    it(@"should terminate thread when the last user releases it", ^{
+        NNRunLoopBrokerPool *pool = [[NNRunLoopBrokerPool alloc] initWithName:@"test" size:1];
+        NNRunLoopBroker *b1 = [pool acquireBroker];
+        NNRunLoopBroker *b2 = [pool acquireBroker];
+        [[theValue(b1 == b2) should] beYes];
+        [pool releaseBroker:b1];
+        [NSThread sleepForTimeInterval:0.5];
+        [[theValue(b1.thread.isFinished) should] beNo];
+        [pool releaseBroker:b2];
+        [NSThread sleepForTimeInterval:0.5];
+        [[theValue(b1.thread.isFinished) should] beYes];
+        [[theValue(pool.brokerCount) should] equal:theValue(0)];
+        [[theValue([pool acquireBroker] == b1) should] beNo];
+    });
+});
+SPEC_END
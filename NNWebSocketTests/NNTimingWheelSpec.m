@@ -0,0 +1,80 @@
+#import "Kiwi.h"
+#import "NNUtils.h"
+
+SPEC_BEGIN(NNTimingWheelSpec)
+
+describe(@"NNTimingWheel", ^{
+
+    __block NNTimingWheel *wheel;
+    __block dispatch_queue_t queue;
+
+    beforeEach(^{
+        wheel = [[NNTimingWheel alloc] initWithResolution:0.01];
+        queue = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+    });
+
+    it(@"should clamp resolution", ^{
+        [[theValue([[NNTimingWheel alloc] initWithResolution:0.001].resolution) should] equal:theValue(0.01)];
+        [[theValue([[NNTimingWheel alloc] initWithResolution:1].resolution) should] equal:theValue(0.1)];
+        [[theValue([NNTimingWheel sharedWheelWithResolution:0.05] == [NNTimingWheel sharedWheelWithResolution:0.05]) should] beYes];
+    });
+
+    it(@"should fire after timeout", ^{
+        __block NSNumber *fired = @(NO);
+        __block CFAbsoluteTime firedAt = 0;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        [wheel scheduleTimeout:0.1 queue:queue block:^{
+            firedAt = CFAbsoluteTimeGetCurrent();
+            fired = @(YES);
+        }];
+        [[expectFutureValue(fired) shouldEventuallyBeforeTimingOutAfter(2)] beYes];
+        [[theValue(firedAt - start) should] beGreaterThanOrEqualTo:theValue(0.1)];
+        [[theValue(firedAt - start) should] beLessThan:theValue(0.5)];
+    });
+
+    it(@"should fire timeouts longer than the first level", ^{
+        __block NSNumber *fired = @(NO);
+        __block CFAbsoluteTime firedAt = 0;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        [wheel scheduleTimeout:1.5 queue:queue block:^{
+            firedAt = CFAbsoluteTimeGetCurrent();
+            fired = @(YES);
+        }];
+        [[expectFutureValue(fired) shouldEventuallyBeforeTimingOutAfter(3)] beYes];
+        [[theValue(firedAt - start) should] beGreaterThanOrEqualTo:theValue(1.5)];
+        [[theValue(firedAt - start) should] beLessThan:theValue(2.0)];
+    });
+
+    it(@"should not fire cancelled timeout", ^{
+        __block NSNumber *cancelledFired = @(NO);
+        __block NSNumber *fired = @(NO);
+        NNTimeout *timeout = [wheel scheduleTimeout:0.05 queue:queue block:^{
+            cancelledFired = @(YES);
+        }];
+        [wheel scheduleTimeout:0.2 queue:queue block:^{
+            fired = @(YES);
+        }];
+        [timeout cancel];
+        [[expectFutureValue(fired) shouldEventuallyBeforeTimingOutAfter(2)] beYes];
+        [[cancelledFired should] beNo];
+    });
+
+    it(@"should fire many timeouts in order of deadline", ^{
+        NSMutableArray *order = [NSMutableArray array];
+        __block NSNumber *finished = @(NO);
+        for (int i=20; i>0; i--) {
+            [wheel scheduleTimeout:i * 0.03 queue:queue block:^{
+                [order addObject:@(i)];
+                if (order.count == 20) {
+                    finished = @(YES);
+                }
+            }];
+        }
+        [[expectFutureValue(finished) shouldEventuallyBeforeTimingOutAfter(3)] beYes];
+        for (int i=0; i<20; i++) {
+            [[[order objectAtIndex:i] should] equal:@(i + 1)];
+        }
+    });
+});
+
+SPEC_END
@@ -187,4 +187,48 @@ SPEC_BEGIN(NNUTF8BufferSpec)
         });
     });
 
+    describe(@"appendData", ^{
+        __block NSData *message;
+        beforeEach(^{
+            // 4MB of mixed ASCII and multibyte characters.
+            NSMutableString *str = [NSMutableString string];
+            while (str.length < 1024 * 1024) {
+                [str appendString:@"The quick brown fox jumps over the lazy dog. "];
+                [str appendString:@"\u3044\u308d\u306f\u306b\u307b\u3078\u3068 \u00e9\u00e8 \U0001F600 "];
+            }
+            message = [str dataUsingEncoding:NSUTF8StringEncoding];
+        });
+        it(@"should validate fragments incrementally regardless of how they are split", ^{
+            for (NSUInteger fragmentLength=1021; fragmentLength<=65536; fragmentLength*=4) {
+                NNUTF8Buffer *buff = [NNUTF8Buffer buffer];
+                NSMutableData *actual = [NSMutableData data];
+                for (NSUInteger pos=0; pos<message.length; pos+=fragmentLength) {
+                    NSRange range = NSMakeRange(pos, MIN(fragmentLength, message.length - pos));
+                    [[theValue([buff appendData:[message subdataWithRange:range]]) should] beYes];
+                    NSData *valid = [buff removeValidUTF8Portion];
+                    if (valid) {
+                        [actual appendData:valid];
+                    }
+                    [[theValue(buff.length) should] beLessThan:theValue(4)];
+                }
+                [[actual should] equal:message];
+            }
+        });
+        it(@"should validate a large multi-fragment message", ^{
+            NSUInteger fragmentLength = 4096;
+            NSUInteger fragments = message.length / fragmentLength;
+            NNUTF8Buffer *buff = [NNUTF8Buffer buffer];
+            for (NSUInteger i=0; i<fragments; i++) {
+                [[theValue([buff appendData:[message subdataWithRange:NSMakeRange(i * fragmentLength, fragmentLength)]]) should] beYes];
+            }
+            [[theValue(buff.length) should] equal:theValue(fragments * fragmentLength)];
+        });
+        it(@"should validate long ASCII and multibyte text", ^{
+            NSMutableData *ascii = [NSMutableData dataWithLength:message.length];
+            memset(ascii.mutableBytes, 'a', ascii.length);
+            [[theValue(NNIsValidUTF8(ascii.bytes, ascii.length)) should] beYes];
+            [[theValue(NNIsValidUTF8(message.bytes, message.length)) should] beYes];
+        });
+    });
+
 SPEC_END
\ No newline at end of file
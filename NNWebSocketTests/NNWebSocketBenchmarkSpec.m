@@ -0,0 +1,681 @@
+#import <malloc/malloc.h>
+#import <mach/mach.h>
+#import <libkern/OSAtomic.h>
+#import <sys/resource.h>
+#import "Kiwi.h"
+#import "NNWebSocket.h"
+#import "NNWebSocketFrameEncoder.h"
+#import "NNUtils.h"
+#import "NNLoopbackEchoServer.h"
+
+/*
+Throughput and latency benchmarks against an in-process loopback echo server.
+They take minutes, so they run only when NNWEBSOCKET_BENCHMARK is set:
+    NNWEBSOCKET_BENCHMARK=1
+
+Each scenario appends one JSON object per line to NNWEBSOCKET_BENCHMARK_OUTPUT
+(NSTemporaryDirectory()/NNWebSocketBenchmark.jsonl by default).
+RTT is measured from send to echo of each message. Allocations are counted on the default malloc zone
+of the whole process while the scenario runs, which the echo server does not add to.
+The server scenarios compare the loopback echo server with an NNWebSocketServer in the same process, whose
+allocations are counted as well.
+*/
+
+#define KB 1024
+#define MB (1024 * 1024)
+
+static volatile int64_t gAllocations = 0;
+static void *(*gMalloc)(malloc_zone_t *zone, size_t size);
+static void *(*gCalloc)(malloc_zone_t *zone, size_t count, size_t size);
+static void *(*gRealloc)(malloc_zone_t *zone, void *ptr, size_t size);
+
+static void *CountingMalloc(malloc_zone_t *zone, size_t size)
+{
+    OSAtomicIncrement64(&gAllocations);
+    return gMalloc(zone, size);
+}
+
+static void *CountingCalloc(malloc_zone_t *zone, size_t count, size_t size)
+{
+    OSAtomicIncrement64(&gAllocations);
+    return gCalloc(zone, count, size);
+}
+
+static void *CountingRealloc(malloc_zone_t *zone, void *ptr, size_t size)
+{
+    OSAtomicIncrement64(&gAllocations);
+    return gRealloc(zone, ptr, size);
+}
+
+static void InstallAllocationCounter()
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        malloc_zone_t *zone = malloc_default_zone();
+        vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE);
+        gMalloc = zone->malloc;
+        gCalloc = zone->calloc;
+        gRealloc = zone->realloc;
+        zone->malloc = CountingMalloc;
+        zone->calloc = CountingCalloc;
+        zone->realloc = CountingRealloc;
+        vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ);
+    });
+}
+
+static uint64_t GetResidentBytes()
+{
+    struct task_basic_info info;
+    mach_msg_type_number_t count = TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+}
+
+static NSUInteger GetThreadCount()
+{
+    thread_act_array_t threads;
+    mach_msg_type_number_t count = 0;
+    if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    for (mach_msg_type_number_t i=0; i<count; i++) {
+        mach_port_deallocate(mach_task_self(), threads[i]);
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t)threads, count * sizeof(thread_act_t));
+    return count;
+}
+
+static BOOL IsBenchmarkEnabled()
+{
+    return [[[NSProcessInfo processInfo] environment] objectForKey:@"NNWEBSOCKET_BENCHMARK"] != nil;
+}
+
+static void Report(NSDictionary *result)
+{
+    NSString *path = [[[NSProcessInfo processInfo] environment] objectForKey:@"NNWEBSOCKET_BENCHMARK_OUTPUT"];
+    if (!path) {
+        path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NNWebSocketBenchmark.jsonl"];
+    }
+    NSMutableData *line = [[NSJSONSerialization dataWithJSONObject:result options:0 error:NULL] mutableCopy];
+    [line appendBytes:"\n" length:1];
+    NSFileHandle *file = [NSFileHandle fileHandleForWritingAtPath:path];
+    if (!file) {
+        [[NSFileManager defaultManager] createFileAtPath:path contents:nil attributes:nil];
+        file = [NSFileHandle fileHandleForWritingAtPath:path];
+    }
+    [file seekToEndOfFile];
+    [file writeData:line];
+    [file closeFile];
+    NSLog(@"%@", [[NSString alloc] initWithData:line encoding:NSUTF8StringEncoding]);
+}
+
+static double Percentile(double *sorted, NSUInteger count, double q)
+{
+    if (count == 0) {
+        return 0;
+    }
+    return sorted[MIN(count - 1, (NSUInteger)(q * count))];
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+typedef struct {
+    NNWebSocketTransportType transport;
+    NSUInteger connections;
+    NSUInteger size;
+    // Messages are sent in fragments of this size when it is not 0.
+    NSUInteger fragmentSize;
+    BOOL text;
+    // Messages per connection.
+    NSUInteger messages;
+    // Messages in flight per connection. 1 measures pure round trips.
+    NSUInteger window;
+} Scenario;
+
+static NSDictionary* RunScenario(NSString *name, NSString *url, Scenario sc)
+{
+    NSUInteger total = sc.connections * sc.messages;
+    double *rtts = malloc(sizeof(double) * total);
+    CFAbsoluteTime *sentAt = malloc(sizeof(CFAbsoluteTime) * total);
+    dispatch_queue_t queue = dispatch_queue_create("NNWebSocketBenchmark", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    NSMutableData *payload = [NSMutableData dataWithLength:sc.size];
+    uint8_t *b = payload.mutableBytes;
+    for (NSUInteger i=0; i<sc.size; i++) {
+        b[i] = (uint8_t)('a' + i % 26);
+    }
+    NSString *text = sc.text ? [[NSString alloc] initWithData:payload encoding:NSASCIIStringEncoding] : nil;
+
+    NNWebSocketOptions *opts = [NNWebSocketOptions options];
+    opts.transportType = sc.transport;
+    opts.callbackQueue = queue;
+    opts.maxPayloadByteSize = 1ull << 32;
+    opts.connectTimeoutSec = 10;
+    opts.readTimeoutSec = 60;
+    opts.writeTimeoutSec = 60;
+    opts.closeTimeoutSec = 10;
+    opts.sendBufferHighWatermark = UINT64_MAX;
+    if (sc.fragmentSize > 0) {
+        opts.sendFragmentByteSize = sc.fragmentSize;
+        opts.autoFragmentThresholdByteSize = sc.fragmentSize;
+    }
+
+    __block NSUInteger opened = 0;
+    __block NSUInteger failed = 0;
+    __block NSUInteger finished = 0;
+    __block NSUInteger rttCount = 0;
+    __block CFAbsoluteTime start = 0;
+    __block CFAbsoluteTime end = 0;
+    __block int64_t allocations = 0;
+    NSMutableArray *clients = [NSMutableArray arrayWithCapacity:sc.connections];
+    NSMutableArray *starters = [NSMutableArray arrayWithCapacity:sc.connections];
+    for (NSUInteger c=0; c<sc.connections; c++) {
+        id<NNWebSocketClient> client = [NNWebSocket client:[NSURL URLWithString:url] options:opts];
+        __weak id<NNWebSocketClient> weakClient = client;
+        __block NSUInteger sent = 0;
+        __block NSUInteger received = 0;
+        CFAbsoluteTime *connSentAt = sentAt + c * sc.messages;
+        dispatch_block_t send = ^{
+            while (sent < sc.messages && sent - received < sc.window) {
+                connSentAt[sent++] = CFAbsoluteTimeGetCurrent();
+                if (text) {
+                    [weakClient sendText:text];
+                } else {
+                    [weakClient sendData:payload];
+                }
+            }
+        };
+        dispatch_block_t receive = ^{
+            CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+            rtts[rttCount++] = now - connSentAt[received++];
+            if (received < sc.messages) {
+                send();
+            } else if (++finished == sc.connections) {
+                end = now;
+                allocations = gAllocations - allocations;
+                dispatch_semaphore_signal(done);
+            }
+        };
+        client.onOpen = ^{
+            if (++opened + failed == sc.connections) {
+                // Every connection starts at once, after all of them have been opened.
+                allocations = gAllocations;
+                start = CFAbsoluteTimeGetCurrent();
+                for (dispatch_block_t starter in starters) {
+                    starter();
+                }
+            }
+        };
+        client.onOpenFailed = ^(NSError *error) {
+            failed++;
+            dispatch_semaphore_signal(done);
+        };
+        if (sc.fragmentSize > 0) {
+            client.onTextChunk = ^(NSString *chunk, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo) {
+                if (isFinal) receive();
+            };
+            client.onDataChunk = ^(NSData *chunk, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo) {
+                if (isFinal) receive();
+            };
+        } else {
+            client.onText = ^(NSString *received) {
+                receive();
+            };
+            client.onData = ^(NSData *received) {
+                receive();
+            };
+        }
+        [clients addObject:client];
+        [starters addObject:[send copy]];
+    }
+    for (id<NNWebSocketClient> client in clients) {
+        [client open];
+    }
+    long timedOut = dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, 600 * NSEC_PER_SEC));
+    __block NSUInteger measured = 0;
+    dispatch_sync(queue, ^{
+        measured = rttCount;
+    });
+    for (id<NNWebSocketClient> client in clients) {
+        [client close];
+    }
+
+    qsort(rtts, measured, sizeof(double), CompareDouble);
+    double seconds = end - start;
+    NSDictionary *result = @{
+        @"scenario" : name,
+        @"transport" : sc.transport == NNWebSocketTransportTypeSocket ? @"socket" : @"stream",
+        @"connections" : @(sc.connections),
+        @"size" : @(sc.size),
+        @"fragment_size" : @(sc.fragmentSize),
+        @"type" : sc.text ? @"text" : @"binary",
+        @"window" : @(sc.window),
+        @"messages" : @(measured),
+        @"completed" : @(timedOut == 0 && failed == 0 && measured == total),
+        @"seconds" : @(seconds),
+        @"msgs_per_sec" : @(seconds > 0 ? measured / seconds : 0),
+        @"mb_per_sec" : @(seconds > 0 ? (double)measured * sc.size / seconds / MB : 0),
+        @"rtt_p50_us" : @(Percentile(rtts, measured, 0.5) * 1e6),
+        @"rtt_p99_us" : @(Percentile(rtts, measured, 0.99) * 1e6),
+        @"rtt_p999_us" : @(Percentile(rtts, measured, 0.999) * 1e6),
+        @"allocs_per_msg" : @(measured > 0 ? (double)allocations / measured : 0),
+    };
+    free(rtts);
+    free(sentAt);
+    Report(result);
+    return result;
+}
+
+// Sends on a pool of sc.connections connections with sc.window messages in flight per connection, so that the
+// throughput can be compared with a single connection carrying the same window.
+static NSDictionary* RunPoolScenario(NSString *name, NSString *url, Scenario sc)
+{
+    NSUInteger total = sc.messages;
+    NSUInteger window = sc.window * sc.connections;
+    double *rtts = malloc(sizeof(double) * total);
+    CFAbsoluteTime *sentAt = malloc(sizeof(CFAbsoluteTime) * total);
+    dispatch_queue_t queue = dispatch_queue_create("NNWebSocketBenchmark", DISPATCH_QUEUE_SERIAL);
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    NSMutableData *payload = [NSMutableData dataWithLength:sc.size];
+    uint8_t *b = payload.mutableBytes;
+    for (NSUInteger i=0; i<sc.size; i++) {
+        b[i] = (uint8_t)('a' + i % 26);
+    }
+
+    NNWebSocketOptions *opts = [NNWebSocketOptions options];
+    opts.transportType = sc.transport;
+    opts.callbackQueue = queue;
+    opts.maxPayloadByteSize = 1ull << 32;
+    opts.connectTimeoutSec = 10;
+    opts.readTimeoutSec = 60;
+    opts.writeTimeoutSec = 60;
+    opts.closeTimeoutSec = 10;
+    opts.sendBufferHighWatermark = UINT64_MAX;
+
+    __block BOOL failed = NO;
+    __block NSUInteger sent = 0;
+    __block NSUInteger received = 0;
+    __block CFAbsoluteTime start = 0;
+    __block CFAbsoluteTime end = 0;
+    __block int64_t allocations = 0;
+    NNWebSocketClientPool *pool = [NNWebSocket pool:[NSURL URLWithString:url] options:opts size:sc.connections];
+    __weak NNWebSocketClientPool *weakPool = pool;
+    dispatch_block_t send = ^{
+        while (sent < total && sent - received < window) {
+            sentAt[sent++] = CFAbsoluteTimeGetCurrent();
+            [weakPool sendData:payload];
+        }
+    };
+    // Echoes may come back on any connection, so a round trip is paired with the oldest message in flight.
+    pool.onData = ^(NSData *data) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        rtts[received] = now - sentAt[received];
+        if (++received < total) {
+            send();
+        } else {
+            end = now;
+            allocations = gAllocations - allocations;
+            dispatch_semaphore_signal(done);
+        }
+    };
+    pool.onOpenFailed = ^(NSError *error) {
+        failed = YES;
+        dispatch_semaphore_signal(done);
+    };
+    [pool open];
+    // onOpen is called on the first connection, so wait for the rest before the clock starts.
+    for (NSUInteger i=0; i<1000 && pool.openConnectionCount < sc.connections && !failed; i++) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    dispatch_async(queue, ^{
+        allocations = gAllocations;
+        start = CFAbsoluteTimeGetCurrent();
+        send();
+    });
+    long timedOut = dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, 600 * NSEC_PER_SEC));
+    __block NSUInteger measured = 0;
+    dispatch_sync(queue, ^{
+        measured = received;
+    });
+    [pool close];
+
+    qsort(rtts, measured, sizeof(double), CompareDouble);
+    double seconds = end - start;
+    NSDictionary *result = @{
+        @"scenario" : name,
+        @"transport" : sc.transport == NNWebSocketTransportTypeSocket ? @"socket" : @"stream",
+        @"connections" : @(sc.connections),
+        @"size" : @(sc.size),
+        @"fragment_size" : @(sc.fragmentSize),
+        @"type" : @"binary",
+        @"window" : @(sc.window),
+        @"messages" : @(measured),
+        @"completed" : @(timedOut == 0 && !failed && measured == total),
+        @"seconds" : @(seconds),
+        @"msgs_per_sec" : @(seconds > 0 ? measured / seconds : 0),
+        @"mb_per_sec" : @(seconds > 0 ? (double)measured * sc.size / seconds / MB : 0),
+        @"rtt_p50_us" : @(Percentile(rtts, measured, 0.5) * 1e6),
+        @"rtt_p99_us" : @(Percentile(rtts, measured, 0.99) * 1e6),
+        @"rtt_p999_us" : @(Percentile(rtts, measured, 0.999) * 1e6),
+        @"allocs_per_msg" : @(measured > 0 ? (double)allocations / measured : 0),
+    };
+    free(rtts);
+    free(sentAt);
+    Report(result);
+    return result;
+}
+
+// Encoding path which NNWebSocketStateOpen used before NNWebSocketFrameEncoder. Kept as a reference for benchmark.
+static NSData* LegacyEncode(NNWebSocketFrame *frame)
+{
+    NSUInteger payloadLen = frame.data.length;
+    NSUInteger headerLen = payloadLen <= 125 ? 2 : payloadLen <= UINT16_MAX ? 4 : 10;
+    headerLen += 4;
+    NSUInteger cnt = 0;
+    uint8_t headerBuff[headerLen];
+    memset(headerBuff, 0, sizeof(headerBuff));
+    if (frame.fin) headerBuff[cnt] += NNWebSocketFrameMaskFin;
+    headerBuff[cnt] += frame.opcode & 0xf;
+    cnt++;
+    headerBuff[cnt] += NNWebSocketFrameMaskMask;
+    if (payloadLen <= 125) {
+        headerBuff[cnt] += payloadLen;
+    } else if (payloadLen <= UINT16_MAX) {
+        headerBuff[cnt] += 126;
+        headerBuff[++cnt] = (uint8_t)((payloadLen & 0xff00) >> 8);
+        headerBuff[++cnt] = (uint8_t)(payloadLen & 0x00ff);
+    } else {
+        headerBuff[cnt] += 127;
+        uint64_t l = payloadLen;
+        for (int i=8; i>0; i--) {
+            headerBuff[++cnt] = (uint8_t)((l >> ((i - 1) * 8)) & 0xff);
+        }
+    }
+    uint8_t maskingKey[4];
+    uint32_t src = arc4random();
+    for (int i=4; i>0; i--) {
+        uint8_t k = (uint8_t)((src >> ((i - 1) * 8)) & 0xff);
+        maskingKey[4 - i] = k;
+        headerBuff[++cnt] = k;
+    }
+    NSMutableData *maskedData = [NSMutableData dataWithData:frame.data];
+    uint8_t *payloadBuff = (uint8_t *)[maskedData mutableBytes];
+    for (int i=0; i<payloadLen; i++) {
+        payloadBuff[i] ^= maskingKey[i % 4];
+    }
+    NSMutableData *f = [NSMutableData data];
+    [f appendBytes:headerBuff length:headerLen];
+    [f appendData:maskedData];
+    return f;
+}
+
+// Keeps each run around the same amount of traffic regardless of message size.
+static NSUInteger MessagesForSize(NSUInteger size)
+{
+    return MAX((NSUInteger)4, MIN((NSUInteger)5000, (NSUInteger)(256 * MB / size)));
+}
+
+// Thousands of connections need both ends of each in this process.
+static void RaiseDescriptorLimit(rlim_t limit)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < limit) {
+        rl.rlim_cur = MIN(limit, rl.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+SPEC_BEGIN(NNWebSocketBenchmarkSpec)
+
+describe(@"Benchmark", ^{
+
+    __block NNLoopbackEchoServer *server;
+    NSArray *transports = @[@(NNWebSocketTransportTypeStream), @(NNWebSocketTransportTypeSocket)];
+
+    beforeAll(^{
+        if (IsBenchmarkEnabled()) {
+            InstallAllocationCounter();
+            server = [[NNLoopbackEchoServer alloc] init];
+            [server start];
+        }
+    });
+
+    afterAll(^{
+        [server stop];
+    });
+
+    it(@"frame encoder", ^{
+        if (!IsBenchmarkEnabled()) return;
+        NNWebSocketFrameEncoder *encoder = [[NNWebSocketFrameEncoder alloc] initWithMasking:YES];
+        for (NSNumber *n in @[@16, @(1 * KB), @(64 * KB), @(1 * MB), @(8 * MB)]) {
+            NSUInteger size = [n unsignedIntegerValue];
+            NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+            frame.data = [NSMutableData dataWithLength:size];
+            NSUInteger iterations = MAX((NSUInteger)4, (64 * MB) / (size * 4));
+            CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+            for (NSUInteger i=0; i<iterations; i++) { @autoreleasepool {
+                LegacyEncode(frame);
+            }}
+            CFAbsoluteTime legacy = CFAbsoluteTimeGetCurrent() - start;
+            start = CFAbsoluteTimeGetCurrent();
+            for (NSUInteger i=0; i<iterations; i++) { @autoreleasepool {
+                [encoder encodeFrame:frame];
+            }}
+            CFAbsoluteTime current = CFAbsoluteTimeGetCurrent() - start;
+            double mb = (double)size * iterations / MB;
+            Report(@{
+                @"scenario" : @"frame_encoder",
+                @"size" : @(size),
+                @"iterations" : @(iterations),
+                @"legacy_mb_per_sec" : @(mb / legacy),
+                @"mb_per_sec" : @(mb / current),
+            });
+        }
+    });
+
+    it(@"timing wheel", ^{
+        if (!IsBenchmarkEnabled()) return;
+        NNTimingWheel *wheel = [[NNTimingWheel alloc] initWithResolution:0.01];
+        dispatch_queue_t queue = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+        NSUInteger iterations = 100000;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i=0; i<iterations; i++) { @autoreleasepool {
+            dispatch_source_t timer = NNCreateTimer(queue, 5, ^{});
+            NNCancelTimer(timer);
+        }}
+        CFAbsoluteTime sources = CFAbsoluteTimeGetCurrent() - start;
+        start = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i=0; i<iterations; i++) { @autoreleasepool {
+            NNTimeout *timeout = [wheel scheduleTimeout:5 queue:queue block:^{}];
+            [timeout cancel];
+        }}
+        CFAbsoluteTime wheelTime = CFAbsoluteTimeGetCurrent() - start;
+        Report(@{
+            @"scenario" : @"timer_schedule_cancel",
+            @"iterations" : @(iterations),
+            @"dispatch_source_ns_per_op" : @(sources * 1e9 / iterations),
+            @"timing_wheel_ns_per_op" : @(wheelTime * 1e9 / iterations),
+        });
+    });
+
+    it(@"utf8 validation", ^{
+        if (!IsBenchmarkEnabled()) return;
+        NSMutableString *str = [NSMutableString string];
+        while (str.length < 1 * MB) {
+            [str appendString:@"The quick brown fox jumps over the lazy dog. "];
+            [str appendString:@"\u3044\u308d\u306f\u306b\u307b\u3078\u3068 \u00e9\u00e8 \U0001F600 "];
+        }
+        NSData *mixed = [str dataUsingEncoding:NSUTF8StringEncoding];
+        NSMutableData *ascii = [NSMutableData dataWithLength:mixed.length];
+        memset(ascii.mutableBytes, 'a', ascii.length);
+        NSUInteger fragmentLength = 4 * KB;
+        NSUInteger fragments = mixed.length / fragmentLength;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        NNUTF8Buffer *buff = [NNUTF8Buffer buffer];
+        for (NSUInteger i=0; i<fragments; i++) {
+            [buff appendData:[mixed subdataWithRange:NSMakeRange(i * fragmentLength, fragmentLength)]];
+        }
+        CFAbsoluteTime fragmented = CFAbsoluteTimeGetCurrent() - start;
+        start = CFAbsoluteTimeGetCurrent();
+        for (int i=0; i<10; i++) {
+            NNIsValidUTF8(ascii.bytes, ascii.length);
+        }
+        CFAbsoluteTime asciiTime = CFAbsoluteTimeGetCurrent() - start;
+        start = CFAbsoluteTimeGetCurrent();
+        for (int i=0; i<10; i++) {
+            NNIsValidUTF8(mixed.bytes, mixed.length);
+        }
+        CFAbsoluteTime mixedTime = CFAbsoluteTimeGetCurrent() - start;
+        Report(@{
+            @"scenario" : @"utf8_validation",
+            @"size" : @(mixed.length),
+            @"fragmented_mb_per_sec" : @(fragments * fragmentLength / fragmented / MB),
+            @"ascii_mb_per_sec" : @(ascii.length * 10 / asciiTime / MB),
+            @"mixed_mb_per_sec" : @(mixed.length * 10 / mixedTime / MB),
+        });
+    });
+
+    it(@"message size sweep", ^{
+        if (!IsBenchmarkEnabled()) return;
+        for (NSNumber *transport in transports) {
+            for (NSNumber *n in @[@16, @256, @(4 * KB), @(64 * KB), @(1 * MB), @(16 * MB), @(64 * MB)]) {
+                NSUInteger size = [n unsignedIntegerValue];
+                Scenario sc = {[transport unsignedIntegerValue], 1, size, 0, NO, MessagesForSize(size), 1};
+                [[RunScenario(@"size_latency", server.url, sc)[@"completed"] should] beYes];
+                sc.window = MAX((NSUInteger)1, MIN((NSUInteger)32, (NSUInteger)(64 * MB / size)));
+                [[RunScenario(@"size_throughput", server.url, sc)[@"completed"] should] beYes];
+            }
+        }
+    });
+
+    it(@"text versus binary", ^{
+        if (!IsBenchmarkEnabled()) return;
+        for (NSNumber *n in @[@(256), @(64 * KB), @(4 * MB)]) {
+            NSUInteger size = [n unsignedIntegerValue];
+            for (NSNumber *text in @[@NO, @YES]) {
+                Scenario sc = {NNWebSocketTransportTypeStream, 1, size, 0, [text boolValue], MessagesForSize(size), 8};
+                [[RunScenario(@"text_binary", server.url, sc)[@"completed"] should] beYes];
+            }
+        }
+    });
+
+    it(@"fragmented messages", ^{
+        if (!IsBenchmarkEnabled()) return;
+        for (NSNumber *transport in transports) {
+            for (NSNumber *f in @[@(4 * KB), @(64 * KB), @(1 * MB)]) {
+                Scenario sc = {[transport unsignedIntegerValue], 1, 16 * MB, [f unsignedIntegerValue], NO, 16, 2};
+                [[RunScenario(@"fragmented", server.url, sc)[@"completed"] should] beYes];
+                sc.text = YES;
+                [[RunScenario(@"fragmented", server.url, sc)[@"completed"] should] beYes];
+            }
+        }
+    });
+
+    it(@"concurrent connections", ^{
+        if (!IsBenchmarkEnabled()) return;
+        for (NSNumber *transport in transports) {
+            for (NSNumber *n in @[@1, @4, @16, @64]) {
+                Scenario sc = {[transport unsignedIntegerValue], [n unsignedIntegerValue], 1 * KB, 0, NO, 2000, 8};
+                [[RunScenario(@"connections", server.url, sc)[@"completed"] should] beYes];
+            }
+        }
+    });
+
+    it(@"io thread sharing", ^{
+        if (!IsBenchmarkEnabled()) return;
+        NNWebSocketOptions *opts = [NNWebSocketOptions options];
+        opts.connectTimeoutSec = 30;
+        for (NSNumber *n in @[@1, @10, @100, @200]) {
+            NSUInteger count = [n unsignedIntegerValue];
+            NSMutableArray *clients = [NSMutableArray arrayWithCapacity:count];
+            __block NSUInteger opened = 0;
+            __block NSUInteger failed = 0;
+            NSMutableArray *latencies = [NSMutableArray arrayWithCapacity:count];
+            uint64_t memoryBefore = GetResidentBytes();
+            NSUInteger threadsBefore = GetThreadCount();
+            CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+            for (NSUInteger i=0; i<count; i++) {
+                id<NNWebSocketClient> c = [NNWebSocket client:[NSURL URLWithString:server.url] options:opts];
+                CFAbsoluteTime connectStart = CFAbsoluteTimeGetCurrent();
+                c.onOpen = ^{
+                    [latencies addObject:@(CFAbsoluteTimeGetCurrent() - connectStart)];
+                    opened++;
+                };
+                c.onOpenFailed = ^(NSError *error) {
+                    failed++;
+                };
+                [clients addObject:c];
+                [c open];
+            }
+            NSDate *until = [NSDate dateWithTimeIntervalSinceNow:30];
+            while (opened + failed < count && [until timeIntervalSinceNow] > 0) {
+                [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+            }
+            CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+            int64_t memory = (int64_t)GetResidentBytes() - (int64_t)memoryBefore;
+            NSUInteger threadsAfter = GetThreadCount();
+            [latencies sortUsingSelector:@selector(compare:)];
+            Report(@{
+                @"scenario" : @"io_threads",
+                @"connections" : @(count),
+                @"opened" : @(opened),
+                @"seconds" : @(elapsed),
+                @"connect_p50_ms" : @(latencies.count > 0 ? [latencies[latencies.count / 2] doubleValue] * 1000 : 0),
+                @"connect_p99_ms" : @(latencies.count > 0 ? [latencies[latencies.count * 99 / 100] doubleValue] * 1000 : 0),
+                @"memory_bytes_per_conn" : @(memory / (int64_t)count),
+                @"threads_added" : @((NSInteger)threadsAfter - (NSInteger)threadsBefore),
+            });
+            for (id<NNWebSocketClient> c in clients) {
+                [c close];
+            }
+            NSDate *closeUntil = [NSDate dateWithTimeIntervalSinceNow:1];
+            while ([closeUntil timeIntervalSinceNow] > 0) {
+                [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:closeUntil];
+            }
+        }
+    });
+
+    it(@"pooled connections", ^{
+        if (!IsBenchmarkEnabled()) return;
+        for (NSNumber *transport in transports) {
+            for (NSNumber *n in @[@1, @2, @4, @8]) {
+                Scenario sc = {[transport unsignedIntegerValue], [n unsignedIntegerValue], 1 * MB, 0, NO, 1024, 2};
+                [[RunPoolScenario(@"pool_scaling", server.url, sc)[@"completed"] should] beYes];
+            }
+        }
+    });
+
+    it(@"server connections", ^{
+        if (!IsBenchmarkEnabled()) return;
+        RaiseDescriptorLimit(8192);
+        NNWebSocketOptions *opts = [NNWebSocketOptions options];
+        opts.maxPayloadByteSize = 1ull << 32;
+        NNWebSocketServer *echo = [NNWebSocket server:0 options:opts];
+        echo.onConnection = ^(id<NNWebSocketClient> connection) {
+            __weak id<NNWebSocketClient> weakConnection = connection;
+            connection.onData = ^(NSData *data) {
+                [weakConnection sendData:data];
+            };
+        };
+        [[theValue([echo startWithError:NULL]) should] beYes];
+        NSString *url = [NSString stringWithFormat:@"ws://localhost:%u/", echo.port];
+        for (NSNumber *transport in transports) {
+            for (NSNumber *n in @[@1, @16, @256, @1024]) {
+                NSUInteger connections = [n unsignedIntegerValue];
+                Scenario sc = {[transport unsignedIntegerValue], connections, 1 * KB, 0, NO, MAX((NSUInteger)16, 32768 / connections), 8};
+                [[RunScenario(@"client_echo", server.url, sc)[@"completed"] should] beYes];
+                [[RunScenario(@"server_echo", url, sc)[@"completed"] should] beYes];
+            }
+        }
+        [echo stop];
+    });
+});
+
+SPEC_END
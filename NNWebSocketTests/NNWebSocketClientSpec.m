@@ -1,12 +1,20 @@
 #import <sys/socket.h>
+#import <netinet/in.h>
+#import <fcntl.h>
+#import <unistd.h>
 #import <objc/runtime.h>
+#import <libkern/OSAtomic.h>
 #import "kiwi.h"
 #import "NNWebSocket.h"
+#import "NNUtils.h"
+#import "NNLoopbackEchoServer.h"
+#import "NNWebSocketTLSSessionCache.h"
 
 #define HOST @"localhost"
 #define PORT 9080
 #define AGENT @"NNWebSocket"
 #define ECHO_URL @"ws://%@:%d/"
+#define DEFLATE_PORT 9081
 #define FAIL() [[@"faild" should] equal:@""];
 #define WAIT(sec) \
 NSDate *loopUntil = [NSDate dateWithTimeIntervalSinceNow:sec]; \
@@ -21,6 +29,12 @@ Launch echoserver:
     $ cd ./NNWebSocketTest/testserver
     $ npm start
 
+permessage-deflate cases depend on testserver/deflateserver.js:
+    $ npm run-script start-deflate
+
+All cases run on the socket transport instead of CFStream with:
+    NNWEBSOCKET_TRANSPORT=socket
+
 */
 
 static NSString* GetEchoUrl()
@@ -37,6 +51,9 @@ static  NNWebSocketOptions* GetDefaultOptions() {
     opts.readTimeoutSec =  20;
     opts.closeTimeoutSec =  20;
     opts.verbose = 0;
+    if ([[[[NSProcessInfo processInfo] environment] objectForKey:@"NNWEBSOCKET_TRANSPORT"] isEqualToString:@"socket"]) {
+        opts.transportType = NNWebSocketTransportTypeSocket;
+    }
     opts.tlsSettings = @{
             (NSString *)kCFStreamSSLAllowsAnyRoot : @(YES),
             (NSString *)kCFStreamSSLValidatesCertificateChain : @(NO),
@@ -58,23 +75,64 @@ static id<NNWebSocketClient> GetEchoClient(NSUInteger verbose)
     return GetClient(GetEchoUrl(), opts);
 }
 
+// Non-blocking listener on 127.0.0.1 which is never accepted from, so that connections to it can be counted.
+static int ListenOnLoopback(uint16_t *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, len) < 0 || listen(fd, 8) < 0 || getsockname(fd, (struct sockaddr *)&addr, &len) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Accepts one connection on 'listener' and answers its request with 'response', then waits for the client to go.
+static void RespondOnce(int listener, NSString *response)
+{
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) & ~O_NONBLOCK);
+        int fd = accept(listener, NULL, NULL);
+        close(listener);
+        if (fd < 0) {
+            return;
+        }
+        struct timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        uint8_t buffer[1024];
+        if (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+            NSData *data = [response dataUsingEncoding:NSASCIIStringEncoding];
+            send(fd, data.bytes, data.length, 0);
+            while (recv(fd, buffer, sizeof(buffer), 0) > 0);
+        }
+        close(fd);
+    });
+}
+
 static NSString* MakeString(NSUInteger length)
 {
-    char buff[length + 1];
-    for (int i=0; i<length; i++) {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    char *buff = data.mutableBytes;
+    for (NSUInteger i=0; i<length; i++) {
         buff[i] = (char)(97 + i % 26);
     }
-    buff[length] = '\0';
-    return [NSMutableString stringWithCString:buff encoding:NSASCIIStringEncoding];
+    return [[NSMutableString alloc] initWithData:data encoding:NSASCIIStringEncoding];
 }
 
 static NSData* MakeBytes(NSUInteger size)
 {
-    UInt8 buff[size];
-    for (int i=0; i<size; i++) {
+    NSMutableData *data = [NSMutableData dataWithLength:size];
+    UInt8 *buff = data.mutableBytes;
+    for (NSUInteger i=0; i<size; i++) {
         buff[i] = (UInt8)(i % 10);
     }
-    return [NSData dataWithBytes:buff length:size];
+    return data;
 }
 
 
@@ -182,6 +240,30 @@ SPEC_BEGIN(NNWebSocketClientSpec)
                 [[theValue(_error.code) should] equal:theValue(NNWebSocketErrorConnectTimeout)];
             });
         });
+        context(@"but server responds without Upgrade header", ^{
+            it(@"onConnectFailed should be called back", ^{
+                uint16_t port = 0;
+                int listener = ListenOnLoopback(&port);
+                [[theValue(listener) should] beGreaterThanOrEqualTo:theValue(0)];
+                RespondOnce(listener, @"HTTP/1.1 101 Switching Protocols\r\n"
+                                       "Connection: Upgrade\r\n"
+                                       "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+                                       "\r\n");
+                client = socket = GetClient([NSString stringWithFormat:@"ws://127.0.0.1:%u/", port], GetDefaultOptions());
+                socket.onOpen = ^{
+                    _opened = @(YES);
+                };
+                socket.onOpenFailed = ^(NSError *error) {
+                    _error = error;
+                    _openFailed = @(YES);
+                };
+                [socket open];
+                [[expectFutureValue(_openFailed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+                [[_opened should] beNo];
+                [[_error.domain should] equal:NNWEBSOCKET_ERROR_DOMAIN];
+                [[theValue(_error.code) should] equal:theValue(NNWebSocketErrorHttpResponseHeaderUpgrade)];
+            });
+        });
     });
 
     context(@"when client close websocket", ^{
@@ -406,6 +488,7 @@ SPEC_BEGIN(NNWebSocketClientSpec)
             [[_calledback should] beNo];
         });
     });
+
     context(@"when client recieves continuation binary frame", ^{
         it(@"onFrame should be called back", ^{
             client = socket = GetEchoClient(0);
@@ -465,6 +548,7 @@ SPEC_BEGIN(NNWebSocketClientSpec)
             [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
         });
     });
+
     context(@"when client recieves confinuation text frame", ^{
         it(@"onFrame should be called back", ^{
             client = socket = GetEchoClient(0);
@@ -676,4 +760,993 @@ SPEC_BEGIN(NNWebSocketClientSpec)
         });
     });
 
-SPEC_END
\ No newline at end of file
+    context(@"when callbackQueue is defined", ^{
+        it(@"listeners should be called back on the queue", ^{
+            __block NSNumber *onMainThread = @(YES);
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.callbackQueue = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:@"hello"];
+            };
+            socket.onText = ^(NSString *text) {
+                onMainThread = @([NSThread isMainThread]);
+                [[text should] equal:@"hello"];
+                [socket close];
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[onMainThread should] beNo];
+        });
+        it(@"listeners should be called back one by one on a concurrent queue", ^{
+            __block int32_t running = 0;
+            __block NSNumber *overlapped = @(NO);
+            __block NSUInteger numberOfTexts = 0;
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.callbackQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                for (int i=0; i<50; i++) {
+                    [socket sendText:[NSString stringWithFormat:@"%d", i]];
+                }
+            };
+            socket.onText = ^(NSString *text) {
+                if (OSAtomicIncrement32Barrier(&running) > 1) {
+                    overlapped = @(YES);
+                }
+                usleep(1000);
+                [[text should] equal:[NSString stringWithFormat:@"%lu", (unsigned long)numberOfTexts]];
+                numberOfTexts++;
+                OSAtomicDecrement32Barrier(&running);
+                if (numberOfTexts == 50) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[overlapped should] beNo];
+        });
+    });
+
+    context(@"when callbackOnIOQueue is enabled", ^{
+        it(@"listeners should be called back off the main thread", ^{
+            __block NSNumber *onMainThread = @(YES);
+            __block NSUInteger numberOfTexts = 0;
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.callbackOnIOQueue = YES;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                for (int i=0; i<10; i++) {
+                    [socket sendText:@"hello"];
+                }
+            };
+            socket.onText = ^(NSString *text) {
+                onMainThread = @([NSThread isMainThread]);
+                if (++numberOfTexts == 10) {
+                    [socket close];
+                }
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[onMainThread should] beNo];
+            [[theValue(numberOfTexts) should] equal:theValue(10)];
+        });
+    });
+
+    context(@"when client sends a burst of frames", ^{
+        it(@"all frames should be echoed back in order", ^{
+            __block NSUInteger numberOfTexts = 0;
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.writeBatchByteSize = 100;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                for (int i=0; i<200; i++) {
+                    [socket sendText:[NSString stringWithFormat:@"%d", i]];
+                }
+                [socket sendText:MakeString(300)];
+            };
+            socket.onText = ^(NSString *text) {
+                if (numberOfTexts < 200) {
+                    [[text should] equal:[NSString stringWithFormat:@"%lu", (unsigned long)numberOfTexts]];
+                } else {
+                    [[text should] equal:MakeString(300)];
+                    _calledback = @(YES);
+                }
+                numberOfTexts++;
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(numberOfTexts) should] equal:theValue(201)];
+        });
+    });
+
+    context(@"when send buffer exceeds high watermark", ^{
+        it(@"onBackpressure and onWritable should be called back", ^{
+            __block NSNumber *backpressured = @(NO);
+            __block NSUInteger numberOfData = 0;
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.sendBufferHighWatermark = 4 * 1024;
+            opts.sendBufferLowWatermark = 1024;
+            opts.sendBufferLimitBehavior = NNWebSocketSendBufferLimitBehaviorDefer;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                for (int i=0; i<20; i++) {
+                    [[theValue([socket sendData:MakeBytes(1024)]) should] beYes];
+                }
+                [[theValue(socket.bufferedAmount) should] beGreaterThan:theValue(opts.sendBufferHighWatermark)];
+            };
+            socket.onBackpressure = ^(uint64_t bufferedAmount) {
+                backpressured = @(YES);
+            };
+            socket.onWritable = ^(uint64_t bufferedAmount) {
+                [[theValue(bufferedAmount) should] beLessThanOrEqualTo:theValue(opts.sendBufferLowWatermark)];
+                _calledback = @(YES);
+            };
+            socket.onData = ^(NSData *data) {
+                numberOfData++;
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[expectFutureValue(theValue(numberOfData)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(20)];
+            [[backpressured should] beYes];
+            [[theValue(socket.bufferedAmount) should] equal:theValue(0)];
+        });
+        it(@"send should be rejected with reject behavior", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.sendBufferHighWatermark = 1024;
+            opts.sendBufferLimitBehavior = NNWebSocketSendBufferLimitBehaviorReject;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [[theValue([socket sendData:MakeBytes(4096)]) should] beYes];
+                [[theValue([socket sendData:MakeBytes(4096)]) should] beNo];
+                [[theValue([socket sendFrame:[NNWebSocketFrame framePing]]) should] beYes];
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"send should be accepted while buffered bytes equal high watermark", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.sendBufferHighWatermark = 0;
+            opts.sendBufferLowWatermark = 0;
+            opts.sendBufferLimitBehavior = NNWebSocketSendBufferLimitBehaviorReject;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [[theValue(socket.bufferedAmount) should] equal:theValue(0)];
+                [[theValue([socket sendData:MakeBytes(16)]) should] beYes];
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"send from another queue should be rejected before frames reach callback queue", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.sendBufferHighWatermark = 2500;
+            opts.sendBufferLimitBehavior = NNWebSocketSendBufferLimitBehaviorReject;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            __block NSUInteger numberOfData = 0;
+            socket.onOpen = ^{
+                _opened = @(YES);
+            };
+            socket.onData = ^(NSData *data) {
+                numberOfData++;
+            };
+            [socket open];
+            [[expectFutureValue(_opened) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            // Callback queue is the main queue, which is blocked until every send has returned.
+            __block NSUInteger accepted = 0;
+            dispatch_sync(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                for (int i=0; i<10; i++) {
+                    if ([socket sendData:MakeBytes(1000)]) accepted++;
+                }
+            });
+            [[theValue(accepted) should] equal:theValue(3)];
+            [[expectFutureValue(theValue(numberOfData)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(3)];
+            [[theValue(socket.bufferedAmount) should] equal:theValue(0)];
+        });
+    });
+
+    context(@"when permessage-deflate is negotiated", ^{
+        __block NNWebSocketOptions *opts;
+        __block NSString *url;
+        beforeEach(^{
+            opts = GetDefaultOptions();
+            opts.perMessageDeflate = YES;
+            url = [NSString stringWithFormat:ECHO_URL, HOST, DEFLATE_PORT];
+        });
+        it(@"compressed text and binary should be echoed back", ^{
+            __block NSNumber *textEchoed = @(NO);
+            client = socket = GetClient(url, opts);
+            socket.onOpen = ^{
+                [socket sendText:MakeString(100000)];
+                [socket sendText:@""];
+                [socket sendData:MakeBytes(70000)];
+            };
+            socket.onText = ^(NSString *text) {
+                if (text.length > 0) {
+                    [[text should] equal:MakeString(100000)];
+                } else {
+                    textEchoed = @(YES);
+                }
+            };
+            socket.onData = ^(NSData *data) {
+                [[data should] equal:MakeBytes(70000)];
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(textEchoed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"fragmented message should be compressed as one message", ^{
+            client = socket = GetClient(url, opts);
+            socket.onOpen = ^{
+                NNWebSocketFrame *frame = [NNWebSocketFrame frameText];
+                frame.fin = NO;
+                frame.text = MakeString(1000);
+                [socket sendFrame:frame];
+                frame = [NNWebSocketFrame frameContinuation];
+                frame.fin = YES;
+                frame.text = MakeString(2000);
+                [socket sendFrame:frame];
+            };
+            socket.onText = ^(NSString *text) {
+                [[text should] equal:[MakeString(1000) stringByAppendingString:MakeString(2000)]];
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"inflated payload should be split by maxPayloadByteSize", ^{
+            __block NSUInteger numberOfChunks = 0;
+            opts.maxPayloadByteSize = 1000;
+            opts.payloadSizeLimitBehavior = NNWebSocketPayloadSizeLimitBehaviorSplit;
+            client = socket = GetClient(url, opts);
+            socket.onOpen = ^{
+                [socket sendData:MakeBytes(10000)];
+            };
+            socket.onDataChunk = ^(NSData *data, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo) {
+                [[theValue(data.length) should] beLessThanOrEqualTo:theValue(1000)];
+                numberOfChunks++;
+                if (isFinal) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(numberOfChunks) should] beGreaterThanOrEqualTo:theValue(10)];
+        });
+        it(@"should fail when inflated payload is too big", ^{
+            opts.maxPayloadByteSize = 1000;
+            client = socket = GetClient(url, opts);
+            socket.onOpen = ^{
+                [socket sendData:[NSMutableData dataWithLength:900]];
+                [socket sendData:[NSMutableData dataWithLength:10000]];
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                [[theValue(status) should] equal:theValue(NNWebSocketStatusMessageTooBig)];
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"server without the extension should open uncompressed connection", ^{
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:MakeString(1000)];
+            };
+            socket.onText = ^(NSString *text) {
+                [[text should] equal:MakeString(1000)];
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+    });
+
+    context(@"when a message exceeds streaming threshold", ^{
+        __block NNWebSocketOptions *opts;
+        beforeEach(^{
+            opts = GetDefaultOptions();
+            opts.maxPayloadByteSize = 1024 * 1024;
+            opts.streamingThresholdByteSize = 1024 * 1024;
+            opts.streamingChunkByteSize = 64 * 1024;
+        });
+        it(@"payload should be given to block sink in bounded chunks", ^{
+            __block NSMutableArray *events = [NSMutableArray array];
+            __block NSMutableData *received = [NSMutableData data];
+            __block NSNumber *textCalled = @(NO);
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendData:MakeBytes(3 * 1024 * 1024 + 10)];
+                [socket sendText:@"small"];
+            };
+            socket.onMessageSink = ^id<NNWebSocketMessageSink>(NNWebSocketFrameOpcode opcode) {
+                [[theValue(opcode) should] equal:theValue(NNWebSocketFrameOpcodeBinary)];
+                return [NNWebSocketStreamSink sinkWithBlock:^BOOL(NNWebSocketMessageSinkEvent event, NSData *data, NSError *error) {
+                    [events addObject:@(event)];
+                    if (event == NNWebSocketMessageSinkEventData) {
+                        [[theValue(data.length) should] beLessThanOrEqualTo:theValue(64 * 1024)];
+                        [received appendData:data];
+                    } else if (event == NNWebSocketMessageSinkEventEnd) {
+                        [error shouldBeNil];
+                        _calledback = @(YES);
+                    }
+                    return YES;
+                }];
+            };
+            socket.onData = ^(NSData *data) {
+                FAIL();
+            };
+            socket.onText = ^(NSString *text) {
+                [[text should] equal:@"small"];
+                textCalled = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            [[expectFutureValue(textCalled) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[[events objectAtIndex:0] should] equal:@(NNWebSocketMessageSinkEventStart)];
+            [[[events lastObject] should] equal:@(NNWebSocketMessageSinkEventEnd)];
+            [[received should] equal:MakeBytes(3 * 1024 * 1024 + 10)];
+        });
+        it(@"text should be written to file", ^{
+            NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NNWebSocketStreamSink.txt"];
+            NSString *text = MakeString(2 * 1024 * 1024);
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:text];
+            };
+            socket.onMessageSink = ^id<NNWebSocketMessageSink>(NNWebSocketFrameOpcode opcode) {
+                return [NNWebSocketStreamSink sinkWithFilePath:path];
+            };
+            socket.onFrame = ^(NNWebSocketFrame *frame) {
+                if (frame.fin) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            NSString *written = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+            [[written should] equal:text];
+            [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+        });
+        it(@"sink should see an error when connection is closed in the middle", ^{
+            __block NSError *sinkError = nil;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendData:MakeBytes(3 * 1024 * 1024)];
+            };
+            socket.onMessageSink = ^id<NNWebSocketMessageSink>(NNWebSocketFrameOpcode opcode) {
+                return [NNWebSocketStreamSink sinkWithBlock:^BOOL(NNWebSocketMessageSinkEvent event, NSData *data, NSError *error) {
+                    if (event == NNWebSocketMessageSinkEventEnd) {
+                        sinkError = error;
+                        _calledback = @(YES);
+                    }
+                    return NO;
+                }];
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            [[theValue(sinkError.code) should] equal:theValue(NNWebSocketErrorMessageSinkWrite)];
+        });
+    });
+
+    context(@"when a large message is sent in fragments", ^{
+        __block NNWebSocketOptions *opts;
+        beforeEach(^{
+            opts = GetDefaultOptions();
+            opts.sendFragmentByteSize = 64 * 1024;
+        });
+        it(@"stream should be echoed fragment by fragment", ^{
+            NSData *payload = MakeBytes(1024 * 1024 + 10);
+            __block NSMutableArray *frames = [NSMutableArray array];
+            __block NSMutableData *received = [NSMutableData data];
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [[theValue([socket sendStream:[NSInputStream inputStreamWithData:payload] opcode:NNWebSocketFrameOpcodeBinary]) should] beYes];
+                [socket sendText:@"after"];
+            };
+            socket.onFrame = ^(NNWebSocketFrame *frame) {
+                [frames addObject:frame];
+                if (frame.opcode == NNWebSocketFrameOpcodeText) {
+                    _calledback = @(YES);
+                } else {
+                    [[theValue(frame.data.length) should] beLessThanOrEqualTo:theValue(64 * 1024)];
+                    [received appendData:frame.data];
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            [[theValue(frames.count) should] equal:theValue(18)];
+            [[theValue([frames[0] opcode]) should] equal:theValue(NNWebSocketFrameOpcodeBinary)];
+            [[theValue([frames[0] fin]) should] beNo];
+            [[theValue([frames[16] opcode]) should] equal:theValue(NNWebSocketFrameOpcodeContinuation)];
+            [[theValue([frames[16] fin]) should] beYes];
+            [[received should] equal:payload];
+        });
+        it(@"producer should be called until it returns nil", ^{
+            __block NSUInteger produced = 0;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendMessageWithOpcode:NNWebSocketFrameOpcodeText producer:^NSData *(NSUInteger maxLength) {
+                    [[theValue(maxLength) should] equal:theValue(64 * 1024)];
+                    return produced++ < 3 ? [@"abc" dataUsingEncoding:NSUTF8StringEncoding] : nil;
+                }];
+            };
+            __block NSMutableString *text = [NSMutableString string];
+            socket.onTextChunk = ^(NSString *chunk, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo) {
+                [text appendString:chunk];
+                if (isFinal) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[text should] equal:@"abcabcabc"];
+        });
+        it(@"data should be fragmented automatically above threshold", ^{
+            opts.autoFragmentThresholdByteSize = 100 * 1024;
+            __block NSUInteger count = 0;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendData:MakeBytes(200 * 1024)];
+            };
+            socket.onFrame = ^(NNWebSocketFrame *frame) {
+                count++;
+                if (frame.fin) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(count) should] equal:theValue(4)];
+        });
+    });
+
+    context(@"when many clients connect", ^{
+        it(@"should share io threads", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            NNRunLoopBrokerPool *pool = [NNRunLoopBrokerPool sharedPoolWithSize:opts.ioThreadCount];
+            NSUInteger count = 20;
+            NSMutableArray *clients = [NSMutableArray arrayWithCapacity:count];
+            __block NSUInteger opened = 0;
+            for (NSUInteger i=0; i<count; i++) {
+                id<NNWebSocketClient> c = GetClient(GetEchoUrl(), opts);
+                c.onOpen = ^{
+                    opened++;
+                };
+                [clients addObject:c];
+                [c open];
+            }
+            [[expectFutureValue(theValue(opened)) shouldEventuallyBeforeTimingOutAfter(10)] equal:theValue(count)];
+            [[theValue(pool.brokerCount) should] beLessThanOrEqualTo:theValue(MIN(pool.size, count))];
+            for (id<NNWebSocketClient> c in clients) {
+                [c close];
+            }
+        });
+    });
+
+    context(@"when socket transport is used", ^{
+        __block NNWebSocketOptions *opts;
+        beforeEach(^{
+            opts = GetDefaultOptions();
+            opts.transportType = NNWebSocketTransportTypeSocket;
+        });
+        it(@"text and data should be echoed", ^{
+            NSData *data = MakeBytes(3 * 1024 * 1024 + 5);
+            __block NSNumber *dataEchoed = @(NO);
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:@"hello"];
+                [socket sendData:data];
+            };
+            socket.onText = ^(NSString *text) {
+                [[text should] equal:@"hello"];
+                _calledback = @(YES);
+            };
+            socket.onData = ^(NSData *received) {
+                [[received should] equal:data];
+                dataEchoed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[expectFutureValue(dataEchoed) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+        });
+        it(@"burst of small frames should be echoed in order", ^{
+            __block NSUInteger count = 0;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                for (NSUInteger i=0; i<1000; i++) {
+                    [socket sendText:[NSString stringWithFormat:@"%lu", (unsigned long)i]];
+                }
+            };
+            socket.onText = ^(NSString *text) {
+                [[text should] equal:[NSString stringWithFormat:@"%lu", (unsigned long)count]];
+                if (++count == 1000) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+        });
+        it(@"onClose should be called back after closing handshake", ^{
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket close];
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                [[theValue(status) should] equal:theValue(NNWebSocketStatusNormalEnd)];
+                [error shouldBeNil];
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"onOpenFailed should be called back when connection is refused", ^{
+            client = socket = GetClient(@"ws://127.0.0.1:9999", opts);
+            socket.onOpenFailed = ^(NSError *error) {
+                [[error.domain should] equal:NSPOSIXErrorDomain];
+                [[theValue(error.code) should] equal:theValue(ECONNREFUSED)];
+                _openFailed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_openFailed) shouldEventuallyBeforeTimingOutAfter(3)] beYes];
+        });
+        it(@"onOpenFailed should be called back when host is unknown", ^{
+            client = socket = GetClient(@"ws://nnwebsocket.invalid:9080", opts);
+            socket.onOpenFailed = ^(NSError *error) {
+                [[theValue(error.code) should] equal:theValue(NNWebSocketErrorResolveHost)];
+                _openFailed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_openFailed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+        });
+        it(@"should not connect when closed while resolving host", ^{
+            uint16_t port = 0;
+            int listener = ListenOnLoopback(&port);
+            [[theValue(listener) should] beGreaterThanOrEqualTo:theValue(0)];
+            client = socket = GetClient([NSString stringWithFormat:@"ws://127.0.0.1:%u/", port], opts);
+            socket.onOpen = ^{
+                _opened = @(YES);
+            };
+            [socket open];
+            [socket close];
+            WAIT(1);
+            [[_opened should] beNo];
+            int fd = accept(listener, NULL, NULL);
+            [[theValue(fd) should] equal:theValue(-1)];
+            if (fd >= 0) close(fd);
+            close(listener);
+        });
+    });
+
+    context(@"when statistics are taken", ^{
+        it(@"should count frames and bytes by opcode", ^{
+            __block NSUInteger received = 0;
+            client = socket = GetClient(GetEchoUrl(), GetDefaultOptions());
+            socket.onOpen = ^{
+                [socket sendText:@"hello"];
+                [socket sendData:MakeBytes(1000)];
+                NNWebSocketFrame *ping = [NNWebSocketFrame framePing];
+                ping.data = MakeBytes(4);
+                [socket sendFrame:ping];
+            };
+            socket.onFrame = ^(NNWebSocketFrame *frame) {
+                if (++received == 3) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            NNWebSocketStatistics *stats = socket.statistics;
+            [[theValue([stats framesSentWithOpcode:NNWebSocketFrameOpcodeText]) should] equal:theValue(1)];
+            [[theValue([stats framesSentWithOpcode:NNWebSocketFrameOpcodeBinary]) should] equal:theValue(1)];
+            [[theValue([stats framesSentWithOpcode:NNWebSocketFrameOpcodePing]) should] equal:theValue(1)];
+            [[theValue([stats framesReceivedWithOpcode:NNWebSocketFrameOpcodeText]) should] equal:theValue(1)];
+            [[theValue([stats framesReceivedWithOpcode:NNWebSocketFrameOpcodeBinary]) should] equal:theValue(1)];
+            [[theValue([stats framesReceivedWithOpcode:NNWebSocketFrameOpcodePong]) should] equal:theValue(1)];
+            [[theValue([stats payloadBytesSentWithOpcode:NNWebSocketFrameOpcodeBinary]) should] equal:theValue(1000)];
+            [[theValue([stats payloadBytesReceivedWithOpcode:NNWebSocketFrameOpcodeText]) should] equal:theValue(5)];
+            [[theValue(stats.framesSent) should] equal:theValue(3)];
+            [[theValue(stats.bytesSent) should] beGreaterThan:theValue(1009)];
+            [[theValue(stats.bytesReceived) should] beGreaterThan:theValue(1009)];
+            [[theValue(stats.writeQueueDepth) should] equal:theValue(0)];
+            [[theValue(stats.handshakeDuration) should] beGreaterThan:theValue(0)];
+            [[theValue(stats.tcpConnectDuration) should] beGreaterThan:theValue(0)];
+            [[theValue(stats.upgradeDuration) should] beGreaterThan:theValue(0)];
+            [[theValue(stats.upgradeDuration) should] beLessThan:theValue(stats.handshakeDuration)];
+            [[theValue(stats.pingRoundTripTime) should] beGreaterThan:theValue(0)];
+            [[theValue(stats.smoothedPingRoundTripTime) should] equal:theValue(stats.pingRoundTripTime)];
+            [[theValue(stats.closeStatus) should] equal:theValue(NNWebSocketStatusNoStatus)];
+            [[[stats.dictionaryRepresentation valueForKeyPath:@"opcodes.binary.payloadBytesSent"] should] equal:@(1000)];
+        });
+        it(@"onStatistics should be called back periodically and on close", ^{
+            __block NSUInteger count = 0;
+            __block NNWebSocketStatistics *last = nil;
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.statisticsIntervalSec = 0.2;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onStatistics = ^(NNWebSocketStatistics *statistics) {
+                last = statistics;
+                if (++count == 3) {
+                    [socket close];
+                }
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(count) should] equal:theValue(4)];
+            [[theValue(last.closeStatus) should] equal:theValue(NNWebSocketStatusNormalEnd)];
+            [[theValue([last framesSentWithOpcode:NNWebSocketFrameOpcodeClose]) should] equal:theValue(1)];
+        });
+        it(@"should keep the reason of failed open", ^{
+            client = socket = GetClient(@"ws://127.0.0.1:9999", GetDefaultOptions());
+            socket.onOpenFailed = ^(NSError *error) {
+                _openFailed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_openFailed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(socket.statistics.closeStatus) should] equal:theValue(NNWebSocketStatusAbnormalClosure)];
+            [socket.statistics.closeError shouldNotBeNil];
+        });
+    });
+
+    context(@"when tracing is enabled", ^{
+        it(@"should record events of the pipeline", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.traceEnabled = YES;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:@"hello"];
+            };
+            socket.onText = ^(NSString *text) {
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:[socket.tracer chromeTraceData] options:(NSJSONReadingOptions)0 error:NULL];
+            NSArray *names = [trace[@"traceEvents"] valueForKey:@"name"];
+            [[names should] contain:@"CLOSED -> CONNECTING"];
+            [[names should] contain:@"CONNECTING -> OPEN"];
+            [[names should] contain:@"write task"];
+            [[names should] contain:@"read task"];
+            [[names should] contain:@"frame decoded"];
+            [[names should] contain:@"listener"];
+            [[names should] contain:@"callback queue hop"];
+        });
+    });
+
+    context(@"when keepalive is enabled", ^{
+        it(@"should measure round trip of pings", ^{
+            __block NNWebSocketStatistics *last = nil;
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.pingIntervalSec = 0.2;
+            opts.statisticsIntervalSec = 1.0;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onStatistics = ^(NNWebSocketStatistics *statistics) {
+                last = statistics;
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            uint64_t pongs = [last framesReceivedWithOpcode:NNWebSocketFrameOpcodePong];
+            [[theValue(pongs) should] beGreaterThan:theValue(0)];
+            [[theValue([[last.pingRoundTripTimeHistogram valueForKeyPath:@"@sum.self"] unsignedLongLongValue]) should] equal:theValue(pongs)];
+            [[theValue(last.pingRoundTripTime) should] beGreaterThan:theValue(0)];
+        });
+        it(@"should skip pings while frames arrive", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.pingIntervalSec = 0.5;
+            opts.skipPingOnInboundTraffic = YES;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            __block NSUInteger count = 0;
+            socket.onOpen = ^{
+                [socket sendText:@"hello"];
+            };
+            socket.onText = ^(NSString *text) {
+                if (++count == 20) {
+                    _calledback = @(YES);
+                    return;
+                }
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+                    [socket sendText:text];
+                });
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            [[theValue([socket.statistics framesSentWithOpcode:NNWebSocketFrameOpcodePing]) should] equal:theValue(0)];
+        });
+        it(@"should fail when pongs are missed", ^{
+            NNLoopbackEchoServer *server = [[NNLoopbackEchoServer alloc] init];
+            [[theValue([server start]) should] beYes];
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.protocols = nil;
+            opts.pingIntervalSec = 0.2;
+            opts.maxMissedPongs = 2;
+            // Echoed pings are left unanswered, so no pong comes back.
+            opts.disableAutomaticPingPong = YES;
+            client = socket = GetClient(server.url, opts);
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                _error = error;
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(_error.code) should] equal:theValue(NNWebSocketErrorPongTimeout)];
+            [[theValue(socket.statistics.closeStatus) should] equal:theValue(NNWebSocketStatusAbnormalClosure)];
+            [server stop];
+        });
+    });
+
+    context(@"when received frames are recycled", ^{
+        it(@"should deliver messages as usual", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.recycleReceivedFrames = YES;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            NSMutableArray *texts = [NSMutableArray array];
+            __block NSUInteger frames = 0;
+            socket.onOpen = ^{
+                for (int i=0; i<100; i++) {
+                    [socket sendText:[NSString stringWithFormat:@"message %d", i]];
+                }
+            };
+            socket.onFrame = ^(NNWebSocketFrame *frame) {
+                frames++;
+            };
+            socket.onText = ^(NSString *text) {
+                [texts addObject:text];
+                if (texts.count == 100) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(frames) should] equal:theValue(100)];
+            [[texts[0] should] equal:@"message 0"];
+            [[texts[99] should] equal:@"message 99"];
+        });
+    });
+
+    context(@"when reading is flow controlled", ^{
+        it(@"should not deliver frames while reading is paused", ^{
+            __block NSUInteger count = 0;
+            client = socket = GetClient(GetEchoUrl(), GetDefaultOptions());
+            socket.onOpen = ^{
+                for (int i=0; i<3; i++) {
+                    [socket sendText:@"hello"];
+                }
+                _opened = @(YES);
+            };
+            socket.onText = ^(NSString *text) {
+                count++;
+            };
+            [socket pauseReading];
+            [socket open];
+            WAIT(2);
+            [[_opened should] beYes];
+            [[theValue(count) should] equal:theValue(0)];
+            [socket resumeReading];
+            [[expectFutureValue(theValue(count)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(3)];
+        });
+        it(@"should deliver every message to a slow listener", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.receiveQueueHighWatermarkFrames = 4;
+            opts.receiveQueueLowWatermarkFrames = 1;
+            opts.receiveQueueHighWatermark = 1024;
+            opts.receiveQueueLowWatermark = 256;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            NSMutableArray *texts = [NSMutableArray array];
+            socket.onOpen = ^{
+                for (int i=0; i<200; i++) {
+                    [socket sendText:[NSString stringWithFormat:@"%d", i]];
+                }
+            };
+            socket.onText = ^(NSString *text) {
+                usleep(1000);
+                [texts addObject:text];
+                if (texts.count == 200) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            [[texts[199] should] equal:@"199"];
+        });
+    });
+
+    context(@"when TLS sessions are cached", ^{
+        it(@"should resume the session on reconnect", ^{
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.tlsSessionCacheSize = 3;
+            NNWebSocketTLSSessionCache *cache = [NNWebSocketTLSSessionCache sharedCacheWithSize:3 lifetime:opts.tlsSessionLifetimeSec];
+            [cache removeAllPeerIDs];
+            uint64_t hits = cache.hits;
+            client = socket = GetClient([NSString stringWithFormat:@"wss://%@:9443/", HOST], opts);
+            __block NSUInteger opens = 0;
+            socket.onOpen = ^{
+                if (++opens == 1) {
+                    [socket close];
+                } else {
+                    _opened = @(YES);
+                }
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                if (opens == 1) {
+                    [socket open];
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_opened) shouldEventuallyBeforeTimingOutAfter(10)] beYes];
+            NNWebSocketStatistics *stats = socket.statistics;
+            [[theValue(stats.tlsSessionMisses) should] equal:theValue(1)];
+            [[theValue(stats.tlsSessionHits) should] equal:theValue(1)];
+            [[theValue(cache.hits - hits) should] equal:theValue(1)];
+            [[theValue(stats.tlsDuration) should] beGreaterThan:theValue(0)];
+        });
+    });
+
+    context(@"when fragmented messages are reassembled", ^{
+        __block NNWebSocketOptions *opts;
+        beforeEach(^{
+            opts = GetDefaultOptions();
+            opts.reassembleFragmentedMessages = YES;
+            opts.autoFragmentThresholdByteSize = 1000;
+            opts.sendFragmentByteSize = 1000;
+        });
+        it(@"should deliver whole messages", ^{
+            NSString *expectedText = [@"" stringByPaddingToLength:1000 withString:@"\u3042" startingAtIndex:0];
+            NSData *expectedData = MakeBytes(5000);
+            __block NSString *text = nil;
+            __block NSData *data = nil;
+            __block NSUInteger frames = 0;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:expectedText];
+                [socket sendData:expectedData];
+            };
+            socket.onFrame = ^(NNWebSocketFrame *frame) {
+                frames++;
+            };
+            socket.onTextChunk = ^(NSString *chunk, NSUInteger index, BOOL isFinal, NSMutableDictionary *userInfo) {
+                FAIL();
+            };
+            socket.onText = ^(NSString *t) {
+                text = t;
+            };
+            socket.onData = ^(NSData *d) {
+                data = d;
+                _calledback = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[text should] equal:expectedText];
+            [[data should] equal:expectedData];
+            [[theValue(frames) should] equal:theValue(8)];
+        });
+        it(@"should close with status 1009 when a message exceeds maxPayloadByteSize", ^{
+            opts.maxPayloadByteSize = 2000;
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendData:MakeBytes(3000)];
+            };
+            socket.onData = ^(NSData *d) {
+                FAIL();
+            };
+            socket.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                _error = error;
+                [[theValue(status) should] equal:theValue(NNWebSocketStatusMessageTooBig)];
+                _closed = @(YES);
+            };
+            [socket open];
+            [[expectFutureValue(_closed) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(_error.code) should] equal:theValue(NNWebSocketErrorMessageTooBig)];
+        });
+        it(@"should split a message exceeding maxPayloadByteSize between characters", ^{
+            opts.maxPayloadByteSize = 2000;
+            opts.payloadSizeLimitBehavior = NNWebSocketPayloadSizeLimitBehaviorSplit;
+            NSString *expectedText = [@"" stringByPaddingToLength:1000 withString:@"\u3042" startingAtIndex:0];
+            NSMutableArray *texts = [NSMutableArray array];
+            client = socket = GetClient(GetEchoUrl(), opts);
+            socket.onOpen = ^{
+                [socket sendText:expectedText];
+            };
+            socket.onText = ^(NSString *t) {
+                [texts addObject:t];
+                if ([[texts componentsJoinedByString:@""] length] == expectedText.length) {
+                    _calledback = @(YES);
+                }
+            };
+            [socket open];
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[theValue(texts.count) should] equal:theValue(2)];
+            [[[texts componentsJoinedByString:@""] should] equal:expectedText];
+        });
+    });
+
+    context(@"when connections are pooled", ^{
+        __block NNWebSocketClientPool *pool;
+        afterEach(^{
+            [pool close];
+            pool = nil;
+        });
+        it(@"should spread messages and merge listeners", ^{
+            pool = [NNWebSocket pool:[NSURL URLWithString:GetEchoUrl()] options:GetDefaultOptions() size:4];
+            client = pool;
+            __block NSUInteger count = 0;
+            pool.onOpen = ^{
+                _opened = @(YES);
+            };
+            pool.onText = ^(NSString *text) {
+                if (++count == 40) {
+                    _calledback = @(YES);
+                }
+            };
+            [pool open];
+            [[expectFutureValue(_opened) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[expectFutureValue(theValue(pool.openConnectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(4)];
+            for (NSUInteger i=0; i<40; i++) {
+                [pool sendText:@"hello"];
+            }
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            NNWebSocketStatistics *stats = pool.statistics;
+            [[theValue([stats framesSentWithOpcode:NNWebSocketFrameOpcodeText]) should] equal:theValue(40)];
+            [[theValue([stats framesReceivedWithOpcode:NNWebSocketFrameOpcodeText]) should] equal:theValue(40)];
+        });
+        it(@"should keep the order of messages with the same key", ^{
+            pool = [NNWebSocket pool:[NSURL URLWithString:GetEchoUrl()] options:GetDefaultOptions() size:4];
+            client = pool;
+            NSMutableArray *texts = [NSMutableArray array];
+            pool.onText = ^(NSString *text) {
+                [texts addObject:text];
+                if (texts.count == 100) {
+                    _calledback = @(YES);
+                }
+            };
+            [pool open];
+            [[expectFutureValue(theValue(pool.openConnectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(4)];
+            NSMutableArray *expected = [NSMutableArray array];
+            for (NSUInteger i=0; i<100; i++) {
+                NSString *text = [NSString stringWithFormat:@"%lu", (unsigned long)i];
+                [expected addObject:text];
+                [pool sendText:text key:@"order"];
+            }
+            [[expectFutureValue(_calledback) shouldEventuallyBeforeTimingOutAfter(5)] beYes];
+            [[texts should] equal:expected];
+        });
+        it(@"should replace a connection closed by the server", ^{
+            NNLoopbackEchoServer *server = [[NNLoopbackEchoServer alloc] init];
+            [[theValue([server start]) should] beYes];
+            NNWebSocketOptions *opts = GetDefaultOptions();
+            opts.protocols = nil;
+            pool = [NNWebSocket pool:[NSURL URLWithString:server.url] options:opts size:2];
+            client = pool;
+            __block NSUInteger closes = 0;
+            pool.onClose = ^(NNWebSocketStatus status, NSError *error) {
+                closes++;
+            };
+            [pool open];
+            [[expectFutureValue(theValue(pool.openConnectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(2)];
+            // The echoed close frame closes the connection from the server side.
+            [pool sendFrame:[NNWebSocketFrame frameClose]];
+            [[expectFutureValue(theValue(pool.openConnectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(1)];
+            [[expectFutureValue(theValue(pool.openConnectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(2)];
+            [[theValue(closes) should] equal:theValue(0)];
+            [[theValue([pool.statistics framesReceivedWithOpcode:NNWebSocketFrameOpcodeClose]) should] equal:theValue(1)];
+            [pool close];
+            [[expectFutureValue(theValue(closes)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(1)];
+            [server stop];
+        });
+    });
+
+SPEC_END
@@ -0,0 +1,209 @@
+#import "Kiwi.h"
+#import "NNWebSocketDeflate.h"
+#import "NNWebSocketFrame.h"
+#import "NNWebSocketFrameEncoder.h"
+#import "NNWebSocketFrameParser.h"
+#import "NNWebSocketOptions.h"
+
+static NSData* MakeText(NSUInteger length)
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *b = data.mutableBytes;
+    for (NSUInteger i=0; i<length; i++) {
+        b[i] = (uint8_t)('a' + (i * 7 + i / 100) % 26);
+    }
+    return data;
+}
+
+static NSData* Inflate(NNWebSocketInflater *inflater, NSArray *parts)
+{
+    NSMutableData *result = [NSMutableData data];
+    for (NSUInteger i=0; i<parts.count; i++) {
+        NSMutableArray *chunks = [NSMutableArray array];
+        if (![inflater inflateData:parts[i] fin:i == parts.count - 1 maxChunkLength:1024 chunks:chunks]) {
+            return nil;
+        }
+        for (NSData *chunk in chunks) {
+            [[theValue(chunk.length) should] beLessThanOrEqualTo:theValue(1024)];
+            [result appendData:chunk];
+        }
+    }
+    return result;
+}
+
+SPEC_BEGIN(NNWebSocketDeflateSpec)
+
+describe(@"NNWebSocketDeflateExtension", ^{
+
+    __block NNWebSocketOptions *options;
+
+    beforeEach(^{
+        options = [NNWebSocketOptions options];
+        options.perMessageDeflate = YES;
+    });
+
+    it(@"should offer parameters from options", ^{
+        [[[NNWebSocketDeflateExtension offerWithOptions:options] should] equal:@"permessage-deflate; client_max_window_bits"];
+        options.deflateClientMaxWindowBits = 10;
+        options.deflateServerMaxWindowBits = 12;
+        options.deflateServerNoContextTakeover = YES;
+        [[[NNWebSocketDeflateExtension offerWithOptions:options] should] equal:@"permessage-deflate; client_max_window_bits=10; server_max_window_bits=12; server_no_context_takeover"];
+    });
+
+    it(@"should accept response parameters", ^{
+        NNWebSocketDeflateExtension *ext = [[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate; client_max_window_bits=\"11\"; server_no_context_takeover" options:options];
+        [ext shouldNotBeNil];
+        [[theValue(ext.clientMaxWindowBits) should] equal:theValue(11)];
+        [[theValue(ext.serverMaxWindowBits) should] equal:theValue(15)];
+        [[theValue(ext.serverNoContextTakeover) should] beYes];
+        [[theValue(ext.clientNoContextTakeover) should] beNo];
+    });
+
+    it(@"should reject unexpected response", ^{
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"x-webkit-deflate-frame" options:options] shouldBeNil];
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate, permessage-deflate" options:options] shouldBeNil];
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate; foo" options:options] shouldBeNil];
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate; server_no_context_takeover; server_no_context_takeover" options:options] shouldBeNil];
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate; client_max_window_bits=16" options:options] shouldBeNil];
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate; client_max_window_bits" options:options] shouldBeNil];
+        options.deflateServerMaxWindowBits = 10;
+        [[[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate; server_max_window_bits=12" options:options] shouldBeNil];
+    });
+});
+
+describe(@"NNWebSocketDeflater", ^{
+
+    it(@"should round trip fragmented messages", ^{
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:NO];
+        NNWebSocketInflater *inflater = [[NNWebSocketInflater alloc] initWithNoContextTakeover:NO];
+        NSData *text = MakeText(50000);
+        for (int i=0; i<3; i++) {
+            NSData *head = [text subdataWithRange:NSMakeRange(0, 10000)];
+            NSData *tail = [text subdataWithRange:NSMakeRange(10000, 40000)];
+            NSArray *parts = @[[deflater deflateData:head fin:NO], [deflater deflateData:tail fin:YES]];
+            [[theValue([parts[0] length] + [parts[1] length]) should] beLessThan:theValue(text.length / 2)];
+            [[Inflate(inflater, parts) should] equal:text];
+        }
+    });
+
+    it(@"should compress empty message", ^{
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:NO];
+        NNWebSocketInflater *inflater = [[NNWebSocketInflater alloc] initWithNoContextTakeover:NO];
+        NSData *compressed = [deflater deflateData:[NSData data] fin:YES];
+        [[theValue(compressed.length) should] equal:theValue(1)];
+        [[Inflate(inflater, @[compressed]) should] equal:[NSData data]];
+    });
+
+    it(@"should not refer previous messages without context takeover", ^{
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:9 noContextTakeover:YES];
+        NSData *text = MakeText(200);
+        NSData *first = [deflater deflateData:text fin:YES];
+        NSData *second = [deflater deflateData:text fin:YES];
+        [[second should] equal:first];
+        NNWebSocketInflater *inflater = [[NNWebSocketInflater alloc] initWithNoContextTakeover:YES];
+        [[Inflate(inflater, @[second]) should] equal:text];
+    });
+
+    it(@"should fail to inflate corrupted data", ^{
+        NNWebSocketInflater *inflater = [[NNWebSocketInflater alloc] initWithNoContextTakeover:NO];
+        uint8_t b[4] = {0xff, 0xff, 0xff, 0xff};
+        [Inflate(inflater, @[[NSData dataWithBytes:b length:4]]) shouldBeNil];
+    });
+
+    it(@"should stop inflating beyond one chunk when limited", ^{
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:YES];
+        NNWebSocketInflater *inflater = [[NNWebSocketInflater alloc] initWithNoContextTakeover:YES];
+        NSMutableArray *chunks = [NSMutableArray array];
+        BOOL overflowed = NO;
+        NSData *exact = [deflater deflateData:MakeText(1000) fin:YES];
+        [[theValue([inflater inflateData:exact fin:YES maxChunkLength:1000 chunks:chunks overflowed:&overflowed]) should] beYes];
+        [[theValue(overflowed) should] beNo];
+        [[chunks should] equal:@[MakeText(1000)]];
+        [chunks removeAllObjects];
+        NSData *bomb = [deflater deflateData:[NSMutableData dataWithLength:16 * 1024 * 1024] fin:YES];
+        [[theValue(bomb.length) should] beLessThan:theValue(64 * 1024)];
+        [[theValue([inflater inflateData:bomb fin:YES maxChunkLength:1000 chunks:chunks overflowed:&overflowed]) should] beYes];
+        [[theValue(overflowed) should] beYes];
+        [[theValue(chunks.count) should] equal:theValue(0)];
+    });
+});
+
+describe(@"NNWebSocketFrameParser with permessage-deflate", ^{
+
+    __block NNWebSocketOptions *options;
+    __block NNWebSocketDeflateExtension *ext;
+    __block NSMutableArray *frames;
+    __block NNWebSocketFrameEncoder *encoder;
+
+    beforeEach(^{
+        options = [NNWebSocketOptions options];
+        options.perMessageDeflate = YES;
+        ext = [[NNWebSocketDeflateExtension alloc] initWithResponse:@"permessage-deflate" options:options];
+        frames = [NSMutableArray array];
+        encoder = [[NNWebSocketFrameEncoder alloc] initWithMasking:NO];
+    });
+
+    it(@"should inflate compressed message", ^{
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:NO];
+        NSData *text = MakeText(5000);
+        NSMutableData *bytes = [NSMutableData data];
+        [bytes appendData:[encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeText fin:YES rsv1:YES parts:@[[deflater deflateData:text fin:YES]]]];
+        [bytes appendData:[encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeText fin:YES parts:@[text]]];
+        NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options deflate:ext];
+        [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+        [[theValue(frames.count) should] equal:theValue(2)];
+        [[[frames[0] data] should] equal:text];
+        [[[frames[1] data] should] equal:text];
+    });
+
+    it(@"should split inflated payload", ^{
+        options.maxPayloadByteSize = 1000;
+        options.payloadSizeLimitBehavior = NNWebSocketPayloadSizeLimitBehaviorSplit;
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:NO];
+        NSData *bytes = [encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeBinary fin:YES rsv1:YES parts:@[[deflater deflateData:[NSMutableData dataWithLength:3500] fin:YES]]];
+        NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options deflate:ext];
+        [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+        [[theValue(frames.count) should] equal:theValue(4)];
+        NNWebSocketFrame *first = frames[0];
+        NNWebSocketFrame *last = frames[3];
+        [[theValue(first.opcode) should] equal:theValue(NNWebSocketFrameOpcodeBinary)];
+        [[theValue(first.fin) should] beNo];
+        [[theValue(last.opcode) should] equal:theValue(NNWebSocketFrameOpcodeContinuation)];
+        [[theValue(last.fin) should] beYes];
+        [[theValue(last.data.length) should] equal:theValue(500)];
+    });
+
+    it(@"should fail when inflated payload is too big", ^{
+        options.maxPayloadByteSize = 1000;
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:NO];
+        NSData *bytes = [encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeBinary fin:YES rsv1:YES parts:@[[deflater deflateData:[NSMutableData dataWithLength:3500] fin:YES]]];
+        NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options deflate:ext];
+        [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+        [[theValue(parser.failed) should] beYes];
+        [[theValue(parser.failureStatus) should] equal:theValue(NNWebSocketStatusMessageTooBig)];
+    });
+
+    it(@"should fail on a highly compressed oversized payload", ^{
+        options.maxPayloadByteSize = 1000;
+        NNWebSocketDeflater *deflater = [[NNWebSocketDeflater alloc] initWithWindowBits:15 noContextTakeover:NO];
+        NSData *bomb = [deflater deflateData:[NSMutableData dataWithLength:16 * 1024 * 1024] fin:YES];
+        NSData *bytes = [encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeBinary fin:YES rsv1:YES parts:@[bomb]];
+        NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options deflate:ext];
+        [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+        [[theValue(parser.failureStatus) should] equal:theValue(NNWebSocketStatusMessageTooBig)];
+        [[theValue(frames.count) should] equal:theValue(0)];
+    });
+
+    it(@"should reject RSV1 on continuation and control frames", ^{
+        uint8_t continuation[2] = {0xc0, 0x00};
+        NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options deflate:ext];
+        [parser parseBytes:continuation length:2 owner:nil sliced:NULL frames:frames];
+        [[theValue(parser.failureError.code) should] equal:theValue(NNWebSocketErrorInvalidRsvBit)];
+        uint8_t ping[2] = {0xc9, 0x00};
+        parser = [[NNWebSocketFrameParser alloc] initWithOptions:options deflate:ext];
+        [parser parseBytes:ping length:2 owner:nil sliced:NULL frames:frames];
+        [[theValue(parser.failureError.code) should] equal:theValue(NNWebSocketErrorInvalidRsvBit)];
+    });
+});
+
+SPEC_END
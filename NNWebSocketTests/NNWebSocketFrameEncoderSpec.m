@@ -0,0 +1,127 @@
+#import "Kiwi.h"
+#import "NNWebSocketFrame.h"
+#import "NNWebSocketFrameEncoder.h"
+
+static NSData* MakeBytes(NSUInteger size)
+{
+    NSMutableData *d = [NSMutableData dataWithLength:size];
+    uint8_t *b = d.mutableBytes;
+    for (NSUInteger i=0; i<size; i++) {
+        b[i] = (uint8_t)(i % 251);
+    }
+    return d;
+}
+
+// Returns unmasked payload of an encoded frame
+static NSData* Unmask(NSData *encoded)
+{
+    const uint8_t *b = encoded.bytes;
+    uint8_t len = b[1] & NNWebSocketFrameMaskPayloadLength;
+    NSUInteger headerLen = len == 126 ? 4 : len == 127 ? 10 : 2;
+    BOOL masked = (b[1] & NNWebSocketFrameMaskMask) > 0;
+    NSUInteger payloadLen = encoded.length - headerLen - (masked ? 4 : 0);
+    NSMutableData *payload = [NSMutableData dataWithLength:payloadLen];
+    uint8_t *p = payload.mutableBytes;
+    const uint8_t *key = b + headerLen;
+    const uint8_t *src = b + headerLen + (masked ? 4 : 0);
+    for (NSUInteger i=0; i<payloadLen; i++) {
+        p[i] = masked ? src[i] ^ key[i % 4] : src[i];
+    }
+    return payload;
+}
+
+SPEC_BEGIN(NNWebSocketFrameEncoderSpec)
+
+describe(@"NNWebSocketFrameEncoder", ^{
+
+    __block NNWebSocketFrameEncoder *encoder;
+
+    beforeEach(^{
+        encoder = [NNWebSocketFrameEncoder encoder];
+    });
+
+    context(@"header", ^{
+        it(@"should have 7bit payload length for 125 bytes", ^{
+            NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+            frame.data = MakeBytes(125);
+            NSData *encoded = [encoder encodeFrame:frame];
+            const uint8_t *b = encoded.bytes;
+            [[theValue(b[0]) should] equal:theValue(0x82)];
+            [[theValue(b[1]) should] equal:theValue(0x80 | 125)];
+            [[theValue(encoded.length) should] equal:theValue(2 + 4 + 125)];
+        });
+        it(@"should have 16bit payload length for 65535 bytes", ^{
+            NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+            frame.data = MakeBytes(65535);
+            NSData *encoded = [encoder encodeFrame:frame];
+            const uint8_t *b = encoded.bytes;
+            [[theValue(b[1]) should] equal:theValue(0x80 | 126)];
+            [[theValue(b[2]) should] equal:theValue(0xff)];
+            [[theValue(b[3]) should] equal:theValue(0xff)];
+            [[theValue(encoded.length) should] equal:theValue(4 + 4 + 65535)];
+        });
+        it(@"should have 64bit payload length for 65536 bytes", ^{
+            NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+            frame.data = MakeBytes(65536);
+            NSData *encoded = [encoder encodeFrame:frame];
+            const uint8_t *b = encoded.bytes;
+            [[theValue(b[1]) should] equal:theValue(0x80 | 127)];
+            [[theValue(b[7]) should] equal:theValue(0x01)];
+            [[theValue(b[8]) should] equal:theValue(0x00)];
+            [[theValue(encoded.length) should] equal:theValue(10 + 4 + 65536)];
+        });
+        it(@"should not have fin bit for non final frame", ^{
+            NNWebSocketFrame *frame = [NNWebSocketFrame frameContinuation];
+            NSData *encoded = [encoder encodeFrame:frame];
+            const uint8_t *b = encoded.bytes;
+            [[theValue(b[0]) should] equal:theValue(0x00)];
+            [[theValue(encoded.length) should] equal:theValue(2 + 4)];
+        });
+    });
+
+    context(@"payload", ^{
+        it(@"should be restored by unmasking", ^{
+            for (NSUInteger size=0; size<300; size++) {
+                NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+                frame.data = MakeBytes(size);
+                [[Unmask([encoder encodeFrame:frame]) should] equal:frame.data];
+            }
+        });
+        it(@"should be same as concatenated parts", ^{
+            NSData *a = MakeBytes(3);
+            NSData *b = MakeBytes(130);
+            NSData *c = MakeBytes(7);
+            NSMutableData *expected = [NSMutableData dataWithData:a];
+            [expected appendData:b];
+            [expected appendData:c];
+            NSData *encoded = [encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeBinary fin:YES parts:@[a, b, c]];
+            [[Unmask(encoded) should] equal:expected];
+        });
+        it(@"should accept dispatch data as a part", ^{
+            NSData *a = MakeBytes(5);
+            NSData *b = MakeBytes(200);
+            dispatch_data_t da = dispatch_data_create(a.bytes, a.length, NULL, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+            dispatch_data_t db = dispatch_data_create(b.bytes, b.length, NULL, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+            dispatch_data_t concat = dispatch_data_create_concat(da, db);
+            NSMutableData *expected = [NSMutableData dataWithData:a];
+            [expected appendData:b];
+            NSData *encoded = [encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeBinary fin:YES parts:@[(id)concat]];
+            [[Unmask(encoded) should] equal:expected];
+        });
+        it(@"should refuse a part which is not data", ^{
+            [[theBlock(^{
+                [encoder encodeFrameWithOpcode:NNWebSocketFrameOpcodeBinary fin:YES parts:@[@"text"]];
+            }) should] raise];
+        });
+        it(@"should not be masked by unmasking encoder", ^{
+            NNWebSocketFrameEncoder *e = [[NNWebSocketFrameEncoder alloc] initWithMasking:NO];
+            NNWebSocketFrame *frame = [NNWebSocketFrame frameBinary];
+            frame.data = MakeBytes(1000);
+            NSData *encoded = [e encodeFrame:frame];
+            [[theValue(encoded.length) should] equal:theValue(4 + 1000)];
+            [[[encoded subdataWithRange:NSMakeRange(4, 1000)] should] equal:frame.data];
+        });
+    });
+});
+
+SPEC_END
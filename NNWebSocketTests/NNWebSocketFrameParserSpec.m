@@ -0,0 +1,251 @@
+#import "Kiwi.h"
+#import "NNWebSocketFrame.h"
+#import "NNWebSocketFrameEncoder.h"
+#import "NNWebSocketFrameParser.h"
+#import "NNWebSocketOptions.h"
+
+static NSData* ServerFrame(NNWebSocketFrameOpcode opcode, BOOL fin, NSUInteger payloadLength)
+{
+    NSMutableData *payload = [NSMutableData dataWithLength:payloadLength];
+    uint8_t *b = payload.mutableBytes;
+    for (NSUInteger i=0; i<payloadLength; i++) {
+        b[i] = (uint8_t)(i % 251);
+    }
+    NNWebSocketFrameEncoder *encoder = [[NNWebSocketFrameEncoder alloc] initWithMasking:NO];
+    return [encoder encodeFrameWithOpcode:opcode fin:fin parts:@[payload]];
+}
+
+static NSData* ClientFrame(NNWebSocketFrameOpcode opcode, BOOL fin, NSUInteger payloadLength)
+{
+    NSMutableData *payload = [NSMutableData dataWithLength:payloadLength];
+    uint8_t *b = payload.mutableBytes;
+    for (NSUInteger i=0; i<payloadLength; i++) {
+        b[i] = (uint8_t)(i % 251);
+    }
+    NNWebSocketFrameEncoder *encoder = [[NNWebSocketFrameEncoder alloc] initWithMasking:YES];
+    return [encoder encodeFrameWithOpcode:opcode fin:fin parts:@[payload]];
+}
+
+SPEC_BEGIN(NNWebSocketFrameParserSpec)
+
+describe(@"NNWebSocketFrameParser", ^{
+
+    __block NNWebSocketOptions *options;
+    __block NSMutableArray *frames;
+
+    beforeEach(^{
+        options = [NNWebSocketOptions options];
+        frames = [NSMutableArray array];
+    });
+
+    context(@"complete frames", ^{
+        it(@"should be decoded at once", ^{
+            NSMutableData *bytes = [NSMutableData data];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeText, YES, 10)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 300)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodePing, YES, 0)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 70000)];
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            BOOL sliced = NO;
+            NSUInteger consumed = [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:&sliced frames:frames];
+            [[theValue(consumed) should] equal:theValue(bytes.length)];
+            [[theValue(sliced) should] beYes];
+            [[theValue(parser.hasPartialFrame) should] beNo];
+            [[theValue(frames.count) should] equal:theValue(4)];
+            NNWebSocketFrame *frame = frames[1];
+            [[theValue(frame.opcode) should] equal:theValue(NNWebSocketFrameOpcodeBinary)];
+            [[theValue(frame.data.length) should] equal:theValue(300)];
+            [[theValue([frame hasTag:NNWebSocketFrameTagDataFrame]) should] beYes];
+            frame = frames[2];
+            [[theValue([frame hasTag:NNWebSocketFrameTagControlFrame]) should] beYes];
+            frame = frames[3];
+            [[theValue(frame.data.length) should] equal:theValue(70000)];
+        });
+        it(@"should be same regardless of how bytes are split", ^{
+            NSMutableData *bytes = [NSMutableData data];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeText, NO, 5)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeContinuation, YES, 200)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 66000)];
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            const uint8_t *b = bytes.bytes;
+            for (NSUInteger pos=0; pos<bytes.length; pos+=7) {
+                NSUInteger len = MIN((NSUInteger)7, bytes.length - pos);
+                [parser parseBytes:b + pos length:len owner:bytes sliced:NULL frames:frames];
+            }
+            [[theValue(frames.count) should] equal:theValue(3)];
+            NNWebSocketFrame *frame = frames[0];
+            [[theValue(frame.fin) should] beNo];
+            frame = frames[2];
+            [[frame.data should] equal:[ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 66000) subdataWithRange:NSMakeRange(10, 66000)]];
+        });
+        it(@"should stop after a close frame", ^{
+            NSMutableData *bytes = [NSMutableData data];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeClose, YES, 2)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeText, YES, 3)];
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            NSUInteger consumed = [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            [[theValue(consumed) should] equal:theValue(4)];
+            [[theValue(frames.count) should] equal:theValue(1)];
+            [[theValue(parser.finished) should] beYes];
+            [[theValue(parser.failed) should] beNo];
+        });
+    });
+
+    context(@"partial frame", ^{
+        it(@"should be filled directly", ^{
+            NSData *bytes = ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 100000);
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            [parser parseBytes:bytes.bytes length:20 owner:bytes sliced:NULL frames:frames];
+            [[theValue(parser.hasPartialFrame) should] beYes];
+            [[theValue(parser.remainingPayloadLength) should] equal:theValue(100000 - 10)];
+            __block NSUInteger offset = 20;
+            while (parser.remainingPayloadLength > 0) {
+                [parser fillPayloadUsingBlock:^NSInteger(uint8_t *dst, NSUInteger length) {
+                    NSUInteger len = MIN(length, (NSUInteger)4096);
+                    memcpy(dst, (const uint8_t *)bytes.bytes + offset, len);
+                    offset += len;
+                    return (NSInteger)len;
+                } frames:frames];
+            }
+            [[theValue(frames.count) should] equal:theValue(1)];
+            [[[frames[0] data] should] equal:[bytes subdataWithRange:NSMakeRange(10, 100000)]];
+        });
+    });
+
+    context(@"payload size limit", ^{
+        it(@"should split payload into continuation frames", ^{
+            options.maxPayloadByteSize = 8;
+            options.payloadSizeLimitBehavior = NNWebSocketPayloadSizeLimitBehaviorSplit;
+            NSData *bytes = ServerFrame(NNWebSocketFrameOpcodeText, YES, 20);
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            [[theValue(frames.count) should] equal:theValue(3)];
+            NNWebSocketFrame *first = frames[0];
+            NNWebSocketFrame *last = frames[2];
+            [[theValue(first.opcode) should] equal:theValue(NNWebSocketFrameOpcodeText)];
+            [[theValue(first.fin) should] beNo];
+            [[theValue(last.opcode) should] equal:theValue(NNWebSocketFrameOpcodeContinuation)];
+            [[theValue(last.fin) should] beYes];
+            [[theValue(last.data.length) should] equal:theValue(4)];
+        });
+        it(@"should fail with message too big", ^{
+            options.maxPayloadByteSize = 8;
+            options.payloadSizeLimitBehavior = NNWebSocketPayloadSizeLimitBehaviorError;
+            NSData *bytes = ServerFrame(NNWebSocketFrameOpcodeText, YES, 20);
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            [[theValue(parser.failed) should] beYes];
+            [[theValue(parser.failureStatus) should] equal:theValue(NNWebSocketStatusMessageTooBig)];
+            [parser.failureError shouldBeNil];
+        });
+    });
+
+    context(@"streaming threshold", ^{
+        it(@"should read large payload in bounded chunks regardless of size limit", ^{
+            options.maxPayloadByteSize = 1000;
+            options.streamingThresholdByteSize = 1000;
+            options.streamingChunkByteSize = 300;
+            NSData *bytes = ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 2000);
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            [[theValue(parser.failed) should] beNo];
+            [[theValue(frames.count) should] equal:theValue(7)];
+            for (NNWebSocketFrame *frame in frames) {
+                [[theValue([frame hasTag:NNWebSocketFrameTagStreamedDataFrame]) should] beYes];
+                [[theValue(frame.data.length) should] beLessThanOrEqualTo:theValue(300)];
+            }
+            [[theValue([[frames lastObject] fin]) should] beYes];
+        });
+    });
+
+    context(@"invalid header", ^{
+        __block NNWebSocketError (^parse)(uint8_t, uint8_t) = nil;
+        beforeEach(^{
+            parse = ^NNWebSocketError(uint8_t b0, uint8_t b1) {
+                uint8_t b[2] = {b0, b1};
+                NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+                [parser parseBytes:b length:2 owner:nil sliced:NULL frames:frames];
+                [[theValue(parser.failureStatus) should] equal:theValue(NNWebSocketStatusProtocolError)];
+                return (NNWebSocketError)parser.failureError.code;
+            };
+        });
+        it(@"should be rejected", ^{
+            [[theValue(parse(0x83, 0x00)) should] equal:theValue(NNWebSocketErrorUnkownDataFrameType)];
+            [[theValue(parse(0x8b, 0x00)) should] equal:theValue(NNWebSocketErrorUnkownControlFrameType)];
+            [[theValue(parse(0xc1, 0x00)) should] equal:theValue(NNWebSocketErrorInvalidRsvBit)];
+            [[theValue(parse(0x81, 0x80)) should] equal:theValue(NNWebSocketErrorReceiveFrameMask)];
+            [[theValue(parse(0x89, 0x7e)) should] equal:theValue(NNWebSocketErrorControlFramePayloadSize)];
+            [[theValue(parse(0x09, 0x00)) should] equal:theValue(NNWebSocketErrorControlFrameFin)];
+        });
+        it(@"should be rejected unless masked on the server side", ^{
+            uint8_t b[2] = {0x81, 0x00};
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            parser.expectsMask = YES;
+            [parser parseBytes:b length:2 owner:nil sliced:NULL frames:frames];
+            [[theValue(parser.failureError.code) should] equal:theValue(NNWebSocketErrorReceiveFrameUnmasked)];
+        });
+    });
+
+    context(@"masked frames", ^{
+        it(@"should be unmasked regardless of how bytes are split", ^{
+            NSData *expected = [ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 300) subdataWithRange:NSMakeRange(4, 300)];
+            for (NSNumber *step in @[@0, @7]) {
+                NSMutableData *bytes = [NSMutableData data];
+                [bytes appendData:ClientFrame(NNWebSocketFrameOpcodeText, YES, 5)];
+                [bytes appendData:ClientFrame(NNWebSocketFrameOpcodeBinary, YES, 300)];
+                NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+                parser.expectsMask = YES;
+                [frames removeAllObjects];
+                NSUInteger n = [step unsignedIntegerValue] ?: bytes.length;
+                const uint8_t *b = bytes.bytes;
+                for (NSUInteger pos=0; pos<bytes.length; pos+=n) {
+                    [parser parseBytes:b + pos length:MIN(n, bytes.length - pos) owner:bytes sliced:NULL frames:frames];
+                }
+                [[theValue(parser.failed) should] beNo];
+                [[theValue(frames.count) should] equal:theValue(2)];
+                NNWebSocketFrame *frame = frames[1];
+                [[frame.data should] equal:expected];
+            }
+        });
+    });
+    context(@"message tags", ^{
+        it(@"should tell type and fragmentation of messages", ^{
+            NSMutableData *bytes = [NSMutableData data];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeText, YES, 3)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeBinary, NO, 3)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodePing, YES, 0)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeContinuation, YES, 3)];
+            [bytes appendData:ServerFrame(NNWebSocketFrameOpcodeContinuation, YES, 3)];
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            [[theValue(frames.count) should] equal:theValue(5)];
+            [[theValue([frames[0] hasTag:NNWebSocketFrameTagSingleTextDataFrame]) should] beYes];
+            [[theValue([frames[1] hasTag:NNWebSocketFrameTagFragmentedBinaryDataFrame]) should] beYes];
+            [[theValue([frames[2] hasTag:NNWebSocketFrameTagBinaryDataFrame]) should] beNo];
+            [[theValue([frames[3] hasTag:NNWebSocketFrameTagFragmentedBinaryDataFrame]) should] beYes];
+            // Headless continuation belongs to no message.
+            [[theValue([frames[4] hasTag:NNWebSocketFrameTagDataFrame]) should] beYes];
+            [[theValue([frames[4] hasTag:NNWebSocketFrameTagBinaryDataFrame | NNWebSocketFrameTagTextDataFrame]) should] beNo];
+        });
+        it(@"should take frames from the pool", ^{
+            NNWebSocketFramePool *pool = [[NNWebSocketFramePool alloc] initWithCapacity:4];
+            NNWebSocketFrameParser *parser = [[NNWebSocketFrameParser alloc] initWithOptions:options];
+            parser.framePool = pool;
+            NSData *bytes = ServerFrame(NNWebSocketFrameOpcodeBinary, YES, 3);
+            [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            NNWebSocketFrame *frame = frames[0];
+            [frames removeAllObjects];
+            [pool recycleFrame:frame];
+            [frame.data shouldBeNil];
+            bytes = ServerFrame(NNWebSocketFrameOpcodeText, YES, 5);
+            [parser parseBytes:bytes.bytes length:bytes.length owner:bytes sliced:NULL frames:frames];
+            [[frames[0] should] beIdenticalTo:frame];
+            [[theValue(frame.opcode) should] equal:theValue(NNWebSocketFrameOpcodeText)];
+            [[theValue(frame.data.length) should] equal:theValue(5)];
+            [[theValue([frame hasTag:NNWebSocketFrameTagSingleTextDataFrame]) should] beYes];
+            [[theValue([frame hasTag:NNWebSocketFrameTagSingleBinaryDataFrame]) should] beNo];
+        });
+    });
+});
+
+SPEC_END
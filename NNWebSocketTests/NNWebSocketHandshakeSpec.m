@@ -0,0 +1,133 @@
+#import "Kiwi.h"
+#import "NNWebSocketHandshake.h"
+#import "NNWebSocketOptions.h"
+
+static NNWebSocketHandshakeResponse* Response(NSString *str)
+{
+    return [NNWebSocketHandshakeResponse responseWithData:[str dataUsingEncoding:NSASCIIStringEncoding]];
+}
+
+static NNWebSocketHandshakeIncomingRequest* IncomingRequest(NSString *str)
+{
+    return [NNWebSocketHandshakeIncomingRequest requestWithData:[str dataUsingEncoding:NSASCIIStringEncoding]];
+}
+
+SPEC_BEGIN(NNWebSocketHandshakeSpec)
+
+describe(@"NNWebSocketHandshake", ^{
+
+    context(@"key", ^{
+
+        it(@"should create accept of the sample in RFC 6455", ^{
+            char accept[NNWEBSOCKET_ACCEPT_LENGTH];
+            NNWebSocketCreateAccept("dGhlIHNhbXBsZSBub25jZQ==", accept);
+            NSString *actual = [[NSString alloc] initWithBytes:accept length:NNWEBSOCKET_ACCEPT_LENGTH encoding:NSASCIIStringEncoding];
+            [[actual should] equal:@"s3pPLMBiTxaQ9kYGzzhZRbK+xOo="];
+        });
+        it(@"should create a different key each time", ^{
+            char key1[NNWEBSOCKET_KEY_LENGTH];
+            char key2[NNWEBSOCKET_KEY_LENGTH];
+            NNWebSocketCreateKey(key1);
+            NNWebSocketCreateKey(key2);
+            [[theValue(memcmp(key1, key2, NNWEBSOCKET_KEY_LENGTH)) shouldNot] equal:theValue(0)];
+            [[theValue(key1[NNWEBSOCKET_KEY_LENGTH - 1]) should] equal:theValue('=')];
+        });
+    });
+    context(@"request", ^{
+
+        it(@"should write the key into the request", ^{
+            NNWebSocketOptions *options = [NNWebSocketOptions options];
+            NSURL *url = [NSURL URLWithString:@"ws://localhost:9080/echo?a=b"];
+            NNWebSocketHandshakeRequest *request = [[NNWebSocketHandshakeRequest alloc] initWithURL:url options:options];
+            NSData *data1 = [request requestWithKey:"dGhlIHNhbXBsZSBub25jZQ=="];
+            NSData *data2 = [request requestWithKey:"AAAAAAAAAAAAAAAAAAAAAA=="];
+            NSString *str1 = [[NSString alloc] initWithData:data1 encoding:NSASCIIStringEncoding];
+            NSString *str2 = [[NSString alloc] initWithData:data2 encoding:NSASCIIStringEncoding];
+            [[theValue([str1 hasPrefix:@"GET /echo?a=b HTTP/1.1\r\n"]) should] beYes];
+            [[theValue([str1 rangeOfString:@"\r\nSec-WebSocket-Key:dGhlIHNhbXBsZSBub25jZQ==\r\n"].location) shouldNot] equal:theValue(NSNotFound)];
+            [[theValue([str2 rangeOfString:@"\r\nSec-WebSocket-Key:AAAAAAAAAAAAAAAAAAAAAA==\r\n"].location) shouldNot] equal:theValue(NSNotFound)];
+            [[theValue([str1 hasSuffix:@"\r\n\r\n"]) should] beYes];
+        });
+    });
+    context(@"response", ^{
+
+        it(@"should parse headers case insensitively", ^{
+            NNWebSocketHandshakeResponse *response = Response(@"HTTP/1.1 101 Switching Protocols\r\n"
+                                                               "upgrade: websocket\r\n"
+                                                               "CONNECTION:Upgrade\r\n"
+                                                               "Server: test\r\n"
+                                                               "sec-websocket-accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=  \r\n"
+                                                               "\r\n");
+            [response shouldNotBeNil];
+            [[theValue(response.statusCode) should] equal:theValue(101)];
+            [[response.upgrade should] equal:@"websocket"];
+            [[theValue([response hasConnectionToken:@"upgrade"]) should] beYes];
+            [[theValue([response isAcceptedKey:"dGhlIHNhbXBsZSBub25jZQ=="]) should] beYes];
+            [[theValue([response isAcceptedKey:"AAAAAAAAAAAAAAAAAAAAAA=="]) should] beNo];
+            [response.extensions shouldBeNil];
+        });
+        it(@"should join values of repeated headers", ^{
+            NNWebSocketHandshakeResponse *response = Response(@"HTTP/1.1 101 Switching Protocols\r\n"
+                                                               "Connection: keep-alive\r\n"
+                                                               "Connection: Upgrade\r\n"
+                                                               "\r\n");
+            [[response.connection should] equal:@"keep-alive, Upgrade"];
+            [[theValue([response hasConnectionToken:@"Upgrade"]) should] beYes];
+        });
+        it(@"should accept lines terminated by LF alone", ^{
+            NNWebSocketHandshakeResponse *response = Response(@"HTTP/1.1 101 Switching Protocols\n"
+                                                               "Upgrade: websocket\n"
+                                                               "\n");
+            [response shouldNotBeNil];
+            [[response.upgrade should] equal:@"websocket"];
+        });
+        it(@"should not parse a malformed or incomplete header", ^{
+            [Response(@"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n") shouldBeNil];
+            [Response(@"HTTP/1.1 1x1 Switching Protocols\r\n\r\n") shouldBeNil];
+            [Response(@"ICY 200 OK\r\n\r\n") shouldBeNil];
+            [Response(@"HTTP/1.1 101 Switching Protocols\r\nUpgrade websocket\r\n\r\n") shouldBeNil];
+            [Response(@"HTTP/1.1 101 Switching Protocols\r\nUpgrade: web\r\n socket\r\n\r\n") shouldBeNil];
+        });
+    });
+    context(@"incoming request", ^{
+
+        it(@"should accept the sample in RFC 6455", ^{
+            NNWebSocketHandshakeIncomingRequest *request = IncomingRequest(@"GET /chat HTTP/1.1\r\n"
+                                                                            "Host: server.example.com\r\n"
+                                                                            "Upgrade: websocket\r\n"
+                                                                            "Connection: keep-alive, Upgrade\r\n"
+                                                                            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                                                            "Sec-WebSocket-Protocol: chat, superchat\r\n"
+                                                                            "Sec-WebSocket-Version: 13\r\n"
+                                                                            "\r\n");
+            [request shouldNotBeNil];
+            [[request.method should] equal:@"GET"];
+            [[request.resource should] equal:@"/chat"];
+            [[request.host should] equal:@"server.example.com"];
+            [[request.version should] equal:@"13"];
+            [[theValue([request hasConnectionToken:@"upgrade"]) should] beYes];
+            [[theValue([request hasValidKey]) should] beYes];
+            NSData *data = [request acceptResponseWithProtocols:@[@"superchat", @"chat"]];
+            NSString *str = [[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding];
+            [[theValue([str hasPrefix:@"HTTP/1.1 101 "]) should] beYes];
+            [[theValue([str rangeOfString:@"\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"].location) shouldNot] equal:theValue(NSNotFound)];
+            [[theValue([str rangeOfString:@"\r\nSec-WebSocket-Protocol: superchat\r\n"].location) shouldNot] equal:theValue(NSNotFound)];
+            [[theValue([str hasSuffix:@"\r\n\r\n"]) should] beYes];
+        });
+        it(@"should not accept an invalid key", ^{
+            NNWebSocketHandshakeIncomingRequest *request = IncomingRequest(@"GET / HTTP/1.1\r\n"
+                                                                            "Host: localhost\r\n"
+                                                                            "Sec-WebSocket-Key: short\r\n"
+                                                                            "\r\n");
+            [request shouldNotBeNil];
+            [[theValue([request hasValidKey]) should] beNo];
+            [[request acceptResponseWithProtocols:nil] shouldBeNil];
+        });
+        it(@"should not parse a malformed request line", ^{
+            [IncomingRequest(@"GET /\r\n\r\n") shouldBeNil];
+            [IncomingRequest(@"GET / HTTP/1.1\r\nHost: localhost\r\n") shouldBeNil];
+        });
+    });
+});
+
+SPEC_END
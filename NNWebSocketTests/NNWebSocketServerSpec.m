@@ -0,0 +1,193 @@
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <unistd.h>
+#import "Kiwi.h"
+#import "NNWebSocket.h"
+
+static NNWebSocketOptions* GetServerOptions()
+{
+    NNWebSocketOptions *opts = [NNWebSocketOptions options];
+    opts.verbose = 0;
+    if ([[[[NSProcessInfo processInfo] environment] objectForKey:@"NNWEBSOCKET_TRANSPORT"] isEqualToString:@"socket"]) {
+        opts.transportType = NNWebSocketTransportTypeSocket;
+    }
+    return opts;
+}
+
+static id<NNWebSocketClient> GetServerClient(NNWebSocketServer *server)
+{
+    NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"ws://localhost:%u/", server.port]];
+    return [NNWebSocket client:url options:GetServerOptions()];
+}
+
+// Sends 'request' over a plain TCP connection and returns the response header.
+static NSString* SendRawRequest(NNWebSocketServer *server, NSString *request)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server.port);
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    NSMutableData *response = [NSMutableData data];
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        NSData *data = [request dataUsingEncoding:NSASCIIStringEncoding];
+        send(fd, data.bytes, data.length, 0);
+        uint8_t buffer[1024];
+        ssize_t len;
+        NSData *terminator = [NSData dataWithBytes:"\r\n\r\n" length:4];
+        while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            [response appendBytes:buffer length:(NSUInteger)len];
+            if ([response rangeOfData:terminator options:0 range:NSMakeRange(0, response.length)].location != NSNotFound) {
+                break;
+            }
+        }
+    }
+    close(fd);
+    return [[NSString alloc] initWithData:response encoding:NSASCIIStringEncoding];
+}
+
+SPEC_BEGIN(NNWebSocketServerSpec)
+
+describe(@"NNWebSocketServer", ^{
+
+    __block NNWebSocketServer *server;
+
+    beforeEach(^{
+        server = [NNWebSocket server:0 options:GetServerOptions()];
+        server.onConnection = ^(id<NNWebSocketClient> connection) {
+            __weak id<NNWebSocketClient> weakConnection = connection;
+            connection.onText = ^(NSString *text) {
+                [weakConnection sendText:text];
+            };
+            connection.onData = ^(NSData *data) {
+                [weakConnection sendData:data];
+            };
+        };
+        NSError *error = nil;
+        [[theValue([server startWithError:&error]) should] beYes];
+        [error shouldBeNil];
+        [[theValue(server.port) shouldNot] equal:theValue(0)];
+    });
+    afterEach(^{
+        [server stop];
+        server = nil;
+    });
+
+    context(@"connections", ^{
+        it(@"should echo messages of a client", ^{
+            id<NNWebSocketClient> client = GetServerClient(server);
+            __block NSString *received = nil;
+            __block NSData *receivedData = nil;
+            client.onOpen = ^{
+                [client sendText:@"hello"];
+                [client sendData:[NSData dataWithBytes:"\x00\x01\x02" length:3]];
+            };
+            client.onText = ^(NSString *text) {
+                received = text;
+            };
+            client.onData = ^(NSData *data) {
+                receivedData = data;
+            };
+            [client open];
+            [[expectFutureValue(received) shouldEventuallyBeforeTimingOutAfter(5)] equal:@"hello"];
+            [[expectFutureValue(receivedData) shouldEventuallyBeforeTimingOutAfter(5)] equal:[NSData dataWithBytes:"\x00\x01\x02" length:3]];
+            [[theValue(server.connectionCount) should] equal:theValue(1)];
+            [client close];
+        });
+        it(@"should be released when the client closes", ^{
+            id<NNWebSocketClient> client = GetServerClient(server);
+            __block NSNumber *status = nil;
+            __block NSNumber *serverStatus = nil;
+            server.onConnection = ^(id<NNWebSocketClient> connection) {
+                connection.onClose = ^(NNWebSocketStatus s, NSError *error) {
+                    serverStatus = @(s);
+                };
+            };
+            client.onClose = ^(NNWebSocketStatus s, NSError *error) {
+                status = @(s);
+                [error shouldBeNil];
+            };
+            [client open];
+            [[expectFutureValue(theValue(server.connectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(1)];
+            [client close];
+            [[expectFutureValue(status) shouldEventuallyBeforeTimingOutAfter(5)] equal:@(NNWebSocketStatusNormalEnd)];
+            [[expectFutureValue(serverStatus) shouldEventuallyBeforeTimingOutAfter(5)] equal:@(NNWebSocketStatusNormalEnd)];
+            [[expectFutureValue(theValue(server.connectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(0)];
+        });
+        it(@"should be closed by stop", ^{
+            id<NNWebSocketClient> client = GetServerClient(server);
+            __block NSNumber *status = nil;
+            client.onClose = ^(NNWebSocketStatus s, NSError *error) {
+                status = @(s);
+            };
+            [client open];
+            [[expectFutureValue(theValue(server.connectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(1)];
+            [server stop];
+            [[expectFutureValue(status) shouldEventuallyBeforeTimingOutAfter(5)] equal:@(NNWebSocketStatusGoingAway)];
+        });
+    });
+    context(@"opening handshake", ^{
+        it(@"should reject a request without Upgrade header", ^{
+            NSString *response = SendRawRequest(server, @"GET / HTTP/1.1\r\n"
+                                                         "Host: localhost\r\n"
+                                                         "Connection: Upgrade\r\n"
+                                                         "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                                         "Sec-WebSocket-Version: 13\r\n"
+                                                         "\r\n");
+            [[theValue([response hasPrefix:@"HTTP/1.1 400 "]) should] beYes];
+            [[theValue(server.connectionCount) should] equal:theValue(0)];
+        });
+        it(@"should accept a valid request", ^{
+            NSString *response = SendRawRequest(server, @"GET / HTTP/1.1\r\n"
+                                                         "Host: localhost\r\n"
+                                                         "Upgrade: websocket\r\n"
+                                                         "Connection: Upgrade\r\n"
+                                                         "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                                         "Sec-WebSocket-Version: 13\r\n"
+                                                         "\r\n");
+            [[theValue([response hasPrefix:@"HTTP/1.1 101 "]) should] beYes];
+        });
+        it(@"should reject a request header longer than the limit", ^{
+            [server stop];
+            NNWebSocketOptions *opts = GetServerOptions();
+            opts.maxHandshakeHeaderByteSize = 1024;
+            server = [NNWebSocket server:0 options:opts];
+            [[theValue([server startWithError:NULL]) should] beYes];
+            NSString *padding = [@"" stringByPaddingToLength:2048 withString:@"a" startingAtIndex:0];
+            NSString *response = SendRawRequest(server, [NSString stringWithFormat:@"GET / HTTP/1.1\r\n"
+                                                                                    "Host: localhost\r\n"
+                                                                                    "X-Padding: %@\r\n"
+                                                                                    "\r\n", padding]);
+            [[theValue([response hasPrefix:@"HTTP/1.1 431 "]) should] beYes];
+            [[expectFutureValue(theValue(server.connectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(0)];
+        });
+    });
+    context(@"broadcast", ^{
+        it(@"should deliver a message to every open connection once", ^{
+            NSMutableArray *clients = [NSMutableArray array];
+            __block NSUInteger received = 0;
+            for (NSUInteger i=0; i<4; i++) {
+                id<NNWebSocketClient> client = GetServerClient(server);
+                client.onText = ^(NSString *text) {
+                    [[text should] equal:@"news"];
+                    received++;
+                };
+                [client open];
+                [clients addObject:client];
+            }
+            [[expectFutureValue(theValue(server.connectionCount)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(4)];
+            [[theValue([server broadcastText:@"news"]) should] equal:theValue(4)];
+            [[expectFutureValue(theValue(received)) shouldEventuallyBeforeTimingOutAfter(5)] equal:theValue(4)];
+            NNWebSocketStatistics *stats = server.statistics;
+            [[theValue([stats framesSentWithOpcode:NNWebSocketFrameOpcodeText]) should] equal:theValue(4)];
+            for (id<NNWebSocketClient> client in clients) {
+                [client close];
+            }
+        });
+    });
+});
+
+SPEC_END
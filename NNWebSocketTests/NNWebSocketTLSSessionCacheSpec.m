@@ -0,0 +1,58 @@
+#import "Kiwi.h"
+#import "NNWebSocketTLSSessionCache.h"
+
+SPEC_BEGIN(NNWebSocketTLSSessionCacheSpec)
+
+describe(@"NNWebSocketTLSSessionCache", ^{
+
+    __block BOOL hit;
+
+    beforeEach(^{
+        hit = NO;
+    });
+
+    it(@"should return the same peer ID for the same host, port and server name", ^{
+        NNWebSocketTLSSessionCache *cache = [[NNWebSocketTLSSessionCache alloc] initWithSize:4 lifetime:60];
+        NSData *peerID1 = [cache peerIDForHost:@"example.com" port:443 serverName:@"example.com" hit:&hit];
+        [[theValue(hit) should] beNo];
+        NSData *peerID2 = [cache peerIDForHost:@"EXAMPLE.com" port:443 serverName:@"example.com" hit:&hit];
+        [[theValue(hit) should] beYes];
+        [[peerID2 should] equal:peerID1];
+        [[[cache peerIDForHost:@"example.com" port:8443 serverName:@"example.com" hit:&hit] shouldNot] equal:peerID1];
+        [[[cache peerIDForHost:@"example.com" port:443 serverName:@"www.example.com" hit:&hit] shouldNot] equal:peerID1];
+        [[theValue(cache.hits) should] equal:theValue(1)];
+        [[theValue(cache.misses) should] equal:theValue(3)];
+    });
+    it(@"should drop the least recently used entry", ^{
+        NNWebSocketTLSSessionCache *cache = [[NNWebSocketTLSSessionCache alloc] initWithSize:2 lifetime:60];
+        [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [cache peerIDForHost:@"b" port:443 serverName:nil hit:&hit];
+        [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [cache peerIDForHost:@"c" port:443 serverName:nil hit:&hit];
+        [[theValue(cache.count) should] equal:theValue(2)];
+        [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [[theValue(hit) should] beYes];
+        [cache peerIDForHost:@"b" port:443 serverName:nil hit:&hit];
+        [[theValue(hit) should] beNo];
+    });
+    it(@"should not return an expired or removed peer ID", ^{
+        NNWebSocketTLSSessionCache *cache = [[NNWebSocketTLSSessionCache alloc] initWithSize:2 lifetime:0.1];
+        NSData *peerID = [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [NSThread sleepForTimeInterval:0.2];
+        [[[cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit] shouldNot] equal:peerID];
+        [[theValue(hit) should] beNo];
+        [cache removePeerIDForHost:@"a" port:443 serverName:nil];
+        [[theValue(cache.count) should] equal:theValue(0)];
+        [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [[theValue(hit) should] beNo];
+    });
+    it(@"should not keep entries when size is 0", ^{
+        NNWebSocketTLSSessionCache *cache = [[NNWebSocketTLSSessionCache alloc] initWithSize:0 lifetime:60];
+        [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [cache peerIDForHost:@"a" port:443 serverName:nil hit:&hit];
+        [[theValue(hit) should] beNo];
+        [[theValue(cache.count) should] equal:theValue(0)];
+    });
+});
+
+SPEC_END
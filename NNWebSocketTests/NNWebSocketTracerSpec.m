@@ -0,0 +1,74 @@
+#import "Kiwi.h"
+#import "NNWebSocketDefine.h"
+#import "NNWebSocketTracer.h"
+
+static NSArray* TraceEvents(NNWebSocketTracer *tracer)
+{
+    NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:[tracer chromeTraceData] options:(NSJSONReadingOptions)0 error:NULL];
+    return trace[@"traceEvents"];
+}
+
+SPEC_BEGIN(NNWebSocketTracerSpec)
+
+describe(@"NNWebSocketTracer", ^{
+
+    it(@"should round capacity up to a power of 2", ^{
+        NNWebSocketTracer *tracer = [[NNWebSocketTracer alloc] initWithCapacity:100];
+        [[theValue(tracer.capacity) should] equal:theValue(128)];
+    });
+
+    it(@"should not record while disabled", ^{
+        NNWebSocketTracer *tracer = [[NNWebSocketTracer alloc] initWithCapacity:16];
+        NNTrace(tracer, NNWebSocketTraceEventStreamReadable, 0, 0);
+        [[theValue(TraceEvents(tracer).count) should] equal:theValue(0)];
+        tracer.enabled = YES;
+        NNTrace(tracer, NNWebSocketTraceEventStreamReadable, 0, 0);
+        tracer.enabled = NO;
+        NNTrace(tracer, NNWebSocketTraceEventStreamReadable, 0, 0);
+        [[theValue(TraceEvents(tracer).count) should] equal:theValue(1)];
+    });
+
+    it(@"should keep latest events", ^{
+        NNWebSocketTracer *tracer = [[NNWebSocketTracer alloc] initWithCapacity:16];
+        tracer.enabled = YES;
+        for (int i=0; i<100; i++) {
+            NNTrace(tracer, NNWebSocketTraceEventBytesRead, i, 0);
+        }
+        NSArray *events = TraceEvents(tracer);
+        [[theValue(events.count) should] equal:theValue(16)];
+        [[[events[0] valueForKeyPath:@"args.bytes"] should] equal:@(84)];
+        [[[[events lastObject] valueForKeyPath:@"args.bytes"] should] equal:@(99)];
+        [tracer clear];
+        [[theValue(TraceEvents(tracer).count) should] equal:theValue(0)];
+    });
+
+    it(@"should export events in chrome trace format", ^{
+        NNWebSocketTracer *tracer = [[NNWebSocketTracer alloc] initWithCapacity:16];
+        tracer.enabled = YES;
+        NNTrace(tracer, NNWebSocketTraceEventWriteTaskEnqueued, 0x10, 5);
+        NNTrace(tracer, NNWebSocketTraceEventListenerBegin, NNWebSocketFrameOpcodeText, 5);
+        NNTrace(tracer, NNWebSocketTraceEventListenerEnd, NNWebSocketFrameOpcodeText, 5);
+        NNTrace(tracer, NNWebSocketTraceEventWriteTaskDequeued, 0x10, 5);
+        NNTrace(tracer, NNWebSocketTraceEventStateChanged, 1, 2);
+        NSArray *events = TraceEvents(tracer);
+        [[[events valueForKey:@"ph"] should] equal:@[@"b", @"B", @"E", @"e", @"i"]];
+        [[events[0][@"id"] should] equal:events[3][@"id"]];
+        [[events[4][@"name"] should] equal:@"CONNECTING -> OPEN"];
+        double first = [events[0][@"ts"] doubleValue];
+        double last = [events[4][@"ts"] doubleValue];
+        [[theValue(last) should] beGreaterThanOrEqualTo:theValue(first)];
+    });
+
+    it(@"should record from many threads", ^{
+        NNWebSocketTracer *tracer = [[NNWebSocketTracer alloc] initWithCapacity:4096];
+        tracer.enabled = YES;
+        dispatch_apply(4, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t n) {
+            for (int i=0; i<1000; i++) {
+                NNTrace(tracer, NNWebSocketTraceEventBytesWritten, i, 0);
+            }
+        });
+        [[theValue(TraceEvents(tracer).count) should] equal:theValue(4000)];
+    });
+});
+
+SPEC_END
@@ -0,0 +1,22 @@
+var WebSocketServer = require('ws').Server;
+
+// Echo server which accepts permessage-deflate(RFC 7692).
+var wsServer = new WebSocketServer({
+    port: 9081,
+    perMessageDeflate: {
+        serverMaxWindowBits: 15,
+        clientMaxWindowBits: 15
+    }
+}, function () {
+    console.log((new Date()) + ' Server is listening on port 9081');
+});
+
+wsServer.on('connection', function (ws) {
+    console.log((new Date()) + ' Connection accepted. extensions:' + JSON.stringify(ws.extensions));
+    ws.on('message', function (data, flags) {
+        ws.send(data, {binary: flags.binary, compress: true});
+    });
+    ws.on('close', function (code, message) {
+        console.log((new Date()) + ' Peer disconnected.');
+    });
+});
@@ -27,12 +27,16 @@ httpsServer.listen(9443, function () {
 wsServer = new WebSocketServer({
     httpServer: httpServer,
     assembleFragments: false,
-    autoAcceptConnections: false
+    autoAcceptConnections: false,
+    maxReceivedFrameSize: 0x4000000,
+    maxReceivedMessageSize: 0x4000000
 });
 wssServer = new WebSocketServer({
     httpServer: httpsServer,
     assembleFragments: false,
-    autoAcceptConnections: false
+    autoAcceptConnections: false,
+    maxReceivedFrameSize: 0x4000000,
+    maxReceivedMessageSize: 0x4000000
 });
 
 function wsHandler(request) {